@@ -1,5 +1,7 @@
 #include "BillingApp.h"
 
+#include <ctime>
+
 #include <DecentApi/Common/SGX/RuntimeError.h>
 
 #include "../Common_App/RequestCategory.h"
@@ -19,6 +21,44 @@ bool Billing::ProcessMsgFromTripPlanner(Decent::Net::ConnectionBase& connection)
 	return retValue;
 }
 
+bool Billing::LoadTariffs(const std::string& data)
+{
+	int retValue = false;
+	sgx_status_t enclaveRet = SGX_SUCCESS;
+
+	enclaveRet = ecall_ride_share_bill_load_tariffs(GetEnclaveId(), &retValue, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_bill_load_tariffs);
+
+	return retValue;
+}
+
+void Billing::UpdateTimeOfDay()
+{
+	//The tariffs follow the local wall clock. std::localtime isn't thread-safe, but it's only called
+	//  by the main thread at the start, and by the time tick thread afterwards.
+	const std::time_t now = std::time(nullptr);
+	const std::tm* localNow = std::localtime(&now);
+	if (localNow == nullptr)
+	{
+		return;
+	}
+	const uint32_t timeOfDay = static_cast<uint32_t>(localNow->tm_hour * 60 * 60 + localNow->tm_min * 60 + localNow->tm_sec);
+
+	sgx_status_t enclaveRet = ecall_ride_share_bill_set_time_of_day(GetEnclaveId(), timeOfDay);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_bill_set_time_of_day);
+}
+
+bool Billing::UpdateSurge()
+{
+	int retValue = false;
+	sgx_status_t enclaveRet = SGX_SUCCESS;
+
+	enclaveRet = ecall_ride_share_bill_update_surge(GetEnclaveId(), &retValue);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_bill_update_surge);
+
+	return retValue;
+}
+
 bool Billing::ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt)
 {
 	if (category == RequestCategory::sk_fromTripPlaner)
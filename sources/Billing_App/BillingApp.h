@@ -15,5 +15,27 @@ namespace RideShare
 
 		virtual bool ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt) override;
 
+		/**
+		 * \brief	Loads the tariff table, in the binary format of TariffTable, into the enclave.
+		 *
+		 * \return	True if it succeeds, false if the tariff table is rejected.
+		 */
+		bool LoadTariffs(const std::string& data);
+
+		/**
+		 * \brief	Gives the local time of the day to the enclave, which picks the time windows of the
+		 * 			tariffs. It should be called before any request is served, and periodically
+		 * 			afterwards.
+		 */
+		void UpdateTimeOfDay();
+
+		/**
+		 * \brief	Has the enclave rebuild the surge multipliers from the live demand and supply
+		 * 			counters of the management services. It should be called periodically.
+		 *
+		 * \return	True if it succeeds, false if the current multipliers are kept.
+		 */
+		bool UpdateSurge();
+
 	};
 }
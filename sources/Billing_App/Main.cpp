@@ -1,5 +1,6 @@
 #include <string>
 #include <memory>
+#include <chrono>
 #include <iostream>
 
 #include <tclap/CmdLine.h>
@@ -25,6 +26,7 @@
 
 #include "../Common/AppNames.h"
 #include "../Common_App/ConnectionManager.h"
+#include "../Common_App/PeriodicTask.h"
 
 #include "BillingApp.h"
 
@@ -63,9 +65,14 @@ int main(int argc, char ** argv)
 	cmd.add(wlKeyArg);
 	cmd.add(isSendWlArg);
 
+	TCLAP::ValueArg<std::string> tariffsPathArg("t", "tariffs", "Path to the tariff table file; without it, every segment has the same unit price.", false, "", "String");
+	cmd.add(tariffsPathArg);
+
 	cmd.parse(argc, argv);
 
 	const size_t numListenThread = 5;
+	const std::chrono::seconds timeTickInterval(5);
+	const std::chrono::seconds surgeUpdateInterval(30);
 
 	//------- Read configuration file:
 	std::unique_ptr<DecentAppConfig> configMgr;
@@ -168,6 +175,22 @@ int main(int argc, char ** argv)
 			ENCLAVE_FILENAME, tokenPath, wlKeyArg.getValue(), *serverCon,
 			"Billing Pay Info" + selfAddr + ":" + std::to_string(selfPort));
 
+		if (tariffsPathArg.getValue().size() > 0)
+		{
+			std::string tariffsStr;
+			DiskFile file(tariffsPathArg.getValue(), FileBase::Mode::Read, true);
+			tariffsStr.resize(file.GetFileSize());
+			file.ReadBlockExactSize(tariffsStr);
+
+			if (!enclave->LoadTariffs(tariffsStr))
+			{
+				PRINT_W("Failed to load the tariff table.");
+				return -1;
+			}
+		}
+
+		enclave->UpdateTimeOfDay();
+
 		smartServer.AddServer(server, enclave, nullptr, numListenThread, 0);
 	}
 	catch (const std::exception& e)
@@ -176,10 +199,25 @@ int main(int argc, char ** argv)
 		return -1;
 	}
 
+	//------- Keep the enclave's time of the day going, for the time windows of the tariffs:
+	PeriodicTask tickTask("update the time of the enclave", timeTickInterval, [&enclave]()
+	{
+		enclave->UpdateTimeOfDay();
+	});
+
+	//------- Keep the surge multipliers up to date:
+	PeriodicTask surgeTask("update the surge multipliers", surgeUpdateInterval, [&enclave]()
+	{
+		enclave->UpdateSurge();
+	});
+
 	//------- keep running until an interrupt signal (Ctrl + C) is received.
 	mainThreadWorker->UpdateUntilInterrupt();
 
 	//------- Exit...
+	tickTask.Stop();
+	surgeTask.Stop();
+
 	enclave.reset();
 	smartServer.Terminate();
 
@@ -1,7 +1,7 @@
-#include <cmath>
-
 #include <mutex>
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include <DecentApi/Common/Common.h>
 #include <DecentApi/Common/make_unique.h>
@@ -19,7 +19,15 @@
 #include "../Common/RideSharingFuncNums.h"
 #include "../Common/RideSharingMessages.h"
 
+#include "../Common_Enc/InSituMessages.h"
 #include "../Common_Enc/OperatorPayment.h"
+#include "../Common_Enc/TlsChannelPool.h"
+
+#include "PathLengthBatch.h"
+#include "SurgeMap.h"
+#include "TariffTable.h"
+
+#include "Enclave_t.h"
 
 using namespace RideShare;
 using namespace Decent::Ra;
@@ -29,37 +37,134 @@ namespace
 {
 	static AppStates& gs_state = GetAppStateSingleton();
 
+	//The counters are only pulled by the periodic surge updates, so one channel each is enough.
+	constexpr size_t gsk_maxIdleChannels = 1;
+
+	static TlsChannelPool gs_pasMgmPool(gs_state, AppNames::sk_passengerMgm, &ocall_ride_share_cnt_mgr_get_pas_mgm, EncFunc::PassengerMgm::k_endSession, gsk_maxIdleChannels);
+	static TlsChannelPool gs_driMgmPool(gs_state, AppNames::sk_driverMgm, &ocall_ride_share_cnt_mgr_get_dri_mgm, EncFunc::DriverMgm::k_endSession, gsk_maxIdleChannels);
+
 	template<typename MsgType>
-	static std::unique_ptr<MsgType> ParseMsg(const std::string& msgStr)
+	static std::unique_ptr<MsgType> ParseMsg(std::string& msgStr)
 	{
-		rapidjson::Document json;
-		Decent::Tools::ParseStr2Json(json, msgStr);
-		return Decent::Tools::make_unique<MsgType>(json);
+		return Decent::Tools::make_unique<MsgType>(ComMsg::ParseInSitu<MsgType>(msgStr, msgStr));
 	}
+
+	//The unit price of every segment, until the untrusted side loads a tariff table.
+	constexpr double gsk_unitPrice = 1.5;
+	constexpr size_t gsk_maxPriceBatchSize = 4096;
+
+	std::shared_ptr<const TariffTable> gs_tariffTable;
+	std::mutex gs_tariffTableMutex;
+
+	//The time of the day (in seconds) given by the untrusted side, through the time ticks, which
+	//  picks the time windows of the tariffs.
+	std::atomic<uint32_t> gs_timeOfDay(0);
+
+	//Rebuilt from the live demand and supply counters by the surge updates; quotes only look it up.
+	std::shared_ptr<const SurgeMap> gs_surgeMap = std::make_shared<SurgeMap>();
+	std::mutex gs_surgeMapMutex;
+
+	//Bumped whenever the price of a path may change, i.e., when a tariff table is loaded, the time
+	//  windows in effect change, or the surge multipliers change; the Trip Planner drops the routes
+	//  it has cached with an older epoch.
+	std::atomic<uint64_t> gs_pricingEpoch(0);
+
+	//The unit prices of the zones at the last time tick, to tell when the time windows in effect change.
+	std::vector<double> gs_currUnitPrices;
+	std::mutex gs_currUnitPricesMutex;
 }
 
-static double CalDist(const ComMsg::Point2D<double>& a, const ComMsg::Point2D<double>& b)
+static std::shared_ptr<const TariffTable> GetTariffTable()
 {
-	return sqrt(pow(b.GetX() - a.GetX(), 2) + pow(b.GetY() - a.GetY(), 2));
+	std::unique_lock<std::mutex> tariffTableLock(gs_tariffTableMutex);
+	return gs_tariffTable;
+}
+
+static std::shared_ptr<const SurgeMap> GetSurgeMap()
+{
+	std::unique_lock<std::mutex> surgeMapLock(gs_surgeMapMutex);
+	return gs_surgeMap;
+}
+
+/**
+ * \brief	Gets the surge multiplier of a path, i.e., the one of the cell where it starts.
+ */
+static double GetSurgeMultiplier(const SurgeMap& surgeMap, const std::vector<ComMsg::Point2D<double> >& path)
+{
+	return path.size() > 0 ? surgeMap.GetMultiplier(path[0]) : 1.0;
 }
 
 static double CalPrice(const std::vector<ComMsg::Point2D<double> >& path)
 {
-	constexpr double unitPrice = 1.5;
-	double price = 0.0;
-	if (path.size() == 0 || path.size() == 1)
+	const double multiplier = GetSurgeMultiplier(*GetSurgeMap(), path);
+
+	std::shared_ptr<const TariffTable> tariffTable = GetTariffTable();
+	if (tariffTable)
+	{
+		std::vector<double> unitPrices;
+		tariffTable->GetUnitPrices(gs_timeOfDay.load(), unitPrices);
+
+		return tariffTable->CalPrice(path, unitPrices) * multiplier;
+	}
+
+	PathLengthBatch lengthBatch;
+	lengthBatch.Add(path);
+
+	std::vector<double> lengths;
+	lengthBatch.CalcLengths(lengths);
+
+	return lengths[0] * gsk_unitPrice * multiplier;
+}
+
+/**
+ * \brief	Calculates the prices of a batch of paths. The segment lengths of all the paths are
+ * 			computed in a single pass, and, with a tariff table, the unit prices of the zones are
+ * 			resolved once for the whole batch.
+ */
+static std::vector<double> CalPrices(const std::vector<ComMsg::Path>& paths)
+{
+	std::shared_ptr<const SurgeMap> surgeMap = GetSurgeMap();
+
+	size_t numPoints = 0;
+	for (const ComMsg::Path& path : paths)
 	{
-		return price;
+		numPoints += path.GetPath().size();
 	}
 
-	const ComMsg::Point2D<double>* prevPoint = &path[0];
-	for (size_t i = 1; i < path.size(); ++i)
+	PathLengthBatch lengthBatch;
+	lengthBatch.Reserve(paths.size(), numPoints);
+	for (const ComMsg::Path& path : paths)
 	{
-		price += CalDist(*prevPoint, path[i]) * unitPrice;
-		prevPoint = &path[i];
+		lengthBatch.Add(path.GetPath());
 	}
 
-	return price;
+	std::vector<double> prices;
+
+	std::shared_ptr<const TariffTable> tariffTable = GetTariffTable();
+	if (tariffTable)
+	{
+		std::vector<double> unitPrices;
+		tariffTable->GetUnitPrices(gs_timeOfDay.load(), unitPrices);
+
+		std::vector<double> segLens;
+		lengthBatch.CalcSegmentLengths(segLens);
+
+		prices.reserve(paths.size());
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			const std::vector<ComMsg::Point2D<double> >& path = paths[i].GetPath();
+			const double* pathSegLens = path.size() < 2 ? nullptr : (segLens.data() + lengthBatch.GetPathBegin(i));
+			prices.push_back(tariffTable->CalPrice(path, unitPrices, pathSegLens) * GetSurgeMultiplier(*surgeMap, path));
+		}
+		return prices;
+	}
+
+	lengthBatch.CalcLengths(prices);
+	for (size_t i = 0; i < prices.size(); ++i)
+	{
+		prices[i] *= gsk_unitPrice * GetSurgeMultiplier(*surgeMap, paths[i].GetPath());
+	}
+	return prices;
 }
 
 static void ProcessCalPriceReq(void* const connection, Decent::Net::TlsCommLayer& tls)
@@ -71,13 +176,48 @@ static void ProcessCalPriceReq(void* const connection, Decent::Net::TlsCommLayer
 	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
 	std::unique_ptr<ComMsg::Path> pathMsg = ParseMsg<ComMsg::Path>(msgBuf);
 
+	//Read before pricing, so a change during it makes the price stale, rather than unnoticed.
+	const uint64_t pricingEpoch = gs_pricingEpoch.load();
+
 	const double price = CalPrice(pathMsg->GetPath());
 	LOGI("Got price: %f.", price);
 
 	ComMsg::Price priceMsg(price, OperatorPayment::GetPaymentInfo());
 
-	tls.SendContainer(cnt, priceMsg.ToString());
+	tls.SendContainer(cnt, priceMsg.ToString(ComMsg::DetectWireFormat(msgBuf)));
+	tls.SendStruct(cnt, pricingEpoch);
+}
+
+/**
+ * \brief	Prices a batch of paths at once, e.g., for the alternatives of a multi-quote, so the batch
+ * 			only costs one round trip. The Trip Planner still prices one path per quote, so this is
+ * 			only offered to the callers of the API for now.
+ */
+static bool ProcessCalPriceBatchReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Processing calculate price batch request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
+	const ComMsg::WireFormat format = ComMsg::DetectWireFormat(msgBuf);
+	std::unique_ptr<ComMsg::PathBatch> pathBatch = ParseMsg<ComMsg::PathBatch>(msgBuf);
+
+	const std::vector<ComMsg::Path>& paths = pathBatch->GetPaths();
+	if (paths.size() > gsk_maxPriceBatchSize)
+	{
+		LOGW("Price batch is too large (%llu).", static_cast<unsigned long long>(paths.size()));
+		return false;
+	}
 
+	std::vector<double> prices = CalPrices(paths);
+	LOGI("Got %llu prices.", static_cast<unsigned long long>(prices.size()));
+
+	ComMsg::PriceBatch priceBatch(std::move(prices), OperatorPayment::GetPaymentInfo());
+
+	tls.SendContainer(cnt, priceBatch.ToString(format));
+
+	return true;
 }
 
 extern "C" int ecall_ride_share_bill_from_trip_planner(void* const connection)
@@ -98,16 +238,29 @@ extern "C" int ecall_ride_share_bill_from_trip_planner(void* const connection)
 		std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, AppNames::sk_tripPlanner, nullptr);
 		TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the Trip Planner ends it.
 		NumType funcNum;
-		tls.RecvStruct(cnt, funcNum);
-
-		switch (funcNum)
+		bool isSessionAlive = true;
+		while (isSessionAlive)
 		{
-		case k_calPrice:
-			ProcessCalPriceReq(connection, tls);
-			break;
-		default:
-			break;
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_calPrice:
+				ProcessCalPriceReq(connection, tls);
+				break;
+			case k_calPriceBatch:
+				isSessionAlive = ProcessCalPriceBatchReq(connection, tls);
+				break;
+			case k_getPricingEpoch:
+				tls.SendStruct(cnt, gs_pricingEpoch.load());
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
 		}
 	}
 	catch (const std::exception& e)
@@ -117,3 +270,104 @@ extern "C" int ecall_ride_share_bill_from_trip_planner(void* const connection)
 
 	return false;
 }
+
+extern "C" int ecall_ride_share_bill_load_tariffs(const uint8_t* data, size_t size)
+{
+	try
+	{
+		std::shared_ptr<const TariffTable> tariffTable = TariffTable::Parse(StringView(reinterpret_cast<const char*>(data), size));
+
+		PRINT_I("Tariff table is loaded, with %llu zones.", static_cast<unsigned long long>(tariffTable->GetNumZones()));
+
+		{
+			std::unique_lock<std::mutex> tariffTableLock(gs_tariffTableMutex);
+			gs_tariffTable = tariffTable;
+		}
+		++gs_pricingEpoch;
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to load the tariff table. Caught exception: %s", e.what());
+		return false;
+	}
+
+	return true;
+}
+
+extern "C" void ecall_ride_share_bill_set_time_of_day(uint32_t time_of_day)
+{
+	gs_timeOfDay.store(time_of_day % TariffTable::sk_secondsPerDay);
+
+	std::shared_ptr<const TariffTable> tariffTable = GetTariffTable();
+	if (tariffTable)
+	{
+		std::vector<double> unitPrices;
+		tariffTable->GetUnitPrices(gs_timeOfDay.load(), unitPrices);
+
+		std::unique_lock<std::mutex> unitPricesLock(gs_currUnitPricesMutex);
+		if (unitPrices != gs_currUnitPrices)
+		{
+			gs_currUnitPrices.swap(unitPrices);
+			++gs_pricingEpoch;
+		}
+	}
+
+	gs_pasMgmPool.EvictIdle();
+	gs_driMgmPool.EvictIdle();
+}
+
+/**
+ * \brief	Rebuilds the surge multipliers from the counters of the management services. Both are
+ * 			queried concurrently. If either fails, the current multipliers are kept.
+ */
+extern "C" int ecall_ride_share_bill_update_surge()
+{
+	try
+	{
+		std::string demandStr;
+		std::string supplyStr;
+
+		std::vector<TlsChannelPool::ConcurrentCall> calls;
+		calls.push_back(TlsChannelPool::ConcurrentCall(gs_pasMgmPool,
+			[](ConnectionBase& cnt, TlsCommLayer& tls)
+			{
+				tls.SendStruct(cnt, EncFunc::PassengerMgm::k_getDemand);
+			},
+			[&demandStr](ConnectionBase& cnt, TlsCommLayer& tls)
+			{
+				demandStr = tls.RecvContainer<std::string>(cnt);
+			}));
+		calls.push_back(TlsChannelPool::ConcurrentCall(gs_driMgmPool,
+			[](ConnectionBase& cnt, TlsCommLayer& tls)
+			{
+				tls.SendStruct(cnt, EncFunc::DriverMgm::k_getSupply);
+			},
+			[&supplyStr](ConnectionBase& cnt, TlsCommLayer& tls)
+			{
+				supplyStr = tls.RecvContainer<std::string>(cnt);
+			}));
+
+		TlsChannelPool::UseConcurrently(calls);
+
+		std::unique_ptr<ComMsg::CellCountBatch> demand = ParseMsg<ComMsg::CellCountBatch>(demandStr);
+		std::unique_ptr<ComMsg::CellCountBatch> supply = ParseMsg<ComMsg::CellCountBatch>(supplyStr);
+
+		std::shared_ptr<const SurgeMap> surgeMap = std::make_shared<SurgeMap>(demand->GetCells(), supply->GetCells());
+
+		LOGI("Surge multipliers are updated, with %llu surged cells.", static_cast<unsigned long long>(surgeMap->GetNumSurgedCells()));
+
+		std::unique_lock<std::mutex> surgeMapLock(gs_surgeMapMutex);
+		if (!surgeMap->HasSameMultipliers(*gs_surgeMap))
+		{
+			gs_surgeMap = surgeMap;
+			++gs_pricingEpoch;
+		}
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to update the surge multipliers. Caught exception: %s", e.what());
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,118 @@
+#include "PathLengthBatch.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+//GCC vector extensions, rather than the intrinsic headers, which aren't on the include paths of
+//  every enclave toolchain.
+#define RIDE_SHARE_SSE2_KERNEL
+#endif
+
+using namespace RideShare;
+
+namespace
+{
+#ifdef RIDE_SHARE_SSE2_KERNEL
+	typedef double Vec2d __attribute__((vector_size(16)));
+
+	inline Vec2d LoadVec2d(const double* ptr)
+	{
+		//Compiled to one unaligned load.
+		Vec2d res;
+		std::memcpy(&res, ptr, sizeof(res));
+		return res;
+	}
+#endif
+
+	/**
+	 * \brief	Calculates the length of each segment between two consecutive points, i.e.,
+	 * 			lens[i] = |(xs[i + 1], ys[i + 1]) - (xs[i], ys[i])|.
+	 */
+	void CalcSegmentLengths(const double* xs, const double* ys, const size_t numSegs, double* lens)
+	{
+		size_t i = 0;
+#ifdef RIDE_SHARE_SSE2_KERNEL
+		for (; i + 2 <= numSegs; i += 2)
+		{
+			const Vec2d dx = LoadVec2d(xs + i + 1) - LoadVec2d(xs + i);
+			const Vec2d dy = LoadVec2d(ys + i + 1) - LoadVec2d(ys + i);
+			const Vec2d len = __builtin_ia32_sqrtpd(dx * dx + dy * dy);
+			std::memcpy(lens + i, &len, sizeof(len));
+		}
+#endif
+		for (; i < numSegs; ++i)
+		{
+			const double dx = xs[i + 1] - xs[i];
+			const double dy = ys[i + 1] - ys[i];
+			lens[i] = std::sqrt(dx * dx + dy * dy);
+		}
+	}
+}
+
+PathLengthBatch::PathLengthBatch() :
+	m_xs(),
+	m_ys(),
+	m_ends()
+{
+}
+
+PathLengthBatch::~PathLengthBatch()
+{
+}
+
+void PathLengthBatch::Reserve(const size_t numPaths, const size_t numPoints)
+{
+	m_xs.reserve(numPoints);
+	m_ys.reserve(numPoints);
+	m_ends.reserve(numPaths);
+}
+
+void PathLengthBatch::Add(const std::vector<ComMsg::Point2D<double> >& path)
+{
+	for (const ComMsg::Point2D<double>& point : path)
+	{
+		m_xs.push_back(point.GetX());
+		m_ys.push_back(point.GetY());
+	}
+	m_ends.push_back(m_xs.size());
+}
+
+void PathLengthBatch::CalcLengths(std::vector<double>& lengths) const
+{
+	lengths.assign(m_ends.size(), 0.0);
+	if (m_xs.size() < 2)
+	{
+		return;
+	}
+
+	//The segments between the last point of a path and the first point of the next one are
+	//  computed as well, since skipping them would break up the pass; they are just not summed.
+	std::vector<double> segLens;
+	CalcSegmentLengths(segLens);
+
+	size_t begin = 0;
+	for (size_t i = 0; i < m_ends.size(); ++i)
+	{
+		const size_t end = m_ends[i];
+		double length = 0.0;
+		for (size_t j = begin; j + 1 < end; ++j)
+		{
+			length += segLens[j];
+		}
+		lengths[i] = length;
+		begin = end;
+	}
+}
+
+void PathLengthBatch::CalcSegmentLengths(std::vector<double>& segLens) const
+{
+	if (m_xs.size() < 2)
+	{
+		segLens.clear();
+		return;
+	}
+
+	segLens.resize(m_xs.size() - 1);
+	::CalcSegmentLengths(m_xs.data(), m_ys.data(), segLens.size(), segLens.data());
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "../Common/RideSharingMessages.h"
+
+namespace RideShare
+{
+	/**
+	 * \brief	The lengths of a batch of paths. The points of all the paths are stored as a structure
+	 * 			of arrays, i.e., all the X's and all the Y's in two contiguous arrays, so the segment
+	 * 			lengths of the whole batch are computed in one tight pass, several segments at a time
+	 * 			where SIMD is available.
+	 */
+	class PathLengthBatch
+	{
+	public:
+		PathLengthBatch();
+
+		PathLengthBatch(const PathLengthBatch& rhs) = delete;
+		PathLengthBatch(PathLengthBatch&& rhs) = delete;
+
+		~PathLengthBatch();
+
+		void Reserve(const size_t numPaths, const size_t numPoints);
+
+		void Add(const std::vector<ComMsg::Point2D<double> >& path);
+
+		size_t GetNumPaths() const { return m_ends.size(); }
+
+		/** \brief	Gets the index of the first point of a path, in the order they were added. */
+		size_t GetPathBegin(const size_t idx) const { return idx == 0 ? 0 : m_ends[idx - 1]; }
+
+		/**
+		 * \brief	Calculates the lengths of the paths, in the order they were added. A path with
+		 * 			fewer than two points has a length of 0.
+		 */
+		void CalcLengths(std::vector<double>& lengths) const;
+
+		/**
+		 * \brief	Calculates the lengths of all the segments, between each point and the next one.
+		 * 			The segments of a path start at the index given by GetPathBegin; the ones
+		 * 			between the last point of a path and the first point of the next one are
+		 * 			computed as well, and should be skipped.
+		 */
+		void CalcSegmentLengths(std::vector<double>& segLens) const;
+
+	private:
+		std::vector<double> m_xs;
+		std::vector<double> m_ys;
+		//One past the last point of each path.
+		std::vector<size_t> m_ends;
+	};
+}
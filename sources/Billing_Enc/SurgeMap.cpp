@@ -0,0 +1,70 @@
+#include "SurgeMap.h"
+
+#include "../Common_Enc/CellEventCounter.h"
+
+using namespace RideShare;
+
+constexpr uint32_t SurgeMap::sk_minDemand;
+constexpr double SurgeMap::sk_slope;
+constexpr double SurgeMap::sk_maxMultiplier;
+
+SurgeMap::SurgeMap() :
+	m_multipliers()
+{
+}
+
+SurgeMap::SurgeMap(const std::vector<ComMsg::CellCount>& demand, const std::vector<ComMsg::CellCount>& supply) :
+	m_multipliers()
+{
+	std::unordered_map<uint64_t, uint32_t> supplyCounts;
+	supplyCounts.reserve(supply.size());
+	for (const ComMsg::CellCount& cell : supply)
+	{
+		supplyCounts[CellEventCounter::CombineCellIndex(cell.GetX(), cell.GetY())] += cell.GetCount();
+	}
+
+	for (const ComMsg::CellCount& cell : demand)
+	{
+		if (cell.GetCount() < sk_minDemand)
+		{
+			continue;
+		}
+
+		const uint64_t key = CellEventCounter::CombineCellIndex(cell.GetX(), cell.GetY());
+
+		auto it = supplyCounts.find(key);
+		const uint32_t supplyCount = (it == supplyCounts.end() || it->second == 0) ? 1 : it->second;
+
+		const double ratio = static_cast<double>(cell.GetCount()) / supplyCount;
+		double multiplier = 1.0 + sk_slope * (ratio - 1.0);
+		if (multiplier <= 1.0)
+		{
+			continue;
+		}
+		if (multiplier > sk_maxMultiplier)
+		{
+			multiplier = sk_maxMultiplier;
+		}
+
+		m_multipliers[key] = multiplier;
+	}
+}
+
+SurgeMap::~SurgeMap()
+{
+}
+
+double SurgeMap::GetMultiplier(const ComMsg::Point2D<double>& pt) const
+{
+	if (m_multipliers.size() == 0)
+	{
+		return 1.0;
+	}
+
+	const uint64_t key = CellEventCounter::CombineCellIndex(
+		CellEventCounter::ToCellIndex(pt.GetX(), SurgeGrid::sk_cellSize),
+		CellEventCounter::ToCellIndex(pt.GetY(), SurgeGrid::sk_cellSize));
+
+	auto it = m_multipliers.find(key);
+	return it == m_multipliers.end() ? 1.0 : it->second;
+}
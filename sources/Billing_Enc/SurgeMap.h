@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+#include "../Common/RideSharingMessages.h"
+
+namespace RideShare
+{
+	/**
+	 * \brief	The surge multipliers of the grid cells (see SurgeGrid), derived from the demand (quotes
+	 * 			requested) and the supply (drivers looking for matches) counted by the management
+	 * 			services over the sliding window. It's built once per update, and only keeps the
+	 * 			cells with a multiplier above 1, so looking up a point at quote time costs O(1).
+	 * 			Once constructed, it's read-only.
+	 */
+	class SurgeMap
+	{
+	public:
+		//Cells with less demand than this are never surged, so a few passengers don't move the price
+		//  (each one is counted once per window; see CellEventCounter).
+		static constexpr uint32_t sk_minDemand = 5;
+		//How much the multiplier grows per unit of the demand/supply ratio above 1.
+		static constexpr double sk_slope = 0.5;
+		static constexpr double sk_maxMultiplier = 3.0;
+
+	public:
+		SurgeMap();
+
+		SurgeMap(const std::vector<ComMsg::CellCount>& demand, const std::vector<ComMsg::CellCount>& supply);
+
+		SurgeMap(const SurgeMap& rhs) = delete;
+		SurgeMap(SurgeMap&& rhs) = delete;
+
+		~SurgeMap();
+
+		/**
+		 * \brief	Gets the multiplier of the cell containing the point; 1 if it isn't surged.
+		 */
+		double GetMultiplier(const ComMsg::Point2D<double>& pt) const;
+
+		size_t GetNumSurgedCells() const { return m_multipliers.size(); }
+
+		bool HasSameMultipliers(const SurgeMap& rhs) const { return m_multipliers == rhs.m_multipliers; }
+
+	private:
+		std::unordered_map<uint64_t, double> m_multipliers;
+	};
+}
@@ -0,0 +1,661 @@
+#include "TariffTable.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <DecentApi/Common/make_unique.h>
+
+#include "../Common/BinaryCoding.h"
+#include "../Common/MessageException.h"
+#include "../Common/RuntimeException.h"
+
+using namespace RideShare;
+
+constexpr uint32_t TariffTable::sk_secondsPerDay;
+constexpr size_t TariffTable::sk_maxNumZones;
+constexpr size_t TariffTable::sk_maxNumVertices;
+constexpr size_t TariffTable::sk_maxNumWindows;
+
+namespace
+{
+	//"RSTF" in little-endian.
+	constexpr uint32_t gsk_tariffMagic = 0x46545352;
+
+	//The number of cells along the longer side of the grid grows with the number of vertices,
+	//  so each cell on a boundary only has a few edges, within these limits.
+	constexpr size_t gsk_minGridRes = 16;
+	constexpr size_t gsk_maxGridRes = 256;
+	constexpr double gsk_cellsPerVertex = 4.0;
+
+	//Where the reference point of a cell is, in cells from its corner; whether it's in a zone is
+	//  found when the grid is built. It's off the center, by odd fractions, since zones are often
+	//  drawn on round coordinates, and a point right on a vertex is in a zone or not depending on
+	//  the direction it's reached from.
+	constexpr double gsk_refPointX = 0.5 + 0.0371;
+	constexpr double gsk_refPointY = 0.5 + 0.0457;
+
+	constexpr double gsk_inf = std::numeric_limits<double>::infinity();
+
+	typedef TariffTable::Vertex Vertex;
+
+	double Cross(const double ax, const double ay, const double bx, const double by)
+	{
+		return ax * by - ay * bx;
+	}
+
+	/**
+	 * \brief	Clips the segment a + t * (b - a), t in [t0, t1], to the rectangle (Liang-Barsky).
+	 *
+	 * \return	False if the segment misses the rectangle.
+	 */
+	bool ClipSegment(const Vertex& a, const Vertex& b, const Vertex& rectMin, const Vertex& rectMax, double& t0, double& t1)
+	{
+		const double dx = b.m_x - a.m_x;
+		const double dy = b.m_y - a.m_y;
+		const double ps[] = { -dx, dx, -dy, dy };
+		const double qs[] = { a.m_x - rectMin.m_x, rectMax.m_x - a.m_x, a.m_y - rectMin.m_y, rectMax.m_y - a.m_y };
+		for (size_t i = 0; i < 4; ++i)
+		{
+			if (ps[i] == 0.0)
+			{
+				if (qs[i] < 0.0)
+				{
+					return false;
+				}
+				continue;
+			}
+
+			const double t = qs[i] / ps[i];
+			if (ps[i] < 0.0)
+			{
+				t0 = std::max(t0, t);
+			}
+			else
+			{
+				t1 = std::min(t1, t);
+			}
+		}
+		return t0 <= t1;
+	}
+
+	/**
+	 * \brief	Finds where the segment from a to b crosses the edge. A point right on a line counts as
+	 * 			on its left, so a segment through a vertex crosses both edges sharing it or neither,
+	 * 			unless they are on both sides of it, and a point on the boundary of a zone is
+	 * 			consistently in or out of it, whichever segment it's reached by.
+	 *
+	 * \param [out]	t	The crossing, as a fraction of the segment.
+	 */
+	bool FindCrossing(const Vertex& a, const Vertex& b, const Vertex& edgeA, const Vertex& edgeB, double& t)
+	{
+		const double dx = b.m_x - a.m_x;
+		const double dy = b.m_y - a.m_y;
+		const double ex = edgeB.m_x - edgeA.m_x;
+		const double ey = edgeB.m_y - edgeA.m_y;
+
+		const double sideA = Cross(ex, ey, a.m_x - edgeA.m_x, a.m_y - edgeA.m_y);
+		const double sideB = Cross(ex, ey, b.m_x - edgeA.m_x, b.m_y - edgeA.m_y);
+		if ((sideA >= 0.0) == (sideB >= 0.0))
+		{
+			//Most edges are missed.
+			return false;
+		}
+		if ((Cross(dx, dy, edgeA.m_x - a.m_x, edgeA.m_y - a.m_y) >= 0.0) == (Cross(dx, dy, edgeB.m_x - a.m_x, edgeB.m_y - a.m_y) >= 0.0))
+		{
+			return false;
+		}
+
+		t = sideA / (sideA - sideB);
+		return true;
+	}
+
+	void CheckPrice(const double price)
+	{
+		if (!std::isfinite(price) || price < 0.0)
+		{
+			throw RuntimeException("A price in the tariff table is invalid.");
+		}
+	}
+
+	void CheckTariff(const TariffTable::Tariff& tariff)
+	{
+		CheckPrice(tariff.m_unitPrice);
+		CheckPrice(tariff.m_surcharge);
+
+		if (tariff.m_windows.size() > TariffTable::sk_maxNumWindows)
+		{
+			throw RuntimeException("A tariff has too many time windows.");
+		}
+		for (const TariffTable::TimeWindow& window : tariff.m_windows)
+		{
+			if (window.m_begin >= TariffTable::sk_secondsPerDay || window.m_end >= TariffTable::sk_secondsPerDay)
+			{
+				throw RuntimeException("A time window of a tariff is invalid.");
+			}
+			CheckPrice(window.m_unitPrice);
+		}
+	}
+
+	double GetUnitPrice(const TariffTable::Tariff& tariff, const uint32_t timeOfDay)
+	{
+		for (const TariffTable::TimeWindow& window : tariff.m_windows)
+		{
+			const bool isIn = window.m_begin <= window.m_end ?
+				(timeOfDay >= window.m_begin && timeOfDay < window.m_end) :
+				(timeOfDay >= window.m_begin || timeOfDay < window.m_end);
+			if (isIn)
+			{
+				return window.m_unitPrice;
+			}
+		}
+		return tariff.m_unitPrice;
+	}
+
+	TariffTable::Tariff ParseTariff(ComMsg::BinaryReader& reader)
+	{
+		TariffTable::Tariff tariff;
+		tariff.m_unitPrice = reader.Read<double>();
+		tariff.m_surcharge = reader.Read<double>();
+
+		const size_t numWindows = reader.ReadSize(2 * sizeof(uint32_t) + sizeof(double));
+		tariff.m_windows.reserve(numWindows);
+		for (size_t i = 0; i < numWindows; ++i)
+		{
+			const uint32_t begin = reader.Read<uint32_t>();
+			const uint32_t end = reader.Read<uint32_t>();
+			const double unitPrice = reader.Read<double>();
+			tariff.m_windows.push_back(TariffTable::TimeWindow{ begin, end, unitPrice });
+		}
+
+		return tariff;
+	}
+
+	//A zone whose boundary crosses a cell, while the grid is being built.
+	struct BuildCellZone
+	{
+		uint32_t m_zone;
+		bool m_isRefIn;
+		std::vector<std::pair<Vertex, Vertex> > m_edges;
+	};
+}
+
+std::unique_ptr<TariffTable> TariffTable::Parse(const StringView& data)
+{
+	using namespace ComMsg;
+	BinaryReader reader(data);
+
+	if (reader.Read<uint32_t>() != gsk_tariffMagic)
+	{
+		throw MessageParseException();
+	}
+
+	Tariff defaultTariff = ParseTariff(reader);
+
+	//The number of vertices, and a tariff without time windows, at least.
+	const size_t numZones = reader.ReadSize(2 * sizeof(uint32_t) + 2 * sizeof(double));
+	std::vector<Zone> zones;
+	zones.reserve(numZones);
+	for (size_t i = 0; i < numZones; ++i)
+	{
+		Zone zone;
+
+		const size_t numVertices = reader.ReadSize(2 * sizeof(double));
+		zone.m_polygon.reserve(numVertices);
+		for (size_t j = 0; j < numVertices; ++j)
+		{
+			const double x = reader.Read<double>();
+			const double y = reader.Read<double>();
+			if (!std::isfinite(x) || !std::isfinite(y))
+			{
+				throw MessageParseException();
+			}
+			zone.m_polygon.push_back(Vertex{ x, y });
+		}
+
+		zone.m_tariff = ParseTariff(reader);
+
+		zones.push_back(std::move(zone));
+	}
+
+	if (!reader.IsEnd())
+	{
+		throw MessageParseException();
+	}
+
+	return Decent::Tools::make_unique<TariffTable>(std::move(defaultTariff), std::move(zones));
+}
+
+TariffTable::TariffTable(Tariff&& defaultTariff, std::vector<Zone>&& zones) :
+	m_defaultTariff(std::forward<Tariff>(defaultTariff)),
+	m_zones(std::forward<std::vector<Zone> >(zones)),
+	m_gridMin{ 0.0, 0.0 },
+	m_cellSize(1.0),
+	m_numCols(0),
+	m_numRows(0),
+	m_cells(),
+	m_cellZones(),
+	m_cellEdges()
+{
+	if (m_zones.size() > sk_maxNumZones)
+	{
+		throw RuntimeException("The tariff table has too many zones.");
+	}
+
+	CheckTariff(m_defaultTariff);
+
+	size_t numVertices = 0;
+	Vertex gridMax{ -gsk_inf, -gsk_inf };
+	m_gridMin = Vertex{ gsk_inf, gsk_inf };
+	for (const Zone& zone : m_zones)
+	{
+		CheckTariff(zone.m_tariff);
+
+		if (zone.m_polygon.size() < 3)
+		{
+			throw RuntimeException("A zone in the tariff table isn't a polygon.");
+		}
+		numVertices += zone.m_polygon.size();
+		if (numVertices > sk_maxNumVertices)
+		{
+			throw RuntimeException("The zones in the tariff table have too many vertices.");
+		}
+
+		for (const Vertex& vertex : zone.m_polygon)
+		{
+			m_gridMin.m_x = std::min(m_gridMin.m_x, vertex.m_x);
+			m_gridMin.m_y = std::min(m_gridMin.m_y, vertex.m_y);
+			gridMax.m_x = std::max(gridMax.m_x, vertex.m_x);
+			gridMax.m_y = std::max(gridMax.m_y, vertex.m_y);
+		}
+	}
+
+	if (m_zones.size() == 0)
+	{
+		m_gridMin = Vertex{ 0.0, 0.0 };
+		return;
+	}
+
+	const double extent = std::max(gridMax.m_x - m_gridMin.m_x, gridMax.m_y - m_gridMin.m_y);
+	const double gridRes = std::ceil(std::sqrt(gsk_cellsPerVertex * numVertices));
+	m_cellSize = extent > 0.0 ? extent / std::min<double>(gsk_maxGridRes, std::max<double>(gsk_minGridRes, gridRes)) : 1.0;
+	m_numCols = std::min(gsk_maxGridRes, static_cast<size_t>((gridMax.m_x - m_gridMin.m_x) / m_cellSize) + 1);
+	m_numRows = std::min(gsk_maxGridRes, static_cast<size_t>((gridMax.m_y - m_gridMin.m_y) / m_cellSize) + 1);
+	//The grid covers the zones, even with the rounding errors.
+	gridMax = Vertex{ m_gridMin.m_x + m_numCols * m_cellSize, m_gridMin.m_y + m_numRows * m_cellSize };
+
+	const uint32_t defaultZone = static_cast<uint32_t>(m_zones.size());
+	std::vector<uint32_t> cellBgZones(m_numCols * m_numRows, defaultZone);
+	std::vector<std::vector<BuildCellZone> > cellZones(m_numCols * m_numRows);
+
+	auto toCol = [this](const double x) -> size_t
+	{
+		const double col = std::floor((x - m_gridMin.m_x) / m_cellSize);
+		return col < 0.0 ? 0 : std::min(m_numCols - 1, static_cast<size_t>(col));
+	};
+
+	//Find the cells crossed by each edge; a row of cells at a time, so only the cells near the
+	//  edge are visited. Since the zones are visited in order, the zones crossing each cell are
+	//  sorted by priority.
+	for (uint32_t zoneIdx = 0; zoneIdx < m_zones.size(); ++zoneIdx)
+	{
+		const std::vector<Vertex>& polygon = m_zones[zoneIdx].m_polygon;
+		for (size_t i = 0; i < polygon.size(); ++i)
+		{
+			const Vertex& a = polygon[i];
+			const Vertex& b = polygon[(i + 1) % polygon.size()];
+
+			for (size_t row = 0; row < m_numRows; ++row)
+			{
+				//With some slack, so an edge on the border between two rows is in both.
+				const double slack = m_cellSize * 1e-9;
+				const Vertex rowMin{ m_gridMin.m_x - m_cellSize, m_gridMin.m_y + row * m_cellSize - slack };
+				const Vertex rowMax{ gridMax.m_x + m_cellSize, m_gridMin.m_y + (row + 1) * m_cellSize + slack };
+
+				double t0 = 0.0;
+				double t1 = 1.0;
+				if (!ClipSegment(a, b, rowMin, rowMax, t0, t1))
+				{
+					continue;
+				}
+
+				const double x0 = a.m_x + (b.m_x - a.m_x) * t0;
+				const double x1 = a.m_x + (b.m_x - a.m_x) * t1;
+				const size_t colEnd = toCol(std::max(x0, x1) + slack) + 1;
+				for (size_t col = toCol(std::min(x0, x1) - slack); col < colEnd; ++col)
+				{
+					std::vector<BuildCellZone>& zonesInCell = cellZones[row * m_numCols + col];
+					if (zonesInCell.size() == 0 || zonesInCell.back().m_zone != zoneIdx)
+					{
+						zonesInCell.push_back(BuildCellZone{ zoneIdx, false, {} });
+					}
+					zonesInCell.back().m_edges.push_back(std::make_pair(a, b));
+				}
+			}
+		}
+	}
+
+	//Find the cells whose reference points are in each zone, a row of cells at a time. A zone without edges
+	//  in such a cell covers the whole cell.
+	std::vector<std::pair<double, bool> > crossings;
+	for (uint32_t zoneIdx = 0; zoneIdx < m_zones.size(); ++zoneIdx)
+	{
+		const std::vector<Vertex>& polygon = m_zones[zoneIdx].m_polygon;
+		for (size_t row = 0; row < m_numRows; ++row)
+		{
+			const double refY = m_gridMin.m_y + (row + gsk_refPointY) * m_cellSize;
+
+			//Where the edges cross the row, and whether each edge goes down, in which case a
+			//  reference point right on it is on its right, and thus past it (see FindCrossing).
+			crossings.clear();
+			for (size_t i = 0; i < polygon.size(); ++i)
+			{
+				const Vertex& a = polygon[i];
+				const Vertex& b = polygon[(i + 1) % polygon.size()];
+				if ((a.m_y <= refY) != (b.m_y <= refY))
+				{
+					crossings.push_back(std::make_pair(a.m_x + (refY - a.m_y) * (b.m_x - a.m_x) / (b.m_y - a.m_y), b.m_y < a.m_y));
+				}
+			}
+			std::sort(crossings.begin(), crossings.end());
+
+			bool isIn = false;
+			size_t next = 0;
+			for (size_t col = 0; col < m_numCols && next < crossings.size(); ++col)
+			{
+				const double refX = m_gridMin.m_x + (col + gsk_refPointX) * m_cellSize;
+				for (; next < crossings.size() && crossings[next].first < refX; ++next)
+				{
+					isIn = !isIn;
+				}
+				bool isRefIn = isIn;
+				for (size_t i = next; i < crossings.size() && crossings[i].first == refX; ++i)
+				{
+					isRefIn = crossings[i].second ? !isRefIn : isRefIn;
+				}
+
+				if (isRefIn)
+				{
+					const size_t cellIdx = row * m_numCols + col;
+					std::vector<BuildCellZone>& zonesInCell = cellZones[cellIdx];
+
+					auto it = std::find_if(zonesInCell.begin(), zonesInCell.end(),
+						[zoneIdx](const BuildCellZone& item) { return item.m_zone == zoneIdx; });
+					if (it != zonesInCell.end())
+					{
+						it->m_isRefIn = true;
+					}
+					else if (cellBgZones[cellIdx] == defaultZone)
+					{
+						//The zones are visited in the order of priority.
+						cellBgZones[cellIdx] = zoneIdx;
+					}
+				}
+			}
+		}
+	}
+
+	m_cells.reserve(cellZones.size());
+	for (size_t i = 0; i < cellZones.size(); ++i)
+	{
+		Cell cell{ cellBgZones[i], static_cast<uint32_t>(m_cellZones.size()), 0 };
+		for (const BuildCellZone& item : cellZones[i])
+		{
+			if (item.m_zone > cell.m_zone)
+			{
+				//It's under the zone covering the cell.
+				break;
+			}
+
+			m_cellZones.push_back(CellZone{ item.m_zone, item.m_isRefIn,
+				static_cast<uint32_t>(m_cellEdges.size()), static_cast<uint32_t>(item.m_edges.size()) });
+			for (const std::pair<Vertex, Vertex>& edge : item.m_edges)
+			{
+				m_cellEdges.push_back(Edge{ edge.first, edge.second });
+			}
+			++cell.m_numZones;
+		}
+		m_cells.push_back(cell);
+	}
+}
+
+TariffTable::~TariffTable()
+{
+}
+
+void TariffTable::GetUnitPrices(const uint32_t timeOfDay, std::vector<double>& unitPrices) const
+{
+	const uint32_t time = timeOfDay % sk_secondsPerDay;
+
+	unitPrices.resize(m_zones.size() + 1);
+	for (size_t i = 0; i < m_zones.size(); ++i)
+	{
+		unitPrices[i] = GetUnitPrice(m_zones[i].m_tariff, time);
+	}
+	unitPrices[m_zones.size()] = GetUnitPrice(m_defaultTariff, time);
+}
+
+double TariffTable::CalPrice(const std::vector<ComMsg::Point2D<double> >& path, const std::vector<double>& unitPrices,
+	const double* segLens) const
+{
+	const uint32_t defaultZone = static_cast<uint32_t>(m_zones.size());
+	const Vertex gridMax{ m_gridMin.m_x + m_numCols * m_cellSize, m_gridMin.m_y + m_numRows * m_cellSize };
+
+	Scratch scratch;
+
+	double price = 0.0;
+	for (size_t i = 1; i < path.size(); ++i)
+	{
+		const Vertex a{ path[i - 1].GetX(), path[i - 1].GetY() };
+		const Vertex b{ path[i].GetX(), path[i].GetY() };
+		const double dx = b.m_x - a.m_x;
+		const double dy = b.m_y - a.m_y;
+		const double len = segLens != nullptr ? segLens[i - 1] : std::sqrt(dx * dx + dy * dy);
+		if (len == 0.0)
+		{
+			continue;
+		}
+
+		if (m_cells.size() == 0)
+		{
+			price += CalZonePrice(defaultZone, len, unitPrices, scratch.m_visitedZones);
+			continue;
+		}
+
+		//Most segments of a road route are within one cell.
+		const double aX = (a.m_x - m_gridMin.m_x) / m_cellSize;
+		const double aY = (a.m_y - m_gridMin.m_y) / m_cellSize;
+		const double bX = (b.m_x - m_gridMin.m_x) / m_cellSize;
+		const double bY = (b.m_y - m_gridMin.m_y) / m_cellSize;
+		if (aX >= 0.0 && aX < m_numCols && aY >= 0.0 && aY < m_numRows &&
+			bX >= 0.0 && bX < m_numCols && bY >= 0.0 && bY < m_numRows &&
+			static_cast<size_t>(aX) == static_cast<size_t>(bX) && static_cast<size_t>(aY) == static_cast<size_t>(bY))
+		{
+			const size_t col = static_cast<size_t>(aX);
+			const size_t row = static_cast<size_t>(aY);
+			price += CalPiecePrice(m_cells[row * m_numCols + col], col, row, a, b, len, 0.0, 1.0, unitPrices, scratch);
+			continue;
+		}
+
+		double t0 = 0.0;
+		double t1 = 1.0;
+		if (!ClipSegment(a, b, m_gridMin, gridMax, t0, t1))
+		{
+			price += CalZonePrice(defaultZone, len, unitPrices, scratch.m_visitedZones);
+			continue;
+		}
+
+		if (t1 - t0 < 1.0)
+		{
+			//The parts out of the grid.
+			price += CalZonePrice(defaultZone, len * (1.0 - (t1 - t0)), unitPrices, scratch.m_visitedZones);
+		}
+
+		//Walk through the cells crossed by the segment (Amanatides-Woo).
+		const double startX = (a.m_x + dx * t0 - m_gridMin.m_x) / m_cellSize;
+		const double startY = (a.m_y + dy * t0 - m_gridMin.m_y) / m_cellSize;
+		size_t col = std::min(m_numCols - 1, static_cast<size_t>(std::max(startX, 0.0)));
+		size_t row = std::min(m_numRows - 1, static_cast<size_t>(std::max(startY, 0.0)));
+
+		const double tDeltaX = dx != 0.0 ? m_cellSize / std::abs(dx) : gsk_inf;
+		const double tDeltaY = dy != 0.0 ? m_cellSize / std::abs(dy) : gsk_inf;
+		double tMaxX = dx > 0.0 ? (m_gridMin.m_x + (col + 1) * m_cellSize - a.m_x) / dx :
+			(dx < 0.0 ? (m_gridMin.m_x + col * m_cellSize - a.m_x) / dx : gsk_inf);
+		double tMaxY = dy > 0.0 ? (m_gridMin.m_y + (row + 1) * m_cellSize - a.m_y) / dy :
+			(dy < 0.0 ? (m_gridMin.m_y + row * m_cellSize - a.m_y) / dy : gsk_inf);
+
+		double tIn = t0;
+		bool isLastCell = false;
+		while (!isLastCell)
+		{
+			double tOut = std::min(t1, std::min(tMaxX, tMaxY));
+			size_t nextCol = col;
+			size_t nextRow = row;
+			if (tOut >= t1)
+			{
+				isLastCell = true;
+			}
+			else if (tMaxX < tMaxY)
+			{
+				nextCol = dx > 0.0 ? col + 1 : col - 1;
+				tMaxX += tDeltaX;
+			}
+			else
+			{
+				nextRow = dy > 0.0 ? row + 1 : row - 1;
+				tMaxY += tDeltaY;
+			}
+
+			if (nextCol >= m_numCols || nextRow >= m_numRows)
+			{
+				//Only possible due to rounding errors; the rest of the segment is in this cell.
+				tOut = t1;
+				isLastCell = true;
+			}
+
+			price += CalPiecePrice(m_cells[row * m_numCols + col], col, row, a, b, len, tIn, tOut, unitPrices, scratch);
+
+			tIn = tOut;
+			col = nextCol;
+			row = nextRow;
+		}
+	}
+
+	return price;
+}
+
+double TariffTable::CalPiecePrice(const Cell& cell, const size_t col, const size_t row, const Vertex& a, const Vertex& b,
+	const double len, const double tBegin, const double tEnd, const std::vector<double>& unitPrices, Scratch& scratch) const
+{
+	if (tEnd <= tBegin)
+	{
+		return 0.0;
+	}
+
+	if (cell.m_numZones == 0)
+	{
+		return CalZonePrice(cell.m_zone, len * (tEnd - tBegin), unitPrices, scratch.m_visitedZones);
+	}
+
+	//The piece is split where it crosses the edges, each of which flips whether the rest of the
+	//  piece is in that zone.
+	scratch.m_crossings.clear();
+	for (uint32_t i = 0; i < cell.m_numZones; ++i)
+	{
+		const CellZone& cellZone = m_cellZones[cell.m_firstZone + i];
+		for (uint32_t j = cellZone.m_firstEdge; j < cellZone.m_firstEdge + cellZone.m_numEdges; ++j)
+		{
+			double t = 0.0;
+			if (FindCrossing(a, b, m_cellEdges[j].m_a, m_cellEdges[j].m_b, t) && t > tBegin && t < tEnd)
+			{
+				scratch.m_crossings.push_back(std::make_pair(t, i));
+			}
+		}
+	}
+	std::sort(scratch.m_crossings.begin(), scratch.m_crossings.end());
+
+	//Whether a part is in a zone differs from whether the reference point of the cell is, by the
+	//  parity of the edges crossed on the way from the reference point to it; all of them cross the
+	//  cell. The middle of the longest part is used, since a path often starts or turns right on a
+	//  boundary, and a crossing may be right at the start, only off by rounding errors.
+	size_t probePart = 0;
+	double probeLen = 0.0;
+	for (size_t i = 0; i <= scratch.m_crossings.size(); ++i)
+	{
+		const double partLen = (i < scratch.m_crossings.size() ? scratch.m_crossings[i].first : tEnd) -
+			(i > 0 ? scratch.m_crossings[i - 1].first : tBegin);
+		if (partLen > probeLen)
+		{
+			probePart = i;
+			probeLen = partLen;
+		}
+	}
+	const double tProbe = (probePart > 0 ? scratch.m_crossings[probePart - 1].first : tBegin) + probeLen / 2.0;
+	const Vertex ref{ m_gridMin.m_x + (col + gsk_refPointX) * m_cellSize, m_gridMin.m_y + (row + gsk_refPointY) * m_cellSize };
+	const Vertex probe{ a.m_x + (b.m_x - a.m_x) * tProbe, a.m_y + (b.m_y - a.m_y) * tProbe };
+
+	scratch.m_isIn.clear();
+	for (uint32_t i = 0; i < cell.m_numZones; ++i)
+	{
+		const CellZone& cellZone = m_cellZones[cell.m_firstZone + i];
+
+		bool isIn = cellZone.m_isRefIn;
+		for (uint32_t j = cellZone.m_firstEdge; j < cellZone.m_firstEdge + cellZone.m_numEdges; ++j)
+		{
+			double t = 0.0;
+			if (FindCrossing(ref, probe, m_cellEdges[j].m_a, m_cellEdges[j].m_b, t))
+			{
+				isIn = !isIn;
+			}
+		}
+		scratch.m_isIn.push_back(isIn);
+	}
+	//Back to the first part.
+	for (size_t i = 0; i < probePart; ++i)
+	{
+		scratch.m_isIn[scratch.m_crossings[i].second] ^= 1;
+	}
+
+	double price = 0.0;
+	double tPrev = tBegin;
+	for (size_t i = 0; i <= scratch.m_crossings.size(); ++i)
+	{
+		const double t = i < scratch.m_crossings.size() ? scratch.m_crossings[i].first : tEnd;
+		if (t > tPrev)
+		{
+			//The zone with the highest priority the part is in.
+			uint32_t zone = cell.m_zone;
+			for (uint32_t j = 0; j < cell.m_numZones; ++j)
+			{
+				if (scratch.m_isIn[j])
+				{
+					zone = m_cellZones[cell.m_firstZone + j].m_zone;
+					break;
+				}
+			}
+
+			price += CalZonePrice(zone, len * (t - tPrev), unitPrices, scratch.m_visitedZones);
+			tPrev = t;
+		}
+
+		if (i < scratch.m_crossings.size())
+		{
+			scratch.m_isIn[scratch.m_crossings[i].second] ^= 1;
+		}
+	}
+
+	return price;
+}
+
+double TariffTable::CalZonePrice(const uint32_t zone, const double len, const std::vector<double>& unitPrices, std::vector<uint32_t>& visitedZones) const
+{
+	const double surcharge = zone < m_zones.size() ? m_zones[zone].m_tariff.m_surcharge : m_defaultTariff.m_surcharge;
+
+	double price = len * unitPrices[zone];
+	if (surcharge > 0.0 && std::find(visitedZones.begin(), visitedZones.end(), zone) == visitedZones.end())
+	{
+		visitedZones.push_back(zone);
+		price += surcharge;
+	}
+	return price;
+}
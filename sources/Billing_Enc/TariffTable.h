@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../Common/RideSharingMessages.h"
+
+namespace RideShare
+{
+	class StringView;
+
+	/**
+	 * \brief	The tariffs of the Billing Services: a default tariff, and tariffs of zones (e.g., the
+	 * 			airport, downtown) given as polygons. Zones come in the order of priority, so where
+	 * 			they overlap, the first one applies. Each tariff has a base unit price, which can be
+	 * 			overridden in some time windows of the day (e.g., at night), and a surcharge, which is
+	 * 			charged once for a path that goes through the zone (or, for the default tariff, goes
+	 * 			outside all the zones).
+	 * 			The zones are indexed by a uniform grid; each cell keeps the zone covering the whole
+	 * 			cell, and only the edges of the zones crossing it, so finding the zone at a point
+	 * 			costs O(1), apart from the few cells on the boundaries. A path is walked through the
+	 * 			cells, and its segments are split where they cross the boundaries of the zones.
+	 * 			Once constructed, it's read-only, so paths can be priced concurrently.
+	 */
+	class TariffTable
+	{
+	public:
+		struct Vertex
+		{
+			double m_x;
+			double m_y;
+		};
+
+		struct TimeWindow
+		{
+			//In seconds of the day; the window wraps past midnight if the end is before the begin.
+			uint32_t m_begin;
+			uint32_t m_end;
+			double m_unitPrice;
+		};
+
+		struct Tariff
+		{
+			double m_unitPrice;
+			double m_surcharge;
+			//The first one containing the time of the day overrides the base unit price.
+			std::vector<TimeWindow> m_windows;
+		};
+
+		struct Zone
+		{
+			std::vector<Vertex> m_polygon;
+			Tariff m_tariff;
+		};
+
+		static constexpr uint32_t sk_secondsPerDay = 24 * 60 * 60;
+
+		static constexpr size_t sk_maxNumZones = 1024;
+		static constexpr size_t sk_maxNumVertices = 64 * 1024;
+		static constexpr size_t sk_maxNumWindows = 32;
+
+		/**
+		 * \brief	Parses tariffs in the binary format: a 32-bit magic number ("RSTF"), the default
+		 * 			tariff, the number of zones, and then, for each zone, the number of vertices of
+		 * 			its polygon, (X, Y) of each vertex, and its tariff. A tariff is its base unit price,
+		 * 			its surcharge, the number of time windows, and (begin, end, unit price) of each
+		 * 			window. It uses the conventions of the binary wire format (see BinaryWriter).
+		 *
+		 * \exception	MessageParseException	Thrown when the input is malformed.
+		 */
+		static std::unique_ptr<TariffTable> Parse(const StringView& data);
+
+	public:
+		TariffTable() = delete;
+
+		/**
+		 * \brief	Constructor
+		 *
+		 * \exception	RuntimeException	Thrown when there are too many zones, vertices, or time
+		 * 									windows, or any of them is invalid.
+		 */
+		TariffTable(Tariff&& defaultTariff, std::vector<Zone>&& zones);
+
+		TariffTable(const TariffTable& rhs) = delete;
+		TariffTable(TariffTable&& rhs) = delete;
+
+		~TariffTable();
+
+		size_t GetNumZones() const { return m_zones.size(); }
+
+		/**
+		 * \brief	Gets the unit prices of the zones at the given time of the day, followed by the one
+		 * 			of the default tariff. It only needs to be done once for a batch of paths.
+		 */
+		void GetUnitPrices(const uint32_t timeOfDay, std::vector<double>& unitPrices) const;
+
+		/**
+		 * \brief	Calculates the price of a path.
+		 *
+		 * \param	path	  	The path.
+		 * \param	unitPrices	The unit prices given by GetUnitPrices.
+		 * \param	segLens   	(Optional) The lengths of the segments of the path, e.g., computed for
+		 * 						a whole batch by PathLengthBatch; if null, they are computed here.
+		 */
+		double CalPrice(const std::vector<ComMsg::Point2D<double> >& path, const std::vector<double>& unitPrices,
+			const double* segLens = nullptr) const;
+
+	private:
+		struct Edge
+		{
+			Vertex m_a;
+			Vertex m_b;
+		};
+
+		//A zone whose boundary crosses a cell.
+		struct CellZone
+		{
+			uint32_t m_zone;
+			bool m_isRefIn;
+			//The edges of the zone crossing the cell.
+			uint32_t m_firstEdge;
+			uint32_t m_numEdges;
+		};
+
+		struct Cell
+		{
+			//The zone with the highest priority covering the whole cell, or the default one.
+			uint32_t m_zone;
+			//The zones with higher priorities crossing the cell, in the order of priority.
+			uint32_t m_firstZone;
+			uint32_t m_numZones;
+		};
+
+		//Buffers reused while pricing a path.
+		struct Scratch
+		{
+			//The zones with surcharges that have been charged.
+			std::vector<uint32_t> m_visitedZones;
+			//Pairs of (fraction of the segment, index of the zone in the cell).
+			std::vector<std::pair<double, uint32_t> > m_crossings;
+			std::vector<uint8_t> m_isIn;
+		};
+
+		//Prices the part [tBegin, tEnd] of the segment from a to b (of length len) that is in the cell.
+		double CalPiecePrice(const Cell& cell, const size_t col, const size_t row, const Vertex& a, const Vertex& b,
+			const double len, const double tBegin, const double tEnd, const std::vector<double>& unitPrices, Scratch& scratch) const;
+
+		//Prices a part of a path in the zone, with its surcharge if it's the first part in the zone.
+		double CalZonePrice(const uint32_t zone, const double len, const std::vector<double>& unitPrices, std::vector<uint32_t>& visitedZones) const;
+
+		Tariff m_defaultTariff;
+		std::vector<Zone> m_zones;
+
+		//The grid; empty if there is no zone.
+		Vertex m_gridMin;
+		double m_cellSize;
+		size_t m_numCols;
+		size_t m_numRows;
+		std::vector<Cell> m_cells;
+		std::vector<CellZone> m_cellZones;
+		std::vector<Edge> m_cellEdges;
+	};
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "MessageException.h"
+#include "StringView.h"
+
+namespace RideShare
+{
+	namespace ComMsg
+	{
+		/**
+		 * \brief	Appends values in the compact binary wire format. Integers are fixed-size and
+		 * 			little-endian, unless they're written by WriteVarInt; doubles are written as their
+		 * 			exact IEEE-754 bits, so they round-trip bit-exactly; strings and arrays are prefixed
+		 * 			by a 32-bit length.
+		 */
+		class BinaryWriter
+		{
+		public:
+			BinaryWriter() = delete;
+
+			explicit BinaryWriter(std::string& out) :
+				m_out(out)
+			{}
+
+			BinaryWriter(const BinaryWriter& rhs) = delete;
+			BinaryWriter(BinaryWriter&& rhs) = delete;
+
+			~BinaryWriter() {}
+
+			void Write(const uint8_t val)
+			{
+				m_out.push_back(static_cast<char>(val));
+			}
+
+			void Write(const uint32_t val)
+			{
+				char buf[sizeof(val)];
+				for (size_t i = 0; i < sizeof(val); ++i)
+				{
+					buf[i] = static_cast<char>((val >> (8 * i)) & 0xFF);
+				}
+				m_out.append(buf, sizeof(buf));
+			}
+
+			void Write(const uint64_t val)
+			{
+				char buf[sizeof(val)];
+				for (size_t i = 0; i < sizeof(val); ++i)
+				{
+					buf[i] = static_cast<char>((val >> (8 * i)) & 0xFF);
+				}
+				m_out.append(buf, sizeof(buf));
+			}
+
+			void Write(const int32_t val)
+			{
+				Write(static_cast<uint32_t>(val));
+			}
+
+			void Write(const double val)
+			{
+				static_assert(sizeof(double) == sizeof(uint64_t), "Only 64-bit double is supported.");
+				uint64_t bits;
+				std::memcpy(&bits, &val, sizeof(bits));
+				Write(bits);
+			}
+
+			//Fixed-size, so it's written as is, without a length.
+			void Write(const Decent::General256Hash& val)
+			{
+				m_out.append(reinterpret_cast<const char*>(val.data()), val.size());
+			}
+
+			void Write(const std::string& val)
+			{
+				WriteSize(val.size());
+				m_out.append(val);
+			}
+
+			void WriteSize(const size_t size)
+			{
+				if (size > UINT32_MAX)
+				{
+					throw MessageException("The message is too large for the binary format.");
+				}
+				Write(static_cast<uint32_t>(size));
+			}
+
+			/**
+			 * \brief	Writes an integer in a variable length, 7 bits per byte, lowest bits first; the
+			 * 			high bit of a byte is set if more bytes follow. It's zigzag-encoded, so integers
+			 * 			close to zero (e.g., deltas) take few bytes, whatever their signs.
+			 */
+			void WriteVarInt(const int64_t val)
+			{
+				uint64_t zigzag = (static_cast<uint64_t>(val) << 1) ^ (val < 0 ? UINT64_MAX : 0);
+				while (zigzag >= 0x80)
+				{
+					m_out.push_back(static_cast<char>((zigzag & 0x7F) | 0x80));
+					zigzag >>= 7;
+				}
+				m_out.push_back(static_cast<char>(zigzag));
+			}
+
+		private:
+			std::string& m_out;
+		};
+
+		/**
+		 * \brief	Reads values written by BinaryWriter. Any read past the end of the input throws
+		 * 			MessageParseException. The input is not copied, so it must outlive the reader, as
+		 * 			well as any StringView read from it.
+		 */
+		class BinaryReader
+		{
+		public:
+			BinaryReader() = delete;
+
+			BinaryReader(const std::string& in, const size_t pos) :
+				m_in(in.data()),
+				m_size(in.size()),
+				m_pos(pos <= in.size() ? pos : in.size())
+			{}
+
+			explicit BinaryReader(const StringView& in) :
+				m_in(in.GetData()),
+				m_size(in.GetSize()),
+				m_pos(0)
+			{}
+
+			BinaryReader(const BinaryReader& rhs) = delete;
+			BinaryReader(BinaryReader&& rhs) = delete;
+
+			~BinaryReader() {}
+
+			template<typename T>
+			T Read();
+
+			/**
+			 * \brief	Reads the size of an array or a string.
+			 *
+			 * \param	minItemSize	The minimum encoded size of each item, used to reject sizes
+			 * 						that can't possibly fit in the remaining input, before anything
+			 * 						is allocated for them.
+			 */
+			size_t ReadSize(const size_t minItemSize);
+
+			/**
+			 * \brief	Reads an integer written by BinaryWriter::WriteVarInt.
+			 */
+			int64_t ReadVarInt();
+
+			bool IsEnd() const { return m_pos == m_size; }
+
+			size_t GetRemainingSize() const { return m_size - m_pos; }
+
+		private:
+			const char* Take(const size_t size)
+			{
+				if (size > GetRemainingSize())
+				{
+					throw MessageParseException();
+				}
+				const char* res = m_in + m_pos;
+				m_pos += size;
+				return res;
+			}
+
+			template<typename T>
+			T ReadUnsigned()
+			{
+				const char* buf = Take(sizeof(T));
+				T res = 0;
+				for (size_t i = 0; i < sizeof(T); ++i)
+				{
+					res |= static_cast<T>(static_cast<uint8_t>(buf[i])) << (8 * i);
+				}
+				return res;
+			}
+
+			const char* m_in;
+			size_t m_size;
+			size_t m_pos;
+		};
+
+		template<>
+		inline uint8_t BinaryReader::Read<uint8_t>()
+		{
+			return ReadUnsigned<uint8_t>();
+		}
+
+		template<>
+		inline uint32_t BinaryReader::Read<uint32_t>()
+		{
+			return ReadUnsigned<uint32_t>();
+		}
+
+		template<>
+		inline uint64_t BinaryReader::Read<uint64_t>()
+		{
+			return ReadUnsigned<uint64_t>();
+		}
+
+		template<>
+		inline int32_t BinaryReader::Read<int32_t>()
+		{
+			return static_cast<int32_t>(ReadUnsigned<uint32_t>());
+		}
+
+		template<>
+		inline double BinaryReader::Read<double>()
+		{
+			const uint64_t bits = ReadUnsigned<uint64_t>();
+			double res;
+			std::memcpy(&res, &bits, sizeof(res));
+			return res;
+		}
+
+		inline size_t BinaryReader::ReadSize(const size_t minItemSize)
+		{
+			const size_t size = Read<uint32_t>();
+			if (minItemSize > 0 && size > GetRemainingSize() / minItemSize)
+			{
+				throw MessageParseException();
+			}
+			return size;
+		}
+
+		inline int64_t BinaryReader::ReadVarInt()
+		{
+			uint64_t zigzag = 0;
+			for (size_t shift = 0; ; shift += 7)
+			{
+				const uint8_t byte = static_cast<uint8_t>(*Take(1));
+				//At most 10 bytes, and the 10th one only has the highest bit.
+				if (shift == 63 && byte > 1)
+				{
+					throw MessageParseException();
+				}
+				zigzag |= static_cast<uint64_t>(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0)
+				{
+					break;
+				}
+			}
+			return static_cast<int64_t>((zigzag >> 1) ^ (0 - (zigzag & 1)));
+		}
+
+		template<>
+		inline StringView BinaryReader::Read<StringView>()
+		{
+			const size_t size = ReadSize(1);
+			const char* buf = Take(size);
+			return StringView(buf, size);
+		}
+
+		template<>
+		inline Decent::General256Hash BinaryReader::Read<Decent::General256Hash>()
+		{
+			Decent::General256Hash res;
+			const char* buf = Take(res.size());
+			std::memcpy(res.data(), buf, res.size());
+			return res;
+		}
+
+		template<>
+		inline std::string BinaryReader::Read<std::string>()
+		{
+			return Read<StringView>().ToString();
+		}
+	}
+}
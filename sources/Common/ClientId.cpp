@@ -0,0 +1,81 @@
+#include "ClientId.h"
+
+#include <algorithm>
+
+#include <mbedtls/pk.h>
+#include <cppcodec/base64_default_rfc4648.hpp>
+
+#include "StringView.h"
+#include "MessageException.h"
+#include "RuntimeException.h"
+
+using namespace RideShare;
+
+namespace
+{
+	//Large enough for the SubjectPublicKeyInfo of an RSA-4096 key; EC keys take about 100 bytes.
+	constexpr size_t gsk_maxPubKeyDerSize = 1024;
+}
+
+ClientId ClientId::FromPubKeyPem(const std::string& pem)
+{
+	mbedtls_pk_context pk;
+	mbedtls_pk_init(&pk);
+
+	unsigned char der[gsk_maxPubKeyDerSize];
+	//Length of the PEM must include the null terminator.
+	int derSize = mbedtls_pk_parse_public_key(&pk, reinterpret_cast<const unsigned char*>(pem.c_str()), pem.size() + 1);
+	if (derSize == 0)
+	{
+		//The DER is written at the end of the buffer.
+		derSize = mbedtls_pk_write_pubkey_der(&pk, der, sizeof(der));
+	}
+	else
+	{
+		derSize = -1;
+	}
+	mbedtls_pk_free(&pk);
+
+	if (derSize <= 0)
+	{
+		throw RuntimeException("Failed to parse the public key of the client.");
+	}
+
+	ClientId res;
+	CalcSha256(res.m_hash, StringView(reinterpret_cast<const char*>(der + sizeof(der) - derSize), static_cast<size_t>(derSize)));
+	return res;
+}
+
+ClientId ClientId::FromPubKeyDer(const std::vector<uint8_t>& der)
+{
+	ClientId res;
+	CalcSha256(res.m_hash, StringView(reinterpret_cast<const char*>(der.data()), der.size()));
+	return res;
+}
+
+ClientId ClientId::Parse(const std::string& str)
+{
+	std::vector<uint8_t> bin;
+	try
+	{
+		bin = cppcodec::base64_rfc4648::decode(str.data(), str.size());
+	}
+	catch (const std::exception&)
+	{
+		throw MessageParseException();
+	}
+
+	ClientId res;
+	if (bin.size() != res.m_hash.size())
+	{
+		throw MessageParseException();
+	}
+
+	std::copy(bin.begin(), bin.end(), res.m_hash.begin());
+	return res;
+}
+
+std::string ClientId::ToString() const
+{
+	return cppcodec::base64_rfc4648::encode(m_hash);
+}
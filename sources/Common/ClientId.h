@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <DecentApi/Common/GeneralKeyTypes.h>
+
+namespace RideShare
+{
+	/**
+	 * \brief	The identity of a passenger or a driver, i.e., the SHA-256 fingerprint of the DER-encoded
+	 * 			SubjectPublicKeyInfo of the client's key. It's a fixed-size value, so copies and
+	 * 			comparisons have a fixed cost, no matter how the key is encoded. On the wire, it's
+	 * 			encoded in base64 in JSON, and as the raw 32 bytes in the binary format.
+	 */
+	class ClientId
+	{
+	public:
+		typedef Decent::General256Hash HashType;
+
+		/**
+		 * \brief	Calculates the identity from the public key in PEM. Throws RuntimeException if the
+		 * 			key can't be parsed.
+		 */
+		static ClientId FromPubKeyPem(const std::string& pem);
+
+		static ClientId FromPubKeyDer(const std::vector<uint8_t>& der);
+
+		/**
+		 * \brief	Decodes the identity from its base64 form. Throws MessageParseException if the
+		 * 			string isn't a valid identity.
+		 */
+		static ClientId Parse(const std::string& str);
+
+	public:
+		ClientId() :
+			m_hash()
+		{
+			m_hash.fill(0);
+		}
+
+		explicit ClientId(const HashType& hash) :
+			m_hash(hash)
+		{}
+
+		~ClientId() {}
+
+		std::string ToString() const;
+
+		const HashType& Get() const { return m_hash; }
+
+		bool operator==(const ClientId& rhs) const { return m_hash == rhs.m_hash; }
+		bool operator!=(const ClientId& rhs) const { return m_hash != rhs.m_hash; }
+		bool operator<(const ClientId& rhs) const { return m_hash < rhs.m_hash; }
+
+	private:
+		HashType m_hash;
+	};
+}
@@ -23,44 +23,71 @@ namespace RideShare
 		{
 			typedef uint8_t NumType;
 			constexpr NumType k_getQuote     = 0;
+
+			constexpr NumType k_endSession   = 0xFF;
 		}
 
 		namespace PassengerMgm
 		{
 			typedef uint8_t NumType;
-			constexpr NumType k_userReg     = 0;
-			constexpr NumType k_logQuery    = 1;
-			constexpr NumType k_getPayInfo  = 2;
+			constexpr NumType k_userReg         = 0;
+			constexpr NumType k_logQuery        = 1;
+			constexpr NumType k_getPayInfo      = 2;
+			constexpr NumType k_getPayInfoBatch = 3;
+			constexpr NumType k_getDemand       = 4;
+			constexpr NumType k_userUpdate      = 5;
+
+			constexpr NumType k_endSession      = 0xFF;
 		}
 
 		namespace DriverMgm
 		{
 			typedef uint8_t NumType;
-			constexpr NumType k_userReg     = 0;
-			constexpr NumType k_logQuery    = 1;
-			constexpr NumType k_getPayInfo  = 2;
+			constexpr NumType k_userReg         = 0;
+			constexpr NumType k_logQuery        = 1;
+			constexpr NumType k_getPayInfo      = 2;
+			constexpr NumType k_getPayInfoBatch = 3;
+			constexpr NumType k_getSupply       = 4;
+			constexpr NumType k_userUpdate      = 5;
+			constexpr NumType k_logQueryBatch   = 6;
+
+			constexpr NumType k_endSession      = 0xFF;
 		}
 
 		namespace Billing
 		{
 			typedef uint8_t NumType;
-			constexpr NumType k_calPrice = 0;
+			constexpr NumType k_calPrice        = 0;
+			constexpr NumType k_calPriceBatch   = 1;
+			constexpr NumType k_getPricingEpoch = 2;
+
+			constexpr NumType k_endSession      = 0xFF;
 		}
 
 		namespace TripMatcher
 		{
 			typedef uint8_t NumType;
-			constexpr NumType k_confirmQuote = 0;
-			constexpr NumType k_findMatch    = 1;
-			constexpr NumType k_confirmMatch = 2;
-			constexpr NumType k_tripStart    = 3;
-			constexpr NumType k_tripEnd      = 4;
+			constexpr NumType k_confirmQuote   = 0;
+			constexpr NumType k_findMatch      = 1;
+			constexpr NumType k_confirmMatch   = 2;
+			constexpr NumType k_tripStart      = 3;
+			constexpr NumType k_tripEnd        = 4;
+			constexpr NumType k_findMatchBatch = 5;
+			constexpr NumType k_subscribe      = 6;
+			constexpr NumType k_waitAssign     = 7;
+			constexpr NumType k_tripTrace      = 8;
+
+			constexpr NumType k_endSession     = 0xFF;
 		}
 
 		namespace Payment
 		{
 			typedef uint8_t NumType;
-			constexpr NumType k_procPayment = 0;
+			constexpr NumType k_procPayment       = 0;
+			constexpr NumType k_procPaymentBatch  = 1;
+			constexpr NumType k_invalidatePayInfo = 2;
+
+			constexpr NumType k_endSession        = 0xFF;
 		}
 	}
 }
@@ -26,6 +26,7 @@
 #include <DecentApi/Common/Ra/CertContainer.h>
 
 #include "MessageException.h"
+#include "VerifiedCertCache.h"
 
 using namespace RideShare;
 using namespace RideShare::ComMsg;
@@ -34,6 +35,14 @@ using namespace Decent::Ra;
 
 namespace
 {
+	//Quotes are signed by only a few Trip Planner instances, so this doesn't need to be large.
+	constexpr size_t gsk_signedQuoteCertCacheSize = 32;
+
+	VerifiedCertCache gs_signedQuoteCertCache(gsk_signedQuoteCertCacheSize);
+
+	//Only changed by the clients at start up, for debugging.
+	WireFormat gs_defaultWireFormat = WireFormat::Binary;
+
 	template<typename T>
 	std::vector<T> ParseArray(const JsonValue & json)
 	{
@@ -54,6 +63,64 @@ namespace
 	{
 		return ParseArray<T>(Decent::Net::CommonJsonMsg::GetMember(json, key));
 	}
+
+	template<typename T>
+	std::vector<T> ParseArray(BinaryReader& reader, const size_t minItemSize)
+	{
+		const size_t size = reader.ReadSize(minItemSize);
+		std::vector<T> res;
+		res.reserve(size);
+		for (size_t i = 0; i < size; ++i)
+		{
+			res.push_back(T(reader));
+		}
+		return res;
+	}
+}
+
+WireFormat ComMsg::GetDefaultWireFormat()
+{
+	return gs_defaultWireFormat;
+}
+
+void ComMsg::SetDefaultWireFormat(const WireFormat format)
+{
+	gs_defaultWireFormat = format;
+}
+
+WireFormat ComMsg::DetectWireFormat(const StringView& msgStr)
+{
+	return (msgStr.GetSize() > 0 && msgStr.GetData()[0] == WireMsg::sk_binaryMagic) ? WireFormat::Binary : WireFormat::Json;
+}
+
+void ComMsg::ParseJsonMsg(const std::string& msgStr, const std::function<void(const JsonValue&)>& callback)
+{
+	JsonDoc json;
+	if (!Tools::ParseStr2Json(json, msgStr))
+	{
+		throw MessageParseException();
+	}
+	callback(json);
+}
+
+constexpr char WireMsg::sk_binaryMagic;
+
+std::string WireMsg::ToString() const
+{
+	return ToString(GetDefaultWireFormat());
+}
+
+std::string WireMsg::ToString(const WireFormat format) const
+{
+	if (format == WireFormat::Json)
+	{
+		return CommonJsonMsg::ToString();
+	}
+
+	std::string res(1, sk_binaryMagic);
+	BinaryWriter writer(res);
+	ToBinary(writer);
+	return res;
 }
 
 template<>
@@ -85,6 +152,12 @@ JsonValue & GetQuote::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void GetQuote::ToBinary(BinaryWriter& writer) const
+{
+	m_ori.ToBinary(writer);
+	m_dest.ToBinary(writer);
+}
+
 constexpr char const Path::sk_labelPath[];
 
 std::vector<Point2D<double> > Path::ParsePath(const JsonValue & json)
@@ -92,6 +165,11 @@ std::vector<Point2D<double> > Path::ParsePath(const JsonValue & json)
 	return ParseArrayObj<Point2D<double> >(json, Path::sk_labelPath);
 }
 
+std::vector<Point2D<double> > Path::ParsePath(BinaryReader& reader)
+{
+	return ParseArray<Point2D<double> >(reader, 2 * sizeof(double));
+}
+
 JsonValue& Path::ToJson(JsonDoc& doc) const
 {
 	std::vector<JsonValue> pathArr;
@@ -109,6 +187,15 @@ JsonValue& Path::ToJson(JsonDoc& doc) const
 	return doc;
 }
 
+void Path::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_path.size());
+	for (const Point2D<double>& point : m_path)
+	{
+		point.ToBinary(writer);
+	}
+}
+
 constexpr char const Price::sk_labelPrice[];
 constexpr char const Price::sk_labelOpPayment[];
 
@@ -119,6 +206,111 @@ JsonValue& Price::ToJson(JsonDoc& doc) const
 	return doc;
 }
 
+void Price::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_price);
+	writer.Write(m_opPayment);
+}
+
+constexpr char const PathBatch::sk_labelPaths[];
+
+std::vector<Path> PathBatch::ParsePaths(const JsonValue & json)
+{
+	return ParseArrayObj<Path>(json, sk_labelPaths);
+}
+
+std::vector<Path> PathBatch::ParsePaths(BinaryReader& reader)
+{
+	//The number of points, at least.
+	return ParseArray<Path>(reader, sizeof(uint32_t));
+}
+
+JsonValue & PathBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> pathArr;
+	pathArr.reserve(m_paths.size());
+
+	for (const Path& path : m_paths)
+	{
+		pathArr.push_back(std::move(path.ToJson(doc)));
+	}
+
+	JsonValue paths = std::move(Tools::JsonConstructArray(doc, pathArr));
+
+	Tools::JsonSetVal(doc, sk_labelPaths, paths);
+
+	return doc;
+}
+
+void PathBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_paths.size());
+	for (const Path& path : m_paths)
+	{
+		path.ToBinary(writer);
+	}
+}
+
+constexpr char const PriceBatch::sk_labelPrices[];
+constexpr char const PriceBatch::sk_labelOpPayment[];
+
+std::vector<double> PriceBatch::ParsePrices(const JsonValue & json)
+{
+	const JsonValue& prices = GetMember(json, sk_labelPrices);
+	if (!prices.JSON_IS_ARRAY())
+	{
+		throw MessageParseException();
+	}
+
+	std::vector<double> res;
+	for (auto it = prices.JSON_ARR_BEGIN(); it != prices.JSON_ARR_END(); ++it)
+	{
+		res.push_back(ParseValue<double>(JSON_ARR_GETVALUE(it), Price::sk_labelPrice));
+	}
+	return res;
+}
+
+std::vector<double> PriceBatch::ParsePrices(BinaryReader& reader)
+{
+	const size_t size = reader.ReadSize(sizeof(double));
+	std::vector<double> res;
+	res.reserve(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		res.push_back(reader.Read<double>());
+	}
+	return res;
+}
+
+JsonValue & PriceBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> priceArr;
+	priceArr.reserve(m_prices.size());
+	for (const double price : m_prices)
+	{
+		Tools::JsonSetVal(doc, Price::sk_labelPrice, price);
+		JsonValue& priceObj = doc;
+		priceArr.push_back(std::move(priceObj));
+	}
+
+	JsonValue prices = std::move(Tools::JsonConstructArray(doc, priceArr));
+
+	Tools::JsonSetVal(doc, sk_labelPrices, prices);
+	Tools::JsonSetVal(doc, sk_labelOpPayment, m_opPayment);
+
+	return doc;
+}
+
+void PriceBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_prices.size());
+	for (const double price : m_prices)
+	{
+		writer.Write(price);
+	}
+	writer.Write(m_opPayment);
+}
+
 constexpr char const Quote::sk_labelGetQuote[];
 constexpr char const Quote::sk_labelPath[];
 constexpr char const Quote::sk_labelPrice[];
@@ -135,16 +327,25 @@ JsonValue& Quote::ToJson(JsonDoc& doc) const
 	Tools::JsonSetVal(doc, sk_labelPath, path);
 	Tools::JsonSetVal(doc, sk_labelPrice, price);
 	Tools::JsonSetVal(doc, sk_labelOpPayment, m_opPayment);
-	Tools::JsonSetVal(doc, sk_labelPasId, m_pasId);
+	Tools::JsonSetVal(doc, sk_labelPasId, m_pasId.ToString());
 
 	return doc;
 }
 
+void Quote::ToBinary(BinaryWriter& writer) const
+{
+	m_getQuote.ToBinary(writer);
+	m_path.ToBinary(writer);
+	m_price.ToBinary(writer);
+	writer.Write(m_opPayment);
+	writer.Write(m_pasId.Get());
+}
+
 constexpr char const SignedQuote::sk_labelQuote[];
 constexpr char const SignedQuote::sk_labelSignature[];
 constexpr char const SignedQuote::sk_labelCert[];
 
-SignedQuote SignedQuote::SignQuote(const Quote& quote, Decent::Ra::States& state)
+SignedQuote SignedQuote::SignQuote(const Quote& quote, Decent::Ra::States& state, const WireFormat format)
 {
 	using namespace Decent::MbedTlsObj;
 
@@ -153,7 +354,7 @@ SignedQuote SignedQuote::SignQuote(const Quote& quote, Decent::Ra::States& state
 	const std::shared_ptr<const Decent::MbedTlsObj::X509Cert> certPtr = state.GetCertContainer().GetCert();
 	const Decent::MbedTlsObj::X509Cert& cert = *certPtr;
 
-	std::string quoteStr = quote.ToString();
+	std::string quoteStr = quote.ToString(format);
 	Decent::MbedTlsObj::Drbg drbg;
 	General256Hash hash;
 	general_secp256r1_signature_t sign;
@@ -181,26 +382,62 @@ SignedQuote SignedQuote::ParseSignedQuote(const JsonValue& json, Decent::Ra::Sta
 	std::string signStr = ParseValue<std::string>(json[SignedQuote::sk_labelSignature]);
 	std::string certPem = ParseValue<std::string>(json[SignedQuote::sk_labelCert]);
 
-	AppX509Cert cert(certPem);
-	TlsConfigWithName tlsCfg(state, Decent::MbedTlsObj::TlsConfig::Mode::ServerVerifyPeer, appName, nullptr);
+	return VerifySignedQuote(std::move(quoteStr), std::move(signStr), std::move(certPem), state, appName);
+}
+
+SignedQuote SignedQuote::ParseSignedQuote(BinaryReader& reader, Decent::Ra::States& state, const std::string& appName)
+{
+	std::string quoteStr = reader.Read<std::string>();
+	std::string signStr = reader.Read<std::string>();
+	std::string certPem = reader.Read<std::string>();
+
+	return VerifySignedQuote(std::move(quoteStr), std::move(signStr), std::move(certPem), state, appName);
+}
+
+SignedQuote SignedQuote::ParseSignedQuote(const std::string& msgStr, Decent::Ra::States& state, const std::string& appName)
+{
+	if (DetectWireFormat(msgStr) == WireFormat::Binary)
+	{
+		BinaryReader reader(msgStr, sizeof(WireMsg::sk_binaryMagic));
+		SignedQuote res = ParseSignedQuote(reader, state, appName);
+		if (!reader.IsEnd())
+		{
+			throw MessageParseException();
+		}
+		return res;
+	}
 
-	uint32_t flag;
-	if (mbedtls_x509_crt_verify_with_profile(cert.Get(), nullptr, nullptr,
-		&mbedtls_x509_crt_profile_suiteb, nullptr, &flag, &TlsConfigWithName::CertVerifyCallBack, &tlsCfg) != MBEDTLS_SUCCESS_RET ||
-		flag != MBEDTLS_SUCCESS_RET)
+	std::unique_ptr<SignedQuote> res;
+	ParseJsonMsg(msgStr, [&res, &state, &appName](const JsonValue& json)
+	{
+		res = Tools::make_unique<SignedQuote>(ParseSignedQuote(json, state, appName));
+	});
+	return std::move(*res);
+}
+
+SignedQuote SignedQuote::VerifySignedQuote(std::string&& quote, std::string&& sign, std::string&& cert, Decent::Ra::States& state, const std::string& appName)
+{
+	Verify(quote, sign, cert, state, appName);
+
+	return SignedQuote(std::move(quote), std::move(sign), std::move(cert));
+}
+
+void SignedQuote::Verify(const StringView& quote, const StringView& sign, const StringView& cert, Decent::Ra::States& state, const std::string& appName)
+{
+	using namespace Decent::MbedTlsObj;
+
+	std::shared_ptr<const EcPublicKey<EcKeyType::SECP256R1> > ecKey = gs_signedQuoteCertCache.Verify(cert, state, appName);
+	if (!ecKey)
 	{
 		throw MessageParseException();
 	}
 
-	general_secp256r1_signature_t sign;
-	Tools::DeserializeStruct(sign, signStr);
+	general_secp256r1_signature_t signature;
+	Tools::DeserializeStruct(signature, sign.ToString());
 	General256Hash hash;
 
-	Hasher<HashType::SHA256>().Calc(hash, quoteStr);
-	const EcPublicKey<EcKeyType::SECP256R1> ecKey(cert.GetCurrPublicKey());
-	ecKey.VerifySign(hash, sign.x, sign.y);
-
-	return SignedQuote(std::move(quoteStr), std::move(signStr), std::move(certPem));
+	CalcSha256(hash, quote);
+	ecKey->VerifySign(hash, signature.x, signature.y);
 }
 
 JsonValue& SignedQuote::ToJson(JsonDoc& doc) const
@@ -212,6 +449,13 @@ JsonValue& SignedQuote::ToJson(JsonDoc& doc) const
 	return doc;
 }
 
+void SignedQuote::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_quote);
+	writer.Write(m_sign);
+	writer.Write(m_cert);
+}
+
 constexpr char const PasContact::sk_labelName[];
 constexpr char const PasContact::sk_labelPhone[];
 
@@ -223,6 +467,12 @@ JsonValue & PasContact::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void PasContact::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_name);
+	writer.Write(m_phone);
+}
+
 Decent::General256Hash PasContact::CalcHash() const
 {
 	using namespace Decent::MbedTlsObj;
@@ -246,6 +496,13 @@ JsonValue & DriContact::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void DriContact::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_name);
+	writer.Write(m_phone);
+	writer.Write(m_licPlate);
+}
+
 Decent::General256Hash DriContact::CalcHash() const
 {
 	using namespace Decent::MbedTlsObj;
@@ -269,6 +526,12 @@ JsonValue & ConfirmQuote::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void ConfirmQuote::ToBinary(BinaryWriter& writer) const
+{
+	m_contact.ToBinary(writer);
+	writer.Write(m_signQuote);
+}
+
 constexpr char const DriSelection::sk_labelDriContact[];
 constexpr char const DriSelection::sk_labelTripId[];
 
@@ -282,6 +545,12 @@ JsonValue & DriSelection::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void DriSelection::ToBinary(BinaryWriter& writer) const
+{
+	m_contact.ToBinary(writer);
+	writer.Write(m_tripId);
+}
+
 constexpr char const PasMatchedResult::sk_labelTripId[];
 constexpr char const PasMatchedResult::sk_labelDriContact[];
 
@@ -295,6 +564,12 @@ JsonValue & PasMatchedResult::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void PasMatchedResult::ToBinary(BinaryWriter& writer) const
+{
+	m_driContact.ToBinary(writer);
+	writer.Write(m_tripId);
+}
+
 constexpr char const PasQueryLog::sk_labelUserId[];
 constexpr char const PasQueryLog::sk_labelGetQuote[];
 
@@ -302,23 +577,89 @@ JsonValue & PasQueryLog::ToJson(JsonDoc & doc) const
 {
 	JsonValue getQuote = std::move(m_getQuote.ToJson(doc));
 
-	Tools::JsonSetVal(doc, PasQueryLog::sk_labelUserId, m_userId);
+	Tools::JsonSetVal(doc, PasQueryLog::sk_labelUserId, m_userId.ToString());
 	Tools::JsonSetVal(doc, PasQueryLog::sk_labelGetQuote, getQuote);
 
 	return doc;
 }
 
+void PasQueryLog::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_userId.Get());
+	m_getQuote.ToBinary(writer);
+}
+
 constexpr char const DriverLoc::sk_labelOrigin[];
+constexpr char const DriverLoc::sk_labelRadius[];
+constexpr char const DriverLoc::sk_labelMaxNum[];
+
+double DriverLoc::ParseRadius(const JsonValue & json)
+{
+	return json.JSON_HAS_MEMBER(DriverLoc::sk_labelRadius) ? ParseValue<double>(json, DriverLoc::sk_labelRadius) : 0.0;
+}
+
+int DriverLoc::ParseMaxNum(const JsonValue & json)
+{
+	return json.JSON_HAS_MEMBER(DriverLoc::sk_labelMaxNum) ? ParseValue<int>(json, DriverLoc::sk_labelMaxNum) : 0;
+}
 
 JsonValue & DriverLoc::ToJson(JsonDoc & doc) const
 {
 	JsonValue loc = std::move(m_loc.ToJson(doc));
 
 	Tools::JsonSetVal(doc, DriverLoc::sk_labelOrigin, loc);
+	Tools::JsonSetVal(doc, DriverLoc::sk_labelRadius, m_radius);
+	Tools::JsonSetVal(doc, DriverLoc::sk_labelMaxNum, m_maxNum);
+
+	return doc;
+}
+
+void DriverLoc::ToBinary(BinaryWriter& writer) const
+{
+	m_loc.ToBinary(writer);
+	writer.Write(m_radius);
+	writer.Write(static_cast<int32_t>(m_maxNum));
+}
+
+constexpr char const DriAvailable::sk_labelDriContact[];
+constexpr char const DriAvailable::sk_labelLoc[];
+
+JsonValue & DriAvailable::ToJson(JsonDoc & doc) const
+{
+	JsonValue contact = std::move(m_contact.ToJson(doc));
+	JsonValue loc = std::move(m_loc.ToJson(doc));
+
+	Tools::JsonSetVal(doc, sk_labelDriContact, contact);
+	Tools::JsonSetVal(doc, sk_labelLoc, loc);
 
 	return doc;
 }
 
+void DriAvailable::ToBinary(BinaryWriter& writer) const
+{
+	m_contact.ToBinary(writer);
+	m_loc.ToBinary(writer);
+}
+
+constexpr char const DriAssignment::sk_labelTripId[];
+constexpr char const DriAssignment::sk_labelPasContact[];
+
+JsonValue & DriAssignment::ToJson(JsonDoc & doc) const
+{
+	JsonValue pasContact = std::move(m_pasContact.ToJson(doc));
+
+	Tools::JsonSetVal(doc, sk_labelTripId, m_tripId);
+	Tools::JsonSetVal(doc, sk_labelPasContact, pasContact);
+
+	return doc;
+}
+
+void DriAssignment::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_tripId);
+	m_pasContact.ToBinary(writer);
+}
+
 constexpr char const MatchItem::sk_labelTripId[];
 constexpr char const MatchItem::sk_labelPath[];
 
@@ -332,6 +673,12 @@ JsonValue & MatchItem::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void MatchItem::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_tripId);
+	m_path.ToBinary(writer);
+}
+
 constexpr char const BestMatches::sk_labelMatches[];
 
 std::vector<MatchItem> BestMatches::ParseMatches(const JsonValue & json)
@@ -339,6 +686,12 @@ std::vector<MatchItem> BestMatches::ParseMatches(const JsonValue & json)
 	return ParseArrayObj<MatchItem>(json, sk_labelMatches);
 }
 
+std::vector<MatchItem> BestMatches::ParseMatches(BinaryReader& reader)
+{
+	//Trip ID size + path size.
+	return ParseArray<MatchItem>(reader, 2 * sizeof(uint32_t));
+}
+
 JsonValue & BestMatches::ToJson(JsonDoc & doc) const
 {
 	std::vector<JsonValue> itemArr;
@@ -356,6 +709,177 @@ JsonValue & BestMatches::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void BestMatches::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_matches.size());
+	for (const MatchItem& item : m_matches)
+	{
+		item.ToBinary(writer);
+	}
+}
+
+constexpr char const MatchUpdate::sk_labelAdded[];
+constexpr char const MatchUpdate::sk_labelRemoved[];
+
+std::vector<MatchItem> MatchUpdate::ParseAdded(const JsonValue & json)
+{
+	return ParseArrayObj<MatchItem>(json, sk_labelAdded);
+}
+
+std::vector<MatchItem> MatchUpdate::ParseAdded(BinaryReader& reader)
+{
+	//Trip ID size + path size.
+	return ParseArray<MatchItem>(reader, 2 * sizeof(uint32_t));
+}
+
+std::vector<std::string> MatchUpdate::ParseRemoved(const JsonValue & json)
+{
+	const JsonValue& removed = GetMember(json, sk_labelRemoved);
+	if (!removed.JSON_IS_ARRAY())
+	{
+		throw MessageParseException();
+	}
+
+	std::vector<std::string> res;
+	for (auto it = removed.JSON_ARR_BEGIN(); it != removed.JSON_ARR_END(); ++it)
+	{
+		res.push_back(ParseValue<std::string>(JSON_ARR_GETVALUE(it), MatchItem::sk_labelTripId));
+	}
+	return res;
+}
+
+std::vector<std::string> MatchUpdate::ParseRemoved(BinaryReader& reader)
+{
+	const size_t size = reader.ReadSize(sizeof(uint32_t));
+	std::vector<std::string> res;
+	res.reserve(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		res.push_back(reader.Read<std::string>());
+	}
+	return res;
+}
+
+JsonValue & MatchUpdate::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> addedArr;
+	addedArr.reserve(m_added.size());
+	for (const MatchItem& item : m_added)
+	{
+		addedArr.push_back(std::move(item.ToJson(doc)));
+	}
+
+	std::vector<JsonValue> removedArr;
+	removedArr.reserve(m_removed.size());
+	for (const std::string& tripId : m_removed)
+	{
+		Tools::JsonSetVal(doc, MatchItem::sk_labelTripId, tripId);
+		JsonValue& idObj = doc;
+		removedArr.push_back(std::move(idObj));
+	}
+
+	JsonValue added = std::move(Tools::JsonConstructArray(doc, addedArr));
+	JsonValue removed = std::move(Tools::JsonConstructArray(doc, removedArr));
+
+	Tools::JsonSetVal(doc, sk_labelAdded, added);
+	Tools::JsonSetVal(doc, sk_labelRemoved, removed);
+
+	return doc;
+}
+
+void MatchUpdate::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_added.size());
+	for (const MatchItem& item : m_added)
+	{
+		item.ToBinary(writer);
+	}
+
+	writer.WriteSize(m_removed.size());
+	for (const std::string& tripId : m_removed)
+	{
+		writer.Write(tripId);
+	}
+}
+
+constexpr char const DriverLocBatch::sk_labelLocs[];
+
+std::vector<DriverLoc> DriverLocBatch::ParseLocs(const JsonValue & json)
+{
+	return ParseArrayObj<DriverLoc>(json, sk_labelLocs);
+}
+
+std::vector<DriverLoc> DriverLocBatch::ParseLocs(BinaryReader& reader)
+{
+	//Location + radius + max number.
+	return ParseArray<DriverLoc>(reader, 3 * sizeof(double) + sizeof(int32_t));
+}
+
+JsonValue & DriverLocBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> locArr;
+	locArr.reserve(m_locs.size());
+
+	for (const DriverLoc& loc : m_locs)
+	{
+		locArr.push_back(std::move(loc.ToJson(doc)));
+	}
+
+	JsonValue locs = std::move(Tools::JsonConstructArray(doc, locArr));
+
+	Tools::JsonSetVal(doc, sk_labelLocs, locs);
+
+	return doc;
+}
+
+void DriverLocBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_locs.size());
+	for (const DriverLoc& loc : m_locs)
+	{
+		loc.ToBinary(writer);
+	}
+}
+
+constexpr char const BestMatchesBatch::sk_labelMatches[];
+
+std::vector<BestMatches> BestMatchesBatch::ParseMatches(const JsonValue & json)
+{
+	return ParseArrayObj<BestMatches>(json, sk_labelMatches);
+}
+
+std::vector<BestMatches> BestMatchesBatch::ParseMatches(BinaryReader& reader)
+{
+	//Number of matches.
+	return ParseArray<BestMatches>(reader, sizeof(uint32_t));
+}
+
+JsonValue & BestMatchesBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> matchesArr;
+	matchesArr.reserve(m_matches.size());
+
+	for (const BestMatches& matches : m_matches)
+	{
+		matchesArr.push_back(std::move(matches.ToJson(doc)));
+	}
+
+	JsonValue matches = std::move(Tools::JsonConstructArray(doc, matchesArr));
+
+	Tools::JsonSetVal(doc, sk_labelMatches, matches);
+
+	return doc;
+}
+
+void BestMatchesBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_matches.size());
+	for (const BestMatches& matches : m_matches)
+	{
+		matches.ToBinary(writer);
+	}
+}
+
 constexpr char const DriQueryLog::sk_labelDriverId[];
 constexpr char const DriQueryLog::sk_labelLoc[];
 
@@ -363,27 +887,126 @@ JsonValue & DriQueryLog::ToJson(JsonDoc & doc) const
 {
 	JsonValue loc = std::move(m_loc.ToJson(doc));
 
-	Tools::JsonSetVal(doc, sk_labelDriverId, m_driverId);
+	Tools::JsonSetVal(doc, sk_labelDriverId, m_driverId.ToString());
 	Tools::JsonSetVal(doc, sk_labelLoc, loc);
 
 	return doc;
 }
 
+void DriQueryLog::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_driverId.Get());
+	m_loc.ToBinary(writer);
+}
+
+constexpr char const DriQueryLogBatch::sk_labelGatewayId[];
+constexpr char const DriQueryLogBatch::sk_labelLocs[];
+
+std::vector<Point2D<double> > DriQueryLogBatch::ParseLocs(const JsonValue & json)
+{
+	return ParseArrayObj<Point2D<double> >(json, sk_labelLocs);
+}
+
+std::vector<Point2D<double> > DriQueryLogBatch::ParseLocs(BinaryReader& reader)
+{
+	return ParseArray<Point2D<double> >(reader, 2 * sizeof(double));
+}
+
+JsonValue & DriQueryLogBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> locArr;
+	locArr.reserve(m_locs.size());
+
+	for (const Point2D<double>& loc : m_locs)
+	{
+		locArr.push_back(std::move(loc.ToJson(doc)));
+	}
+
+	JsonValue locs = std::move(Tools::JsonConstructArray(doc, locArr));
+
+	Tools::JsonSetVal(doc, sk_labelGatewayId, m_gatewayId.ToString());
+	Tools::JsonSetVal(doc, sk_labelLocs, locs);
+
+	return doc;
+}
+
+void DriQueryLogBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_gatewayId.Get());
+	writer.WriteSize(m_locs.size());
+	for (const Point2D<double>& loc : m_locs)
+	{
+		loc.ToBinary(writer);
+	}
+}
+
+constexpr char const FinalBill::sk_labelTripId[];
 constexpr char const FinalBill::sk_labelQuote[];
 constexpr char const FinalBill::sk_labelOpPayment[];
 constexpr char const FinalBill::sk_labelDriId[];
+constexpr char const FinalBill::sk_labelFare[];
 
 JsonValue & FinalBill::ToJson(JsonDoc & doc) const
 {
 	JsonValue quote = std::move(m_quote.ToJson(doc));
 
+	Tools::JsonSetVal(doc, sk_labelTripId, m_tripId);
 	Tools::JsonSetVal(doc, sk_labelQuote, quote);
 	Tools::JsonSetVal(doc, sk_labelOpPayment, m_opPay);
-	Tools::JsonSetVal(doc, sk_labelDriId, m_driId);
+	Tools::JsonSetVal(doc, sk_labelDriId, m_driId.ToString());
+	Tools::JsonSetVal(doc, sk_labelFare, m_fare);
 
 	return doc;
 }
 
+void FinalBill::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_tripId);
+	m_quote.ToBinary(writer);
+	writer.Write(m_opPay);
+	writer.Write(m_driId.Get());
+	writer.Write(m_fare);
+}
+
+constexpr char const FinalBillBatch::sk_labelBills[];
+
+std::vector<FinalBill> FinalBillBatch::ParseBills(const JsonValue & json)
+{
+	return ParseArrayObj<FinalBill>(json, sk_labelBills);
+}
+
+std::vector<FinalBill> FinalBillBatch::ParseBills(BinaryReader& reader)
+{
+	//Trip ID size + passenger ID + driver ID + fare, at least.
+	return ParseArray<FinalBill>(reader, sizeof(uint32_t) + 2 * sizeof(ClientId::HashType) + sizeof(double));
+}
+
+JsonValue & FinalBillBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> billArr;
+	billArr.reserve(m_bills.size());
+
+	for (const FinalBill& bill : m_bills)
+	{
+		billArr.push_back(std::move(bill.ToJson(doc)));
+	}
+
+	JsonValue bills = std::move(Tools::JsonConstructArray(doc, billArr));
+
+	Tools::JsonSetVal(doc, sk_labelBills, bills);
+
+	return doc;
+}
+
+void FinalBillBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_bills.size());
+	for (const FinalBill& bill : m_bills)
+	{
+		bill.ToBinary(writer);
+	}
+}
+
 constexpr char const PasReg::sk_labelContact[];
 constexpr char const PasReg::sk_labelPayment[];
 constexpr char const PasReg::sk_labelCsr[];
@@ -399,6 +1022,13 @@ JsonValue & PasReg::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void PasReg::ToBinary(BinaryWriter& writer) const
+{
+	m_contact.ToBinary(writer);
+	writer.Write(m_pay);
+	writer.Write(m_csr);
+}
+
 constexpr char const DriReg::sk_labelContact[];
 constexpr char const DriReg::sk_labelPayment[];
 constexpr char const DriReg::sk_labelCsr[];
@@ -416,6 +1046,14 @@ JsonValue & DriReg::ToJson(JsonDoc & doc) const
 	return doc;
 }
 
+void DriReg::ToBinary(BinaryWriter& writer) const
+{
+	m_contact.ToBinary(writer);
+	writer.Write(m_pay);
+	writer.Write(m_csr);
+	writer.Write(m_driLic);
+}
+
 constexpr char const RequestedPayment::sk_labelPayment[];
 constexpr char const RequestedPayment::sk_labelOpPaymnet[];
 
@@ -426,3 +1064,328 @@ JsonValue & RequestedPayment::ToJson(JsonDoc & doc) const
 
 	return doc;
 }
+
+void RequestedPayment::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_pay);
+	writer.Write(m_opPay);
+}
+
+constexpr char const PayInfoQueryBatch::sk_labelIds[];
+constexpr char const PayInfoQueryBatch::sk_labelId[];
+
+std::vector<ClientId> PayInfoQueryBatch::ParseIds(const JsonValue & json)
+{
+	const JsonValue& ids = GetMember(json, sk_labelIds);
+	if (!ids.JSON_IS_ARRAY())
+	{
+		throw MessageParseException();
+	}
+
+	std::vector<ClientId> res;
+	for (auto it = ids.JSON_ARR_BEGIN(); it != ids.JSON_ARR_END(); ++it)
+	{
+		res.push_back(ClientId::Parse(ParseValue<std::string>(JSON_ARR_GETVALUE(it), sk_labelId)));
+	}
+	return res;
+}
+
+std::vector<ClientId> PayInfoQueryBatch::ParseIds(BinaryReader& reader)
+{
+	const size_t size = reader.ReadSize(sizeof(ClientId::HashType));
+	std::vector<ClientId> res;
+	res.reserve(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		res.push_back(ClientId(reader.Read<ClientId::HashType>()));
+	}
+	return res;
+}
+
+JsonValue & PayInfoQueryBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> idArr;
+	idArr.reserve(m_ids.size());
+	for (const ClientId& id : m_ids)
+	{
+		Tools::JsonSetVal(doc, sk_labelId, id.ToString());
+		JsonValue& idObj = doc;
+		idArr.push_back(std::move(idObj));
+	}
+
+	JsonValue ids = std::move(Tools::JsonConstructArray(doc, idArr));
+
+	Tools::JsonSetVal(doc, sk_labelIds, ids);
+
+	return doc;
+}
+
+void PayInfoQueryBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_ids.size());
+	for (const ClientId& id : m_ids)
+	{
+		writer.Write(id.Get());
+	}
+}
+
+constexpr char const RequestedPaymentBatch::sk_labelPayments[];
+constexpr char const RequestedPaymentBatch::sk_labelOpPayment[];
+
+std::vector<std::string> RequestedPaymentBatch::ParsePayments(const JsonValue & json)
+{
+	const JsonValue& pays = GetMember(json, sk_labelPayments);
+	if (!pays.JSON_IS_ARRAY())
+	{
+		throw MessageParseException();
+	}
+
+	std::vector<std::string> res;
+	for (auto it = pays.JSON_ARR_BEGIN(); it != pays.JSON_ARR_END(); ++it)
+	{
+		res.push_back(ParseValue<std::string>(JSON_ARR_GETVALUE(it), RequestedPayment::sk_labelPayment));
+	}
+	return res;
+}
+
+std::vector<std::string> RequestedPaymentBatch::ParsePayments(BinaryReader& reader)
+{
+	const size_t size = reader.ReadSize(sizeof(uint32_t));
+	std::vector<std::string> res;
+	res.reserve(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		res.push_back(reader.Read<std::string>());
+	}
+	return res;
+}
+
+JsonValue & RequestedPaymentBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> payArr;
+	payArr.reserve(m_pays.size());
+	for (const std::string& pay : m_pays)
+	{
+		Tools::JsonSetVal(doc, RequestedPayment::sk_labelPayment, pay);
+		JsonValue& payObj = doc;
+		payArr.push_back(std::move(payObj));
+	}
+
+	JsonValue pays = std::move(Tools::JsonConstructArray(doc, payArr));
+
+	Tools::JsonSetVal(doc, sk_labelPayments, pays);
+	Tools::JsonSetVal(doc, sk_labelOpPayment, m_opPay);
+
+	return doc;
+}
+
+void RequestedPaymentBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_pays.size());
+	for (const std::string& pay : m_pays)
+	{
+		writer.Write(pay);
+	}
+	writer.Write(m_opPay);
+}
+
+constexpr char const CellCount::sk_labelX[];
+constexpr char const CellCount::sk_labelY[];
+constexpr char const CellCount::sk_labelCount[];
+
+JsonValue & CellCount::ToJson(JsonDoc & doc) const
+{
+	Tools::JsonSetVal(doc, sk_labelX, static_cast<int>(m_x));
+	Tools::JsonSetVal(doc, sk_labelY, static_cast<int>(m_y));
+	Tools::JsonSetVal(doc, sk_labelCount, static_cast<int>(m_count));
+
+	return doc;
+}
+
+void CellCount::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_x);
+	writer.Write(m_y);
+	writer.Write(m_count);
+}
+
+constexpr char const CellCountBatch::sk_labelCells[];
+
+std::vector<CellCount> CellCountBatch::ParseCells(const JsonValue & json)
+{
+	return ParseArrayObj<CellCount>(json, sk_labelCells);
+}
+
+std::vector<CellCount> CellCountBatch::ParseCells(BinaryReader& reader)
+{
+	return ParseArray<CellCount>(reader, 2 * sizeof(int32_t) + sizeof(uint32_t));
+}
+
+JsonValue & CellCountBatch::ToJson(JsonDoc & doc) const
+{
+	std::vector<JsonValue> cellArr;
+	cellArr.reserve(m_cells.size());
+
+	for (const CellCount& cell : m_cells)
+	{
+		cellArr.push_back(std::move(cell.ToJson(doc)));
+	}
+
+	JsonValue cells = std::move(Tools::JsonConstructArray(doc, cellArr));
+
+	Tools::JsonSetVal(doc, sk_labelCells, cells);
+
+	return doc;
+}
+
+void CellCountBatch::ToBinary(BinaryWriter& writer) const
+{
+	writer.WriteSize(m_cells.size());
+	for (const CellCount& cell : m_cells)
+	{
+		cell.ToBinary(writer);
+	}
+}
+
+constexpr char const TripTrace::sk_labelTripId[];
+constexpr char const TripTrace::sk_labelOri[];
+constexpr char const TripTrace::sk_labelDeltas[];
+constexpr char const TripTrace::sk_labelX[];
+constexpr char const TripTrace::sk_labelY[];
+constexpr double TripTrace::sk_resolution;
+constexpr double TripTrace::sk_maxCoord;
+
+int64_t TripTrace::ToFixed(const double val)
+{
+	//It's false for NaN as well.
+	if (!(val >= -sk_maxCoord && val <= sk_maxCoord))
+	{
+		throw MessageException("The coordinate of the trip trace is out of range.");
+	}
+	const double scaled = val / sk_resolution;
+	return static_cast<int64_t>(scaled >= 0.0 ? scaled + 0.5 : scaled - 0.5);
+}
+
+int64_t TripTrace::ParseFixed(BinaryReader& reader)
+{
+	static const int64_t sk_maxFixed = static_cast<int64_t>(sk_maxCoord / sk_resolution);
+
+	const int64_t res = reader.ReadVarInt();
+	if (res < -sk_maxFixed || res > sk_maxFixed)
+	{
+		throw MessageParseException();
+	}
+	return res;
+}
+
+std::vector<TripTrace::Delta> TripTrace::ParseDeltas(const JsonValue & json)
+{
+	const JsonValue& deltas = GetMember(json, sk_labelDeltas);
+	if (!deltas.JSON_IS_ARRAY())
+	{
+		throw MessageParseException();
+	}
+
+	std::vector<Delta> res;
+	for (auto it = deltas.JSON_ARR_BEGIN(); it != deltas.JSON_ARR_END(); ++it)
+	{
+		const JsonValue& delta = JSON_ARR_GETVALUE(it);
+		res.push_back(Delta{ ParseValue<int>(delta, sk_labelX), ParseValue<int>(delta, sk_labelY) });
+	}
+	return res;
+}
+
+std::vector<TripTrace::Delta> TripTrace::ParseDeltas(BinaryReader& reader)
+{
+	//Each coordinate takes one byte, at least.
+	const size_t size = reader.ReadSize(2);
+	std::vector<Delta> res;
+	res.reserve(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		const int64_t dx = reader.ReadVarInt();
+		const int64_t dy = reader.ReadVarInt();
+		if (dx < INT32_MIN || dx > INT32_MAX ||
+			dy < INT32_MIN || dy > INT32_MAX)
+		{
+			throw MessageParseException();
+		}
+		res.push_back(Delta{ static_cast<int32_t>(dx), static_cast<int32_t>(dy) });
+	}
+	return res;
+}
+
+TripTrace::TripTrace(const std::string& tripId, const std::vector<Point2D<double> >& points) :
+	m_tripId(tripId),
+	m_oriX(0),
+	m_oriY(0),
+	m_deltas()
+{
+	if (points.size() == 0)
+	{
+		throw MessageException("A trip trace must have at least one point.");
+	}
+
+	m_oriX = ToFixed(points[0].GetX());
+	m_oriY = ToFixed(points[0].GetY());
+
+	m_deltas.reserve(points.size() - 1);
+	int64_t prevX = m_oriX;
+	int64_t prevY = m_oriY;
+	for (size_t i = 1; i < points.size(); ++i)
+	{
+		const int64_t x = ToFixed(points[i].GetX());
+		const int64_t y = ToFixed(points[i].GetY());
+		const int64_t dx = x - prevX;
+		const int64_t dy = y - prevY;
+		if (dx < INT32_MIN || dx > INT32_MAX ||
+			dy < INT32_MIN || dy > INT32_MAX)
+		{
+			throw MessageException("The points of the trip trace are too far apart.");
+		}
+		m_deltas.push_back(Delta{ static_cast<int32_t>(dx), static_cast<int32_t>(dy) });
+		prevX = x;
+		prevY = y;
+	}
+}
+
+TripTrace::TripTrace(std::string&& tripId, const Point2D<double>& ori, std::vector<Delta>&& deltas) :
+	TripTrace(std::forward<std::string>(tripId), ToFixed(ori.GetX()), ToFixed(ori.GetY()),
+		std::forward<std::vector<Delta> >(deltas))
+{}
+
+JsonValue & TripTrace::ToJson(JsonDoc & doc) const
+{
+	JsonValue ori = std::move(Point2D<double>(ToCoord(m_oriX), ToCoord(m_oriY)).ToJson(doc));
+
+	std::vector<JsonValue> deltaArr;
+	deltaArr.reserve(m_deltas.size());
+	for (const Delta& delta : m_deltas)
+	{
+		Tools::JsonSetVal(doc, sk_labelX, static_cast<int>(delta.m_dx));
+		Tools::JsonSetVal(doc, sk_labelY, static_cast<int>(delta.m_dy));
+		JsonValue& deltaObj = doc;
+		deltaArr.push_back(std::move(deltaObj));
+	}
+
+	JsonValue deltas = std::move(Tools::JsonConstructArray(doc, deltaArr));
+
+	Tools::JsonSetVal(doc, sk_labelTripId, m_tripId);
+	Tools::JsonSetVal(doc, sk_labelOri, ori);
+	Tools::JsonSetVal(doc, sk_labelDeltas, deltas);
+
+	return doc;
+}
+
+void TripTrace::ToBinary(BinaryWriter& writer) const
+{
+	writer.Write(m_tripId);
+	writer.WriteVarInt(m_oriX);
+	writer.WriteVarInt(m_oriY);
+	writer.WriteSize(m_deltas.size());
+	for (const Delta& delta : m_deltas)
+	{
+		writer.WriteVarInt(delta.m_dx);
+		writer.WriteVarInt(delta.m_dy);
+	}
+}
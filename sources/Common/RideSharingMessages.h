@@ -2,10 +2,18 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
 
+#include <DecentApi/Common/make_unique.h>
 #include <DecentApi/Common/Net/CommonMessages.h>
 #include <DecentApi/Common/GeneralKeyTypes.h>
 
+#include "StringView.h"
+#include "BinaryCoding.h"
+#include "ClientId.h"
+#include "MessageException.h"
+
 namespace Decent
 {
 	namespace MbedTlsObj
@@ -26,8 +34,70 @@ namespace RideShare
 		typedef Decent::Tools::JsonValue JsonValue;
 		typedef Decent::Tools::JsonDoc   JsonDoc;
 
+		enum class WireFormat
+		{
+			Json,
+			Binary,
+		};
+
+		/**
+		 * \brief	Gets the format used by ToString(). It's binary by default; JSON is kept for debugging.
+		 */
+		WireFormat GetDefaultWireFormat();
+		void SetDefaultWireFormat(const WireFormat format);
+
+		WireFormat DetectWireFormat(const StringView& msgStr);
+
+		/**
+		 * \brief	Base of all messages, which can be serialized in either JSON or the compact binary
+		 * 			format. A binary message starts with a zero byte, which never starts a JSON text, so
+		 * 			the receiver can tell the format; replies should be sent in the format of the request.
+		 */
+		class WireMsg : virtual public Decent::Net::CommonJsonMsg
+		{
+		public:
+			static constexpr char sk_binaryMagic = '\0';
+
+		public:
+			virtual ~WireMsg() {}
+
+			virtual std::string ToString() const override;
+
+			std::string ToString(const WireFormat format) const;
+
+			virtual void ToBinary(BinaryWriter& writer) const = 0;
+		};
+
+		//Parses the JSON text and passes the root to the callback; it's here so the JSON library stays out of this header.
+		void ParseJsonMsg(const std::string& msgStr, const std::function<void(const JsonValue&)>& callback);
+
+		/**
+		 * \brief	Parses a message in either wire format.
+		 */
+		template<typename MsgType>
+		inline std::unique_ptr<MsgType> ParseWireMsg(const std::string& msgStr)
+		{
+			if (DetectWireFormat(msgStr) == WireFormat::Binary)
+			{
+				BinaryReader reader(msgStr, sizeof(WireMsg::sk_binaryMagic));
+				std::unique_ptr<MsgType> res = Decent::Tools::make_unique<MsgType>(reader);
+				if (!reader.IsEnd())
+				{
+					throw MessageParseException();
+				}
+				return std::move(res);
+			}
+
+			std::unique_ptr<MsgType> res;
+			ParseJsonMsg(msgStr, [&res](const JsonValue& json)
+			{
+				res = Decent::Tools::make_unique<MsgType>(json);
+			});
+			return std::move(res);
+		}
+
 		template<typename T>
-		class Point2D : virtual public Decent::Net::CommonJsonMsg
+		class Point2D : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelX[] = "X";
@@ -58,9 +128,19 @@ namespace RideShare
 				m_y(ParseValue<T>(json, sk_labelY))
 			{}
 
+			Point2D(BinaryReader& reader) :
+				m_x(reader.Read<T>()),
+				m_y(reader.Read<T>())
+			{}
+
 			~Point2D() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override
+			{
+				writer.Write(m_x);
+				writer.Write(m_y);
+			}
 
 			const T& GetX() const { return m_x; }
 			const T& GetY() const { return m_y; }
@@ -73,7 +153,7 @@ namespace RideShare
 		//template<class T> constexpr char const Point2D<T>::sk_labelX[];
 		//template<class T> constexpr char const Point2D<T>::sk_labelY[];
 
-		class GetQuote : virtual public Decent::Net::CommonJsonMsg
+		class GetQuote : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelOrigin[] = "Ori";
@@ -104,9 +184,15 @@ namespace RideShare
 					ParseSubMessage<Point2D<double> >(json, sk_labelDest))
 			{}
 
+			GetQuote(BinaryReader& reader) :
+				m_ori(reader),
+				m_dest(reader)
+			{}
+
 			~GetQuote() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const Point2D<double>& GetOri() const { return m_ori; }
 			const Point2D<double>& GetDest() const { return m_dest; }
@@ -116,12 +202,13 @@ namespace RideShare
 			Point2D<double> m_dest;
 		};
 
-		class Path :virtual public Decent::Net::CommonJsonMsg
+		class Path : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelPath[] = "Path";
 
 			static std::vector<Point2D<double> > ParsePath(const JsonValue& json);
+			static std::vector<Point2D<double> > ParsePath(BinaryReader& reader);
 
 		public:
 			Path() = delete;
@@ -145,9 +232,14 @@ namespace RideShare
 				Path(ParsePath(json))
 			{}
 
+			Path(BinaryReader& reader) :
+				Path(ParsePath(reader))
+			{}
+
 			~Path() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const std::vector<Point2D<double> >& GetPath() const { return m_path; }
 
@@ -155,7 +247,7 @@ namespace RideShare
 			std::vector<Point2D<double> > m_path;
 		};
 
-		class Price : virtual public Decent::Net::CommonJsonMsg
+		class Price : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelPrice[] = "Price";
@@ -186,9 +278,15 @@ namespace RideShare
 					ParseValue<std::string>(json, sk_labelOpPayment))
 			{}
 
+			Price(BinaryReader& reader) :
+				m_price(reader.Read<double>()),
+				m_opPayment(reader.Read<std::string>())
+			{}
+
 			~Price() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			double GetPrice() const { return m_price; }
 			const std::string& GetOpPayment() const { return m_opPayment; }
@@ -198,7 +296,109 @@ namespace RideShare
 			std::string m_opPayment;
 		};
 
-		class Quote : virtual public Decent::Net::CommonJsonMsg
+		class PathBatch : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelPaths[] = "Paths";
+
+			static std::vector<Path> ParsePaths(const JsonValue& json);
+			static std::vector<Path> ParsePaths(BinaryReader& reader);
+
+		public:
+			PathBatch() = delete;
+			PathBatch(const std::vector<Path>& paths) :
+				m_paths(paths)
+			{}
+
+			PathBatch(std::vector<Path>&& paths) :
+				m_paths(std::forward<std::vector<Path> >(paths))
+			{}
+
+			PathBatch(const PathBatch& rhs) :
+				PathBatch(rhs.m_paths)
+			{}
+
+			PathBatch(PathBatch&& rhs) :
+				PathBatch(std::forward<std::vector<Path> >(rhs.m_paths))
+			{}
+
+			PathBatch(const JsonValue& json) :
+				PathBatch(ParsePaths(json))
+			{}
+
+			PathBatch(BinaryReader& reader) :
+				PathBatch(ParsePaths(reader))
+			{}
+
+			~PathBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<Path>& GetPaths() const { return m_paths; }
+
+		private:
+			std::vector<Path> m_paths;
+		};
+
+		/**
+		 * \brief	The prices of a PathBatch, in the same order; all of them are paid to the same operator.
+		 */
+		class PriceBatch : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelPrices[] = "Prices";
+			static constexpr char const sk_labelOpPayment[] = "OpPay";
+
+			static std::vector<double> ParsePrices(const JsonValue& json);
+			static std::vector<double> ParsePrices(BinaryReader& reader);
+
+		public:
+			PriceBatch() = delete;
+
+			PriceBatch(const std::vector<double>& prices, const std::string& opPayment) :
+				m_prices(prices),
+				m_opPayment(opPayment)
+			{}
+
+			PriceBatch(std::vector<double>&& prices, std::string&& opPayment) :
+				m_prices(std::forward<std::vector<double> >(prices)),
+				m_opPayment(std::forward<std::string>(opPayment))
+			{}
+
+			PriceBatch(const PriceBatch& rhs) :
+				PriceBatch(rhs.m_prices, rhs.m_opPayment)
+			{}
+
+			PriceBatch(PriceBatch&& rhs) :
+				PriceBatch(std::forward<std::vector<double> >(rhs.m_prices),
+					std::forward<std::string>(rhs.m_opPayment))
+			{}
+
+			PriceBatch(const JsonValue& json) :
+				PriceBatch(ParsePrices(json),
+					ParseValue<std::string>(json, sk_labelOpPayment))
+			{}
+
+			PriceBatch(BinaryReader& reader) :
+				m_prices(ParsePrices(reader)),
+				m_opPayment(reader.Read<std::string>())
+			{}
+
+			~PriceBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<double>& GetPrices() const { return m_prices; }
+			const std::string& GetOpPayment() const { return m_opPayment; }
+
+		private:
+			std::vector<double> m_prices;
+			std::string m_opPayment;
+		};
+
+		class Quote : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelGetQuote[] = "GetQuote";
@@ -209,7 +409,7 @@ namespace RideShare
 
 		public:
 			Quote() = delete;
-			Quote(const GetQuote& quote, const Path& path, const Price& price, const std::string& opPayment, const std::string& pasId) :
+			Quote(const GetQuote& quote, const Path& path, const Price& price, const std::string& opPayment, const ClientId& pasId) :
 				m_getQuote(quote),
 				m_path(path),
 				m_price(price),
@@ -217,12 +417,12 @@ namespace RideShare
 				m_pasId(pasId)
 			{}
 
-			Quote(GetQuote&& quote, Path&& path, Price&& price, std::string&& opPayment, std::string&& pasId) :
+			Quote(GetQuote&& quote, Path&& path, Price&& price, std::string&& opPayment, const ClientId& pasId) :
 				m_getQuote(std::forward<GetQuote>(quote)),
 				m_path(std::forward<Path>(path)),
 				m_price(std::forward<Price>(price)),
 				m_opPayment(std::forward<std::string>(opPayment)),
-				m_pasId(std::forward<std::string>(pasId))
+				m_pasId(pasId)
 			{}
 
 			Quote(const Quote& rhs) :
@@ -234,7 +434,7 @@ namespace RideShare
 					std::forward<Path>(rhs.m_path),
 					std::forward<Price>(rhs.m_price),
 					std::forward<std::string>(rhs.m_opPayment),
-					std::forward<std::string>(rhs.m_pasId))
+					rhs.m_pasId)
 			{}
 
 			Quote(const JsonValue& json) :
@@ -242,36 +442,57 @@ namespace RideShare
 					ParseSubMessage<Path>(json, sk_labelPath),
 					ParseSubMessage<Price>(json, sk_labelPrice),
 					ParseValue<std::string>(json, sk_labelOpPayment),
-					ParseValue<std::string>(json, sk_labelPasId))
+					ClientId::Parse(ParseValue<std::string>(json, sk_labelPasId)))
+			{}
+
+			Quote(BinaryReader& reader) :
+				m_getQuote(reader),
+				m_path(reader),
+				m_price(reader),
+				m_opPayment(reader.Read<std::string>()),
+				m_pasId(reader.Read<ClientId::HashType>())
 			{}
 
 			~Quote() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const GetQuote& GetGetQuote() const { return m_getQuote; }
 			const Path& GetPath() const { return m_path; }
 			const Price& GetPrice() const { return m_price; }
 			const std::string& GetOpPayment() const { return m_opPayment; }
-			const std::string& GetPasId() const { return m_pasId; }
+			const ClientId& GetPasId() const { return m_pasId; }
 
 		private:
 			GetQuote m_getQuote;
 			Path m_path;
 			Price m_price;
 			std::string m_opPayment;
-			std::string m_pasId;
+			ClientId m_pasId;
 		};
 
-		class SignedQuote : virtual public Decent::Net::CommonJsonMsg
+		class SignedQuote : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelQuote[] = "Quote";
 			static constexpr char const sk_labelSignature[] = "Sign";
 			static constexpr char const sk_labelCert[] = "Cert";
 
-			static SignedQuote SignQuote(const Quote& quote, Decent::Ra::States& state);
+			static SignedQuote SignQuote(const Quote& quote, Decent::Ra::States& state, const WireFormat format);
 			static SignedQuote ParseSignedQuote(const JsonValue& json, Decent::Ra::States& state, const std::string& appName);
+			static SignedQuote ParseSignedQuote(BinaryReader& reader, Decent::Ra::States& state, const std::string& appName);
+
+			//Parses a signed quote in either wire format.
+			static SignedQuote ParseSignedQuote(const std::string& msgStr, Decent::Ra::States& state, const std::string& appName);
+
+			/**
+			 * \brief	Verifies the certificate and the signature of a signed quote, without taking
+			 * 			copies of its fields.
+			 *
+			 * \exception	MessageParseException	Thrown when the verification failed.
+			 */
+			static void Verify(const StringView& quote, const StringView& sign, const StringView& cert, Decent::Ra::States& state, const std::string& appName);
 
 		public:
 			SignedQuote() = delete;
@@ -289,6 +510,7 @@ namespace RideShare
 			~SignedQuote() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const std::string& GetQuote() const { return m_quote; }
 
@@ -305,12 +527,14 @@ namespace RideShare
 				m_cert(std::forward<std::string>(cert))
 			{}
 
+			static SignedQuote VerifySignedQuote(std::string&& quote, std::string&& sign, std::string&& cert, Decent::Ra::States& state, const std::string& appName);
+
 			std::string m_quote;
 			std::string m_sign;
 			std::string m_cert;
 		};
 
-		class PasContact : virtual public Decent::Net::CommonJsonMsg
+		class PasContact : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelName[] = "Name";
@@ -343,9 +567,15 @@ namespace RideShare
 					ParseValue<std::string>(json, sk_labelPhone))
 			{}
 
+			PasContact(BinaryReader& reader) :
+				m_name(reader.Read<std::string>()),
+				m_phone(reader.Read<std::string>())
+			{}
+
 			~PasContact() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const std::string& GetName() const { return m_name; }
 			const std::string& GetPhone() const { return m_phone; }
@@ -357,7 +587,7 @@ namespace RideShare
 			std::string m_phone;
 		};
 
-		class DriContact : virtual public Decent::Net::CommonJsonMsg
+		class DriContact : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelName[] = "Name";
@@ -395,9 +625,16 @@ namespace RideShare
 					ParseValue<std::string>(json, sk_labelLicPlate))
 			{}
 
+			DriContact(BinaryReader& reader) :
+				m_name(reader.Read<std::string>()),
+				m_phone(reader.Read<std::string>()),
+				m_licPlate(reader.Read<std::string>())
+			{}
+
 			~DriContact() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const std::string& GetName() const { return m_name; }
 			const std::string& GetPhone() const { return m_phone; }
@@ -410,7 +647,7 @@ namespace RideShare
 			std::string m_licPlate;
 		};
 
-		class ConfirmQuote : virtual public Decent::Net::CommonJsonMsg
+		class ConfirmQuote : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelPasContact[] = "Contact";
@@ -443,9 +680,15 @@ namespace RideShare
 					ParseValue<std::string>(json, sk_labelSignedQuote))
 			{}
 
+			ConfirmQuote(BinaryReader& reader) :
+				m_contact(reader),
+				m_signQuote(reader.Read<std::string>())
+			{}
+
 			~ConfirmQuote() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const PasContact& GetContact() const { return m_contact; }
 			const std::string& GetSignQuote() const { return m_signQuote; }
@@ -455,7 +698,7 @@ namespace RideShare
 			std::string m_signQuote;
 		};
 
-		class DriSelection : virtual public Decent::Net::CommonJsonMsg
+		class DriSelection : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelDriContact[] = "Contact";
@@ -488,9 +731,15 @@ namespace RideShare
 					ParseValue<std::string>(json, sk_labelTripId))
 			{}
 
+			DriSelection(BinaryReader& reader) :
+				m_contact(reader),
+				m_tripId(reader.Read<std::string>())
+			{}
+
 			~DriSelection() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const DriContact& GetContact() const { return m_contact; }
 			const std::string& GetTripId() const { return m_tripId; }
@@ -500,7 +749,7 @@ namespace RideShare
 			std::string m_tripId;
 		};
 
-		class PasMatchedResult : virtual public Decent::Net::CommonJsonMsg
+		class PasMatchedResult : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelTripId[] = "TripId";
@@ -533,9 +782,15 @@ namespace RideShare
 					ParseSubMessage<DriContact>(json, sk_labelDriContact))
 			{}
 
+			PasMatchedResult(BinaryReader& reader) :
+				m_driContact(reader),
+				m_tripId(reader.Read<std::string>())
+			{}
+
 			~PasMatchedResult() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const DriContact& GetDriContact() const { return m_driContact; }
 			const std::string& GetTripId() const { return m_tripId; }
@@ -545,7 +800,7 @@ namespace RideShare
 			std::string m_tripId;
 		};
 
-		class PasQueryLog : virtual public Decent::Net::CommonJsonMsg
+		class PasQueryLog : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelUserId[] = "UserId";
@@ -554,13 +809,13 @@ namespace RideShare
 		public:
 			PasQueryLog() = delete;
 
-			PasQueryLog(const std::string& userId, const GetQuote& getQuote) :
+			PasQueryLog(const ClientId& userId, const GetQuote& getQuote) :
 				m_userId(userId),
 				m_getQuote(getQuote)
 			{}
 
-			PasQueryLog(std::string&& userId, GetQuote&& getQuote) :
-				m_userId(std::forward<std::string>(userId)),
+			PasQueryLog(const ClientId& userId, GetQuote&& getQuote) :
+				m_userId(userId),
 				m_getQuote(std::forward<GetQuote>(getQuote))
 			{}
 
@@ -569,65 +824,211 @@ namespace RideShare
 			{}
 
 			PasQueryLog(PasQueryLog&& rhs) :
-				PasQueryLog(std::forward<std::string>(rhs.m_userId),
+				PasQueryLog(rhs.m_userId,
 					std::forward<GetQuote>(rhs.m_getQuote))
 			{}
 
 			PasQueryLog(const JsonValue& json) :
-				PasQueryLog(ParseValue<std::string>(json, sk_labelUserId),
+				PasQueryLog(ClientId::Parse(ParseValue<std::string>(json, sk_labelUserId)),
 					ParseSubMessage<GetQuote>(json, sk_labelGetQuote))
 			{}
 
+			PasQueryLog(BinaryReader& reader) :
+				m_userId(reader.Read<ClientId::HashType>()),
+				m_getQuote(reader)
+			{}
+
 			~PasQueryLog() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
-			const std::string& GetUserId() const { return m_userId; }
+			const ClientId& GetUserId() const { return m_userId; }
 			const GetQuote& GetGetQuote() const { return m_getQuote; }
 
 		private:
-			std::string m_userId;
+			ClientId m_userId;
 			GetQuote m_getQuote;
 		};
 
-		class DriverLoc : virtual public Decent::Net::CommonJsonMsg
+		class DriverLoc : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelOrigin[] = "Loc";
+			static constexpr char const sk_labelRadius[] = "Radius";
+			static constexpr char const sk_labelMaxNum[] = "MaxNum";
+
+			//Radius and max number of matches are optional; zero means the server's default.
+			static double ParseRadius(const JsonValue& json);
+			static int ParseMaxNum(const JsonValue& json);
 
 		public:
 			DriverLoc() = delete;
 			DriverLoc(const Point2D<double>& loc) :
-				m_loc(loc)
+				DriverLoc(loc, 0.0, 0)
 			{}
 
 			DriverLoc(Point2D<double>&& loc) :
-				m_loc(std::forward<Point2D<double> >(loc))
+				DriverLoc(std::forward<Point2D<double> >(loc), 0.0, 0)
+			{}
+
+			DriverLoc(const Point2D<double>& loc, const double radius, const int maxNum) :
+				m_loc(loc),
+				m_radius(radius),
+				m_maxNum(maxNum)
+			{}
+
+			DriverLoc(Point2D<double>&& loc, const double radius, const int maxNum) :
+				m_loc(std::forward<Point2D<double> >(loc)),
+				m_radius(radius),
+				m_maxNum(maxNum)
 			{}
 
 			DriverLoc(const DriverLoc& rhs) :
-				DriverLoc(rhs.m_loc)
+				DriverLoc(rhs.m_loc, rhs.m_radius, rhs.m_maxNum)
 			{}
 
 			DriverLoc(DriverLoc&& rhs) :
-				DriverLoc(std::forward<Point2D<double> >(rhs.m_loc))
+				DriverLoc(std::forward<Point2D<double> >(rhs.m_loc), rhs.m_radius, rhs.m_maxNum)
 			{}
 
 			DriverLoc(const JsonValue& json) :
-				DriverLoc(ParseSubMessage<Point2D<double> >(json, sk_labelOrigin))
+				DriverLoc(ParseSubMessage<Point2D<double> >(json, sk_labelOrigin),
+					ParseRadius(json),
+					ParseMaxNum(json))
+			{}
+
+			DriverLoc(BinaryReader& reader) :
+				m_loc(reader),
+				m_radius(reader.Read<double>()),
+				m_maxNum(reader.Read<int32_t>())
 			{}
 
 			~DriverLoc() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
-			const Point2D<double>& GetLoc() { return m_loc; }
+			const Point2D<double>& GetLoc() const { return m_loc; }
+			double GetRadius() const { return m_radius; }
+			int GetMaxNum() const { return m_maxNum; }
 
 		private:
 			Point2D<double> m_loc;
+			double m_radius;
+			int m_maxNum;
 		};
 
-		class MatchItem : virtual public Decent::Net::CommonJsonMsg
+		/**
+		 * \brief	A driver, who is available for the batch assignment, at the given location.
+		 */
+		class DriAvailable : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelDriContact[] = "Contact";
+			static constexpr char const sk_labelLoc[] = "Loc";
+
+		public:
+			DriAvailable() = delete;
+
+			DriAvailable(const DriContact& contact, const DriverLoc& loc) :
+				m_contact(contact),
+				m_loc(loc)
+			{}
+
+			DriAvailable(DriContact&& contact, DriverLoc&& loc) :
+				m_contact(std::forward<DriContact>(contact)),
+				m_loc(std::forward<DriverLoc>(loc))
+			{}
+
+			DriAvailable(const DriAvailable& rhs) :
+				DriAvailable(rhs.m_contact, rhs.m_loc)
+			{}
+
+			DriAvailable(DriAvailable&& rhs) :
+				DriAvailable(std::forward<DriContact>(rhs.m_contact),
+					std::forward<DriverLoc>(rhs.m_loc))
+			{}
+
+			DriAvailable(const JsonValue& json) :
+				DriAvailable(ParseSubMessage<DriContact>(json, sk_labelDriContact),
+					ParseSubMessage<DriverLoc>(json, sk_labelLoc))
+			{}
+
+			DriAvailable(BinaryReader& reader) :
+				m_contact(reader),
+				m_loc(reader)
+			{}
+
+			~DriAvailable() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const DriContact& GetContact() const { return m_contact; }
+			const DriverLoc& GetLoc() const { return m_loc; }
+
+		private:
+			DriContact m_contact;
+			DriverLoc m_loc;
+		};
+
+		/**
+		 * \brief	The trip assigned to a driver by the batch assignment. An empty trip ID means the
+		 * 			driver hasn't been assigned any trip before the wait expired.
+		 */
+		class DriAssignment : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelTripId[] = "TripId";
+			static constexpr char const sk_labelPasContact[] = "PasContact";
+
+		public:
+			DriAssignment() = delete;
+
+			DriAssignment(const std::string& tripId, const PasContact& pasContact) :
+				m_tripId(tripId),
+				m_pasContact(pasContact)
+			{}
+
+			DriAssignment(std::string&& tripId, PasContact&& pasContact) :
+				m_tripId(std::forward<std::string>(tripId)),
+				m_pasContact(std::forward<PasContact>(pasContact))
+			{}
+
+			DriAssignment(const DriAssignment& rhs) :
+				DriAssignment(rhs.m_tripId, rhs.m_pasContact)
+			{}
+
+			DriAssignment(DriAssignment&& rhs) :
+				DriAssignment(std::forward<std::string>(rhs.m_tripId),
+					std::forward<PasContact>(rhs.m_pasContact))
+			{}
+
+			DriAssignment(const JsonValue& json) :
+				DriAssignment(ParseValue<std::string>(json, sk_labelTripId),
+					ParseSubMessage<PasContact>(json, sk_labelPasContact))
+			{}
+
+			DriAssignment(BinaryReader& reader) :
+				m_tripId(reader.Read<std::string>()),
+				m_pasContact(reader)
+			{}
+
+			~DriAssignment() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::string& GetTripId() const { return m_tripId; }
+			const PasContact& GetPasContact() const { return m_pasContact; }
+
+		private:
+			std::string m_tripId;
+			PasContact m_pasContact;
+		};
+
+		class MatchItem : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelTripId[] = "Id";
@@ -659,9 +1060,15 @@ namespace RideShare
 					ParseSubMessage<Path>(json, sk_labelPath))
 			{}
 
+			MatchItem(BinaryReader& reader) :
+				m_tripId(reader.Read<std::string>()),
+				m_path(reader)
+			{}
+
 			~MatchItem() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const std::string& GetTripId() const { return m_tripId; }
 			const Path& GetPath() const { return m_path; }
@@ -671,12 +1078,13 @@ namespace RideShare
 			Path m_path;
 		};
 
-		class BestMatches :virtual public Decent::Net::CommonJsonMsg
+		class BestMatches : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelMatches[] = "Mat";
 
 			static std::vector<MatchItem> ParseMatches(const JsonValue& json);
+			static std::vector<MatchItem> ParseMatches(BinaryReader& reader);
 
 		public:
 			BestMatches() = delete;
@@ -700,9 +1108,14 @@ namespace RideShare
 				BestMatches(ParseMatches(json))
 			{}
 
+			BestMatches(BinaryReader& reader) :
+				BestMatches(ParseMatches(reader))
+			{}
+
 			~BestMatches() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const std::vector<MatchItem>& GetMatches() const { return m_matches; }
 
@@ -710,7 +1123,159 @@ namespace RideShare
 			std::vector<MatchItem> m_matches;
 		};
 
-		class DriQueryLog : virtual public Decent::Net::CommonJsonMsg
+		/**
+		 * \brief	An update pushed to a driver who has subscribed to the matches around a location.
+		 * 			The first update carries the current best matches; later ones carry the trips that
+		 * 			have just become available, and the IDs of the ones that have been taken or expired.
+		 */
+		class MatchUpdate : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelAdded[] = "Add";
+			static constexpr char const sk_labelRemoved[] = "Rem";
+
+			static std::vector<MatchItem> ParseAdded(const JsonValue& json);
+			static std::vector<MatchItem> ParseAdded(BinaryReader& reader);
+			static std::vector<std::string> ParseRemoved(const JsonValue& json);
+			static std::vector<std::string> ParseRemoved(BinaryReader& reader);
+
+		public:
+			MatchUpdate() = delete;
+			MatchUpdate(const std::vector<MatchItem>& added, const std::vector<std::string>& removed) :
+				m_added(added),
+				m_removed(removed)
+			{}
+
+			MatchUpdate(std::vector<MatchItem>&& added, std::vector<std::string>&& removed) :
+				m_added(std::forward<std::vector<MatchItem> >(added)),
+				m_removed(std::forward<std::vector<std::string> >(removed))
+			{}
+
+			MatchUpdate(const MatchUpdate& rhs) :
+				MatchUpdate(rhs.m_added, rhs.m_removed)
+			{}
+
+			MatchUpdate(MatchUpdate&& rhs) :
+				MatchUpdate(std::forward<std::vector<MatchItem> >(rhs.m_added),
+					std::forward<std::vector<std::string> >(rhs.m_removed))
+			{}
+
+			MatchUpdate(const JsonValue& json) :
+				MatchUpdate(ParseAdded(json), ParseRemoved(json))
+			{}
+
+			MatchUpdate(BinaryReader& reader) :
+				m_added(ParseAdded(reader)),
+				m_removed(ParseRemoved(reader))
+			{}
+
+			~MatchUpdate() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<MatchItem>& GetAdded() const { return m_added; }
+			const std::vector<std::string>& GetRemoved() const { return m_removed; }
+
+		private:
+			std::vector<MatchItem> m_added;
+			std::vector<std::string> m_removed;
+		};
+
+		class DriverLocBatch : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelLocs[] = "Locs";
+
+			static std::vector<DriverLoc> ParseLocs(const JsonValue& json);
+			static std::vector<DriverLoc> ParseLocs(BinaryReader& reader);
+
+		public:
+			DriverLocBatch() = delete;
+			DriverLocBatch(const std::vector<DriverLoc>& locs) :
+				m_locs(locs)
+			{}
+
+			DriverLocBatch(std::vector<DriverLoc>&& locs) :
+				m_locs(std::forward<std::vector<DriverLoc> >(locs))
+			{}
+
+			DriverLocBatch(const DriverLocBatch& rhs) :
+				DriverLocBatch(rhs.m_locs)
+			{}
+
+			DriverLocBatch(DriverLocBatch&& rhs) :
+				DriverLocBatch(std::forward<std::vector<DriverLoc> >(rhs.m_locs))
+			{}
+
+			DriverLocBatch(const JsonValue& json) :
+				DriverLocBatch(ParseLocs(json))
+			{}
+
+			DriverLocBatch(BinaryReader& reader) :
+				DriverLocBatch(ParseLocs(reader))
+			{}
+
+			~DriverLocBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<DriverLoc>& GetLocs() const { return m_locs; }
+
+		private:
+			std::vector<DriverLoc> m_locs;
+		};
+
+		/**
+		 * \brief	Reply to DriverLocBatch; the i-th best matches are for the i-th location.
+		 */
+		class BestMatchesBatch : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelMatches[] = "Mats";
+
+			static std::vector<BestMatches> ParseMatches(const JsonValue& json);
+			static std::vector<BestMatches> ParseMatches(BinaryReader& reader);
+
+		public:
+			BestMatchesBatch() = delete;
+			BestMatchesBatch(const std::vector<BestMatches>& matches) :
+				m_matches(matches)
+			{}
+
+			BestMatchesBatch(std::vector<BestMatches>&& matches) :
+				m_matches(std::forward<std::vector<BestMatches> >(matches))
+			{}
+
+			BestMatchesBatch(const BestMatchesBatch& rhs) :
+				BestMatchesBatch(rhs.m_matches)
+			{}
+
+			BestMatchesBatch(BestMatchesBatch&& rhs) :
+				BestMatchesBatch(std::forward<std::vector<BestMatches> >(rhs.m_matches))
+			{}
+
+			BestMatchesBatch(const JsonValue& json) :
+				BestMatchesBatch(ParseMatches(json))
+			{}
+
+			BestMatchesBatch(BinaryReader& reader) :
+				BestMatchesBatch(ParseMatches(reader))
+			{}
+
+			~BestMatchesBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<BestMatches>& GetMatches() const { return m_matches; }
+
+		private:
+			std::vector<BestMatches> m_matches;
+		};
+
+		class DriQueryLog : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelDriverId[] = "DriverId";
@@ -719,13 +1284,13 @@ namespace RideShare
 		public:
 			DriQueryLog() = delete;
 
-			DriQueryLog(const std::string& driverId, const Point2D<double>& loc) :
+			DriQueryLog(const ClientId& driverId, const Point2D<double>& loc) :
 				m_driverId(driverId),
 				m_loc(loc)
 			{}
 
-			DriQueryLog(std::string&& driverId, Point2D<double>&& loc) :
-				m_driverId(std::forward<std::string>(driverId)),
+			DriQueryLog(const ClientId& driverId, Point2D<double>&& loc) :
+				m_driverId(driverId),
 				m_loc(std::forward<Point2D<double> >(loc))
 			{}
 
@@ -734,80 +1299,233 @@ namespace RideShare
 			{}
 
 			DriQueryLog(DriQueryLog&& rhs) :
-				DriQueryLog(std::forward<std::string>(rhs.m_driverId),
+				DriQueryLog(rhs.m_driverId,
 					std::forward<Point2D<double> >(rhs.m_loc))
 			{}
 
 			DriQueryLog(const JsonValue& json) :
-				DriQueryLog(ParseValue<std::string>(json, sk_labelDriverId),
+				DriQueryLog(ClientId::Parse(ParseValue<std::string>(json, sk_labelDriverId)),
 					ParseSubMessage<Point2D<double> >(json, sk_labelLoc))
 			{}
 
+			DriQueryLog(BinaryReader& reader) :
+				m_driverId(reader.Read<ClientId::HashType>()),
+				m_loc(reader)
+			{}
+
 			~DriQueryLog() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
-			const std::string& GetDriverId() const { return m_driverId; }
+			const ClientId& GetDriverId() const { return m_driverId; }
 			const Point2D<double>& GetLoc() const { return m_loc; }
 
 		private:
-			std::string m_driverId;
+			ClientId m_driverId;
 			Point2D<double> m_loc;
 		};
 
-		class FinalBill : virtual public Decent::Net::CommonJsonMsg
+		/**
+		 * \brief	The query logs of a batch of driver locations, sent by a gateway (e.g., of a fleet)
+		 * 			on behalf of its drivers. The drivers are not identified one by one, so the whole
+		 * 			batch is logged under the ID of the gateway.
+		 */
+		class DriQueryLogBatch : virtual public WireMsg
 		{
 		public:
+			static constexpr char const sk_labelGatewayId[] = "GatewayId";
+			static constexpr char const sk_labelLocs[] = "Locs";
+
+			static std::vector<Point2D<double> > ParseLocs(const JsonValue& json);
+			static std::vector<Point2D<double> > ParseLocs(BinaryReader& reader);
+
+		public:
+			DriQueryLogBatch() = delete;
+
+			DriQueryLogBatch(const ClientId& gatewayId, const std::vector<Point2D<double> >& locs) :
+				m_gatewayId(gatewayId),
+				m_locs(locs)
+			{}
+
+			DriQueryLogBatch(const ClientId& gatewayId, std::vector<Point2D<double> >&& locs) :
+				m_gatewayId(gatewayId),
+				m_locs(std::forward<std::vector<Point2D<double> > >(locs))
+			{}
+
+			DriQueryLogBatch(const DriQueryLogBatch& rhs) :
+				DriQueryLogBatch(rhs.m_gatewayId, rhs.m_locs)
+			{}
+
+			DriQueryLogBatch(DriQueryLogBatch&& rhs) :
+				DriQueryLogBatch(rhs.m_gatewayId,
+					std::forward<std::vector<Point2D<double> > >(rhs.m_locs))
+			{}
+
+			DriQueryLogBatch(const JsonValue& json) :
+				DriQueryLogBatch(ClientId::Parse(ParseValue<std::string>(json, sk_labelGatewayId)),
+					ParseLocs(json))
+			{}
+
+			DriQueryLogBatch(BinaryReader& reader) :
+				m_gatewayId(reader.Read<ClientId::HashType>()),
+				m_locs(ParseLocs(reader))
+			{}
+
+			~DriQueryLogBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const ClientId& GetGatewayId() const { return m_gatewayId; }
+			const std::vector<Point2D<double> >& GetLocs() const { return m_locs; }
+
+		private:
+			ClientId m_gatewayId;
+			std::vector<Point2D<double> > m_locs;
+		};
+
+		/**
+		 * \brief	The outcome of each final bill of a batch, replied by the Payment Services. A bill
+		 * 			that was already settled (i.e., one sent again after its reply was lost) is
+		 * 			replied as settled.
+		 */
+		enum class BillStatus : uint8_t
+		{
+			Settled = 0,
+			//The passenger or the driver isn't registered, or their payment info can't be found.
+			Rejected = 1,
+		};
+
+		class FinalBill : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelTripId[] = "TripId";
 			static constexpr char const sk_labelQuote[] = "Quote";
 			static constexpr char const sk_labelOpPayment[] = "OpPay";
 			static constexpr char const sk_labelDriId[] = "DriId";
+			static constexpr char const sk_labelFare[] = "Fare";
 
 		public:
 			FinalBill() = delete;
 
-			FinalBill(const Quote& quote, const std::string& opPayment, const std::string& driId) :
+			/**
+			 * \brief	Constructor
+			 *
+			 * \param	tripId	The ID of the trip, on which the Payment Services dedupe the bills, so
+			 * 					a bill sent again is only settled once.
+			 * \param	fare  	The fare settled, which is metered from the distance driven, rather
+			 * 					than the price of the quote.
+			 */
+			FinalBill(const std::string& tripId, const Quote& quote, const std::string& opPayment, const ClientId& driId, const double fare) :
+				m_tripId(tripId),
 				m_quote(quote),
 				m_opPay(opPayment),
-				m_driId(driId)
+				m_driId(driId),
+				m_fare(fare)
 			{}
 
-			FinalBill(Quote&& quote, std::string&& opPayment, std::string&& driId) :
+			FinalBill(std::string&& tripId, Quote&& quote, std::string&& opPayment, const ClientId& driId, const double fare) :
+				m_tripId(std::forward<std::string>(tripId)),
 				m_quote(std::forward<Quote>(quote)),
 				m_opPay(std::forward<std::string>(opPayment)),
-				m_driId(std::forward<std::string>(driId))
+				m_driId(driId),
+				m_fare(fare)
 			{}
 
 			FinalBill(const FinalBill& rhs) :
-				FinalBill(rhs.m_quote, rhs.m_opPay, rhs.m_driId)
+				FinalBill(rhs.m_tripId, rhs.m_quote, rhs.m_opPay, rhs.m_driId, rhs.m_fare)
 			{}
 
 			FinalBill(FinalBill&& rhs) :
-				FinalBill(std::forward<Quote>(rhs.m_quote),
+				FinalBill(std::forward<std::string>(rhs.m_tripId),
+					std::forward<Quote>(rhs.m_quote),
 					std::forward<std::string>(rhs.m_opPay),
-					std::forward<std::string>(rhs.m_driId))
+					rhs.m_driId,
+					rhs.m_fare)
 			{}
 
 			FinalBill(const JsonValue& json) :
-				FinalBill(ParseSubMessage<Quote >(json, sk_labelQuote),
+				FinalBill(ParseValue<std::string>(json, sk_labelTripId),
+					ParseSubMessage<Quote >(json, sk_labelQuote),
 					ParseValue<std::string>(json, sk_labelOpPayment),
-					ParseValue<std::string>(json, sk_labelDriId))
+					ClientId::Parse(ParseValue<std::string>(json, sk_labelDriId)),
+					ParseValue<double>(json, sk_labelFare))
+			{}
+
+			FinalBill(BinaryReader& reader) :
+				m_tripId(reader.Read<std::string>()),
+				m_quote(reader),
+				m_opPay(reader.Read<std::string>()),
+				m_driId(reader.Read<ClientId::HashType>()),
+				m_fare(reader.Read<double>())
 			{}
 
 			~FinalBill() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
+			const std::string& GetTripId() const { return m_tripId; }
 			const Quote& GetQuote() const { return m_quote; }
 			const std::string& GetOpPayment() const { return m_opPay; }
-			const std::string& GetDriId() const { return m_driId; }
+			const ClientId& GetDriId() const { return m_driId; }
+			double GetFare() const { return m_fare; }
 
 		private:
+			std::string m_tripId;
 			Quote m_quote;
 			std::string m_opPay;
-			std::string m_driId;
+			ClientId m_driId;
+			double m_fare;
+		};
+
+		class FinalBillBatch : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelBills[] = "Bills";
+
+			static std::vector<FinalBill> ParseBills(const JsonValue& json);
+			static std::vector<FinalBill> ParseBills(BinaryReader& reader);
+
+		public:
+			FinalBillBatch() = delete;
+			FinalBillBatch(const std::vector<FinalBill>& bills) :
+				m_bills(bills)
+			{}
+
+			FinalBillBatch(std::vector<FinalBill>&& bills) :
+				m_bills(std::forward<std::vector<FinalBill> >(bills))
+			{}
+
+			FinalBillBatch(const FinalBillBatch& rhs) :
+				FinalBillBatch(rhs.m_bills)
+			{}
+
+			FinalBillBatch(FinalBillBatch&& rhs) :
+				FinalBillBatch(std::forward<std::vector<FinalBill> >(rhs.m_bills))
+			{}
+
+			FinalBillBatch(const JsonValue& json) :
+				FinalBillBatch(ParseBills(json))
+			{}
+
+			FinalBillBatch(BinaryReader& reader) :
+				FinalBillBatch(ParseBills(reader))
+			{}
+
+			~FinalBillBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<FinalBill>& GetBills() const { return m_bills; }
+
+		private:
+			std::vector<FinalBill> m_bills;
 		};
 
-		class PasReg : virtual public Decent::Net::CommonJsonMsg
+		class PasReg : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelContact[] = "Contact";
@@ -845,9 +1563,16 @@ namespace RideShare
 					ParseValue<std::string>(json, sk_labelCsr))
 			{}
 
+			PasReg(BinaryReader& reader) :
+				m_contact(reader),
+				m_pay(reader.Read<std::string>()),
+				m_csr(reader.Read<std::string>())
+			{}
+
 			~PasReg() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const PasContact& GetContact() const { return m_contact; }
 			const std::string& GetPayment() const { return m_pay; }
@@ -859,7 +1584,7 @@ namespace RideShare
 			std::string m_csr;
 		};
 
-		class DriReg : virtual public Decent::Net::CommonJsonMsg
+		class DriReg : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelContact[] = "Contact";
@@ -902,9 +1627,17 @@ namespace RideShare
 					ParseValue<std::string>(json, sk_labelDriLic))
 			{}
 
+			DriReg(BinaryReader& reader) :
+				m_contact(reader),
+				m_pay(reader.Read<std::string>()),
+				m_csr(reader.Read<std::string>()),
+				m_driLic(reader.Read<std::string>())
+			{}
+
 			~DriReg() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const DriContact& GetContact() const { return m_contact; }
 			const std::string& GetPayment() const { return m_pay; }
@@ -918,7 +1651,7 @@ namespace RideShare
 			std::string m_driLic;
 		};
 
-		class RequestedPayment : virtual public Decent::Net::CommonJsonMsg
+		class RequestedPayment : virtual public WireMsg
 		{
 		public:
 			static constexpr char const sk_labelPayment[] = "Pay";
@@ -951,9 +1684,15 @@ namespace RideShare
 					ParseValue<std::string>(json, sk_labelOpPaymnet))
 			{}
 
+			RequestedPayment(BinaryReader& reader) :
+				m_pay(reader.Read<std::string>()),
+				m_opPay(reader.Read<std::string>())
+			{}
+
 			~RequestedPayment() {}
 
 			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
 
 			const std::string& GetPayemnt() const { return m_pay; }
 			const std::string& GetOpPayment() const { return m_opPay; }
@@ -962,5 +1701,312 @@ namespace RideShare
 			std::string m_pay;
 			std::string m_opPay;
 		};
+
+		class PayInfoQueryBatch : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelIds[] = "Ids";
+			static constexpr char const sk_labelId[] = "Id";
+
+			static std::vector<ClientId> ParseIds(const JsonValue& json);
+			static std::vector<ClientId> ParseIds(BinaryReader& reader);
+
+		public:
+			PayInfoQueryBatch() = delete;
+			PayInfoQueryBatch(const std::vector<ClientId>& ids) :
+				m_ids(ids)
+			{}
+
+			PayInfoQueryBatch(std::vector<ClientId>&& ids) :
+				m_ids(std::forward<std::vector<ClientId> >(ids))
+			{}
+
+			PayInfoQueryBatch(const PayInfoQueryBatch& rhs) :
+				PayInfoQueryBatch(rhs.m_ids)
+			{}
+
+			PayInfoQueryBatch(PayInfoQueryBatch&& rhs) :
+				PayInfoQueryBatch(std::forward<std::vector<ClientId> >(rhs.m_ids))
+			{}
+
+			PayInfoQueryBatch(const JsonValue& json) :
+				PayInfoQueryBatch(ParseIds(json))
+			{}
+
+			PayInfoQueryBatch(BinaryReader& reader) :
+				PayInfoQueryBatch(ParseIds(reader))
+			{}
+
+			~PayInfoQueryBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<ClientId>& GetIds() const { return m_ids; }
+
+		private:
+			std::vector<ClientId> m_ids;
+		};
+
+		/**
+		 * \brief	Reply to PayInfoQueryBatch; the i-th payment info is for the i-th client, and it's
+		 * 			empty if the client isn't registered.
+		 */
+		class RequestedPaymentBatch : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelPayments[] = "Pays";
+			static constexpr char const sk_labelOpPayment[] = "OpPay";
+
+			static std::vector<std::string> ParsePayments(const JsonValue& json);
+			static std::vector<std::string> ParsePayments(BinaryReader& reader);
+
+		public:
+			RequestedPaymentBatch() = delete;
+
+			RequestedPaymentBatch(const std::vector<std::string>& payments, const std::string& opPayment) :
+				m_pays(payments),
+				m_opPay(opPayment)
+			{}
+
+			RequestedPaymentBatch(std::vector<std::string>&& payments, std::string&& opPayment) :
+				m_pays(std::forward<std::vector<std::string> >(payments)),
+				m_opPay(std::forward<std::string>(opPayment))
+			{}
+
+			RequestedPaymentBatch(const RequestedPaymentBatch& rhs) :
+				RequestedPaymentBatch(rhs.m_pays, rhs.m_opPay)
+			{}
+
+			RequestedPaymentBatch(RequestedPaymentBatch&& rhs) :
+				RequestedPaymentBatch(std::forward<std::vector<std::string> >(rhs.m_pays),
+					std::forward<std::string>(rhs.m_opPay))
+			{}
+
+			RequestedPaymentBatch(const JsonValue& json) :
+				RequestedPaymentBatch(ParsePayments(json),
+					ParseValue<std::string>(json, sk_labelOpPayment))
+			{}
+
+			RequestedPaymentBatch(BinaryReader& reader) :
+				m_pays(ParsePayments(reader)),
+				m_opPay(reader.Read<std::string>())
+			{}
+
+			~RequestedPaymentBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<std::string>& GetPayments() const { return m_pays; }
+			const std::string& GetOpPayment() const { return m_opPay; }
+
+		private:
+			std::vector<std::string> m_pays;
+			std::string m_opPay;
+		};
+
+		/**
+		 * \brief	The number of events in a cell of a grid, given by the indexes of the cell.
+		 */
+		class CellCount : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelX[] = "X";
+			static constexpr char const sk_labelY[] = "Y";
+			static constexpr char const sk_labelCount[] = "Count";
+
+		public:
+			CellCount() = delete;
+
+			CellCount(const int32_t x, const int32_t y, const uint32_t count) :
+				m_x(x),
+				m_y(y),
+				m_count(count)
+			{}
+
+			CellCount(const CellCount& rhs) :
+				CellCount(rhs.m_x, rhs.m_y, rhs.m_count)
+			{}
+
+			CellCount(const JsonValue& json) :
+				CellCount(ParseValue<int>(json, sk_labelX),
+					ParseValue<int>(json, sk_labelY),
+					static_cast<uint32_t>(ParseValue<int>(json, sk_labelCount)))
+			{}
+
+			CellCount(BinaryReader& reader) :
+				m_x(reader.Read<int32_t>()),
+				m_y(reader.Read<int32_t>()),
+				m_count(reader.Read<uint32_t>())
+			{}
+
+			~CellCount() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			int32_t GetX() const { return m_x; }
+			int32_t GetY() const { return m_y; }
+			uint32_t GetCount() const { return m_count; }
+
+		private:
+			int32_t m_x;
+			int32_t m_y;
+			uint32_t m_count;
+		};
+
+		class CellCountBatch : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelCells[] = "Cells";
+
+			static std::vector<CellCount> ParseCells(const JsonValue& json);
+			static std::vector<CellCount> ParseCells(BinaryReader& reader);
+
+		public:
+			CellCountBatch() = delete;
+
+			CellCountBatch(const std::vector<CellCount>& cells) :
+				m_cells(cells)
+			{}
+
+			CellCountBatch(std::vector<CellCount>&& cells) :
+				m_cells(std::forward<std::vector<CellCount> >(cells))
+			{}
+
+			CellCountBatch(const CellCountBatch& rhs) :
+				CellCountBatch(rhs.m_cells)
+			{}
+
+			CellCountBatch(CellCountBatch&& rhs) :
+				CellCountBatch(std::forward<std::vector<CellCount> >(rhs.m_cells))
+			{}
+
+			CellCountBatch(const JsonValue& json) :
+				CellCountBatch(ParseCells(json))
+			{}
+
+			CellCountBatch(BinaryReader& reader) :
+				CellCountBatch(ParseCells(reader))
+			{}
+
+			~CellCountBatch() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::vector<CellCount>& GetCells() const { return m_cells; }
+
+		private:
+			std::vector<CellCount> m_cells;
+		};
+
+		/**
+		 * \brief	A part of the trace of a trip, i.e., the locations streamed by the driver during the
+		 * 			trip. The coordinates are fixed-point, in units of sk_resolution; the first point is
+		 * 			absolute, and each following one is given by its delta from the previous point, so
+		 * 			the binary format only takes a few bytes per point.
+		 */
+		class TripTrace : virtual public WireMsg
+		{
+		public:
+			static constexpr char const sk_labelTripId[] = "TripId";
+			static constexpr char const sk_labelOri[] = "Ori";
+			static constexpr char const sk_labelDeltas[] = "Deltas";
+			static constexpr char const sk_labelX[] = "X";
+			static constexpr char const sk_labelY[] = "Y";
+
+			static constexpr double sk_resolution = 1e-5;
+			//The largest magnitude of a coordinate.
+			static constexpr double sk_maxCoord = 1e9;
+
+			struct Delta
+			{
+				int32_t m_dx;
+				int32_t m_dy;
+			};
+
+			/**
+			 * \brief	Converts a coordinate to the fixed-point.
+			 *
+			 * \exception	MessageException	Thrown when the coordinate is not finite, or its
+			 * 									magnitude is larger than sk_maxCoord.
+			 */
+			static int64_t ToFixed(const double val);
+
+			static double ToCoord(const int64_t val) { return val * sk_resolution; }
+
+			static std::vector<Delta> ParseDeltas(const JsonValue& json);
+			static std::vector<Delta> ParseDeltas(BinaryReader& reader);
+
+		public:
+			TripTrace() = delete;
+
+			/**
+			 * \brief	Encodes the points, which must not be empty.
+			 *
+			 * \exception	MessageException	Thrown when a point is out of range, or two points in
+			 * 									a row are too far apart to be encoded.
+			 */
+			TripTrace(const std::string& tripId, const std::vector<Point2D<double> >& points);
+
+			TripTrace(const std::string& tripId, const int64_t oriX, const int64_t oriY, const std::vector<Delta>& deltas) :
+				m_tripId(tripId),
+				m_oriX(oriX),
+				m_oriY(oriY),
+				m_deltas(deltas)
+			{}
+
+			TripTrace(std::string&& tripId, const int64_t oriX, const int64_t oriY, std::vector<Delta>&& deltas) :
+				m_tripId(std::forward<std::string>(tripId)),
+				m_oriX(oriX),
+				m_oriY(oriY),
+				m_deltas(std::forward<std::vector<Delta> >(deltas))
+			{}
+
+			TripTrace(const TripTrace& rhs) :
+				TripTrace(rhs.m_tripId, rhs.m_oriX, rhs.m_oriY, rhs.m_deltas)
+			{}
+
+			TripTrace(TripTrace&& rhs) :
+				TripTrace(std::forward<std::string>(rhs.m_tripId), rhs.m_oriX, rhs.m_oriY,
+					std::forward<std::vector<Delta> >(rhs.m_deltas))
+			{}
+
+			TripTrace(const JsonValue& json) :
+				TripTrace(ParseValue<std::string>(json, sk_labelTripId),
+					ParseSubMessage<Point2D<double> >(json, sk_labelOri),
+					ParseDeltas(json))
+			{}
+
+			TripTrace(BinaryReader& reader) :
+				m_tripId(reader.Read<std::string>()),
+				m_oriX(ParseFixed(reader)),
+				m_oriY(ParseFixed(reader)),
+				m_deltas(ParseDeltas(reader))
+			{}
+
+			~TripTrace() {}
+
+			virtual JsonValue& ToJson(JsonDoc& doc) const override;
+			virtual void ToBinary(BinaryWriter& writer) const override;
+
+			const std::string& GetTripId() const { return m_tripId; }
+			int64_t GetOriX() const { return m_oriX; }
+			int64_t GetOriY() const { return m_oriY; }
+			const std::vector<Delta>& GetDeltas() const { return m_deltas; }
+
+		private:
+			//Reads a fixed-point coordinate, rejecting the ones out of range.
+			static int64_t ParseFixed(BinaryReader& reader);
+
+			TripTrace(std::string&& tripId, const Point2D<double>& ori, std::vector<Delta>&& deltas);
+
+			std::string m_tripId;
+			int64_t m_oriX;
+			int64_t m_oriY;
+			std::vector<Delta> m_deltas;
+		};
 	}
 }
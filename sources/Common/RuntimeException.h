@@ -1,19 +1,19 @@
 #pragma once
 
-#include <exception>
 #include <string>
+#include <stdexcept>
 
 namespace RideShare
 {
-	class RuntimeException : public std::exception
+	class RuntimeException : public std::runtime_error
 	{
 	public:
 		explicit RuntimeException(const std::string& what_arg) :
-			std::exception(what_arg.c_str())
+			std::runtime_error(what_arg)
 		{}
 
 		explicit RuntimeException(const char* what_arg) :
-			std::exception(what_arg)
+			std::runtime_error(what_arg)
 		{}
 
 	private:
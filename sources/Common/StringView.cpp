@@ -0,0 +1,16 @@
+#include "StringView.h"
+
+#include <mbedtls/md.h>
+
+#include "RuntimeException.h"
+
+using namespace RideShare;
+
+void RideShare::CalcSha256(Decent::General256Hash& hash, const StringView& data)
+{
+	if (mbedtls_md(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+		reinterpret_cast<const unsigned char*>(data.GetData()), data.GetSize(), hash.data()) != 0)
+	{
+		throw RuntimeException("Failed to calculate the SHA-256 hash.");
+	}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <DecentApi/Common/GeneralKeyTypes.h>
+
+namespace RideShare
+{
+	/**
+	 * \brief	A non-owning reference to a range of characters, e.g., a field inside a receive buffer,
+	 * 			since std::string_view is not available in C++11. The referred buffer must outlive the
+	 * 			view.
+	 */
+	class StringView
+	{
+	public:
+		StringView() :
+			m_data(nullptr),
+			m_size(0)
+		{}
+
+		StringView(const char* data, const size_t size) :
+			m_data(data),
+			m_size(size)
+		{}
+
+		StringView(const std::string& str) :
+			m_data(str.data()),
+			m_size(str.size())
+		{}
+
+		~StringView() {}
+
+		const char* GetData() const { return m_data; }
+		size_t GetSize() const { return m_size; }
+
+		std::string ToString() const { return std::string(m_data, m_size); }
+
+	private:
+		const char* m_data;
+		size_t m_size;
+	};
+
+	/**
+	 * \brief	Calculates the SHA-256 hash of the viewed characters, without copying them into a
+	 * 			string first.
+	 */
+	void CalcSha256(Decent::General256Hash& hash, const StringView& data);
+}
@@ -0,0 +1,121 @@
+#include "VerifiedCertCache.h"
+
+#include <mbedtls/x509_crt.h>
+
+#include <DecentApi/Common/Common.h>
+#include <DecentApi/Common/MbedTls/X509Cert.h>
+#include <DecentApi/Common/Ra/AppX509Cert.h>
+#include <DecentApi/Common/Ra/TlsConfigWithName.h>
+#include <DecentApi/Common/Ra/States.h>
+#include <DecentApi/Common/Ra/CertContainer.h>
+#include <DecentApi/Common/Ra/WhiteList/LoadedList.h>
+
+using namespace RideShare;
+using namespace Decent;
+using namespace Decent::Ra;
+using namespace Decent::MbedTlsObj;
+
+VerifiedCertCache::VerifiedCertCache(const size_t maxSize) :
+	m_maxSize(maxSize),
+	m_mutex(),
+	m_whiteListHash(),
+	m_selfCert(),
+	m_map(),
+	m_lruList()
+{
+}
+
+VerifiedCertCache::~VerifiedCertCache()
+{
+}
+
+std::shared_ptr<const VerifiedCertCache::PubKeyType> VerifiedCertCache::Verify(const StringView& certPem, States& state, const std::string& appName)
+{
+	const General256Hash whiteListHash = CalcWhiteListHash(state);
+	std::shared_ptr<const X509Cert> selfCert = state.GetCertContainer().GetCert();
+
+	KeyType key(General256Hash(), appName);
+	CalcSha256(key.first, certPem);
+
+	{
+		std::unique_lock<std::mutex> cacheLock(m_mutex);
+		CheckStateLocked(whiteListHash, selfCert);
+
+		auto it = m_map.find(key);
+		if (it != m_map.end())
+		{
+			m_lruList.splice(m_lruList.begin(), m_lruList, it->second.second);
+			return it->second.first;
+		}
+	}
+
+	//Not found; do the full verification without holding the lock.
+	AppX509Cert cert(certPem.ToString());
+	TlsConfigWithName tlsCfg(state, TlsConfigWithName::Mode::ServerVerifyPeer, appName, nullptr);
+
+	uint32_t flag;
+	if (mbedtls_x509_crt_verify_with_profile(cert.Get(), nullptr, nullptr,
+		&mbedtls_x509_crt_profile_suiteb, nullptr, &flag, &TlsConfigWithName::CertVerifyCallBack, &tlsCfg) != MBEDTLS_SUCCESS_RET ||
+		flag != MBEDTLS_SUCCESS_RET)
+	{
+		return nullptr;
+	}
+
+	std::shared_ptr<const PubKeyType> pubKey = std::make_shared<PubKeyType>(cert.GetCurrPublicKey());
+
+	std::unique_lock<std::mutex> cacheLock(m_mutex);
+	if (!CheckStateLocked(whiteListHash, selfCert) || m_maxSize == 0)
+	{
+		//The state has changed during the verification; the result is only good for this call.
+		return pubKey;
+	}
+
+	auto it = m_map.find(key);
+	if (it != m_map.end())
+	{
+		//Someone else has just added it.
+		return it->second.first;
+	}
+
+	if (m_map.size() >= m_maxSize)
+	{
+		m_map.erase(m_lruList.back());
+		m_lruList.pop_back();
+	}
+
+	m_lruList.push_front(key);
+	m_map.insert(std::make_pair(key, std::make_pair(pubKey, m_lruList.begin())));
+
+	return pubKey;
+}
+
+General256Hash VerifiedCertCache::CalcWhiteListHash(States& state)
+{
+	//Each entry is (enclave hash, App name), and each field is ended by a NUL, so different lists
+	//  can't serialize to the same string.
+	std::string serialized;
+	for (const auto& item : state.GetLoadedWhiteList().GetMap())
+	{
+		serialized.append(item.first).push_back('\0');
+		serialized.append(item.second).push_back('\0');
+	}
+
+	General256Hash hash;
+	CalcSha256(hash, serialized);
+	return hash;
+}
+
+bool VerifiedCertCache::CheckStateLocked(const General256Hash& whiteListHash, const std::shared_ptr<const X509Cert>& selfCert)
+{
+	if (m_whiteListHash == whiteListHash && m_selfCert == selfCert)
+	{
+		return true;
+	}
+
+	m_map.clear();
+	m_lruList.clear();
+	m_whiteListHash = whiteListHash;
+	m_selfCert = selfCert;
+
+	return false;
+}
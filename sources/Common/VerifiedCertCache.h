@@ -0,0 +1,83 @@
+#pragma once
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <DecentApi/Common/GeneralKeyTypes.h>
+#include <DecentApi/Common/MbedTls/EcKey.h>
+
+#include "StringView.h"
+
+namespace Decent
+{
+	namespace MbedTlsObj
+	{
+		class X509Cert;
+	}
+
+	namespace Ra
+	{
+		class States;
+	}
+}
+
+namespace RideShare
+{
+	/**
+	 * \brief	A bounded (LRU) cache of App certificates that have passed the verification against the
+	 * 			Decent Server and the whitelist. Entries are keyed by the hash of the certificate PEM
+	 * 			and the expected App name, and keep the parsed public key; thus, verifying a repeated
+	 * 			certificate costs a hash calculation and a lookup. The whole cache is dropped once the
+	 * 			content of the loaded whitelist (compared by its hash, so an in-place update is caught
+	 * 			too) or our own certificate in the state changes. Only successful results are cached,
+	 * 			so a flood of invalid certificates can't evict the valid ones.
+	 */
+	class VerifiedCertCache
+	{
+	public:
+		typedef Decent::MbedTlsObj::EcPublicKey<Decent::MbedTlsObj::EcKeyType::SECP256R1> PubKeyType;
+
+	public:
+		VerifiedCertCache() = delete;
+
+		explicit VerifiedCertCache(const size_t maxSize);
+
+		VerifiedCertCache(const VerifiedCertCache& rhs) = delete;
+		VerifiedCertCache(VerifiedCertCache&& rhs) = delete;
+
+		~VerifiedCertCache();
+
+		/**
+		 * \brief	Verifies the App certificate, or looks up a previous verification result.
+		 *
+		 * \param	certPem	The certificate in PEM.
+		 * \param	state  	The Decent state.
+		 * \param	appName	The name of the App that the certificate should belong to.
+		 *
+		 * \return	The public key in the certificate, or nullptr if the verification failed.
+		 */
+		std::shared_ptr<const PubKeyType> Verify(const StringView& certPem, Decent::Ra::States& state, const std::string& appName);
+
+	private:
+		typedef std::pair<Decent::General256Hash, std::string> KeyType;
+		typedef std::list<KeyType> LruListType;
+		typedef std::map<KeyType, std::pair<std::shared_ptr<const PubKeyType>, LruListType::iterator> > MapType;
+
+		static Decent::General256Hash CalcWhiteListHash(Decent::Ra::States& state);
+
+		//Returns true if the cache was made with the same whitelist and certificate; otherwise, the cache is dropped.
+		bool CheckStateLocked(const Decent::General256Hash& whiteListHash, const std::shared_ptr<const Decent::MbedTlsObj::X509Cert>& selfCert);
+
+		const size_t m_maxSize;
+
+		std::mutex m_mutex;
+		Decent::General256Hash m_whiteListHash;
+		std::shared_ptr<const Decent::MbedTlsObj::X509Cert> m_selfCert;
+		MapType m_map;
+		LruListType m_lruList;
+	};
+}
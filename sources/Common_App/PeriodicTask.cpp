@@ -0,0 +1,53 @@
+#include "PeriodicTask.h"
+
+#include <DecentApi/Common/Common.h>
+
+using namespace RideShare;
+
+PeriodicTask::PeriodicTask(const std::string& name, const std::chrono::milliseconds& interval, std::function<void()> task) :
+	m_name(name),
+	m_interval(interval),
+	m_task(std::move(task)),
+	m_mutex(),
+	m_cond(),
+	m_isTerminated(false),
+	m_thread(&PeriodicTask::Run, this)
+{
+}
+
+PeriodicTask::~PeriodicTask()
+{
+	Stop();
+}
+
+void PeriodicTask::Stop()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_isTerminated = true;
+	}
+	m_cond.notify_all();
+
+	if (m_thread.joinable())
+	{
+		m_thread.join();
+	}
+}
+
+void PeriodicTask::Run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_cond.wait_for(lock, m_interval, [this]() { return m_isTerminated; }))
+	{
+		lock.unlock();
+		try
+		{
+			m_task();
+		}
+		catch (const std::exception& e)
+		{
+			PRINT_W("Failed to %s. Error Msg: %s", m_name.c_str(), e.what());
+		}
+		lock.lock();
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+namespace RideShare
+{
+	/**
+	 * \brief	Runs a task (e.g., the time ticks of an enclave) on its own thread, once every
+	 * 			interval, until it's stopped. An exception thrown by the task is logged, and the
+	 * 			task keeps running at the next interval.
+	 */
+	class PeriodicTask
+	{
+	public:
+		PeriodicTask() = delete;
+
+		/**
+		 * \brief	Constructor. The thread is started right away; the first run is after one
+		 * 			interval.
+		 *
+		 * \param	name		The name of the task, used in the log, e.g., "update the time".
+		 * \param	interval	The interval between the runs.
+		 * \param	task		The task.
+		 */
+		PeriodicTask(const std::string& name, const std::chrono::milliseconds& interval, std::function<void()> task);
+
+		PeriodicTask(const PeriodicTask& rhs) = delete;
+		PeriodicTask(PeriodicTask&& rhs) = delete;
+
+		/** \brief	Destructor. Stops the task, if it's not stopped yet. */
+		~PeriodicTask();
+
+		/**
+		 * \brief	Stops the task, and waits for the current run, if any, to finish. Calling it
+		 * 			again does nothing.
+		 */
+		void Stop();
+
+	private:
+		void Run();
+
+		const std::string m_name;
+		const std::chrono::milliseconds m_interval;
+		std::function<void()> m_task;
+
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		bool m_isTerminated;
+
+		//Started last, once the rest is constructed.
+		std::thread m_thread;
+	};
+}
@@ -4,11 +4,14 @@ namespace RideShare
 {
 	namespace RequestCategory
 	{
-		constexpr char const sk_fromDriver[]      = "RideShare::FromDriver";
-		constexpr char const sk_fromPassenger[]   = "RideShare::FromPassenger";
+		constexpr char const sk_fromDriver[]       = "RideShare::FromDriver";
+		constexpr char const sk_fromPassenger[]    = "RideShare::FromPassenger";
 
-		constexpr char const sk_fromPayment[]     = "RideShare::FromPayment";
-		constexpr char const sk_fromTripPlaner[]  = "RideShare::FromTripPlaner";
-		constexpr char const sk_fromTripMatcher[] = "RideShare::FromTripMatcher";
+		constexpr char const sk_fromPayment[]      = "RideShare::FromPayment";
+		constexpr char const sk_fromBilling[]      = "RideShare::FromBilling";
+		constexpr char const sk_fromTripPlaner[]   = "RideShare::FromTripPlaner";
+		constexpr char const sk_fromTripMatcher[]  = "RideShare::FromTripMatcher";
+		constexpr char const sk_fromPassengerMgm[] = "RideShare::FromPassengerMgm";
+		constexpr char const sk_fromDriverMgm[]    = "RideShare::FromDriverMgm";
 	}
 }
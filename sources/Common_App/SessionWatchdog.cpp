@@ -0,0 +1,84 @@
+#include "SessionWatchdog.h"
+
+#include <DecentApi/Common/Net/ConnectionBase.h>
+
+using namespace RideShare;
+
+namespace
+{
+	//Well above the time a client takes to send its next request within a step, e.g., between the
+	//  traces it streams; the clients open a new session for each step of a ride, since they may
+	//  pause for any time between the steps (e.g., for the whole ride).
+	const std::chrono::seconds gsk_defaultIdleTimeout(30);
+}
+
+extern "C" void ocall_ride_share_session_touch(void* cnt)
+{
+	SessionWatchdog::GetInstance().Touch(cnt);
+}
+
+SessionWatchdog::Session::Session(SessionWatchdog& watchdog, Decent::Net::ConnectionBase& connection) :
+	m_watchdog(watchdog),
+	m_connection(connection)
+{
+	std::unique_lock<std::mutex> sessionsLock(m_watchdog.m_mutex);
+	m_watchdog.m_sessions[&m_connection] = ClockType::now();
+}
+
+SessionWatchdog::Session::~Session()
+{
+	std::unique_lock<std::mutex> sessionsLock(m_watchdog.m_mutex);
+	m_watchdog.m_sessions.erase(&m_connection);
+}
+
+SessionWatchdog& SessionWatchdog::GetInstance()
+{
+	static SessionWatchdog inst(gsk_defaultIdleTimeout);
+	return inst;
+}
+
+SessionWatchdog::SessionWatchdog(const std::chrono::seconds& idleTimeout) :
+	m_idleTimeout(idleTimeout),
+	m_mutex(),
+	m_sessions()
+{
+}
+
+SessionWatchdog::~SessionWatchdog()
+{
+}
+
+void SessionWatchdog::Touch(void* connection)
+{
+	std::unique_lock<std::mutex> sessionsLock(m_mutex);
+	auto it = m_sessions.find(static_cast<Decent::Net::ConnectionBase*>(connection));
+	if (it != m_sessions.end())
+	{
+		it->second = ClockType::now();
+	}
+}
+
+size_t SessionWatchdog::CloseIdle()
+{
+	const ClockType::time_point now = ClockType::now();
+	size_t numClosed = 0;
+
+	//The lock is held while terminating, so the session ecall can't return, and the connection
+	//  can't be freed, in the meantime.
+	std::unique_lock<std::mutex> sessionsLock(m_mutex);
+	for (auto it = m_sessions.begin(); it != m_sessions.end();)
+	{
+		if (now - it->second > m_idleTimeout)
+		{
+			it->first->Terminate();
+			it = m_sessions.erase(it);
+			++numClosed;
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	return numClosed;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <chrono>
+
+namespace Decent
+{
+	namespace Net
+	{
+		class ConnectionBase;
+	}
+}
+
+namespace RideShare
+{
+	/**
+	 * \brief	Ends the client sessions that stay idle too long. A session ecall (e.g., the one
+	 * 			serving a passenger) holds a listen thread and a TCS slot while it waits for the next
+	 * 			request, so a few idle clients could starve everyone else. The enclave touches its
+	 * 			session after each request (through ocall_ride_share_session_touch), and CloseIdle,
+	 * 			run periodically, terminates the connections not touched within the idle timeout;
+	 * 			the pending receive in the enclave then fails, and the session ends.
+	 */
+	class SessionWatchdog
+	{
+	public:
+		/**
+		 * \brief	Watches a connection while a session ecall is serving it.
+		 */
+		class Session
+		{
+		public:
+			Session() = delete;
+
+			Session(SessionWatchdog& watchdog, Decent::Net::ConnectionBase& connection);
+
+			Session(const Session& rhs) = delete;
+			Session(Session&& rhs) = delete;
+
+			~Session();
+
+		private:
+			SessionWatchdog& m_watchdog;
+			Decent::Net::ConnectionBase& m_connection;
+		};
+
+		/** \brief	Gets the watchdog of this process, which the enclave's touches go to. */
+		static SessionWatchdog& GetInstance();
+
+	public:
+		SessionWatchdog() = delete;
+
+		SessionWatchdog(const std::chrono::seconds& idleTimeout);
+
+		SessionWatchdog(const SessionWatchdog& rhs) = delete;
+		SessionWatchdog(SessionWatchdog&& rhs) = delete;
+
+		~SessionWatchdog();
+
+		/** \brief	Marks the session of the connection as active now; ignored if it isn't watched. */
+		void Touch(void* connection);
+
+		/**
+		 * \brief	Terminates the connections of the sessions idle for longer than the timeout.
+		 *
+		 * \return	The number of sessions closed.
+		 */
+		size_t CloseIdle();
+
+	private:
+		typedef std::chrono::steady_clock ClockType;
+
+		const std::chrono::seconds m_idleTimeout;
+
+		std::mutex m_mutex;
+		//Connection => last time the session was active.
+		std::map<Decent::Net::ConnectionBase*, ClockType::time_point> m_sessions;
+	};
+}
@@ -0,0 +1,175 @@
+#include "CellEventCounter.h"
+
+#include <cmath>
+
+using namespace RideShare;
+
+int32_t CellEventCounter::ToCellIndex(const double val, const double cellSize)
+{
+	const double idx = std::floor(val / cellSize);
+	//Clamp to the 32-bit range (and map NaN to the lowest cell), so it's safe to cast.
+	if (!(idx > INT32_MIN))
+	{
+		return INT32_MIN;
+	}
+	if (idx > INT32_MAX)
+	{
+		return INT32_MAX;
+	}
+	return static_cast<int32_t>(idx);
+}
+
+uint64_t CellEventCounter::CombineCellIndex(const int32_t cx, const int32_t cy)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+}
+
+CellEventCounter::CellEventCounter(const double cellSize, const uint64_t bucketLen, const size_t maxNumCells, const size_t maxNumSources) :
+	m_cellSize(cellSize),
+	m_bucketLen(bucketLen > 0 ? bucketLen : 1),
+	m_maxNumCells(maxNumCells),
+	m_maxNumSources(maxNumSources),
+	m_mutex(),
+	m_cells(),
+	m_sources()
+{
+}
+
+CellEventCounter::~CellEventCounter()
+{
+}
+
+void CellEventCounter::Add(const ComMsg::Point2D<double>& loc, const ClientId& source, const uint64_t currTime)
+{
+	const uint64_t bucketIdx = currTime / m_bucketLen;
+
+	std::unique_lock<std::mutex> cellsLock(m_mutex);
+
+	if (!IsSourceNew(source, bucketIdx))
+	{
+		return;
+	}
+
+	Count(loc, bucketIdx);
+	m_sources[source] = bucketIdx;
+}
+
+void CellEventCounter::AddBatch(const std::vector<ComMsg::Point2D<double> >& locs, const ClientId& source, const uint64_t currTime)
+{
+	const uint64_t bucketIdx = currTime / m_bucketLen;
+
+	std::unique_lock<std::mutex> cellsLock(m_mutex);
+
+	if (!IsSourceNew(source, bucketIdx))
+	{
+		return;
+	}
+
+	for (const ComMsg::Point2D<double>& loc : locs)
+	{
+		Count(loc, bucketIdx);
+	}
+	m_sources[source] = bucketIdx;
+}
+
+std::vector<ComMsg::CellCount> CellEventCounter::GetCounts(const uint64_t currTime)
+{
+	const uint64_t bucketIdx = currTime / m_bucketLen;
+
+	std::vector<ComMsg::CellCount> res;
+
+	std::unique_lock<std::mutex> cellsLock(m_mutex);
+	PruneSources(bucketIdx);
+	res.reserve(m_cells.size());
+
+	for (auto it = m_cells.begin(); it != m_cells.end(); )
+	{
+		Cell& cell = it->second;
+		for (size_t i = 0; i < SurgeGrid::sk_numBuckets; ++i)
+		{
+			if (cell.m_counts[i] > 0 && cell.m_bucketIdx[i] + SurgeGrid::sk_numBuckets <= bucketIdx)
+			{
+				cell.m_total -= cell.m_counts[i];
+				cell.m_counts[i] = 0;
+			}
+		}
+
+		if (cell.m_total == 0)
+		{
+			it = m_cells.erase(it);
+			continue;
+		}
+
+		res.push_back(ComMsg::CellCount(static_cast<int32_t>(it->first >> 32), static_cast<int32_t>(it->first & 0xFFFFFFFF), cell.m_total));
+		++it;
+	}
+
+	return res;
+}
+
+void CellEventCounter::PruneSources(const uint64_t bucketIdx)
+{
+	for (auto it = m_sources.begin(); it != m_sources.end(); )
+	{
+		if (it->second + SurgeGrid::sk_numBuckets <= bucketIdx)
+		{
+			it = m_sources.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+bool CellEventCounter::IsSourceNew(const ClientId& source, const uint64_t bucketIdx)
+{
+	auto it = m_sources.find(source);
+	if (it != m_sources.end())
+	{
+		return it->second + SurgeGrid::sk_numBuckets <= bucketIdx;
+	}
+
+	if (m_sources.size() >= m_maxNumSources)
+	{
+		PruneSources(bucketIdx);
+	}
+	return m_sources.size() < m_maxNumSources;
+}
+
+void CellEventCounter::Count(const ComMsg::Point2D<double>& loc, const uint64_t bucketIdx)
+{
+	const uint64_t key = CombineCellIndex(ToCellIndex(loc.GetX(), m_cellSize), ToCellIndex(loc.GetY(), m_cellSize));
+	const size_t slot = static_cast<size_t>(bucketIdx % SurgeGrid::sk_numBuckets);
+
+	auto it = m_cells.find(key);
+	if (it == m_cells.end())
+	{
+		if (m_cells.size() >= m_maxNumCells)
+		{
+			return;
+		}
+		it = m_cells.insert(std::make_pair(key, Cell())).first;
+		Cell& newCell = it->second;
+		for (size_t i = 0; i < SurgeGrid::sk_numBuckets; ++i)
+		{
+			newCell.m_bucketIdx[i] = 0;
+			newCell.m_counts[i] = 0;
+		}
+		newCell.m_total = 0;
+	}
+
+	Cell& cell = it->second;
+	if (cell.m_bucketIdx[slot] < bucketIdx)
+	{
+		//The slot was counting a bucket that is out of the window by now.
+		cell.m_total -= cell.m_counts[slot];
+		cell.m_counts[slot] = 0;
+		cell.m_bucketIdx[slot] = bucketIdx;
+	}
+	//Otherwise, it's the current bucket; or the time has just moved on, in which case the event is
+	//  counted in the newer bucket.
+
+	++cell.m_counts[slot];
+	++cell.m_total;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "../Common/ClientId.h"
+#include "../Common/RideSharingMessages.h"
+
+namespace RideShare
+{
+	/**
+	 * \brief	The grid shared by the demand and supply counters of the management services, and the
+	 * 			surge multipliers of the Billing Services.
+	 */
+	namespace SurgeGrid
+	{
+		constexpr double sk_cellSize = 1.0;
+
+		//A sliding window of 10 minutes, in buckets of a minute.
+		constexpr uint64_t sk_bucketLen = 60;
+		constexpr size_t sk_numBuckets = 10;
+
+		//The counters live in the 1 MB heap of the management enclaves, so each is kept under about
+		//  200 KB: a cell takes about 160 bytes (with the overhead of the map), and a source about
+		//  80 bytes. 512 cells cover the busy part of a city; events in other cells are dropped,
+		//  so they are never surged.
+		constexpr size_t sk_maxNumCells = 512;
+		//Distinct sources (i.e., passengers or drivers) counted per window.
+		constexpr size_t sk_maxNumSources = 1024;
+	}
+
+	/**
+	 * \brief	Counts events (e.g., the quotes requested, or the drivers looking for matches) in each
+	 * 			cell of a grid, over a sliding time window. The window is split into buckets; each cell
+	 * 			keeps a count per bucket, and a running total, so adding an event is O(1). A bucket is
+	 * 			reset when it's reused, and the buckets fallen out of the window are dropped from the
+	 * 			totals when the counts are read. A source is counted at most once per window, so a
+	 * 			single client repeating its requests can't inflate the counts.
+	 */
+	class CellEventCounter
+	{
+	public:
+		/**
+		 * \brief	Converts a coordinate to the index of its cell, clamped to the 32-bit range.
+		 */
+		static int32_t ToCellIndex(const double val, const double cellSize);
+
+		/**
+		 * \brief	Combines the indices of a cell (on X and Y) into a single key.
+		 */
+		static uint64_t CombineCellIndex(const int32_t cx, const int32_t cy);
+
+	public:
+		CellEventCounter() = delete;
+
+		/**
+		 * \brief	Constructor
+		 *
+		 * \param	cellSize   	The size of the grid cells.
+		 * \param	bucketLen  	The length (in seconds) of a bucket.
+		 * \param	maxNumCells  	The maximum number of cells counted at once; events in other
+		 * 							cells are dropped until some cells are idle for a whole window.
+		 * \param	maxNumSources	The maximum number of distinct sources counted in a window;
+		 * 							events from other sources are dropped until some fall out of it.
+		 */
+		CellEventCounter(const double cellSize, const uint64_t bucketLen, const size_t maxNumCells, const size_t maxNumSources);
+
+		CellEventCounter(const CellEventCounter& rhs) = delete;
+		CellEventCounter(CellEventCounter&& rhs) = delete;
+
+		~CellEventCounter();
+
+		/**
+		 * \brief	Counts an event from the source at the location, unless the source is already
+		 * 			counted within the window.
+		 */
+		void Add(const ComMsg::Point2D<double>& loc, const ClientId& source, const uint64_t currTime);
+
+		/**
+		 * \brief	Counts an event at each of the locations, from a source speaking for many (e.g., a
+		 * 			gateway of a fleet, whose drivers are not identified one by one). The batch is
+		 * 			counted as a whole, unless the source is already counted within the window.
+		 */
+		void AddBatch(const std::vector<ComMsg::Point2D<double> >& locs, const ClientId& source, const uint64_t currTime);
+
+		/**
+		 * \brief	Gets the counts within the window ending at currTime, of the cells with any event;
+		 * 			the idle cells are removed.
+		 */
+		std::vector<ComMsg::CellCount> GetCounts(const uint64_t currTime);
+
+	private:
+		/** \brief	Checks if the source can be counted now. The mutex must be held. */
+		bool IsSourceNew(const ClientId& source, const uint64_t bucketIdx);
+
+		/** \brief	Counts an event at the location. The mutex must be held. */
+		void Count(const ComMsg::Point2D<double>& loc, const uint64_t bucketIdx);
+
+		void PruneSources(const uint64_t bucketIdx);
+
+		struct Cell
+		{
+			//The index of the bucket (i.e., time / bucket length) each slot is counting.
+			uint64_t m_bucketIdx[SurgeGrid::sk_numBuckets];
+			uint32_t m_counts[SurgeGrid::sk_numBuckets];
+			uint32_t m_total;
+		};
+
+		const double m_cellSize;
+		const uint64_t m_bucketLen;
+		const size_t m_maxNumCells;
+		const size_t m_maxNumSources;
+
+		std::mutex m_mutex;
+		std::unordered_map<uint64_t, Cell> m_cells;
+		//The sources counted within the window, and the bucket each one is counted in.
+		std::map<ClientId, uint64_t> m_sources;
+	};
+}
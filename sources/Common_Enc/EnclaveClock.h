@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+namespace RideShare
+{
+	/**
+	 * \brief	Advances the enclave's view of the current time (in seconds). There is no trusted
+	 * 			clock in the enclave, so the time is given by the untrusted side, through its
+	 * 			periodic ecalls; it only moves forward, so a late or replayed tick can't turn it
+	 * 			back.
+	 *
+	 * \param [in,out]	currTime	The current time kept by the enclave.
+	 * \param 			newTime 	The time given by the untrusted side.
+	 *
+	 * \return	The current time after the update.
+	 */
+	inline uint64_t AdvanceTime(std::atomic<uint64_t>& currTime, const uint64_t newTime)
+	{
+		uint64_t prevTime = currTime.load();
+		while (prevTime < newTime && !currTime.compare_exchange_weak(prevTime, newTime))
+		{}
+		return prevTime < newTime ? newTime : prevTime;
+	}
+}
@@ -0,0 +1,54 @@
+#include "InSituMessages.h"
+
+#include <cstring>
+
+#include <DecentApi/Common/Net/CommonMessages.h>
+
+using namespace RideShare;
+using namespace RideShare::ComMsg;
+
+namespace
+{
+	StringView ParseStringView(const JsonValue& json, const char* label)
+	{
+		const JsonValue& val = Decent::Net::CommonJsonMsg::GetMember(json, label);
+		if (!val.JSON_IS_STRING())
+		{
+			throw MessageParseException();
+		}
+		return StringView(val.GetString(), val.GetStringLength());
+	}
+}
+
+char* ComMsg::GetInSituBuffer(std::string& buffer, const StringView& region)
+{
+	const char* const bufBegin = buffer.data();
+	const char* const bufEnd = bufBegin + buffer.size();
+	if (region.GetData() < bufBegin || region.GetData() > bufEnd ||
+		region.GetSize() > static_cast<size_t>(bufEnd - region.GetData()))
+	{
+		throw MessageParseException();
+	}
+
+	char* const res = &buffer[region.GetData() - bufBegin];
+	//The parser stops at the first null; make sure it stops exactly at the end of the region.
+	if (res[region.GetSize()] != '\0' ||
+		std::memchr(res, '\0', region.GetSize()) != nullptr)
+	{
+		throw MessageParseException();
+	}
+	return res;
+}
+
+ConfirmQuoteView::ConfirmQuoteView(const JsonValue& json) :
+	m_contact(Decent::Net::CommonJsonMsg::GetMember(json, ConfirmQuote::sk_labelPasContact)),
+	m_signQuote(ParseStringView(json, ConfirmQuote::sk_labelSignedQuote))
+{
+}
+
+SignedQuoteView::SignedQuoteView(const JsonValue& json) :
+	m_quote(ParseStringView(json, SignedQuote::sk_labelQuote)),
+	m_sign(ParseStringView(json, SignedQuote::sk_labelSignature)),
+	m_cert(ParseStringView(json, SignedQuote::sk_labelCert))
+{
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+
+#include <rapidjson/document.h>
+
+#include "../Common/RideSharingMessages.h"
+#include "../Common/MessageException.h"
+#include "../Common/StringView.h"
+
+namespace RideShare
+{
+	namespace ComMsg
+	{
+		/**
+		 * \brief	Gets the writable start of a JSON message inside the receive buffer, for in-situ
+		 * 			parsing. The region must be null-terminated right at its end, which is true for
+		 * 			the whole buffer, and for strings that have been parsed in situ.
+		 *
+		 * \exception	MessageParseException	Thrown if the region is not in the buffer, or not
+		 * 										null-terminated.
+		 */
+		char* GetInSituBuffer(std::string& buffer, const StringView& region);
+
+		/**
+		 * \brief	Parses a message that lies in the given region of the receive buffer, in place.
+		 * 			Binary messages are read straight from the buffer; JSON messages are parsed in situ,
+		 * 			which unescapes strings inside the buffer rather than copying them into the DOM.
+		 * 			Thus, the buffer may be modified, and any StringView in the result refers into the
+		 * 			buffer, which must outlive it.
+		 */
+		template<typename MsgType>
+		inline MsgType ParseInSitu(std::string& buffer, const StringView& region)
+		{
+			if (DetectWireFormat(region) == WireFormat::Binary)
+			{
+				BinaryReader reader(StringView(region.GetData() + sizeof(WireMsg::sk_binaryMagic),
+					region.GetSize() - sizeof(WireMsg::sk_binaryMagic)));
+				MsgType res(reader);
+				if (!reader.IsEnd())
+				{
+					throw MessageParseException();
+				}
+				return res;
+			}
+
+			rapidjson::Document json;
+			json.ParseInsitu(GetInSituBuffer(buffer, region));
+			if (json.HasParseError())
+			{
+				throw MessageParseException();
+			}
+			return MsgType(json);
+		}
+
+		/**
+		 * \brief	ConfirmQuote, parsed in place; the signed quote refers into the receive buffer.
+		 */
+		class ConfirmQuoteView
+		{
+		public:
+			ConfirmQuoteView() = delete;
+
+			ConfirmQuoteView(const JsonValue& json);
+
+			ConfirmQuoteView(BinaryReader& reader) :
+				m_contact(reader),
+				m_signQuote(reader.Read<StringView>())
+			{}
+
+			~ConfirmQuoteView() {}
+
+			const PasContact& GetContact() const { return m_contact; }
+			const StringView& GetSignQuote() const { return m_signQuote; }
+
+		private:
+			PasContact m_contact;
+			StringView m_signQuote;
+		};
+
+		/**
+		 * \brief	SignedQuote, parsed in place; all fields refer into the receive buffer. Unlike
+		 * 			SignedQuote::ParseSignedQuote, parsing doesn't verify it; call Verify before use.
+		 */
+		class SignedQuoteView
+		{
+		public:
+			SignedQuoteView() = delete;
+
+			SignedQuoteView(const JsonValue& json);
+
+			SignedQuoteView(BinaryReader& reader) :
+				m_quote(reader.Read<StringView>()),
+				m_sign(reader.Read<StringView>()),
+				m_cert(reader.Read<StringView>())
+			{}
+
+			~SignedQuoteView() {}
+
+			void Verify(Decent::Ra::States& state, const std::string& appName) const
+			{
+				SignedQuote::Verify(m_quote, m_sign, m_cert, state, appName);
+			}
+
+			const StringView& GetQuote() const { return m_quote; }
+
+		private:
+			StringView m_quote;
+			StringView m_sign;
+			StringView m_cert;
+		};
+	}
+}
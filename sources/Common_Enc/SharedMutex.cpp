@@ -0,0 +1,58 @@
+#include "SharedMutex.h"
+
+using namespace RideShare;
+
+SharedMutex::SharedMutex() :
+	m_mutex(),
+	m_readerCond(),
+	m_writerCond(),
+	m_readerCount(0),
+	m_waitingWriterCount(0),
+	m_isWriterActive(false)
+{
+}
+
+SharedMutex::~SharedMutex()
+{
+}
+
+void SharedMutex::lock()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	++m_waitingWriterCount;
+	m_writerCond.wait(lock, [this] { return !m_isWriterActive && m_readerCount == 0; });
+	--m_waitingWriterCount;
+	m_isWriterActive = true;
+}
+
+void SharedMutex::unlock()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_isWriterActive = false;
+	}
+	//Let the next writer go first if there is any; otherwise, release all readers.
+	m_writerCond.notify_one();
+	m_readerCond.notify_all();
+}
+
+void SharedMutex::lock_shared()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_readerCond.wait(lock, [this] { return !m_isWriterActive && m_waitingWriterCount == 0; });
+	++m_readerCount;
+}
+
+void SharedMutex::unlock_shared()
+{
+	bool isLastReader = false;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		--m_readerCount;
+		isLastReader = (m_readerCount == 0);
+	}
+	if (isLastReader)
+	{
+		m_writerCond.notify_one();
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+
+namespace RideShare
+{
+	/**
+	 * \brief	A readers-writer mutex, since std::shared_mutex is not available in C++11. Multiple
+	 * 			readers can hold it at the same time, while a writer holds it exclusively. Waiting
+	 * 			writers are preferred over new readers, so writers won't starve under read-heavy
+	 * 			loads. The naming follows the standard Lockable concepts, so it can be used with
+	 * 			std::unique_lock (exclusive) and SharedLock (shared).
+	 */
+	class SharedMutex
+	{
+	public:
+		SharedMutex();
+
+		SharedMutex(const SharedMutex& rhs) = delete;
+		SharedMutex(SharedMutex&& rhs) = delete;
+
+		~SharedMutex();
+
+		void lock();
+		void unlock();
+
+		void lock_shared();
+		void unlock_shared();
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_readerCond;
+		std::condition_variable m_writerCond;
+		size_t m_readerCount;
+		size_t m_waitingWriterCount;
+		bool m_isWriterActive;
+	};
+
+	/**
+	 * \brief	RAII holder of a shared (read-side) lock.
+	 */
+	template<typename MutexType>
+	class SharedLock
+	{
+	public:
+		SharedLock() = delete;
+
+		explicit SharedLock(MutexType& mutex) :
+			m_mutex(mutex)
+		{
+			m_mutex.lock_shared();
+		}
+
+		SharedLock(const SharedLock& rhs) = delete;
+		SharedLock(SharedLock&& rhs) = delete;
+
+		~SharedLock()
+		{
+			m_mutex.unlock_shared();
+		}
+
+	private:
+		MutexType& m_mutex;
+	};
+}
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+
+namespace RideShare
+{
+	/**
+	 * \brief	A uniform grid spatial index over the 2D plane. Each cell keeps the items located
+	 * 			inside it, so a radius query only visits the cells overlapping the query circle,
+	 * 			and its cost grows with the number of items nearby, rather than the total number
+	 * 			of items stored. This class is NOT thread-safe.
+	 *
+	 * \tparam	T	Type of the item. The grid only stores pointers to the items; it doesn't own them.
+	 */
+	template<typename T>
+	class SpatialGrid
+	{
+	public:
+		//Pair of (item, distance to the query point)
+		typedef std::pair<T*, double> ResultType;
+
+	public:
+		SpatialGrid() = delete;
+
+		explicit SpatialGrid(const double cellSize) :
+			m_cellSize(cellSize),
+			m_cells(),
+			m_size(0)
+		{}
+
+		SpatialGrid(const SpatialGrid& rhs) = delete;
+		SpatialGrid(SpatialGrid&& rhs) = delete;
+
+		~SpatialGrid() {}
+
+		void Insert(const double x, const double y, T* const item)
+		{
+			m_cells[GetCellKey(x, y)].push_back(Entry(x, y, item));
+			++m_size;
+		}
+
+		/**
+		 * \brief	Removes the item located at (x, y).
+		 *
+		 * \return	True if the item is found and removed, false if it doesn't exist.
+		 */
+		bool Remove(const double x, const double y, T* const item)
+		{
+			auto cellIt = m_cells.find(GetCellKey(x, y));
+			if (cellIt == m_cells.end())
+			{
+				return false;
+			}
+
+			std::vector<Entry>& cell = cellIt->second;
+			auto it = std::find_if(cell.begin(), cell.end(), [item](const Entry& entry)
+			{
+				return entry.m_item == item;
+			});
+			if (it == cell.end())
+			{
+				return false;
+			}
+
+			//Order inside a cell doesn't matter, so swap with the last one to avoid shifting.
+			*it = cell.back();
+			cell.pop_back();
+
+			if (cell.size() == 0)
+			{
+				m_cells.erase(cellIt);
+			}
+			--m_size;
+
+			return true;
+		}
+
+		/**
+		 * \brief	Finds all items within the given radius of (x, y). Results are appended to res, in
+		 * 			no particular order.
+		 */
+		void FindInRadius(const double x, const double y, const double radius, std::vector<ResultType>& res) const
+		{
+			const double radiusSq = radius * radius;
+
+			const int64_t minCx = ToCellIndex(x - radius);
+			const int64_t maxCx = ToCellIndex(x + radius);
+			const int64_t minCy = ToCellIndex(y - radius);
+			const int64_t maxCy = ToCellIndex(y + radius);
+
+			if ((maxCx - minCx + 1) * (maxCy - minCy + 1) > static_cast<int64_t>(m_cells.size()))
+			{
+				//The query window covers more cells than we have; just walk the non-empty ones.
+				for (auto it = m_cells.cbegin(); it != m_cells.cend(); ++it)
+				{
+					CollectInRadius(it->second, x, y, radiusSq, res);
+				}
+				return;
+			}
+
+			for (int64_t cx = minCx; cx <= maxCx; ++cx)
+			{
+				for (int64_t cy = minCy; cy <= maxCy; ++cy)
+				{
+					auto it = m_cells.find(CombineCellIndex(cx, cy));
+					if (it != m_cells.cend())
+					{
+						CollectInRadius(it->second, x, y, radiusSq, res);
+					}
+				}
+			}
+		}
+
+		/**
+		 * \brief	Finds the (at most) maxNum items closest to (x, y) within the given radius. It visits
+		 * 			the cells ring by ring outward from the query cell, keeps the best candidates in a
+		 * 			bounded max-heap, and stops as soon as no unvisited cell can contain a closer item.
+		 *
+		 * \param [out]	res	The results, sorted by the distance in ascending order.
+		 */
+		void FindNearest(const double x, const double y, const double radius, const size_t maxNum, std::vector<ResultType>& res) const
+		{
+			res.clear();
+			if (maxNum == 0 || m_size == 0)
+			{
+				return;
+			}
+
+			const double radiusSq = radius * radius;
+			const int64_t cx0 = ToCellIndex(x);
+			const int64_t cy0 = ToCellIndex(y);
+			//Number of rings needed to cover the whole query circle.
+			const int64_t maxRing = std::max(std::max(cx0 - ToCellIndex(x - radius), ToCellIndex(x + radius) - cx0),
+				std::max(cy0 - ToCellIndex(y - radius), ToCellIndex(y + radius) - cy0));
+
+			if ((2 * maxRing + 1) * (2 * maxRing + 1) > static_cast<int64_t>(m_cells.size()))
+			{
+				//Again, the query window covers more cells than we have; just walk the non-empty ones.
+				for (auto it = m_cells.cbegin(); it != m_cells.cend(); ++it)
+				{
+					CollectNearest(it->second, x, y, radiusSq, maxNum, res);
+				}
+			}
+			else
+			{
+				for (int64_t ring = 0; ring <= maxRing; ++ring)
+				{
+					//Any cell in this ring is at least (ring - 1) cells away from the query point.
+					if (res.size() == maxNum && ring > 0)
+					{
+						const double ringMinDist = (ring - 1) * m_cellSize;
+						if (res.front().second <= ringMinDist * ringMinDist)
+						{
+							break;
+						}
+					}
+
+					for (int64_t cx = cx0 - ring; cx <= cx0 + ring; ++cx)
+					{
+						//Only the top & bottom rows need the full span; the rest only have the two ends.
+						const bool isEdgeRow = (cx == cx0 - ring || cx == cx0 + ring);
+						const int64_t step = (isEdgeRow || ring == 0) ? 1 : 2 * ring;
+						for (int64_t cy = cy0 - ring; cy <= cy0 + ring; cy += step)
+						{
+							auto it = m_cells.find(CombineCellIndex(cx, cy));
+							if (it != m_cells.cend())
+							{
+								CollectNearest(it->second, x, y, radiusSq, maxNum, res);
+							}
+						}
+					}
+				}
+			}
+
+			//The heap holds squared distances; sort it and convert to real distances.
+			std::sort_heap(res.begin(), res.end(), &HeapCompare);
+			for (ResultType& item : res)
+			{
+				item.second = std::sqrt(item.second);
+			}
+		}
+
+		size_t GetSize() const { return m_size; }
+
+	private:
+		struct Entry
+		{
+			double m_x;
+			double m_y;
+			T* m_item;
+
+			Entry(const double x, const double y, T* const item) :
+				m_x(x),
+				m_y(y),
+				m_item(item)
+			{}
+		};
+
+		static void CollectInRadius(const std::vector<Entry>& cell, const double x, const double y, const double radiusSq, std::vector<ResultType>& res)
+		{
+			for (const Entry& entry : cell)
+			{
+				const double dx = entry.m_x - x;
+				const double dy = entry.m_y - y;
+				const double distSq = dx * dx + dy * dy;
+				if (distSq <= radiusSq)
+				{
+					res.push_back(std::make_pair(entry.m_item, std::sqrt(distSq)));
+				}
+			}
+		}
+
+		static bool HeapCompare(const ResultType& a, const ResultType& b)
+		{
+			return a.second < b.second;
+		}
+
+		static void CollectNearest(const std::vector<Entry>& cell, const double x, const double y, const double radiusSq, const size_t maxNum, std::vector<ResultType>& heap)
+		{
+			for (const Entry& entry : cell)
+			{
+				const double dx = entry.m_x - x;
+				const double dy = entry.m_y - y;
+				const double distSq = dx * dx + dy * dy;
+				if (distSq > radiusSq)
+				{
+					continue;
+				}
+
+				if (heap.size() < maxNum)
+				{
+					heap.push_back(std::make_pair(entry.m_item, distSq));
+					std::push_heap(heap.begin(), heap.end(), &HeapCompare);
+				}
+				else if (distSq < heap.front().second)
+				{
+					//Replace the farthest one in the heap.
+					std::pop_heap(heap.begin(), heap.end(), &HeapCompare);
+					heap.back() = std::make_pair(entry.m_item, distSq);
+					std::push_heap(heap.begin(), heap.end(), &HeapCompare);
+				}
+			}
+		}
+
+		static uint64_t CombineCellIndex(const int64_t cx, const int64_t cy)
+		{
+			return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+		}
+
+		int64_t ToCellIndex(const double val) const
+		{
+			const double idx = std::floor(val / m_cellSize);
+			//Clamp to the 32-bit range (and map NaN to the lowest cell), so it's safe to cast.
+			if (!(idx > INT32_MIN))
+			{
+				return INT32_MIN;
+			}
+			if (idx > INT32_MAX)
+			{
+				return INT32_MAX;
+			}
+			return static_cast<int64_t>(idx);
+		}
+
+		uint64_t GetCellKey(const double x, const double y) const
+		{
+			return CombineCellIndex(ToCellIndex(x), ToCellIndex(y));
+		}
+
+		double m_cellSize;
+		std::unordered_map<uint64_t, std::vector<Entry> > m_cells;
+		size_t m_size;
+	};
+}
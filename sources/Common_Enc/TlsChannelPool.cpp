@@ -0,0 +1,239 @@
+#include "TlsChannelPool.h"
+
+#include <DecentApi/Common/Common.h>
+#include <DecentApi/Common/make_unique.h>
+#include <DecentApi/Common/Ra/TlsConfigWithName.h>
+#include <DecentApi/Common/Net/TlsCommLayer.h>
+#include <DecentApi/CommonEnclave/Net/EnclaveConnectionOwner.h>
+
+using namespace RideShare;
+using namespace Decent::Ra;
+using namespace Decent::Net;
+
+constexpr uint32_t TlsChannelPool::sk_maxIdleTicks;
+
+struct TlsChannelPool::Channel
+{
+	//The TLS layer refers to the connection, so the connection must be constructed first. The
+	//  TLS layer is null until the handshake is done.
+	EnclaveConnectionOwner m_cnt;
+	std::unique_ptr<TlsCommLayer> m_tls;
+	//The number of time ticks it has been idle in the pool.
+	uint32_t m_idleTicks;
+
+	Channel(EnclaveConnectionOwner&& cnt) :
+		m_cnt(std::forward<EnclaveConnectionOwner>(cnt)),
+		m_tls(),
+		m_idleTicks(0)
+	{}
+};
+
+TlsChannelPool::TlsChannelPool(States& state, const std::string& appName, CntBuilderType cntBuilder, const uint8_t endSession, const size_t maxIdle) :
+	m_state(state),
+	m_appName(appName),
+	m_cntBuilder(cntBuilder),
+	m_endSession(endSession),
+	m_maxIdle(maxIdle),
+	m_idleMutex(),
+	m_idle()
+{
+}
+
+TlsChannelPool::~TlsChannelPool()
+{
+}
+
+void TlsChannelPool::Use(const UseFuncType& func)
+{
+	std::unique_ptr<Channel> channel = Get();
+	if (!channel)
+	{
+		channel = Connect();
+	}
+
+	func(channel->m_cnt, *channel->m_tls);
+	Put(std::move(channel));
+}
+
+void TlsChannelPool::UseWithRetry(const UseFuncType& func)
+{
+	std::unique_ptr<Channel> channel = Get();
+	if (channel)
+	{
+		try
+		{
+			func(channel->m_cnt, *channel->m_tls);
+			Put(std::move(channel));
+			return;
+		}
+		catch (const std::exception& e)
+		{
+			LOGI("Pooled channel to %s failed (%s). Retrying with a new channel...", m_appName.c_str(), e.what());
+		}
+		channel.reset();
+	}
+
+	channel = Connect();
+	func(channel->m_cnt, *channel->m_tls);
+	Put(std::move(channel));
+}
+
+void TlsChannelPool::UseConcurrently(const std::vector<ConcurrentCall>& calls)
+{
+	std::vector<std::unique_ptr<Channel> > channels(calls.size());
+	std::vector<bool> isPooled(calls.size(), false);
+
+	//Check out the idle channels, and open the connections of the rest, before any handshake.
+	for (size_t i = 0; i < calls.size(); ++i)
+	{
+		channels[i] = calls[i].m_pool->Get();
+		isPooled[i] = (channels[i] != nullptr);
+		if (!isPooled[i])
+		{
+			channels[i] = calls[i].m_pool->Open();
+		}
+	}
+
+	//Send all the requests.
+	for (size_t i = 0; i < calls.size(); ++i)
+	{
+		const ConcurrentCall& call = calls[i];
+
+		if (isPooled[i])
+		{
+			try
+			{
+				call.m_send(channels[i]->m_cnt, *channels[i]->m_tls);
+				continue;
+			}
+			catch (const std::exception& e)
+			{
+				LOGI("Pooled channel to %s failed (%s). Retrying with a new channel...", call.m_pool->m_appName.c_str(), e.what());
+			}
+			isPooled[i] = false;
+			channels[i] = call.m_pool->Connect();
+		}
+		else
+		{
+			call.m_pool->Handshake(*channels[i]);
+		}
+
+		call.m_send(channels[i]->m_cnt, *channels[i]->m_tls);
+	}
+
+	//Then, receive all the replies.
+	for (size_t i = 0; i < calls.size(); ++i)
+	{
+		const ConcurrentCall& call = calls[i];
+
+		try
+		{
+			call.m_recv(channels[i]->m_cnt, *channels[i]->m_tls);
+		}
+		catch (const std::exception& e)
+		{
+			if (!isPooled[i])
+			{
+				throw;
+			}
+
+			//A pooled channel closed by the peer may only fail once the reply is expected.
+			LOGI("Pooled channel to %s failed (%s). Retrying with a new channel...", call.m_pool->m_appName.c_str(), e.what());
+			channels[i] = call.m_pool->Connect();
+			call.m_send(channels[i]->m_cnt, *channels[i]->m_tls);
+			call.m_recv(channels[i]->m_cnt, *channels[i]->m_tls);
+		}
+
+		call.m_pool->Put(std::move(channels[i]));
+	}
+}
+
+std::unique_ptr<TlsChannelPool::Channel> TlsChannelPool::Open()
+{
+	LOGI("Opening a new channel to %s...", m_appName.c_str());
+
+	return Decent::Tools::make_unique<Channel>(EnclaveConnectionOwner::CntBuilder(SGX_SUCCESS, m_cntBuilder));
+}
+
+void TlsChannelPool::Handshake(Channel& channel)
+{
+	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(m_state, TlsConfigWithName::Mode::ClientHasCert, m_appName, nullptr);
+
+	channel.m_tls = Decent::Tools::make_unique<TlsCommLayer>(channel.m_cnt, tlsCfg, true, nullptr);
+}
+
+std::unique_ptr<TlsChannelPool::Channel> TlsChannelPool::Connect()
+{
+	std::unique_ptr<Channel> channel = Open();
+	Handshake(*channel);
+	return channel;
+}
+
+std::unique_ptr<TlsChannelPool::Channel> TlsChannelPool::Get()
+{
+	std::unique_lock<std::mutex> idleLock(m_idleMutex);
+	if (m_idle.size() == 0)
+	{
+		return nullptr;
+	}
+
+	std::unique_ptr<Channel> channel = std::move(m_idle.back());
+	m_idle.pop_back();
+	return std::move(channel);
+}
+
+void TlsChannelPool::Put(std::unique_ptr<Channel> channel)
+{
+	{
+		std::unique_lock<std::mutex> idleLock(m_idleMutex);
+		if (m_idle.size() < m_maxIdle)
+		{
+			channel->m_idleTicks = 0;
+			m_idle.push_back(std::move(channel));
+			return;
+		}
+	}
+
+	//The pool is full; close this one, so it doesn't keep holding a thread at the destination.
+	Close(*channel);
+}
+
+void TlsChannelPool::EvictIdle()
+{
+	std::vector<std::unique_ptr<Channel> > evicted;
+	{
+		std::unique_lock<std::mutex> idleLock(m_idleMutex);
+		for (auto it = m_idle.begin(); it != m_idle.end(); )
+		{
+			if (++(*it)->m_idleTicks >= sk_maxIdleTicks)
+			{
+				evicted.push_back(std::move(*it));
+				it = m_idle.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	for (std::unique_ptr<Channel>& channel : evicted)
+	{
+		LOGI("Closing an idle channel to %s...", m_appName.c_str());
+		Close(*channel);
+	}
+}
+
+void TlsChannelPool::Close(Channel& channel)
+{
+	//The destination may have closed it already, in which case there is nothing more to do; the
+	//  connection is closed anyway when the channel is destroyed.
+	try
+	{
+		channel.m_tls->SendStruct(channel.m_cnt, m_endSession);
+	}
+	catch (const std::exception& e)
+	{
+		LOGI("Failed to end the session of a channel to %s (%s).", m_appName.c_str(), e.what());
+	}
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include <sgx_error.h>
+
+namespace Decent
+{
+	namespace Ra
+	{
+		class States;
+	}
+
+	namespace Net
+	{
+		class ConnectionBase;
+		class TlsCommLayer;
+	}
+}
+
+namespace RideShare
+{
+	/**
+	 * \brief	A pool of long-lived, mutually authenticated TLS channels to one destination service.
+	 * 			Callers check a channel out, send any number of requests through it, and it's put
+	 * 			back for the next caller, so the handshake is only paid when the pool runs dry. The
+	 * 			destination must keep serving requests on the session until it receives the
+	 * 			end-session function number.
+	 * 			Each idle channel holds one listening thread (and one TCS) of the destination, so a
+	 * 			destination serving N enclaves, each with one pool of it, holds at most N * maxIdle
+	 * 			threads for idle channels; its number of listening threads must be well above that.
+	 * 			Idle channels are also closed after sk_maxIdleTicks time ticks (see EvictIdle), so
+	 * 			they are closed by this side before the destination gives up on them.
+	 */
+	class TlsChannelPool
+	{
+	public:
+		typedef sgx_status_t(*CntBuilderType)(void**);
+
+		//With time ticks every 5 seconds, an idle channel is closed after 10 to 15 seconds.
+		static constexpr uint32_t sk_maxIdleTicks = 2;
+
+		typedef std::function<void(Decent::Net::ConnectionBase&, Decent::Net::TlsCommLayer&)> UseFuncType;
+
+		/**
+		 * \brief	A call split into sending the request, and receiving the reply. Like the func given
+		 * 			to UseWithRetry, both steps must be safe to be run again from the beginning, e.g.,
+		 * 			a query.
+		 */
+		struct ConcurrentCall
+		{
+			TlsChannelPool* m_pool;
+			UseFuncType m_send;
+			UseFuncType m_recv;
+
+			ConcurrentCall(TlsChannelPool& pool, const UseFuncType& send, const UseFuncType& recv) :
+				m_pool(&pool),
+				m_send(send),
+				m_recv(recv)
+			{}
+		};
+
+		/**
+		 * \brief	Runs independent calls, possibly to different destinations, so that they overlap.
+		 * 			Each call has its own channel; all requests are sent before any reply is received,
+		 * 			so the destinations work on them at the same time, and the total latency is about
+		 * 			the longest call, rather than the sum. Enclaves have no threads of their own, so
+		 * 			this is done by ordering the steps, instead of running the calls in parallel.
+		 * 			The connections of all the calls without an idle channel are opened before any
+		 * 			handshake, so the destinations set up their sessions at the same time; the TLS
+		 * 			handshakes themselves are blocking, so they still run one after the other, each
+		 * 			followed by its request, so a destination works on it during the next handshake.
+		 * 			Failures are handled like UseWithRetry does; the first call that fails on a new
+		 * 			channel throws.
+		 */
+		static void UseConcurrently(const std::vector<ConcurrentCall>& calls);
+
+	public:
+		TlsChannelPool() = delete;
+
+		/**
+		 * \brief	Constructor
+		 *
+		 * \param	state     	The Decent App state.
+		 * \param	appName   	Name of the destination app, used to verify its certificate.
+		 * \param	cntBuilder	The OCALL that opens a new connection to the destination.
+		 * \param	endSession	The function number that ends a session at the destination.
+		 * \param	maxIdle   	The maximum number of idle channels kept. Each idle channel holds
+		 * 					one listening thread of the destination.
+		 */
+		TlsChannelPool(Decent::Ra::States& state, const std::string& appName, CntBuilderType cntBuilder, const uint8_t endSession, const size_t maxIdle);
+
+		TlsChannelPool(const TlsChannelPool& rhs) = delete;
+		TlsChannelPool(TlsChannelPool&& rhs) = delete;
+
+		~TlsChannelPool();
+
+		/**
+		 * \brief	Runs func with a channel checked out from the pool (or a new one, if there is no
+		 * 			idle channel). The channel is returned to the pool only if func succeeds; any
+		 * 			failure is thrown, since the request may or may not have been processed.
+		 */
+		void Use(const UseFuncType& func);
+
+		/**
+		 * \brief	Same as Use, except that, if a pooled channel fails, it may have been closed by
+		 * 			the peer, so func is retried once on a new channel. Thus, func must be safe to be
+		 * 			run again from the beginning, i.e., queries, and requests that are idempotent.
+		 * 			A request without a reply (i.e., one-way) is not noticed to fail until the peer
+		 * 			acknowledges it, so one should be received before func returns.
+		 */
+		void UseWithRetry(const UseFuncType& func);
+
+		/**
+		 * \brief	Counts a time tick for the idle channels, and closes the ones idle for
+		 * 			sk_maxIdleTicks ticks. It should be called on every time tick of the enclave.
+		 */
+		void EvictIdle();
+
+	private:
+		struct Channel;
+
+		/** \brief	Opens a new connection to the destination, without the TLS handshake yet. */
+		std::unique_ptr<Channel> Open();
+
+		void Handshake(Channel& channel);
+
+		std::unique_ptr<Channel> Connect();
+
+		std::unique_ptr<Channel> Get();
+
+		void Put(std::unique_ptr<Channel> channel);
+
+		void Close(Channel& channel);
+
+		Decent::Ra::States& m_state;
+		const std::string m_appName;
+		CntBuilderType m_cntBuilder;
+		const uint8_t m_endSession;
+		const size_t m_maxIdle;
+
+		std::mutex m_idleMutex;
+		std::vector<std::unique_ptr<Channel> > m_idle;
+	};
+}
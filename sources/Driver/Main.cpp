@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 #include <tclap/CmdLine.h>
 #include <json/json.h>
@@ -42,16 +44,27 @@ namespace
 }
 
 bool RegesterCert(Net::ConnectionBase& con, const ComMsg::DriContact& contact);
-std::unique_ptr<ComMsg::BestMatches> SendQuery(Net::ConnectionBase& con);
-bool ConfirmMatch(Net::ConnectionBase& con, const ComMsg::DriContact& contact, const std::string& tripId);
-bool TripStartOrEnd(Net::ConnectionBase& con, const std::string& tripId, const bool isStart);
+std::unique_ptr<ComMsg::BestMatches> SendQuery(TlsCommLayer& tls);
+std::string WaitForMatch(TlsCommLayer& tls);
+std::string WaitForAssignment(TlsCommLayer& tls, const ComMsg::DriContact& contact);
+bool ConfirmMatch(TlsCommLayer& tls, const ComMsg::DriContact& contact, const std::string& tripId);
+bool TripStartOrEnd(TlsCommLayer& tls, const std::string& tripId, const bool isStart);
+bool SendTripTrace(TlsCommLayer& tls, const std::string& tripId);
 
 template<typename MsgType>
 static std::unique_ptr<MsgType> ParseMsg(const std::string& msgStr)
 {
-	JsonDoc json;
-	Decent::Tools::ParseStr2Json(json, msgStr);
-	return std::make_unique<MsgType>(json);
+	return ComMsg::ParseWireMsg<MsgType>(msgStr);
+}
+
+/**
+ * \brief	Starts a keep-alive session with the given service, so multiple requests can share one TLS
+ * 			handshake. The session must be ended with the service's k_endSession.
+ */
+static std::unique_ptr<TlsCommLayer> StartSession(Net::ConnectionBase& con, const std::string& appName)
+{
+	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, appName, nullptr);
+	return std::make_unique<TlsCommLayer>(con, tlsCfg, true, nullptr);
 }
 
 static void Pause(const std::string& msg)
@@ -78,8 +91,22 @@ int main(int argc, char ** argv)
 	TCLAP::ValueArg<std::string> configPathArg("c", "config", "Path to the configuration file.", false, "Config.json", "String");
 	cmd.add(configPathArg);
 
+	TCLAP::SwitchArg jsonMsgArg("j", "json-msg", "Send messages in JSON instead of the binary format, for debugging.", false);
+	cmd.add(jsonMsgArg);
+
+	TCLAP::SwitchArg subscribeArg("u", "subscribe", "Subscribe to the matches nearby, and wait for the updates, instead of querying once.", false);
+	cmd.add(subscribeArg);
+
+	TCLAP::SwitchArg batchAssignArg("a", "batch-assign", "Wait for a trip from the batch assignment, instead of picking one.", false);
+	cmd.add(batchAssignArg);
+
 	cmd.parse(argc, argv);
 
+	if (jsonMsgArg.getValue())
+	{
+		ComMsg::SetDefaultWireFormat(ComMsg::WireFormat::Json);
+	}
+
 	//------- Read configuration file:
 	std::unique_ptr<DecentAppConfig> configMgr;
 	try
@@ -121,6 +148,7 @@ int main(int argc, char ** argv)
 	ComMsg::DriContact contact("driFirst driLast", "1234567890", "LicensePlateHere");
 
 	std::unique_ptr<Net::ConnectionBase> appCon;
+	std::unique_ptr<TlsCommLayer> tls;
 
 	Pause("register");
 	appCon = ConnectionManager::GetConnection2DriverMgm(RequestCategory::sk_fromDriver);
@@ -130,36 +158,90 @@ int main(int argc, char ** argv)
 	}
 
 	Pause("find closest passengers");
-	std::unique_ptr<ComMsg::BestMatches> matches;
+	std::string tripId;
 	appCon = ConnectionManager::GetConnection2TripMatcher(RequestCategory::sk_fromDriver);
-	if (!(matches = SendQuery(*appCon)) ||
-		matches->GetMatches().size() == 0)
+	tls = StartSession(*appCon, AppNames::sk_tripMatcher);
+	if (batchAssignArg.getValue())
 	{
-		return -1;
+		if ((tripId = WaitForAssignment(*tls, contact)).size() == 0)
+		{
+			return -1;
+		}
+
+		//The waiting connection is closed by the Trip Matcher once the trip is assigned.
+		tls.reset();
 	}
+	else if (subscribeArg.getValue())
+	{
+		if ((tripId = WaitForMatch(*tls)).size() == 0)
+		{
+			return -1;
+		}
 
-	Pause("pick first closest passenger");
+		//The subscription holds on to its connection, so the rest goes through new ones.
+		tls.reset();
+	}
+	else
+	{
+		std::unique_ptr<ComMsg::BestMatches> matches;
+		if (!(matches = SendQuery(*tls)) ||
+			matches->GetMatches().size() == 0)
+		{
+			return -1;
+		}
+		tripId = matches->GetMatches()[0].GetTripId();
+	}
+
+	//Each step below, which follows a pause, goes through a session of its own, since the Trip
+	//  Matcher closes the sessions left idle (see SessionWatchdog).
+	if (tls)
+	{
+		tls->SendStruct(EncFunc::TripMatcher::k_endSession);
+		tls.reset();
+	}
+
+	if (!batchAssignArg.getValue())
+	{
+		Pause("pick first closest passenger");
+		appCon = ConnectionManager::GetConnection2TripMatcher(RequestCategory::sk_fromDriver);
+		tls = StartSession(*appCon, AppNames::sk_tripMatcher);
+		if (!ConfirmMatch(*tls, contact, tripId))
+		{
+			return -1;
+		}
+		tls->SendStruct(EncFunc::TripMatcher::k_endSession);
+		tls.reset();
+	}
+
+	Pause("start trip");
 	appCon = ConnectionManager::GetConnection2TripMatcher(RequestCategory::sk_fromDriver);
-	const ComMsg::MatchItem& firstItem = matches->GetMatches()[0];
-	const std::string tripId = firstItem.GetTripId();
-	if (!ConfirmMatch(*appCon, contact, tripId))
+	tls = StartSession(*appCon, AppNames::sk_tripMatcher);
+	if (!TripStartOrEnd(*tls, tripId, true))
 	{
 		return -1;
 	}
+	tls->SendStruct(EncFunc::TripMatcher::k_endSession);
+	tls.reset();
 
-	Pause("start trip");
+	Pause("stream trip trace");
 	appCon = ConnectionManager::GetConnection2TripMatcher(RequestCategory::sk_fromDriver);
-	if (!TripStartOrEnd(*appCon, tripId, true))
+	tls = StartSession(*appCon, AppNames::sk_tripMatcher);
+	if (!SendTripTrace(*tls, tripId))
 	{
 		return -1;
 	}
+	tls->SendStruct(EncFunc::TripMatcher::k_endSession);
+	tls.reset();
 
 	Pause("end trip");
 	appCon = ConnectionManager::GetConnection2TripMatcher(RequestCategory::sk_fromDriver);
-	if (!TripStartOrEnd(*appCon, tripId, false))
+	tls = StartSession(*appCon, AppNames::sk_tripMatcher);
+	if (!TripStartOrEnd(*tls, tripId, false))
 	{
 		return -1;
 	}
+	tls->SendStruct(EncFunc::TripMatcher::k_endSession);
+	tls.reset();
 
 	Pause("exit");
 	return 0;
@@ -196,15 +278,12 @@ bool RegesterCert(Net::ConnectionBase& con, const ComMsg::DriContact& contact)
 	return true;
 }
 
-std::unique_ptr<ComMsg::BestMatches> SendQuery(Net::ConnectionBase& con)
+std::unique_ptr<ComMsg::BestMatches> SendQuery(TlsCommLayer& tls)
 {
 	using namespace EncFunc::TripMatcher;
 
 	ComMsg::DriverLoc DriLoc(ComMsg::Point2D<double>(1.1, 1.2));
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_tripMatcher, nullptr);
-	TlsCommLayer tls(con, tlsCfg, true, nullptr);
-
 	tls.SendStruct(k_findMatch);
 	tls.SendContainer(DriLoc.ToString());
 	std::string msgBuf = tls.RecvContainer<std::string>();
@@ -232,14 +311,71 @@ std::unique_ptr<ComMsg::BestMatches> SendQuery(Net::ConnectionBase& con)
 	return std::move(matchesMsg);
 }
 
-bool ConfirmMatch(Net::ConnectionBase& con, const ComMsg::DriContact& contact, const std::string& tripId)
+std::string WaitForMatch(TlsCommLayer& tls)
 {
 	using namespace EncFunc::TripMatcher;
 
-	ComMsg::DriSelection driSelection(contact, tripId);
+	ComMsg::DriverLoc DriLoc(ComMsg::Point2D<double>(1.1, 1.2));
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_tripMatcher, nullptr);
-	Decent::Net::TlsCommLayer tls(con, tlsCfg, true, nullptr);
+	tls.SendStruct(k_subscribe);
+	tls.SendContainer(DriLoc.ToString());
+
+	//The first update has the current matches; wait until there is at least one trip available.
+	std::vector<std::string> available;
+	while (available.size() == 0)
+	{
+		std::string msgBuf = tls.RecvContainer<std::string>();
+		std::unique_ptr<ComMsg::MatchUpdate> update = ParseMsg<ComMsg::MatchUpdate>(msgBuf);
+
+		for (const std::string& tripId : update->GetRemoved())
+		{
+			PRINT_I("Trip taken or expired: %s.", tripId.c_str());
+			available.erase(std::remove(available.begin(), available.end(), tripId), available.end());
+		}
+		for (const ComMsg::MatchItem& match : update->GetAdded())
+		{
+			PRINT_I("Trip available: %s, Ori: (%f, %f), Dest: (%f, %f).",
+				match.GetTripId().c_str(),
+				match.GetPath().GetPath().front().GetX(), match.GetPath().GetPath().front().GetY(),
+				match.GetPath().GetPath().back().GetX(), match.GetPath().GetPath().back().GetY());
+			available.push_back(match.GetTripId());
+		}
+	}
+
+	return available.front();
+}
+
+std::string WaitForAssignment(TlsCommLayer& tls, const ComMsg::DriContact& contact)
+{
+	using namespace EncFunc::TripMatcher;
+
+	ComMsg::DriAvailable available(contact, ComMsg::DriverLoc(ComMsg::Point2D<double>(1.1, 1.2)));
+
+	tls.SendStruct(k_waitAssign);
+	tls.SendContainer(available.ToString());
+
+	PRINT_I("Waiting for the batch assignment...");
+	std::string msgBuf = tls.RecvContainer<std::string>();
+	std::unique_ptr<ComMsg::DriAssignment> assignment = ParseMsg<ComMsg::DriAssignment>(msgBuf);
+
+	if (assignment->GetTripId().size() == 0)
+	{
+		PRINT_I("No trip is assigned before timeout.");
+		return std::string();
+	}
+
+	PRINT_I("Assigned trip %s, with passenger:", assignment->GetTripId().c_str());
+	PRINT_I("\tName:  %s.", assignment->GetPasContact().GetName().c_str());
+	PRINT_I("\tPhone: %s.", assignment->GetPasContact().GetPhone().c_str());
+
+	return assignment->GetTripId();
+}
+
+bool ConfirmMatch(TlsCommLayer& tls, const ComMsg::DriContact& contact, const std::string& tripId)
+{
+	using namespace EncFunc::TripMatcher;
+
+	ComMsg::DriSelection driSelection(contact, tripId);
 
 	tls.SendStruct(k_confirmMatch);
 	tls.SendContainer(driSelection.ToString());
@@ -253,13 +389,10 @@ bool ConfirmMatch(Net::ConnectionBase& con, const ComMsg::DriContact& contact, c
 	return true;
 }
 
-bool TripStartOrEnd(Net::ConnectionBase& con, const std::string& tripId, const bool isStart)
+bool TripStartOrEnd(TlsCommLayer& tls, const std::string& tripId, const bool isStart)
 {
 	using namespace EncFunc::TripMatcher;
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_tripMatcher, nullptr);
-	Decent::Net::TlsCommLayer tls(con, tlsCfg, true, nullptr);
-
 	tls.SendStruct(isStart ? k_tripStart : k_tripEnd);
 	tls.SendContainer(tripId);
 
@@ -267,3 +400,28 @@ bool TripStartOrEnd(Net::ConnectionBase& con, const std::string& tripId, const b
 
 	return true;
 }
+
+bool SendTripTrace(TlsCommLayer& tls, const std::string& tripId)
+{
+	using namespace EncFunc::TripMatcher;
+
+	//A made-up drive, streamed in a few parts, as a driver would do periodically.
+	constexpr size_t numParts = 3;
+	constexpr size_t numPointsPerPart = 10;
+	for (size_t i = 0; i < numParts; ++i)
+	{
+		std::vector<ComMsg::Point2D<double> > points;
+		for (size_t j = 0; j < numPointsPerPart; ++j)
+		{
+			const double step = static_cast<double>(i * numPointsPerPart + j);
+			points.push_back(ComMsg::Point2D<double>(1.1 + 0.05 * step, 1.2 + 0.03 * step));
+		}
+
+		tls.SendStruct(k_tripTrace);
+		tls.SendContainer(ComMsg::TripTrace(tripId, points).ToString());
+	}
+
+	PRINT_I("Trip trace is sent.");
+
+	return true;
+}
@@ -17,7 +17,14 @@ namespace RideShare
 
 		virtual bool ProcessMsgFromPayment(Decent::Net::ConnectionBase& connection);
 
+		virtual bool ProcessMsgFromBilling(Decent::Net::ConnectionBase& connection);
+
 		virtual bool ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt) override;
 
+		/**
+		 * \brief	Updates the time of the enclave, for the sliding window of the surge counters.
+		 */
+		void UpdateTime();
+
 	};
 }
@@ -1,4 +1,5 @@
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <map>
 
@@ -22,8 +23,15 @@
 #include "../Common/AppNames.h"
 #include "../Common/RideSharingFuncNums.h"
 #include "../Common/RideSharingMessages.h"
+#include "../Common/ClientId.h"
 
+#include "../Common_Enc/InSituMessages.h"
 #include "../Common_Enc/OperatorPayment.h"
+#include "../Common_Enc/TlsChannelPool.h"
+#include "../Common_Enc/CellEventCounter.h"
+#include "../Common_Enc/EnclaveClock.h"
+
+#include "Enclave_t.h"
 
 using namespace RideShare;
 using namespace Decent::Ra;
@@ -32,6 +40,11 @@ using namespace Decent::Net;
 namespace
 {
 	static AppStates& gs_state = GetAppStateSingleton();
+
+	//Only used for the rare invalidations of the payment info cached by the Payment Services.
+	constexpr size_t gsk_maxIdleChannels = 1;
+
+	static TlsChannelPool gs_paymentPool(gs_state, AppNames::sk_payment, &ocall_ride_share_cnt_mgr_get_payment, EncFunc::Payment::k_endSession, gsk_maxIdleChannels);
 	
 	struct DriProfileItem
 	{
@@ -56,17 +69,27 @@ namespace
 		{}
 	};
 
-	typedef std::map<std::string, DriProfileItem> ProfileMapType;
+	typedef std::map<ClientId, DriProfileItem> ProfileMapType;
 	ProfileMapType gs_profileMap;
 	const ProfileMapType& gsk_profileMap = gs_profileMap;
 	std::mutex gs_profileMapMutex;
 
+	//Same as the bill batch limit of the Payment Services.
+	constexpr size_t gsk_maxPayInfoBatchSize = 4096;
+	//Same as the find-match batch limit of the Trip Matcher.
+	constexpr size_t gsk_maxQueryLogBatchSize = 4096;
+
+	//The time (in seconds), for the sliding window of the supply counter (see AdvanceTime).
+	std::atomic<uint64_t> gs_currTime(0);
+
+	//The drivers looking for matches in each cell. Drivers keep polling for matches while they are
+	//  available, so the number of their queries follows the number of available drivers.
+	CellEventCounter gs_supplyCounter(SurgeGrid::sk_cellSize, SurgeGrid::sk_bucketLen, SurgeGrid::sk_maxNumCells, SurgeGrid::sk_maxNumSources);
+
 	template<typename MsgType>
-	static std::unique_ptr<MsgType> ParseMsg(const std::string& msgStr)
+	static std::unique_ptr<MsgType> ParseMsg(std::string& msgStr)
 	{
-		rapidjson::Document json;
-		Decent::Tools::ParseStr2Json(json, msgStr);
-		return Decent::Tools::make_unique<MsgType>(json);
+		return Decent::Tools::make_unique<MsgType>(ComMsg::ParseInSitu<MsgType>(msgStr, msgStr));
 	}
 }
 
@@ -85,7 +108,39 @@ static bool VerifyPayment(const std::string& pay)
 	return pay.size() != 0;
 }
 
-static void ProcessDriRegisterReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+/**
+ * \brief	Tells the Payment Services to drop its cached payment info of the driver. It's best
+ * 			effort; if it fails, the cached info still expires after its TTL.
+ */
+static void InvalidatePaymentInfo(const ClientId& id)
+{
+	using namespace EncFunc::Payment;
+	LOGI("Invalidating the payment info cached by the Payment Services...");
+
+	try
+	{
+		//Invalidating is idempotent; the acknowledgement tells a stale channel from a success.
+		gs_paymentPool.UseWithRetry([&id](ConnectionBase& cnt, TlsCommLayer& tls)
+		{
+			tls.SendStruct(cnt, k_invalidatePayInfo);
+			tls.SendStruct(cnt, id.Get());
+			uint8_t ack = 0;
+			tls.RecvStruct(cnt, ack);
+		});
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to invalidate the cached payment info. Caught exception: %s", e.what());
+	}
+}
+
+/**
+ * \brief	Registers a new driver, or, if isUpdate is set, updates the profile of a registered one
+ * 			(e.g., a new payment info). In both cases, the client proves it holds the key through
+ * 			the CSR, and gets a new certificate, since the certificate carries the contact hash.
+ * 			Registering an existing key, or updating an unknown one, is rejected.
+ */
+static void ProcessDriRegisterReq(void* const connection, Decent::Net::TlsCommLayer& tls, const bool isUpdate)
 {
 	using namespace Decent::MbedTlsObj;
 
@@ -107,16 +162,17 @@ static void ProcessDriRegisterReq(void* const connection, Decent::Net::TlsCommLa
 	certReq.VerifySignature();
 
 	EcPublicKey<EcKeyType::SECP256R1> clientKey(EcPublicKey<EcKeyType::SECP256R1>(certReq.GetPublicKey()));
-	std::string driId = clientKey.GetPublicPem();
+	const ClientId driId = ClientId::FromPubKeyDer(clientKey.GetPublicDer());
 
 	{
-		std::unique_lock<std::mutex> profileMapLock(gs_profileMapMutex);
-		if (gsk_profileMap.find(driId) != gsk_profileMap.cend())
+		std::unique_lock<std::mutex> profilesLock(gs_profileMapMutex);
+		if ((gsk_profileMap.find(driId) != gsk_profileMap.cend()) != isUpdate)
 		{
-			LOGI("Client profile already exist.");
+			LOGI(isUpdate ? "Client profile doesn't exist." : "Client profile already exist.");
 			return;
 		}
 	}
+
 	std::shared_ptr<const AppX509Cert> cert = gs_state.GetAppCertContainer().GetAppCert();
 
 	if (!cert)
@@ -131,13 +187,32 @@ static void ProcessDriRegisterReq(void* const connection, Decent::Net::TlsCommLa
 	ClientX509CertWriter clientCert(clientKey, *cert, prvKey, "Decent_RideShare_Driver",
 		cppcodec::base64_rfc4648::encode(contact.CalcHash()));
 
+	bool isPayChanged = false;
 	{
 		std::unique_lock<std::mutex> pasProfilesLock(gs_profileMapMutex);
 
+		//Checked again, since another request for the same key may have got in meanwhile.
+		auto it = gs_profileMap.find(driId);
+		if ((it != gs_profileMap.end()) != isUpdate)
+		{
+			LOGI(isUpdate ? "Client profile doesn't exist." : "Client profile already exist.");
+			return;
+		}
+		if (isUpdate)
+		{
+			isPayChanged = (it->second.m_pay != driRegInfo->GetPayment());
+			gs_profileMap.erase(it);
+		}
+
 		gs_profileMap.insert(std::make_pair(driId,
 			DriProfileItem(contact, driRegInfo->GetPayment(), driRegInfo->GetDriLic())));
 
-		LOGI("Client profile added. Profile store size: %llu.", gsk_profileMap.size());
+		LOGI(isUpdate ? "Client profile updated. Profile store size: %llu." : "Client profile added. Profile store size: %llu.", gsk_profileMap.size());
+	}
+
+	if (isPayChanged)
+	{
+		InvalidatePaymentInfo(driId);
 	}
 
 	Drbg drbg;
@@ -157,20 +232,58 @@ static void LogQuery(void* const connection, Decent::Net::TlsCommLayer& tls)
 	const ComMsg::Point2D<double>& loc = queryLog->GetLoc();
 
 	PRINT_I("Logged Driver Query:");
-	PRINT_I("Driver ID:\n%s", queryLog->GetDriverId().c_str());
+	PRINT_I("Driver ID:\n%s", queryLog->GetDriverId().ToString().c_str());
 	PRINT_I("Location: (%f, %f)", loc.GetX(), loc.GetY());
 
+	gs_supplyCounter.Add(loc, queryLog->GetDriverId(), gs_currTime.load());
 }
 
-static void RequestPaymentInfo(void* const connection, Decent::Net::TlsCommLayer& tls)
+/**
+ * \brief	Logs the queries of a batch of driver locations, sent through a gateway. The drivers are
+ * 			not identified one by one, so the batch is logged, and counted in the supply, under the
+ * 			ID of the gateway.
+ *
+ * \return	False if the batch is too large, so the session should be ended.
+ */
+static bool LogQueryBatch(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Logging a batch of driver's queries...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
+	std::unique_ptr<ComMsg::DriQueryLogBatch> queryLog = ParseMsg<ComMsg::DriQueryLogBatch>(msgBuf);
+
+	const std::vector<ComMsg::Point2D<double> >& locs = queryLog->GetLocs();
+	if (locs.size() > gsk_maxQueryLogBatchSize)
+	{
+		LOGW("The batch of query logs is too large!");
+		return false;
+	}
+
+	PRINT_I("Logged a batch of %llu Driver Queries, through a gateway:", static_cast<unsigned long long>(locs.size()));
+	PRINT_I("Gateway ID:\n%s", queryLog->GetGatewayId().ToString().c_str());
+	for (const ComMsg::Point2D<double>& loc : locs)
+	{
+		LOGI("Location: (%f, %f)", loc.GetX(), loc.GetY());
+	}
+
+	gs_supplyCounter.AddBatch(locs, queryLog->GetGatewayId(), gs_currTime.load());
+
+	return true;
+}
+
+static bool RequestPaymentInfo(void* const connection, Decent::Net::TlsCommLayer& tls)
 {
 	LOGI("Processing payment info request...");
 
 	EnclaveCntTranslator cnt(connection);
 
-	std::string driId = tls.RecvContainer<std::string>(cnt);
+	ClientId::HashType driIdHash;
+	tls.RecvStruct(cnt, driIdHash);
+	const ClientId driId(driIdHash);
 
-	LOGI("Looking for payment info of driver:\n %s", driId.c_str());
+	LOGI("Looking for payment info of driver:\n %s", driId.ToString().c_str());
 
 	std::string driPayInfo;
 	std::string selfPayInfo = OperatorPayment::GetPaymentInfo();
@@ -179,7 +292,7 @@ static void RequestPaymentInfo(void* const connection, Decent::Net::TlsCommLayer
 		auto it = gsk_profileMap.find(driId);
 		if (it == gsk_profileMap.cend())
 		{
-			return;
+			return false;
 		}
 		driPayInfo = it->second.m_pay;
 	}
@@ -189,6 +302,60 @@ static void RequestPaymentInfo(void* const connection, Decent::Net::TlsCommLayer
 	ComMsg::RequestedPayment payInfo(std::move(driPayInfo), std::move(selfPayInfo));
 
 	tls.SendContainer(cnt, payInfo.ToString());
+
+	return true;
+}
+
+/**
+ * \brief	Replies the payment info of a batch of drivers at once, so a batch of bills only costs
+ * 			one round trip. Unlike the single query, an unknown driver doesn't end the session; its
+ * 			payment info is just left empty.
+ */
+static bool RequestPaymentInfoBatch(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Processing payment info batch request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
+	const ComMsg::WireFormat format = ComMsg::DetectWireFormat(msgBuf);
+	std::unique_ptr<ComMsg::PayInfoQueryBatch> query = ParseMsg<ComMsg::PayInfoQueryBatch>(msgBuf);
+
+	const std::vector<ClientId>& ids = query->GetIds();
+	if (ids.size() > gsk_maxPayInfoBatchSize)
+	{
+		LOGW("Payment info batch is too large (%llu).", static_cast<unsigned long long>(ids.size()));
+		return false;
+	}
+
+	std::vector<std::string> payInfos;
+	payInfos.reserve(ids.size());
+	size_t numFound = 0;
+	{
+		std::unique_lock<std::mutex> profilesLock(gs_profileMapMutex);
+		for (const ClientId& id : ids)
+		{
+			auto it = gsk_profileMap.find(id);
+			if (it == gsk_profileMap.cend())
+			{
+				payInfos.push_back(std::string());
+			}
+			else
+			{
+				payInfos.push_back(it->second.m_pay);
+				++numFound;
+			}
+		}
+	}
+
+	LOGI("%llu of %llu driver profiles are found. Sending payment info...",
+		static_cast<unsigned long long>(numFound), static_cast<unsigned long long>(ids.size()));
+
+	ComMsg::RequestedPaymentBatch payInfo(std::move(payInfos), std::string(OperatorPayment::GetPaymentInfo()));
+
+	tls.SendContainer(cnt, payInfo.ToString(format));
+
+	return true;
 }
 
 extern "C" int ecall_ride_share_dm_from_dri(void* const connection)
@@ -215,7 +382,10 @@ extern "C" int ecall_ride_share_dm_from_dri(void* const connection)
 		switch (funcNum)
 		{
 		case k_userReg:
-			ProcessDriRegisterReq(connection, tls);
+			ProcessDriRegisterReq(connection, tls, false);
+			break;
+		case k_userUpdate:
+			ProcessDriRegisterReq(connection, tls, true);
 			break;
 		default:
 			break;
@@ -247,16 +417,26 @@ extern "C" int ecall_ride_share_dm_from_trip_matcher(void* const connection)
 		std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, AppNames::sk_tripMatcher, nullptr);
 		Decent::Net::TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the Trip Matcher ends it.
 		NumType funcNum;
-		tls.RecvStruct(cnt, funcNum);
-
-		switch (funcNum)
+		bool isSessionAlive = true;
+		while (isSessionAlive)
 		{
-		case k_logQuery:
-			LogQuery(connection, tls);
-			break;
-		default:
-			break;
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_logQuery:
+				LogQuery(connection, tls);
+				break;
+			case k_logQueryBatch:
+				isSessionAlive = LogQueryBatch(connection, tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
 		}
 	}
 	catch (const std::exception& e)
@@ -286,16 +466,26 @@ extern "C" int ecall_ride_share_dm_from_payment(void* const connection)
 		std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, AppNames::sk_payment, nullptr);
 		Decent::Net::TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the Payment Services ends it, or a request fails.
 		NumType funcNum;
-		tls.RecvStruct(cnt, funcNum);
-
-		switch (funcNum)
+		bool isSessionAlive = true;
+		while (isSessionAlive)
 		{
-		case k_getPayInfo:
-			RequestPaymentInfo(connection, tls);
-			break;
-		default:
-			break;
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_getPayInfo:
+				isSessionAlive = RequestPaymentInfo(connection, tls);
+				break;
+			case k_getPayInfoBatch:
+				isSessionAlive = RequestPaymentInfoBatch(connection, tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
 		}
 	}
 	catch (const std::exception& e)
@@ -305,3 +495,71 @@ extern "C" int ecall_ride_share_dm_from_payment(void* const connection)
 
 	return false;
 }
+
+/**
+ * \brief	Replies the supply counts of the cells, within the sliding window, for the surge multipliers.
+ */
+static bool RequestSupply(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Processing supply request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	const ComMsg::CellCountBatch counts(gs_supplyCounter.GetCounts(gs_currTime.load()));
+
+	tls.SendContainer(cnt, counts.ToString());
+
+	return true;
+}
+
+extern "C" int ecall_ride_share_dm_from_billing(void* const connection)
+{
+	if (!OperatorPayment::IsPaymentInfoValid())
+	{
+		return false;
+	}
+
+	using namespace EncFunc::DriverMgm;
+
+	LOGI("Processing message from Billing Services...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	try
+	{
+		std::shared_ptr<TlsConfigWithName> billTlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, AppNames::sk_billing, nullptr);
+		TlsCommLayer tls(cnt, billTlsCfg, true, nullptr);
+
+		//Keep serving requests on the same session until the Billing Services ends it.
+		NumType funcNum;
+		bool isSessionAlive = true;
+		while (isSessionAlive)
+		{
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_getSupply:
+				isSessionAlive = RequestSupply(connection, tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to processing message from Billing Services. Caught exception: %s", e.what());
+	}
+
+	return false;
+}
+
+extern "C" void ecall_ride_share_dm_set_time(uint64_t curr_time)
+{
+	AdvanceTime(gs_currTime, curr_time);
+
+	gs_paymentPool.EvictIdle();
+}
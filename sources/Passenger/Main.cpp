@@ -39,9 +39,9 @@ using namespace Decent::Ra::WhiteList;
 using namespace Decent::AppConfig;
 
 bool RegesterCert(Net::ConnectionBase& con, const ComMsg::PasContact& contact);
-bool SendQuery(Net::ConnectionBase& con, std::string& signedQuote);
-bool ConfirmQuote(Net::ConnectionBase& con, const ComMsg::PasContact& contact, const std::string& signedQuoteStr, std::string& tripId);
-bool TripStartOrEnd(Net::ConnectionBase& con, const std::string& tripId, const bool isStart);
+bool SendQuery(TlsCommLayer& tls, std::string& signedQuote);
+bool ConfirmQuote(TlsCommLayer& tls, const ComMsg::PasContact& contact, const std::string& signedQuoteStr, std::string& tripId);
+bool TripStartOrEnd(TlsCommLayer& tls, const std::string& tripId, const bool isStart);
 
 namespace
 {
@@ -55,17 +55,22 @@ namespace
 template<typename MsgType>
 static std::unique_ptr<MsgType> ParseMsg(const std::string& msgStr)
 {
-	JsonDoc json;
-	Decent::Tools::ParseStr2Json(json, msgStr);
-	return std::make_unique<MsgType>(json);
+	return ComMsg::ParseWireMsg<MsgType>(msgStr);
 }
 
 static std::unique_ptr<ComMsg::SignedQuote> ParseSignedQuote(const std::string& msg, Ra::States& state)
 {
-	JsonDoc json;
-	ParseStr2Json(json, msg);
+	return std::make_unique<ComMsg::SignedQuote>(ComMsg::SignedQuote::ParseSignedQuote(msg, state, AppNames::sk_tripPlanner));
+}
 
-	return std::make_unique<ComMsg::SignedQuote>(ComMsg::SignedQuote::ParseSignedQuote(json, state, AppNames::sk_tripPlanner));
+/**
+ * \brief	Starts a keep-alive session with the given service, so multiple requests can share one TLS
+ * 			handshake. The session must be ended with the service's k_endSession.
+ */
+static std::unique_ptr<TlsCommLayer> StartSession(Net::ConnectionBase& con, const std::string& appName)
+{
+	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, appName, nullptr);
+	return std::make_unique<TlsCommLayer>(con, tlsCfg, true, nullptr);
 }
 
 static void Pause(const std::string& msg)
@@ -92,8 +97,16 @@ int main(int argc, char ** argv)
 	TCLAP::ValueArg<std::string> configPathArg("c", "config", "Path to the configuration file.", false, "Config.json", "String");
 	cmd.add(configPathArg);
 
+	TCLAP::SwitchArg jsonMsgArg("j", "json-msg", "Send messages in JSON instead of the binary format, for debugging.", false);
+	cmd.add(jsonMsgArg);
+
 	cmd.parse(argc, argv);
 
+	if (jsonMsgArg.getValue())
+	{
+		ComMsg::SetDefaultWireFormat(ComMsg::WireFormat::Json);
+	}
+
 	//------- Read configuration file:
 	std::unique_ptr<DecentAppConfig> configMgr;
 	try
@@ -135,6 +148,7 @@ int main(int argc, char ** argv)
 	ComMsg::PasContact contact("pasFirst pasLast", "1234567890");
 
 	std::unique_ptr<Net::ConnectionBase> appCon;
+	std::unique_ptr<TlsCommLayer> tls;
 
 	Pause("register");
 	appCon = ConnectionManager::GetConnection2PassengerMgm(RequestCategory::sk_fromPassenger);
@@ -146,32 +160,46 @@ int main(int argc, char ** argv)
 	Pause("get quote");
 	std::string signedQuoteStr;
 	appCon = ConnectionManager::GetConnection2TripPlanner(RequestCategory::sk_fromPassenger);
-	if (!SendQuery(*appCon, signedQuoteStr))
+	tls = StartSession(*appCon, AppNames::sk_tripPlanner);
+	if (!SendQuery(*tls, signedQuoteStr))
 	{
 		return -1;
 	}
+	tls->SendStruct(EncFunc::TripPlaner::k_endSession);
+	tls.reset();
 
 	Pause("confirm quote");
 	std::string tripId;
 	appCon = ConnectionManager::GetConnection2TripMatcher(RequestCategory::sk_fromPassenger);
-	if (!ConfirmQuote(*appCon, contact, signedQuoteStr, tripId))
+	tls = StartSession(*appCon, AppNames::sk_tripMatcher);
+	if (!ConfirmQuote(*tls, contact, signedQuoteStr, tripId))
 	{
 		return -1;
 	}
+	//Trip Matcher closes the session after the match result is sent.
+	tls.reset();
 
+	//The start and the end of the trip go through sessions of their own, since the Trip Matcher
+	//  closes the sessions left idle (see SessionWatchdog), e.g., for the whole ride.
 	Pause("start trip");
 	appCon = ConnectionManager::GetConnection2TripMatcher(RequestCategory::sk_fromPassenger);
-	if (!TripStartOrEnd(*appCon, tripId, true))
+	tls = StartSession(*appCon, AppNames::sk_tripMatcher);
+	if (!TripStartOrEnd(*tls, tripId, true))
 	{
 		return -1;
 	}
+	tls->SendStruct(EncFunc::TripMatcher::k_endSession);
+	tls.reset();
 
 	Pause("end trip");
 	appCon = ConnectionManager::GetConnection2TripMatcher(RequestCategory::sk_fromPassenger);
-	if (!TripStartOrEnd(*appCon, tripId, false))
+	tls = StartSession(*appCon, AppNames::sk_tripMatcher);
+	if (!TripStartOrEnd(*tls, tripId, false))
 	{
 		return -1;
 	}
+	tls->SendStruct(EncFunc::TripMatcher::k_endSession);
+	tls.reset();
 
 	Pause("exit");
 	return 0;
@@ -208,16 +236,13 @@ bool RegesterCert(Net::ConnectionBase& con, const ComMsg::PasContact& contact)
 	return true;
 }
 
-bool SendQuery(Net::ConnectionBase& con, std::string& signedQuoteStr)
+bool SendQuery(TlsCommLayer& tls, std::string& signedQuoteStr)
 {
 	using namespace EncFunc::TripPlaner;
 
 	ComMsg::GetQuote getQuote(ComMsg::Point2D<double>(gs_locRandDis(gs_randGen), gs_locRandDis(gs_randGen)), 
 		ComMsg::Point2D<double>(gs_locRandDis(gs_randGen), gs_locRandDis(gs_randGen)));
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_tripPlanner, nullptr);
-	TlsCommLayer tls(con, tlsCfg, true, nullptr);
-
 	tls.SendStruct(k_getQuote);
 	tls.SendContainer(getQuote.ToString());
 	signedQuoteStr = tls.RecvContainer<std::string>();
@@ -230,15 +255,12 @@ bool SendQuery(Net::ConnectionBase& con, std::string& signedQuoteStr)
 	return true;
 }
 
-bool ConfirmQuote(Net::ConnectionBase& con, const ComMsg::PasContact& contact, const std::string& signedQuoteStr, std::string& tripId)
+bool ConfirmQuote(TlsCommLayer& tls, const ComMsg::PasContact& contact, const std::string& signedQuoteStr, std::string& tripId)
 {
 	using namespace EncFunc::TripMatcher;
 
 	ComMsg::ConfirmQuote confirmQuote(contact, signedQuoteStr);
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_tripMatcher, nullptr);
-	TlsCommLayer tls(con, tlsCfg, true, nullptr);
-
 	tls.SendStruct(k_confirmQuote);
 	tls.SendContainer(confirmQuote.ToString());
 	PRINT_I("Waiting for a match...\n");
@@ -246,6 +268,13 @@ bool ConfirmQuote(Net::ConnectionBase& con, const ComMsg::PasContact& contact, c
 
 	std::unique_ptr<ComMsg::PasMatchedResult> matchedResult = ParseMsg<ComMsg::PasMatchedResult>(msgBuf);
 
+	//An empty result means the quote has expired before any driver took it.
+	if (matchedResult->GetTripId().size() == 0)
+	{
+		PRINT_I("No driver has taken the trip in time.");
+		return false;
+	}
+
 	PRINT_I("Matched Driver:");
 	PRINT_I("\tName:  %s.", matchedResult->GetDriContact().GetName().c_str());
 	PRINT_I("\tPhone: %s.", matchedResult->GetDriContact().GetPhone().c_str());
@@ -255,13 +284,10 @@ bool ConfirmQuote(Net::ConnectionBase& con, const ComMsg::PasContact& contact, c
 	return true;
 }
 
-bool TripStartOrEnd(Net::ConnectionBase& con, const std::string& tripId, const bool isStart)
+bool TripStartOrEnd(TlsCommLayer& tls, const std::string& tripId, const bool isStart)
 {
 	using namespace EncFunc::TripMatcher;
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_tripMatcher, nullptr);
-	TlsCommLayer tls(con, tlsCfg, true, nullptr);
-
 	tls.SendStruct(isStart ? k_tripStart : k_tripEnd);
 	tls.SendContainer(tripId);
 
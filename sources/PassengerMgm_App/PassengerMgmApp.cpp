@@ -1,5 +1,7 @@
 #include "PassengerMgmApp.h"
 
+#include <chrono>
+
 #include <DecentApi/Common/SGX/RuntimeError.h>
 
 #include "../Common_App/RequestCategory.h"
@@ -41,6 +43,17 @@ bool PassengerMgm::ProcessMsgFromPayment(Decent::Net::ConnectionBase& connection
 	return retValue;
 }
 
+bool PassengerMgm::ProcessMsgFromBilling(Decent::Net::ConnectionBase& connection)
+{
+	int retValue = false;
+	sgx_status_t enclaveRet = SGX_SUCCESS;
+
+	enclaveRet = ecall_ride_share_pm_from_billing(GetEnclaveId(), &retValue, &connection);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_pm_from_billing);
+
+	return retValue;
+}
+
 bool PassengerMgm::ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt)
 {
 	if (category == RequestCategory::sk_fromPassenger)
@@ -55,8 +68,21 @@ bool PassengerMgm::ProcessSmartMessage(const std::string& category, Decent::Net:
 	{
 		return ProcessMsgFromPayment(connection);
 	}
+	else if (category == RequestCategory::sk_fromBilling)
+	{
+		return ProcessMsgFromBilling(connection);
+	}
 	else
 	{
 		return RideShareApp::ProcessSmartMessage(category, connection, freeHeldCnt);
 	}
 }
+
+void PassengerMgm::UpdateTime()
+{
+	//A monotonic clock, so the window isn't affected by changes of the wall clock.
+	const uint64_t currTime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+
+	sgx_status_t enclaveRet = ecall_ride_share_pm_set_time(GetEnclaveId(), currTime);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_pm_set_time);
+}
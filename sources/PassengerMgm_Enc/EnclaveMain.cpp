@@ -1,6 +1,7 @@
 //#include "Enclave_t.h"
 
 #include <mutex>
+#include <atomic>
 #include <memory>
 #include <map>
 
@@ -24,8 +25,15 @@
 #include "../Common/AppNames.h"
 #include "../Common/RideSharingFuncNums.h"
 #include "../Common/RideSharingMessages.h"
+#include "../Common/ClientId.h"
 
+#include "../Common_Enc/InSituMessages.h"
 #include "../Common_Enc/OperatorPayment.h"
+#include "../Common_Enc/TlsChannelPool.h"
+#include "../Common_Enc/CellEventCounter.h"
+#include "../Common_Enc/EnclaveClock.h"
+
+#include "Enclave_t.h"
 
 using namespace RideShare;
 using namespace Decent::Ra;
@@ -34,6 +42,11 @@ using namespace Decent::Net;
 namespace
 {
 	static AppStates& gs_state = GetAppStateSingleton();
+
+	//Only used for the rare invalidations of the payment info cached by the Payment Services.
+	constexpr size_t gsk_maxIdleChannels = 1;
+
+	static TlsChannelPool gs_paymentPool(gs_state, AppNames::sk_payment, &ocall_ride_share_cnt_mgr_get_payment, EncFunc::Payment::k_endSession, gsk_maxIdleChannels);
 	
 	struct PasProfileItem
 	{
@@ -54,16 +67,23 @@ namespace
 		{}
 	};
 
-	std::map<std::string, PasProfileItem> gs_pasProfiles;
-	const std::map<std::string, PasProfileItem>& gsk_pasProfiles = gs_pasProfiles;
+	std::map<ClientId, PasProfileItem> gs_pasProfiles;
+	const std::map<ClientId, PasProfileItem>& gsk_pasProfiles = gs_pasProfiles;
 	std::mutex gs_pasProfilesMutex;
 
+	//Same as the bill batch limit of the Payment Services.
+	constexpr size_t gsk_maxPayInfoBatchSize = 4096;
+
+	//The time (in seconds), for the sliding window of the demand counter (see AdvanceTime).
+	std::atomic<uint64_t> gs_currTime(0);
+
+	//The quotes requested in each cell, by their origins.
+	CellEventCounter gs_demandCounter(SurgeGrid::sk_cellSize, SurgeGrid::sk_bucketLen, SurgeGrid::sk_maxNumCells, SurgeGrid::sk_maxNumSources);
+
 	template<typename MsgType>
-	static std::unique_ptr<MsgType> ParseMsg(const std::string& msgStr)
+	static std::unique_ptr<MsgType> ParseMsg(std::string& msgStr)
 	{
-		rapidjson::Document json;
-		Decent::Tools::ParseStr2Json(json, msgStr);
-		return Decent::Tools::make_unique<MsgType>(json);
+		return Decent::Tools::make_unique<MsgType>(ComMsg::ParseInSitu<MsgType>(msgStr, msgStr));
 	}
 
 	static bool VerifyContactInfo(const ComMsg::PasContact& contact)
@@ -72,7 +92,39 @@ namespace
 	}
 }
 
-static void ProcessPasRegisterReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+/**
+ * \brief	Tells the Payment Services to drop its cached payment info of the passenger. It's best
+ * 			effort; if it fails, the cached info still expires after its TTL.
+ */
+static void InvalidatePaymentInfo(const ClientId& id)
+{
+	using namespace EncFunc::Payment;
+	LOGI("Invalidating the payment info cached by the Payment Services...");
+
+	try
+	{
+		//Invalidating is idempotent; the acknowledgement tells a stale channel from a success.
+		gs_paymentPool.UseWithRetry([&id](ConnectionBase& cnt, TlsCommLayer& tls)
+		{
+			tls.SendStruct(cnt, k_invalidatePayInfo);
+			tls.SendStruct(cnt, id.Get());
+			uint8_t ack = 0;
+			tls.RecvStruct(cnt, ack);
+		});
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to invalidate the cached payment info. Caught exception: %s", e.what());
+	}
+}
+
+/**
+ * \brief	Registers a new passenger, or, if isUpdate is set, updates the profile of a registered one
+ * 			(e.g., a new payment info). In both cases, the client proves it holds the key through
+ * 			the CSR, and gets a new certificate, since the certificate carries the contact hash.
+ * 			Registering an existing key, or updating an unknown one, is rejected.
+ */
+static void ProcessPasRegisterReq(void* const connection, Decent::Net::TlsCommLayer& tls, const bool isUpdate)
 {
 	using namespace Decent::MbedTlsObj;
 
@@ -92,16 +144,17 @@ static void ProcessPasRegisterReq(void* const connection, Decent::Net::TlsCommLa
 	certReq.VerifySignature();
 
 	EcPublicKey<EcKeyType::SECP256R1> clientKey(EcPublicKey<EcKeyType::SECP256R1>(certReq.GetPublicKey()));
-	std::string pasId = clientKey.GetPublicPem();
+	const ClientId pasId = ClientId::FromPubKeyDer(clientKey.GetPublicDer());
 
 	{
-		std::unique_lock<std::mutex> pasProfilesLock(gs_pasProfilesMutex);
-		if (gsk_pasProfiles.find(pasId) != gsk_pasProfiles.cend())
+		std::unique_lock<std::mutex> profilesLock(gs_pasProfilesMutex);
+		if ((gsk_pasProfiles.find(pasId) != gsk_pasProfiles.cend()) != isUpdate)
 		{
-			LOGI("Client profile already exist.");
+			LOGI(isUpdate ? "Client profile doesn't exist." : "Client profile already exist.");
 			return;
 		}
 	}
+
 	std::shared_ptr<const AppX509Cert> cert = gs_state.GetAppCertContainer().GetAppCert();
 
 	if (!cert)
@@ -115,13 +168,32 @@ static void ProcessPasRegisterReq(void* const connection, Decent::Net::TlsCommLa
 	ClientX509CertWriter clientCert(clientKey, *cert, prvKey, "Decent_RideShare_Passenger",
 		cppcodec::base64_rfc4648::encode(pasRegInfo->GetContact().CalcHash()));
 
+	bool isPayChanged = false;
 	{
 		std::unique_lock<std::mutex> pasProfilesLock(gs_pasProfilesMutex);
 
+		//Checked again, since another request for the same key may have got in meanwhile.
+		auto it = gs_pasProfiles.find(pasId);
+		if ((it != gs_pasProfiles.end()) != isUpdate)
+		{
+			LOGI(isUpdate ? "Client profile doesn't exist." : "Client profile already exist.");
+			return;
+		}
+		if (isUpdate)
+		{
+			isPayChanged = (it->second.m_pay != pasRegInfo->GetPayment());
+			gs_pasProfiles.erase(it);
+		}
+
 		gs_pasProfiles.insert(std::make_pair(pasId,
 			PasProfileItem(pasRegInfo->GetContact().GetName(), pasRegInfo->GetContact().GetPhone(), pasRegInfo->GetPayment())));
 
-		LOGI("Client profile added. Profile store size: %llu.", gsk_pasProfiles.size());
+		LOGI(isUpdate ? "Client profile updated. Profile store size: %llu." : "Client profile added. Profile store size: %llu.", gsk_pasProfiles.size());
+	}
+
+	if (isPayChanged)
+	{
+		InvalidatePaymentInfo(pasId);
 	}
 
 	Drbg drbg;
@@ -153,7 +225,10 @@ extern "C" int ecall_ride_share_pm_from_pas(void* const connection)
 		switch (funcNum)
 		{
 		case k_userReg:
-			ProcessPasRegisterReq(connection, tls);
+			ProcessPasRegisterReq(connection, tls, false);
+			break;
+		case k_userUpdate:
+			ProcessPasRegisterReq(connection, tls, true);
 			break;
 		default:
 			break;
@@ -179,10 +254,11 @@ static void LogQuery(void* const connection, Decent::Net::TlsCommLayer& tls)
 	const ComMsg::GetQuote& getQuote = queryLog->GetGetQuote();
 
 	LOGI("Logged Passenger Query:");
-	LOGI("Passenger ID:\n%s", queryLog->GetUserId().c_str());
+	LOGI("Passenger ID:\n%s", queryLog->GetUserId().ToString().c_str());
 	LOGI("Origin:      (%f, %f)", getQuote.GetOri().GetX(), getQuote.GetOri().GetY());
 	LOGI("Destination: (%f, %f)", getQuote.GetDest().GetX(), getQuote.GetDest().GetY());
 
+	gs_demandCounter.Add(getQuote.GetOri(), queryLog->GetUserId(), gs_currTime.load());
 }
 
 extern "C" int ecall_ride_share_pm_from_trip_planner(void* const connection)
@@ -203,16 +279,23 @@ extern "C" int ecall_ride_share_pm_from_trip_planner(void* const connection)
 		std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, AppNames::sk_tripPlanner, nullptr);
 		TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the Trip Planner ends it.
 		NumType funcNum;
-		tls.RecvStruct(cnt, funcNum);
-
-		switch (funcNum)
+		bool isSessionAlive = true;
+		while (isSessionAlive)
 		{
-		case k_logQuery:
-			LogQuery(connection, tls);
-			break;
-		default:
-			break;
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_logQuery:
+				LogQuery(connection, tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
 		}
 	}
 	catch (const std::exception& e)
@@ -223,13 +306,15 @@ extern "C" int ecall_ride_share_pm_from_trip_planner(void* const connection)
 	return false;
 }
 
-static void RequestPaymentInfo(void* const connection, Decent::Net::TlsCommLayer& tls)
+static bool RequestPaymentInfo(void* const connection, Decent::Net::TlsCommLayer& tls)
 {
 	LOGI("Processing payment info request...");
 
 	EnclaveCntTranslator cnt(connection);
 
-	std::string pasId = tls.RecvContainer<std::string>(cnt);
+	ClientId::HashType pasIdHash;
+	tls.RecvStruct(cnt, pasIdHash);
+	const ClientId pasId(pasIdHash);
 
 	std::string pasPayInfo;
 	std::string selfPayInfo = OperatorPayment::GetPaymentInfo();
@@ -238,7 +323,7 @@ static void RequestPaymentInfo(void* const connection, Decent::Net::TlsCommLayer
 		auto it = gsk_pasProfiles.find(pasId);
 		if (it == gsk_pasProfiles.cend())
 		{
-			return;
+			return false;
 		}
 		pasPayInfo = it->second.m_pay;
 	}
@@ -248,6 +333,60 @@ static void RequestPaymentInfo(void* const connection, Decent::Net::TlsCommLayer
 	ComMsg::RequestedPayment payInfo(std::move(pasPayInfo), std::move(selfPayInfo));
 
 	tls.SendContainer(cnt, payInfo.ToString());
+
+	return true;
+}
+
+/**
+ * \brief	Replies the payment info of a batch of passengers at once, so a batch of bills only costs
+ * 			one round trip. Unlike the single query, an unknown passenger doesn't end the session; its
+ * 			payment info is just left empty.
+ */
+static bool RequestPaymentInfoBatch(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Processing payment info batch request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
+	const ComMsg::WireFormat format = ComMsg::DetectWireFormat(msgBuf);
+	std::unique_ptr<ComMsg::PayInfoQueryBatch> query = ParseMsg<ComMsg::PayInfoQueryBatch>(msgBuf);
+
+	const std::vector<ClientId>& ids = query->GetIds();
+	if (ids.size() > gsk_maxPayInfoBatchSize)
+	{
+		LOGW("Payment info batch is too large (%llu).", static_cast<unsigned long long>(ids.size()));
+		return false;
+	}
+
+	std::vector<std::string> payInfos;
+	payInfos.reserve(ids.size());
+	size_t numFound = 0;
+	{
+		std::unique_lock<std::mutex> pasProfilesLock(gs_pasProfilesMutex);
+		for (const ClientId& id : ids)
+		{
+			auto it = gsk_pasProfiles.find(id);
+			if (it == gsk_pasProfiles.cend())
+			{
+				payInfos.push_back(std::string());
+			}
+			else
+			{
+				payInfos.push_back(it->second.m_pay);
+				++numFound;
+			}
+		}
+	}
+
+	LOGI("%llu of %llu passenger profiles are found. Sending payment info...",
+		static_cast<unsigned long long>(numFound), static_cast<unsigned long long>(ids.size()));
+
+	ComMsg::RequestedPaymentBatch payInfo(std::move(payInfos), std::string(OperatorPayment::GetPaymentInfo()));
+
+	tls.SendContainer(cnt, payInfo.ToString(format));
+
+	return true;
 }
 
 extern "C" int ecall_ride_share_pm_from_payment(void* const connection)
@@ -268,16 +407,26 @@ extern "C" int ecall_ride_share_pm_from_payment(void* const connection)
 		std::shared_ptr<TlsConfigWithName> payTlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, AppNames::sk_payment, nullptr);
 		TlsCommLayer tls(cnt, payTlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the Payment Services ends it, or a request fails.
 		NumType funcNum;
-		tls.RecvStruct(cnt, funcNum);
-
-		switch (funcNum)
+		bool isSessionAlive = true;
+		while (isSessionAlive)
 		{
-		case k_getPayInfo:
-			RequestPaymentInfo(connection, tls);
-			break;
-		default:
-			break;
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_getPayInfo:
+				isSessionAlive = RequestPaymentInfo(connection, tls);
+				break;
+			case k_getPayInfoBatch:
+				isSessionAlive = RequestPaymentInfoBatch(connection, tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
 		}
 	}
 	catch (const std::exception& e)
@@ -288,3 +437,71 @@ extern "C" int ecall_ride_share_pm_from_payment(void* const connection)
 
 	return false;
 }
+
+/**
+ * \brief	Replies the demand counts of the cells, within the sliding window, for the surge multipliers.
+ */
+static bool RequestDemand(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Processing demand request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	const ComMsg::CellCountBatch counts(gs_demandCounter.GetCounts(gs_currTime.load()));
+
+	tls.SendContainer(cnt, counts.ToString());
+
+	return true;
+}
+
+extern "C" int ecall_ride_share_pm_from_billing(void* const connection)
+{
+	if (!OperatorPayment::IsPaymentInfoValid())
+	{
+		return false;
+	}
+
+	using namespace EncFunc::PassengerMgm;
+
+	LOGI("Processing message from Billing Services...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	try
+	{
+		std::shared_ptr<TlsConfigWithName> billTlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, AppNames::sk_billing, nullptr);
+		TlsCommLayer tls(cnt, billTlsCfg, true, nullptr);
+
+		//Keep serving requests on the same session until the Billing Services ends it.
+		NumType funcNum;
+		bool isSessionAlive = true;
+		while (isSessionAlive)
+		{
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_getDemand:
+				isSessionAlive = RequestDemand(connection, tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to processing message from Billing Services. Caught exception: %s", e.what());
+	}
+
+	return false;
+}
+
+extern "C" void ecall_ride_share_pm_set_time(uint64_t curr_time)
+{
+	AdvanceTime(gs_currTime, curr_time);
+
+	gs_paymentPool.EvictIdle();
+}
@@ -1,5 +1,6 @@
 #include <string>
 #include <memory>
+#include <chrono>
 #include <iostream>
 
 #include <tclap/CmdLine.h>
@@ -25,6 +26,7 @@
 
 #include "../Common/AppNames.h"
 #include "../Common_App/ConnectionManager.h"
+#include "../Common_App/PeriodicTask.h"
 
 #include "PaymentApp.h"
 
@@ -66,6 +68,7 @@ int main(int argc, char ** argv)
 	cmd.parse(argc, argv);
 
 	const size_t numListenThread = 5;
+	const std::chrono::seconds timeTickInterval(5);
 
 	//------- Read configuration file:
 	std::unique_ptr<DecentAppConfig> configMgr;
@@ -167,6 +170,8 @@ int main(int argc, char ** argv)
 			ENCLAVE_FILENAME, tokenPath, wlKeyArg.getValue(), *serverCon,
 			"Payment Pay Info" + selfAddr + ":" + std::to_string(selfPort));
 
+		enclave->UpdateTime();
+
 		smartServer.AddServer(server, enclave, nullptr, numListenThread, 0);
 	}
 	catch (const std::exception& e)
@@ -175,10 +180,18 @@ int main(int argc, char ** argv)
 		return -1;
 	}
 
+	//------- Keep the enclave's clock going, for the TTLs of the cached payment info:
+	PeriodicTask tickTask("update the time of the enclave", timeTickInterval, [&enclave]()
+	{
+		enclave->UpdateTime();
+	});
+
 	//------- keep running until an interrupt signal (Ctrl + C) is received.
 	mainThreadWorker->UpdateUntilInterrupt();
 
 	//------- Exit...
+	tickTask.Stop();
+
 	enclave.reset();
 	smartServer.Terminate();
 
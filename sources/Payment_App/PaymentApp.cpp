@@ -1,5 +1,7 @@
 #include "PaymentApp.h"
 
+#include <chrono>
+
 #include <DecentApi/Common/SGX/RuntimeError.h>
 
 #include "../Common_App/RequestCategory.h"
@@ -19,14 +21,53 @@ bool PaymentApp::ProcessMsgFromTripMatcher(Decent::Net::ConnectionBase& connecti
 	return retValue;
 }
 
+bool PaymentApp::ProcessMsgFromPassengerMgm(Decent::Net::ConnectionBase& connection)
+{
+	int retValue = false;
+	sgx_status_t enclaveRet = SGX_SUCCESS;
+
+	enclaveRet = ecall_ride_share_pay_from_pas_mgm(GetEnclaveId(), &retValue, &connection);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_pay_from_pas_mgm);
+
+	return retValue;
+}
+
+bool PaymentApp::ProcessMsgFromDriverMgm(Decent::Net::ConnectionBase& connection)
+{
+	int retValue = false;
+	sgx_status_t enclaveRet = SGX_SUCCESS;
+
+	enclaveRet = ecall_ride_share_pay_from_dri_mgm(GetEnclaveId(), &retValue, &connection);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_pay_from_dri_mgm);
+
+	return retValue;
+}
+
 bool PaymentApp::ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt)
 {
 	if (category == RequestCategory::sk_fromTripMatcher)
 	{
 		return ProcessMsgFromTripMatcher(connection);
 	}
+	else if (category == RequestCategory::sk_fromPassengerMgm)
+	{
+		return ProcessMsgFromPassengerMgm(connection);
+	}
+	else if (category == RequestCategory::sk_fromDriverMgm)
+	{
+		return ProcessMsgFromDriverMgm(connection);
+	}
 	else
 	{
 		return RideShareApp::ProcessSmartMessage(category, connection, freeHeldCnt);
 	}
 }
+
+void PaymentApp::UpdateTime()
+{
+	//A monotonic clock, so the TTLs aren't affected by changes of the wall clock.
+	const uint64_t currTime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+
+	sgx_status_t enclaveRet = ecall_ride_share_pay_set_time(GetEnclaveId(), currTime);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_pay_set_time);
+}
@@ -13,7 +13,17 @@ namespace RideShare
 
 		virtual bool ProcessMsgFromTripMatcher(Decent::Net::ConnectionBase& connection);
 
+		virtual bool ProcessMsgFromPassengerMgm(Decent::Net::ConnectionBase& connection);
+
+		virtual bool ProcessMsgFromDriverMgm(Decent::Net::ConnectionBase& connection);
+
 		virtual bool ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt) override;
 
+		/**
+		 * \brief	Gives the current time to the enclave, which times out its cached payment info.
+		 * 			It should be called before any request is served, and periodically afterwards.
+		 */
+		void UpdateTime();
+
 	};
 }
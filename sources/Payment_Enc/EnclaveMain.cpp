@@ -1,3 +1,6 @@
+#include <map>
+#include <atomic>
+
 #include <DecentApi/Common/Common.h>
 #include <DecentApi/Common/make_unique.h>
 #include <DecentApi/Common/Ra/TlsConfigWithName.h>
@@ -13,7 +16,13 @@
 #include "../Common/RideSharingMessages.h"
 #include "../Common/AppNames.h"
 
+#include "../Common_Enc/EnclaveClock.h"
+#include "../Common_Enc/InSituMessages.h"
 #include "../Common_Enc/OperatorPayment.h"
+#include "../Common_Enc/TlsChannelPool.h"
+
+#include "PaymentInfoCache.h"
+#include "SettledBillLog.h"
 
 #include "Enclave_t.h"
 
@@ -25,51 +34,193 @@ namespace
 {
 	static AppStates& gs_state = GetAppStateSingleton();
 
+	constexpr size_t gsk_maxIdleChannels = 2;
+
+	static TlsChannelPool gs_pasMgmPool(gs_state, AppNames::sk_passengerMgm, &ocall_ride_share_cnt_mgr_get_pas_mgm, EncFunc::PassengerMgm::k_endSession, gsk_maxIdleChannels);
+	static TlsChannelPool gs_driMgmPool(gs_state, AppNames::sk_driverMgm, &ocall_ride_share_cnt_mgr_get_dri_mgm, EncFunc::DriverMgm::k_endSession, gsk_maxIdleChannels);
+
+	constexpr size_t gsk_maxPaymentBatchSize = 4096;
+
+	constexpr size_t gsk_payInfoCacheSize = 16 * 1024;
+	//Seconds a cached payment info is used without asking the management service again. It bounds
+	//  how long a change can go unnoticed, if its invalidation is lost.
+	constexpr uint64_t gsk_payInfoCacheTtl = 10 * 60;
+
+	PaymentInfoCache gs_pasPayInfoCache(gsk_payInfoCacheSize, gsk_payInfoCacheTtl);
+	PaymentInfoCache gs_driPayInfoCache(gsk_payInfoCacheSize, gsk_payInfoCacheTtl);
+
+	constexpr size_t gsk_settledLogSize = 2048;
+	//Must be well above the Trip Matcher's maximum delay between two tries of the same bill.
+	constexpr uint64_t gsk_settledLogTtl = 10 * 60;
+
+	SettledBillLog gs_settledLog(gsk_settledLogSize, gsk_settledLogTtl);
+
+	//The time (in seconds), for the TTL of the payment info cache (see AdvanceTime).
+	std::atomic<uint64_t> gs_currTime(0);
+
 	template<typename MsgType>
-	static std::unique_ptr<MsgType> ParseMsg(const std::string& msgStr)
+	static std::unique_ptr<MsgType> ParseMsg(std::string& msgStr)
 	{
-		rapidjson::Document json;
-		Decent::Tools::ParseStr2Json(json, msgStr);
-		return Decent::Tools::make_unique<MsgType>(json);
+		return Decent::Tools::make_unique<MsgType>(ComMsg::ParseInSitu<MsgType>(msgStr, msgStr));
 	}
 }
 
-static std::unique_ptr<ComMsg::RequestedPayment> GetPassengerPayment(const std::string& pasId)
+namespace
 {
-	using namespace EncFunc::PassengerMgm;
-	LOGI("Connecting to a Passenger Management...");
+	/**
+	 * \brief	A lookup of the payment info of a batch of clients registered at one management service.
+	 * 			The cached ones are found when it starts; the rest are requested in one call, which
+	 * 			can be run together with the calls to other services.
+	 */
+	struct PaymentLookup
+	{
+		TlsChannelPool& m_pool;
+		const uint8_t m_funcNum;
+		PaymentInfoCache& m_cache;
+		const uint64_t m_currTime;
+		const uint64_t m_epoch;
+
+		//The payment info of each client, or nullptr if the client isn't registered.
+		std::vector<PaymentInfoCache::ValueType> m_res;
+		std::vector<ClientId> m_missedIds;
+		std::vector<size_t> m_missedIdxs;
+		std::string m_queryStr;
+		std::string m_replyStr;
 
+		PaymentLookup(TlsChannelPool& pool, const uint8_t funcNum, PaymentInfoCache& cache) :
+			m_pool(pool),
+			m_funcNum(funcNum),
+			m_cache(cache),
+			m_currTime(gs_currTime.load()),
+			m_epoch(cache.GetEpoch()),
+			m_res(),
+			m_missedIds(),
+			m_missedIdxs(),
+			m_queryStr(),
+			m_replyStr()
+		{}
+	};
+}
+
+/**
+ * \brief	Starts a payment info lookup. If some of the clients aren't in the cache, a call to the
+ * 			management service is added to calls.
+ */
+static void StartPaymentLookup(PaymentLookup& lookup, const std::vector<ClientId>& ids, std::vector<TlsChannelPool::ConcurrentCall>& calls)
+{
+	lookup.m_res.assign(ids.size(), nullptr);
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		lookup.m_res[i] = lookup.m_cache.Find(ids[i], lookup.m_currTime);
+		if (!lookup.m_res[i])
+		{
+			lookup.m_missedIds.push_back(ids[i]);
+			lookup.m_missedIdxs.push_back(i);
+		}
+	}
 
-	EnclaveConnectionOwner cnt = EnclaveConnectionOwner::CntBuilder(SGX_SUCCESS, &ocall_ride_share_cnt_mgr_get_pas_mgm);
+	if (lookup.m_missedIds.size() == 0)
+	{
+		return;
+	}
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_passengerMgm, nullptr);
-	TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
+	LOGI("Requesting %llu payment info not in the cache...", static_cast<unsigned long long>(lookup.m_missedIds.size()));
 
-	tls.SendStruct(cnt, k_getPayInfo);
-	tls.SendContainer(cnt, pasId);
-	std::string strBuf = tls.RecvContainer<std::string>(cnt);
+	lookup.m_queryStr = ComMsg::PayInfoQueryBatch(lookup.m_missedIds).ToString();
 
-	return ParseMsg<ComMsg::RequestedPayment>(strBuf);
+	const uint8_t funcNum = lookup.m_funcNum;
+	const std::string& queryStr = lookup.m_queryStr;
+	std::string& replyStr = lookup.m_replyStr;
+	calls.push_back(TlsChannelPool::ConcurrentCall(lookup.m_pool,
+		[funcNum, &queryStr](ConnectionBase& cnt, TlsCommLayer& tls)
+		{
+			tls.SendStruct(cnt, funcNum);
+			tls.SendContainer(cnt, queryStr);
+		},
+		[&replyStr](ConnectionBase& cnt, TlsCommLayer& tls)
+		{
+			replyStr = tls.RecvContainer<std::string>(cnt);
+		}));
 }
 
-static std::unique_ptr<ComMsg::RequestedPayment> GetDriverPayment(const std::string& driId)
+/**
+ * \brief	Finishes a payment info lookup, once its call (if any) has been run. The payment info
+ * 			received is put in the cache.
+ *
+ * \return	False if the reply doesn't match the query.
+ */
+static bool FinishPaymentLookup(PaymentLookup& lookup)
 {
-	using namespace EncFunc::DriverMgm;
-	LOGI("Connecting to a Driver Management...");
+	if (lookup.m_missedIds.size() == 0)
+	{
+		return true;
+	}
 
-	EnclaveConnectionOwner cnt = EnclaveConnectionOwner::CntBuilder(SGX_SUCCESS, &ocall_ride_share_cnt_mgr_get_dri_mgm);
+	std::unique_ptr<ComMsg::RequestedPaymentBatch> reply = ParseMsg<ComMsg::RequestedPaymentBatch>(lookup.m_replyStr);
+	const std::vector<std::string>& payments = reply->GetPayments();
+	if (payments.size() != lookup.m_missedIds.size())
+	{
+		LOGW("The number of payment info received doesn't match the query.");
+		return false;
+	}
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_driverMgm, nullptr);
-	TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
+	for (size_t i = 0; i < payments.size(); ++i)
+	{
+		if (payments[i].size() == 0)
+		{
+			continue;
+		}
 
-	tls.SendStruct(cnt, k_getPayInfo);
-	tls.SendContainer(cnt, driId);
-	std::string strBuf = tls.RecvContainer<std::string>(cnt);
+		PaymentInfoCache::ValueType payment = std::make_shared<ComMsg::RequestedPayment>(payments[i], reply->GetOpPayment());
+		lookup.m_cache.Put(lookup.m_missedIds[i], payment, lookup.m_currTime, lookup.m_epoch);
+		lookup.m_res[lookup.m_missedIdxs[i]] = payment;
+	}
+	return true;
+}
 
-	return ParseMsg<ComMsg::RequestedPayment>(strBuf);
+/**
+ * \brief	Gets the payment info of the passengers and the drivers. The Passenger Management and
+ * 			the Driver Management are queried concurrently, so it takes about one round trip,
+ * 			rather than two.
+ *
+ * \return	False if a reply doesn't match the query.
+ */
+static bool GetPayments(const std::vector<ClientId>& pasIds, const std::vector<ClientId>& driIds,
+	std::vector<PaymentInfoCache::ValueType>& pasPayments, std::vector<PaymentInfoCache::ValueType>& driPayments)
+{
+	PaymentLookup pasLookup(gs_pasMgmPool, EncFunc::PassengerMgm::k_getPayInfoBatch, gs_pasPayInfoCache);
+	PaymentLookup driLookup(gs_driMgmPool, EncFunc::DriverMgm::k_getPayInfoBatch, gs_driPayInfoCache);
+
+	std::vector<TlsChannelPool::ConcurrentCall> calls;
+	StartPaymentLookup(pasLookup, pasIds, calls);
+	StartPaymentLookup(driLookup, driIds, calls);
+
+	TlsChannelPool::UseConcurrently(calls);
+
+	if (!FinishPaymentLookup(pasLookup) ||
+		!FinishPaymentLookup(driLookup))
+	{
+		return false;
+	}
+
+	pasPayments.swap(pasLookup.m_res);
+	driPayments.swap(driLookup.m_res);
+	return true;
 }
 
-static void ProcessPayment(void* const connection, Decent::Net::TlsCommLayer& tls)
+static void SettleBill(const ComMsg::FinalBill& bill, const ComMsg::RequestedPayment& pasPayment, const ComMsg::RequestedPayment& driPayment)
+{
+	PRINT_I("Pay %f (quoted %f) from %s, to:", bill.GetFare(), bill.GetQuote().GetPrice().GetPrice(), pasPayment.GetPayemnt().c_str());
+	PRINT_I("\t Driver                       : %s", driPayment.GetPayemnt().c_str());
+	PRINT_I("\t Billing Services     Operator: %s", bill.GetQuote().GetPrice().GetOpPayment().c_str());
+	PRINT_I("\t Trip Planner         Operator: %s", bill.GetQuote().GetOpPayment().c_str());
+	PRINT_I("\t Trip Matcher         Operator: %s", bill.GetOpPayment().c_str());
+	PRINT_I("\t Passenger Management Operator: %s", pasPayment.GetOpPayment().c_str());
+	PRINT_I("\t Driver Management    Operator: %s", driPayment.GetOpPayment().c_str());
+	PRINT_I("\t Payment Services     Operator: %s", OperatorPayment::GetPaymentInfo().c_str());
+}
+
+static bool ProcessPayment(void* const connection, Decent::Net::TlsCommLayer& tls)
 {
 	LOGI("Process payment...");
 
@@ -78,17 +229,108 @@ static void ProcessPayment(void* const connection, Decent::Net::TlsCommLayer& tl
 	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
 	std::unique_ptr<ComMsg::FinalBill> bill = ParseMsg<ComMsg::FinalBill>(msgBuf);
 
-	std::unique_ptr<ComMsg::RequestedPayment> pasPayment = GetPassengerPayment(bill->GetQuote().GetPasId());
-	std::unique_ptr<ComMsg::RequestedPayment> driPayment = GetDriverPayment(bill->GetDriId());
+	std::vector<PaymentInfoCache::ValueType> pasPayments;
+	std::vector<PaymentInfoCache::ValueType> driPayments;
+	if (!GetPayments(std::vector<ClientId>(1, bill->GetQuote().GetPasId()), std::vector<ClientId>(1, bill->GetDriId()), pasPayments, driPayments))
+	{
+		return false;
+	}
 
-	PRINT_I("Pay from %s, to:", pasPayment->GetPayemnt().c_str());
-	PRINT_I("\t Driver                       : %s", driPayment->GetPayemnt().c_str());
-	PRINT_I("\t Billing Services     Operator: %s", bill->GetQuote().GetPrice().GetOpPayment().c_str());
-	PRINT_I("\t Trip Planner         Operator: %s", bill->GetQuote().GetOpPayment().c_str());
-	PRINT_I("\t Trip Matcher         Operator: %s", bill->GetOpPayment().c_str());
-	PRINT_I("\t Passenger Management Operator: %s", pasPayment->GetOpPayment().c_str());
-	PRINT_I("\t Driver Management    Operator: %s", driPayment->GetOpPayment().c_str());
-	PRINT_I("\t Payment Services     Operator: %s", OperatorPayment::GetPaymentInfo().c_str());
+	if (!pasPayments[0] || !driPayments[0])
+	{
+		PRINT_W("The passenger or the driver of the bill isn't registered. The bill is skipped.");
+		return true;
+	}
+
+	if (!gs_settledLog.TryClaim(bill->GetTripId(), gs_currTime.load()))
+	{
+		LOGW("The bill of trip %s has been settled already.", bill->GetTripId().c_str());
+		return true;
+	}
+
+	SettleBill(*bill, *pasPayments[0], *driPayments[0]);
+
+	return true;
+}
+
+/**
+ * \brief	Settles a batch of bills. The payment info of all the passengers and drivers in the batch
+ * 			that isn't cached is fetched with one concurrent query per management service, and each client is
+ * 			only looked up once. The status of each bill is replied (see ComMsg::BillStatus); a bill whose
+ * 			trip has been settled already isn't charged again.
+ */
+static bool ProcessPaymentBatch(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Process payment batch...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
+	std::unique_ptr<ComMsg::FinalBillBatch> billBatch = ParseMsg<ComMsg::FinalBillBatch>(msgBuf);
+
+	const std::vector<ComMsg::FinalBill>& bills = billBatch->GetBills();
+	if (bills.size() > gsk_maxPaymentBatchSize)
+	{
+		LOGW("Payment batch is too large (%llu).", static_cast<unsigned long long>(bills.size()));
+		return false;
+	}
+
+	if (bills.size() == 0)
+	{
+		tls.SendContainer(cnt, std::vector<uint8_t>());
+		return true;
+	}
+
+	//Client ID => index in the query.
+	std::map<ClientId, size_t> pasIdxs;
+	std::map<ClientId, size_t> driIdxs;
+	std::vector<ClientId> pasIds;
+	std::vector<ClientId> driIds;
+	for (const ComMsg::FinalBill& bill : bills)
+	{
+		if (pasIdxs.insert(std::make_pair(bill.GetQuote().GetPasId(), pasIds.size())).second)
+		{
+			pasIds.push_back(bill.GetQuote().GetPasId());
+		}
+		if (driIdxs.insert(std::make_pair(bill.GetDriId(), driIds.size())).second)
+		{
+			driIds.push_back(bill.GetDriId());
+		}
+	}
+
+	std::vector<PaymentInfoCache::ValueType> pasPayments;
+	std::vector<PaymentInfoCache::ValueType> driPayments;
+	if (!GetPayments(pasIds, driIds, pasPayments, driPayments))
+	{
+		return false;
+	}
+
+	const uint64_t currTime = gs_currTime.load();
+	std::vector<uint8_t> statuses(bills.size(), static_cast<uint8_t>(ComMsg::BillStatus::Settled));
+	for (size_t i = 0; i < bills.size(); ++i)
+	{
+		const ComMsg::FinalBill& bill = bills[i];
+		const PaymentInfoCache::ValueType& pasPayment = pasPayments[pasIdxs.find(bill.GetQuote().GetPasId())->second];
+		const PaymentInfoCache::ValueType& driPayment = driPayments[driIdxs.find(bill.GetDriId())->second];
+		if (!pasPayment || !driPayment)
+		{
+			PRINT_W("The passenger or the driver of a bill isn't registered. The bill is rejected.");
+			statuses[i] = static_cast<uint8_t>(ComMsg::BillStatus::Rejected);
+			continue;
+		}
+
+		if (!gs_settledLog.TryClaim(bill.GetTripId(), currTime))
+		{
+			LOGW("The bill of trip %s has been settled already.", bill.GetTripId().c_str());
+			continue;
+		}
+
+		SettleBill(bill, *pasPayment, *driPayment);
+	}
+
+	tls.SendContainer(cnt, statuses);
+
+	return true;
 }
 
 extern "C" int ecall_ride_share_pay_from_trip_matcher(void* const connection)
@@ -108,16 +350,26 @@ extern "C" int ecall_ride_share_pay_from_trip_matcher(void* const connection)
 		std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, AppNames::sk_tripMatcher, nullptr);
 		TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the Trip Matcher ends it.
 		NumType funcNum;
-		tls.RecvStruct(cnt, funcNum);
-
-		switch (funcNum)
+		bool isSessionAlive = true;
+		while (isSessionAlive)
 		{
-		case k_procPayment:
-			ProcessPayment(connection, tls);
-			break;
-		default:
-			break;
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_procPayment:
+				isSessionAlive = ProcessPayment(connection, tls);
+				break;
+			case k_procPaymentBatch:
+				isSessionAlive = ProcessPaymentBatch(connection, tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
 		}
 	}
 	catch (const std::exception& e)
@@ -127,3 +379,75 @@ extern "C" int ecall_ride_share_pay_from_trip_matcher(void* const connection)
 
 	return false;
 }
+
+static void InvalidatePaymentInfo(void* const connection, Decent::Net::TlsCommLayer& tls, PaymentInfoCache& cache)
+{
+	EnclaveCntTranslator cnt(connection);
+
+	ClientId::HashType idHash;
+	tls.RecvStruct(cnt, idHash);
+
+	cache.Invalidate(ClientId(idHash));
+
+	//Acknowledged, so the sender notices a failure.
+	tls.SendStruct(cnt, static_cast<uint8_t>(1));
+
+	LOGI("Cached payment info is invalidated.");
+}
+
+static int ProcessMsgFromMgm(void* const connection, const char* appName, PaymentInfoCache& cache)
+{
+	using namespace EncFunc::Payment;
+	LOGI("Processing message from %s...", appName);
+
+	EnclaveCntTranslator cnt(connection);
+
+	try
+	{
+		std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ServerVerifyPeer, appName, nullptr);
+		TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
+
+		//Keep serving requests on the same session until the management service ends it.
+		NumType funcNum;
+		bool isSessionAlive = true;
+		while (isSessionAlive)
+		{
+			tls.RecvStruct(cnt, funcNum);
+
+			switch (funcNum)
+			{
+			case k_invalidatePayInfo:
+				InvalidatePaymentInfo(connection, tls, cache);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to processing message from %s. Caught exception: %s", appName, e.what());
+	}
+
+	return false;
+}
+
+extern "C" int ecall_ride_share_pay_from_pas_mgm(void* const connection)
+{
+	return ProcessMsgFromMgm(connection, AppNames::sk_passengerMgm, gs_pasPayInfoCache);
+}
+
+extern "C" int ecall_ride_share_pay_from_dri_mgm(void* const connection)
+{
+	return ProcessMsgFromMgm(connection, AppNames::sk_driverMgm, gs_driPayInfoCache);
+}
+
+extern "C" void ecall_ride_share_pay_set_time(uint64_t curr_time)
+{
+	AdvanceTime(gs_currTime, curr_time);
+
+	gs_pasMgmPool.EvictIdle();
+	gs_driMgmPool.EvictIdle();
+}
@@ -0,0 +1,91 @@
+#include "PaymentInfoCache.h"
+
+#include "../Common/RideSharingMessages.h"
+
+using namespace RideShare;
+
+PaymentInfoCache::PaymentInfoCache(const size_t maxSize, const uint64_t ttl) :
+	m_maxSize(maxSize),
+	m_ttl(ttl),
+	m_mutex(),
+	m_epoch(0),
+	m_map(),
+	m_lruList()
+{
+}
+
+PaymentInfoCache::~PaymentInfoCache()
+{
+}
+
+PaymentInfoCache::ValueType PaymentInfoCache::Find(const ClientId& id, const uint64_t currTime)
+{
+	std::unique_lock<std::mutex> cacheLock(m_mutex);
+
+	auto it = m_map.find(id);
+	if (it == m_map.end())
+	{
+		return nullptr;
+	}
+
+	if (currTime >= it->second.m_expireTime)
+	{
+		m_lruList.erase(it->second.m_lruIt);
+		m_map.erase(it);
+		return nullptr;
+	}
+
+	m_lruList.splice(m_lruList.begin(), m_lruList, it->second.m_lruIt);
+	return it->second.m_val;
+}
+
+uint64_t PaymentInfoCache::GetEpoch()
+{
+	std::unique_lock<std::mutex> cacheLock(m_mutex);
+	return m_epoch;
+}
+
+void PaymentInfoCache::Put(const ClientId& id, const ValueType& val, const uint64_t currTime, const uint64_t epoch)
+{
+	std::unique_lock<std::mutex> cacheLock(m_mutex);
+	if (epoch != m_epoch || m_maxSize == 0)
+	{
+		//Some payment info has changed since the lookup started; it may be stale.
+		return;
+	}
+
+	auto it = m_map.find(id);
+	if (it != m_map.end())
+	{
+		it->second.m_val = val;
+		it->second.m_expireTime = currTime + m_ttl;
+		m_lruList.splice(m_lruList.begin(), m_lruList, it->second.m_lruIt);
+		return;
+	}
+
+	if (m_map.size() >= m_maxSize)
+	{
+		m_map.erase(m_lruList.back());
+		m_lruList.pop_back();
+	}
+
+	m_lruList.push_front(id);
+
+	Entry& entry = m_map[id];
+	entry.m_val = val;
+	entry.m_expireTime = currTime + m_ttl;
+	entry.m_lruIt = m_lruList.begin();
+}
+
+void PaymentInfoCache::Invalidate(const ClientId& id)
+{
+	std::unique_lock<std::mutex> cacheLock(m_mutex);
+	++m_epoch;
+
+	auto it = m_map.find(id);
+	if (it != m_map.end())
+	{
+		m_lruList.erase(it->second.m_lruIt);
+		m_map.erase(it);
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+#include "../Common/ClientId.h"
+
+namespace RideShare
+{
+	namespace ComMsg
+	{
+		class RequestedPayment;
+	}
+
+	/**
+	 * \brief	A bounded (LRU) cache of the payment info of the clients registered at one management
+	 * 			service. Entries expire after the TTL, and are dropped once the management service
+	 * 			tells that the payment info has changed. An invalidation also bumps an epoch, and a
+	 * 			lookup result is only stored if no invalidation happened since the lookup started;
+	 * 			thus, a reply that was on the wire while the info changed can't be cached.
+	 */
+	class PaymentInfoCache
+	{
+	public:
+		typedef std::shared_ptr<const ComMsg::RequestedPayment> ValueType;
+
+	public:
+		PaymentInfoCache() = delete;
+
+		/**
+		 * \brief	Constructor
+		 *
+		 * \param	maxSize	The maximum number of entries.
+		 * \param	ttl	   	Seconds an entry is kept.
+		 */
+		PaymentInfoCache(const size_t maxSize, const uint64_t ttl);
+
+		PaymentInfoCache(const PaymentInfoCache& rhs) = delete;
+		PaymentInfoCache(PaymentInfoCache&& rhs) = delete;
+
+		~PaymentInfoCache();
+
+		/**
+		 * \return	The cached payment info, or nullptr if it's not cached or has expired.
+		 */
+		ValueType Find(const ClientId& id, const uint64_t currTime);
+
+		/**
+		 * \brief	Gets the current epoch; it should be read before the management service is queried,
+		 * 			and then given to Put.
+		 */
+		uint64_t GetEpoch();
+
+		void Put(const ClientId& id, const ValueType& val, const uint64_t currTime, const uint64_t epoch);
+
+		void Invalidate(const ClientId& id);
+
+	private:
+		typedef std::list<ClientId> LruListType;
+
+		struct Entry
+		{
+			ValueType m_val;
+			uint64_t m_expireTime;
+			LruListType::iterator m_lruIt;
+		};
+
+		typedef std::map<ClientId, Entry> MapType;
+
+		const size_t m_maxSize;
+		const uint64_t m_ttl;
+
+		std::mutex m_mutex;
+		uint64_t m_epoch;
+		MapType m_map;
+		//Most recently used at the front.
+		LruListType m_lruList;
+	};
+}
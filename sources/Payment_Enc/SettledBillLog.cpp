@@ -0,0 +1,59 @@
+#include "SettledBillLog.h"
+
+using namespace RideShare;
+
+SettledBillLog::SettledBillLog(const size_t maxSize, const uint64_t ttl) :
+	m_maxSize(maxSize),
+	m_ttl(ttl),
+	m_mutex(),
+	m_map(),
+	m_ageList()
+{
+}
+
+SettledBillLog::~SettledBillLog()
+{
+}
+
+bool SettledBillLog::TryClaim(const std::string& tripId, const uint64_t currTime)
+{
+	std::unique_lock<std::mutex> logLock(m_mutex);
+
+	PruneExpired(currTime);
+
+	if (m_map.find(tripId) != m_map.end())
+	{
+		return false;
+	}
+
+	if (m_maxSize == 0)
+	{
+		return true;
+	}
+
+	if (m_map.size() >= m_maxSize)
+	{
+		m_map.erase(m_ageList.front());
+		m_ageList.pop_front();
+	}
+
+	m_ageList.push_back(tripId);
+	m_map[tripId] = currTime + m_ttl;
+
+	return true;
+}
+
+void SettledBillLog::PruneExpired(const uint64_t currTime)
+{
+	//Entries are added in time order, so the expired ones are at the front.
+	while (m_ageList.size() > 0)
+	{
+		auto it = m_map.find(m_ageList.front());
+		if (currTime < it->second)
+		{
+			return;
+		}
+		m_map.erase(it);
+		m_ageList.pop_front();
+	}
+}
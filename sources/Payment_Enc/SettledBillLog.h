@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+namespace RideShare
+{
+	/**
+	 * \brief	A bounded log of the trips whose bills have been settled recently. The Trip Matcher
+	 * 			sends a bill again if it didn't get the reply, so a bill is only settled if its trip
+	 * 			isn't in the log. Entries expire after the TTL, which must be longer than the maximum
+	 * 			delay between the Trip Matcher's retries; once the log is full, the oldest entry is
+	 * 			dropped.
+	 */
+	class SettledBillLog
+	{
+	public:
+		SettledBillLog() = delete;
+
+		/**
+		 * \brief	Constructor
+		 *
+		 * \param	maxSize	The maximum number of entries.
+		 * \param	ttl	   	Seconds an entry is kept.
+		 */
+		SettledBillLog(const size_t maxSize, const uint64_t ttl);
+
+		SettledBillLog(const SettledBillLog& rhs) = delete;
+		SettledBillLog(SettledBillLog&& rhs) = delete;
+
+		~SettledBillLog();
+
+		/**
+		 * \brief	Claims the settlement of the bill of a trip.
+		 *
+		 * \return	True if the bill should be settled by the caller, false if it has been settled
+		 * 			already.
+		 */
+		bool TryClaim(const std::string& tripId, const uint64_t currTime);
+
+	private:
+		void PruneExpired(const uint64_t currTime);
+
+		const size_t m_maxSize;
+		const uint64_t m_ttl;
+
+		std::mutex m_mutex;
+		//Trip ID => expire time.
+		std::map<std::string, uint64_t> m_map;
+		//Trip IDs; oldest at the front.
+		std::list<std::string> m_ageList;
+	};
+}
@@ -0,0 +1,143 @@
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "../TripMatcher_Enc/AuctionAssignment.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+
+namespace
+{
+	typedef AuctionAssignment::Edge Edge;
+
+	double GetBenefit(const std::vector<Edge>& edges, const size_t obj)
+	{
+		for (const Edge& edge : edges)
+		{
+			if (edge.m_obj == obj)
+			{
+				return edge.m_benefit;
+			}
+		}
+		return -1.0;
+	}
+
+	//The reference: the best total benefit, by trying every choice of each person in turn.
+	double FindBestTotal(const std::vector<std::vector<Edge> >& edges, const size_t person, std::vector<bool>& isTaken)
+	{
+		if (person == edges.size())
+		{
+			return 0.0;
+		}
+
+		double best = FindBestTotal(edges, person + 1, isTaken);
+		for (const Edge& edge : edges[person])
+		{
+			if (!isTaken[edge.m_obj])
+			{
+				isTaken[edge.m_obj] = true;
+				best = std::max(best, edge.m_benefit + FindBestTotal(edges, person + 1, isTaken));
+				isTaken[edge.m_obj] = false;
+			}
+		}
+		return best;
+	}
+
+	//Checks the assignment only uses the given edges, and each object at most once; returns its total benefit.
+	double CheckAssignment(const std::vector<std::vector<Edge> >& edges, const size_t numObjs, const std::vector<size_t>& assigned)
+	{
+		RS_CHECK(assigned.size() == edges.size());
+
+		std::vector<bool> isTaken(numObjs, false);
+		double total = 0.0;
+		for (size_t i = 0; i < assigned.size(); ++i)
+		{
+			if (assigned[i] == AuctionAssignment::sk_unassigned)
+			{
+				continue;
+			}
+
+			RS_CHECK(assigned[i] < numObjs && !isTaken[assigned[i]]);
+			isTaken[assigned[i]] = true;
+
+			const double benefit = GetBenefit(edges[i], assigned[i]);
+			RS_CHECK(benefit > 0.0);
+			total += benefit;
+		}
+		return total;
+	}
+}
+
+RS_TEST(AuctionAssignment_NearOptimal)
+{
+	std::mt19937 randGen(4);
+	std::uniform_real_distribution<double> benefitDis(1.0, 10.0);
+	const double epsilon = 0.001;
+
+	for (size_t round = 0; round < 50; ++round)
+	{
+		//More or fewer persons than objects, with a few edges each.
+		const size_t numPersons = 1 + randGen() % 7;
+		const size_t numObjs = 1 + randGen() % 7;
+
+		std::vector<std::vector<Edge> > edges(numPersons);
+		for (std::vector<Edge>& personEdges : edges)
+		{
+			for (size_t obj = 0; obj < numObjs; ++obj)
+			{
+				if (randGen() % 2 == 0)
+				{
+					personEdges.push_back(Edge{ obj, benefitDis(randGen) });
+				}
+			}
+		}
+
+		std::vector<bool> isTaken(numObjs, false);
+		const double bestTotal = FindBestTotal(edges, 0, isTaken);
+
+		std::vector<std::vector<Edge> > edgesCopy = edges;
+		AuctionAssignment auction(numObjs, std::move(edgesCopy));
+		const std::vector<size_t> assigned = auction.Solve(epsilon, 1000000);
+
+		const double total = CheckAssignment(edges, numObjs, assigned);
+		RS_CHECK(total >= bestTotal - numPersons * epsilon - 1e-9);
+	}
+}
+
+RS_TEST(AuctionAssignment_Contested)
+{
+	//Both persons prefer object 0, but the best total gives it to person 1.
+	std::vector<std::vector<Edge> > edges = {
+		{ Edge{ 0, 10.0 }, Edge{ 1, 9.0 } },
+		{ Edge{ 0, 10.0 }, Edge{ 1, 1.0 } },
+	};
+
+	AuctionAssignment auction(2, std::move(edges));
+	const std::vector<size_t> assigned = auction.Solve(0.01, 1000);
+
+	RS_CHECK(assigned.size() == 2);
+	RS_CHECK(assigned[0] == 1);
+	RS_CHECK(assigned[1] == 0);
+}
+
+RS_TEST(AuctionAssignment_BudgetRunsOut)
+{
+	std::vector<std::vector<Edge> > edges(20);
+	for (std::vector<Edge>& personEdges : edges)
+	{
+		for (size_t obj = 0; obj < 20; ++obj)
+		{
+			personEdges.push_back(Edge{ obj, 5.0 });
+		}
+	}
+	const std::vector<std::vector<Edge> > edgesCopy = edges;
+
+	AuctionAssignment auction(20, std::move(edges));
+	const std::vector<size_t> assigned = auction.Solve(0.001, 5);
+
+	//The partial assignment is still valid.
+	RS_CHECK(auction.GetNumBids() <= 5);
+	CheckAssignment(edgesCopy, 20, assigned);
+}
@@ -0,0 +1,133 @@
+#include <limits>
+
+#include "../Common/BinaryCoding.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+using namespace RideShare::ComMsg;
+
+RS_TEST(BinaryCoding_RoundTrip)
+{
+	Decent::General256Hash hash;
+	for (size_t i = 0; i < hash.size(); ++i)
+	{
+		hash[i] = static_cast<uint8_t>(i * 7);
+	}
+
+	std::string buf;
+	BinaryWriter writer(buf);
+	writer.Write(static_cast<uint8_t>(0xAB));
+	writer.Write(static_cast<uint32_t>(0xDEADBEEF));
+	writer.Write(static_cast<uint64_t>(0x0123456789ABCDEFULL));
+	writer.Write(static_cast<int32_t>(-42));
+	writer.Write(-0.1);
+	writer.Write(std::numeric_limits<double>::infinity());
+	writer.Write(hash);
+	writer.Write(std::string("ride\0share", 10));
+	writer.Write(std::string());
+
+	BinaryReader reader(buf, 0);
+	RS_CHECK(reader.Read<uint8_t>() == 0xAB);
+	RS_CHECK(reader.Read<uint32_t>() == 0xDEADBEEF);
+	RS_CHECK(reader.Read<uint64_t>() == 0x0123456789ABCDEFULL);
+	RS_CHECK(reader.Read<int32_t>() == -42);
+	//Doubles round-trip bit-exactly.
+	RS_CHECK(reader.Read<double>() == -0.1);
+	RS_CHECK(reader.Read<double>() == std::numeric_limits<double>::infinity());
+	RS_CHECK(reader.Read<Decent::General256Hash>() == hash);
+	RS_CHECK(reader.Read<std::string>() == std::string("ride\0share", 10));
+	RS_CHECK(reader.Read<std::string>().empty());
+	RS_CHECK(reader.IsEnd());
+}
+
+RS_TEST(BinaryCoding_LittleEndian)
+{
+	std::string buf;
+	BinaryWriter writer(buf);
+	writer.Write(static_cast<uint32_t>(0x04030201));
+
+	RS_CHECK(buf == std::string("\x01\x02\x03\x04", 4));
+}
+
+RS_TEST(BinaryCoding_VarInt)
+{
+	const int64_t vals[] = { 0, 1, -1, 63, -64, 64, -65, 1000000, -1000000, INT64_MAX, INT64_MIN };
+
+	std::string buf;
+	BinaryWriter writer(buf);
+	for (const int64_t val : vals)
+	{
+		writer.WriteVarInt(val);
+	}
+
+	BinaryReader reader(buf, 0);
+	for (const int64_t val : vals)
+	{
+		RS_CHECK(reader.ReadVarInt() == val);
+	}
+	RS_CHECK(reader.IsEnd());
+
+	//Zigzag-encoded, so small values take one byte, whatever their signs.
+	std::string smallBuf;
+	BinaryWriter smallWriter(smallBuf);
+	smallWriter.WriteVarInt(-64);
+	smallWriter.WriteVarInt(63);
+	RS_CHECK(smallBuf.size() == 2);
+
+	//The longest encoding is 10 bytes.
+	std::string longBuf;
+	BinaryWriter longWriter(longBuf);
+	longWriter.WriteVarInt(INT64_MIN);
+	RS_CHECK(longBuf.size() == 10);
+}
+
+RS_TEST(BinaryCoding_RejectsMalformed)
+{
+	//Reading past the end.
+	{
+		const std::string buf("\x01\x02\x03", 3);
+		BinaryReader reader(buf, 0);
+		RS_CHECK_THROWS(reader.Read<uint32_t>(), MessageParseException);
+	}
+
+	//A string longer than the rest of the input.
+	{
+		std::string buf;
+		BinaryWriter writer(buf);
+		writer.WriteSize(100);
+		buf.append("short");
+		BinaryReader reader(buf, 0);
+		RS_CHECK_THROWS(reader.Read<std::string>(), MessageParseException);
+	}
+
+	//An array whose items can't possibly fit, rejected by the size alone.
+	{
+		std::string buf;
+		BinaryWriter writer(buf);
+		writer.WriteSize(3);
+		buf.append(16, '\0');
+		BinaryReader reader(buf, 0);
+		RS_CHECK_THROWS(reader.ReadSize(8), MessageParseException);
+	}
+
+	//A var-int longer than 10 bytes, or with too many bits in the 10th byte.
+	{
+		const std::string buf(11, '\x80');
+		BinaryReader reader(buf, 0);
+		RS_CHECK_THROWS(reader.ReadVarInt(), MessageParseException);
+	}
+	{
+		std::string buf(9, '\xFF');
+		buf.push_back('\x02');
+		BinaryReader reader(buf, 0);
+		RS_CHECK_THROWS(reader.ReadVarInt(), MessageParseException);
+	}
+
+	//Truncated var-int.
+	{
+		const std::string buf(1, '\x80');
+		BinaryReader reader(buf, 0);
+		RS_CHECK_THROWS(reader.ReadVarInt(), MessageParseException);
+	}
+}
@@ -0,0 +1,108 @@
+#include "../Common_Enc/CellEventCounter.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+
+namespace
+{
+	typedef ComMsg::Point2D<double> Point;
+
+	//A window of 10 buckets of 60 seconds.
+	constexpr uint64_t gsk_bucketLen = 60;
+	constexpr uint64_t gsk_windowLen = gsk_bucketLen * SurgeGrid::sk_numBuckets;
+
+	ClientId MakeClientId(const uint32_t idx)
+	{
+		ClientId::HashType hash;
+		hash.fill(0);
+		std::memcpy(hash.data(), &idx, sizeof(idx));
+		return ClientId(hash);
+	}
+
+	uint32_t GetCount(const std::vector<ComMsg::CellCount>& counts, const int32_t x, const int32_t y)
+	{
+		for (const ComMsg::CellCount& count : counts)
+		{
+			if (count.GetX() == x && count.GetY() == y)
+			{
+				return count.GetCount();
+			}
+		}
+		return 0;
+	}
+}
+
+RS_TEST(CellEventCounter_CellIndex)
+{
+	RS_CHECK(CellEventCounter::ToCellIndex(0.5, 1.0) == 0);
+	RS_CHECK(CellEventCounter::ToCellIndex(-0.5, 1.0) == -1);
+	RS_CHECK(CellEventCounter::ToCellIndex(7.9, 2.0) == 3);
+	RS_CHECK(CellEventCounter::ToCellIndex(1e300, 1.0) == INT32_MAX);
+	RS_CHECK(CellEventCounter::ToCellIndex(-1e300, 1.0) == INT32_MIN);
+	RS_CHECK(CellEventCounter::ToCellIndex(std::nan(""), 1.0) == INT32_MIN);
+
+	RS_CHECK(CellEventCounter::CombineCellIndex(-1, 2) != CellEventCounter::CombineCellIndex(2, -1));
+}
+
+RS_TEST(CellEventCounter_SourceCountedOncePerWindow)
+{
+	CellEventCounter counter(1.0, gsk_bucketLen, 16, 16);
+	const Point loc(0.5, 0.5);
+
+	//One source repeating its requests is counted once; four more sources add four.
+	for (uint64_t t = 0; t < 100; ++t)
+	{
+		counter.Add(loc, MakeClientId(1), t);
+	}
+	for (uint32_t i = 2; i < 6; ++i)
+	{
+		counter.Add(loc, MakeClientId(i), 10);
+	}
+	std::vector<ComMsg::CellCount> counts = counter.GetCounts(100);
+	RS_CHECK(counts.size() == 1);
+	RS_CHECK(GetCount(counts, 0, 0) == 5);
+
+	//Once the window has moved past the events, they are dropped, and the source is counted again.
+	counter.Add(loc, MakeClientId(1), gsk_windowLen + 100);
+	counts = counter.GetCounts(gsk_windowLen + 100);
+	RS_CHECK(GetCount(counts, 0, 0) == 1);
+
+	//Idle cells are removed.
+	RS_CHECK(counter.GetCounts(3 * gsk_windowLen).size() == 0);
+}
+
+RS_TEST(CellEventCounter_Batch)
+{
+	CellEventCounter counter(1.0, gsk_bucketLen, 16, 16);
+	const std::vector<Point> locs = { Point(0.5, 0.5), Point(0.7, 0.2), Point(-3.2, 7.9) };
+
+	counter.AddBatch(locs, MakeClientId(1), 0);
+	//The same source, within the window.
+	counter.AddBatch(locs, MakeClientId(1), 10);
+
+	const std::vector<ComMsg::CellCount> counts = counter.GetCounts(10);
+	RS_CHECK(counts.size() == 2);
+	RS_CHECK(GetCount(counts, 0, 0) == 2);
+	RS_CHECK(GetCount(counts, -4, 7) == 1);
+}
+
+RS_TEST(CellEventCounter_Limits)
+{
+	CellEventCounter counter(1.0, gsk_bucketLen, 4, 8);
+
+	//At most 8 sources in a window.
+	for (uint32_t i = 0; i < 20; ++i)
+	{
+		counter.Add(Point(0.5, 0.5), MakeClientId(i), 0);
+	}
+	RS_CHECK(GetCount(counter.GetCounts(0), 0, 0) == 8);
+
+	//At most 4 cells; the cell above is idle by then, and removed by the periodic read.
+	RS_CHECK(counter.GetCounts(2 * gsk_windowLen).size() == 0);
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		counter.Add(Point(10.0 + i, 0.0), MakeClientId(100 + i), 2 * gsk_windowLen);
+	}
+	RS_CHECK(counter.GetCounts(2 * gsk_windowLen).size() == 4);
+}
@@ -0,0 +1,235 @@
+#include <queue>
+#include <limits>
+#include <random>
+#include <functional>
+
+#include "../Common/BinaryCoding.h"
+#include "../Common/MessageException.h"
+#include "../Common/RuntimeException.h"
+#include "../TripPlaner_Enc/RoadGraph.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+
+namespace
+{
+	constexpr uint32_t gsk_roadGraphMagic = 0x47525352; //"RSRG"
+
+	typedef RoadGraph::Node Node;
+	typedef RoadGraph::Road Road;
+
+	double CalcDistance(const Node& a, const Node& b)
+	{
+		return std::hypot(b.m_x - a.m_x, b.m_y - a.m_y);
+	}
+
+	std::string Serialize(const std::vector<Node>& nodes, const std::vector<Road>& roads)
+	{
+		std::string res;
+		ComMsg::BinaryWriter writer(res);
+
+		writer.Write(gsk_roadGraphMagic);
+		writer.WriteSize(nodes.size());
+		for (const Node& node : nodes)
+		{
+			writer.Write(node.m_x);
+			writer.Write(node.m_y);
+		}
+		writer.WriteSize(roads.size());
+		for (const Road& road : roads)
+		{
+			writer.Write(road.m_from);
+			writer.Write(road.m_to);
+			writer.Write(static_cast<uint8_t>(road.m_isOneWay ? 1 : 0));
+		}
+		return res;
+	}
+
+	//A jittered grid with some roads removed or one-way, and some diagonals.
+	void GenerateGrid(const uint32_t width, std::mt19937& randGen, std::vector<Node>& nodes, std::vector<Road>& roads)
+	{
+		std::uniform_real_distribution<double> jitterDis(-0.3, 0.3);
+		std::uniform_int_distribution<uint32_t> pctDis(0, 99);
+
+		for (uint32_t i = 0; i < width; ++i)
+		{
+			for (uint32_t j = 0; j < width; ++j)
+			{
+				nodes.push_back(Node{ i + jitterDis(randGen), j + jitterDis(randGen) });
+			}
+		}
+		for (uint32_t i = 0; i < width; ++i)
+		{
+			for (uint32_t j = 0; j < width; ++j)
+			{
+				const uint32_t from = i * width + j;
+				if (i + 1 < width && pctDis(randGen) >= 10)
+				{
+					roads.push_back(Road{ from, (i + 1) * width + j, pctDis(randGen) < 15 });
+				}
+				if (j + 1 < width && pctDis(randGen) >= 10)
+				{
+					roads.push_back(Road{ from, i * width + j + 1, pctDis(randGen) < 15 });
+				}
+				if (i + 1 < width && j + 1 < width && pctDis(randGen) < 20)
+				{
+					roads.push_back(Road{ from, (i + 1) * width + j + 1, false });
+				}
+			}
+		}
+	}
+
+	//The reference: the shortest length by Dijkstra's algorithm, or infinity.
+	double FindShortestLength(const std::vector<Node>& nodes, const std::vector<Road>& roads, const uint32_t ori, const uint32_t dst)
+	{
+		typedef std::pair<double, uint32_t> QueueItem;
+
+		std::vector<std::vector<std::pair<uint32_t, double> > > adj(nodes.size());
+		for (const Road& road : roads)
+		{
+			const double length = CalcDistance(nodes[road.m_from], nodes[road.m_to]);
+			adj[road.m_from].push_back(std::make_pair(road.m_to, length));
+			if (!road.m_isOneWay)
+			{
+				adj[road.m_to].push_back(std::make_pair(road.m_from, length));
+			}
+		}
+
+		std::vector<double> dists(nodes.size(), std::numeric_limits<double>::infinity());
+		std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem> > queue;
+		dists[ori] = 0.0;
+		queue.push(QueueItem(0.0, ori));
+		while (!queue.empty())
+		{
+			const QueueItem item = queue.top();
+			queue.pop();
+			if (item.first > dists[item.second])
+			{
+				continue;
+			}
+			for (const std::pair<uint32_t, double>& arc : adj[item.second])
+			{
+				if (item.first + arc.second < dists[arc.first])
+				{
+					dists[arc.first] = item.first + arc.second;
+					queue.push(QueueItem(dists[arc.first], arc.first));
+				}
+			}
+		}
+		return dists[dst];
+	}
+
+	bool IsRoad(const std::vector<Node>& nodes, const std::vector<Road>& roads, const Node* a, const Node* b)
+	{
+		for (const Road& road : roads)
+		{
+			const Node& from = nodes[road.m_from];
+			const Node& to = nodes[road.m_to];
+			const bool isForward = from.m_x == a->m_x && from.m_y == a->m_y && to.m_x == b->m_x && to.m_y == b->m_y;
+			const bool isBackward = from.m_x == b->m_x && from.m_y == b->m_y && to.m_x == a->m_x && to.m_y == a->m_y;
+			if (isForward || (isBackward && !road.m_isOneWay))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+RS_TEST(RoadGraph_FindRoute_MatchesDijkstra)
+{
+	std::mt19937 randGen(5);
+	std::vector<Node> nodes;
+	std::vector<Road> roads;
+	GenerateGrid(12, randGen, nodes, roads);
+
+	std::unique_ptr<RoadGraph> graph = RoadGraph::Parse(StringView(Serialize(nodes, roads)));
+	RS_CHECK(graph->GetNumNodes() == nodes.size());
+
+	std::uniform_int_distribution<uint32_t> nodeDis(0, static_cast<uint32_t>(nodes.size() - 1));
+	for (size_t i = 0; i < 100; ++i)
+	{
+		const uint32_t ori = nodeDis(randGen);
+		const uint32_t dst = nodeDis(randGen);
+
+		uint32_t oriNode = 0;
+		uint32_t dstNode = 0;
+		RS_CHECK(graph->SnapToNode(nodes[ori], 0.01, oriNode));
+		RS_CHECK(graph->SnapToNode(nodes[dst], 0.01, dstNode));
+
+		std::vector<const Node*> route;
+		const bool isFound = graph->FindRoute(oriNode, dstNode, route);
+		const double expLength = FindShortestLength(nodes, roads, ori, dst);
+		RS_CHECK(isFound == !std::isinf(expLength));
+		if (!isFound)
+		{
+			continue;
+		}
+
+		//The route goes from the origin to the destination, on the roads, and is the shortest.
+		RS_CHECK(route.size() > 0);
+		RS_CHECK(route.front()->m_x == nodes[ori].m_x && route.front()->m_y == nodes[ori].m_y);
+		RS_CHECK(route.back()->m_x == nodes[dst].m_x && route.back()->m_y == nodes[dst].m_y);
+
+		double length = 0.0;
+		for (size_t j = 1; j < route.size(); ++j)
+		{
+			RS_CHECK(IsRoad(nodes, roads, route[j - 1], route[j]));
+			length += CalcDistance(*route[j - 1], *route[j]);
+		}
+		RS_CHECK_NEAR(length, expLength, 1e-9);
+	}
+}
+
+RS_TEST(RoadGraph_OneWayAndUnreachable)
+{
+	//0 -> 1 is one-way, and 2 is isolated.
+	std::vector<Node> nodes = { Node{ 0.0, 0.0 }, Node{ 1.0, 0.0 }, Node{ 5.0, 5.0 } };
+	std::vector<Road> roads = { Road{ 0, 1, true } };
+	RoadGraph graph(std::move(nodes), roads);
+
+	std::vector<const Node*> route;
+	RS_CHECK(graph.FindRoute(0, 1, route) && route.size() == 2);
+	RS_CHECK(!graph.FindRoute(1, 0, route));
+	RS_CHECK(!graph.FindRoute(0, 2, route));
+
+	uint32_t node = 0;
+	RS_CHECK(graph.SnapToNode(Node{ 4.9, 5.1 }, 0.5, node) && node == 2);
+	RS_CHECK(!graph.SnapToNode(Node{ 3.0, 3.0 }, 0.5, node));
+}
+
+RS_TEST(RoadGraph_Parse_RejectsMalformed)
+{
+	std::vector<Node> nodes = { Node{ 0.0, 0.0 }, Node{ 1.0, 0.0 } };
+	std::vector<Road> roads = { Road{ 0, 1, false } };
+	const std::string data = Serialize(nodes, roads);
+
+	RS_CHECK(RoadGraph::Parse(StringView(data))->GetNumNodes() == 2);
+
+	//Truncated, trailing bytes, and a wrong magic number.
+	RS_CHECK_THROWS(RoadGraph::Parse(StringView(data.substr(0, data.size() - 1))), MessageParseException);
+	RS_CHECK_THROWS(RoadGraph::Parse(StringView(data + '\0')), MessageParseException);
+	std::string badMagic = data;
+	badMagic[0] = 'X';
+	RS_CHECK_THROWS(RoadGraph::Parse(StringView(badMagic)), MessageParseException);
+
+	//A road to a node that doesn't exist.
+	std::vector<Road> badRoads = { Road{ 0, 2, false } };
+	RS_CHECK_THROWS(RoadGraph::Parse(StringView(Serialize(nodes, badRoads))), RuntimeException);
+}
+
+RS_TEST(RoadGraph_SizeLimit)
+{
+	RS_CHECK(RoadGraph::IsSizeSupported(50000, 100000));
+	RS_CHECK(!RoadGraph::IsSizeSupported(1000000, 0));
+	RS_CHECK(!RoadGraph::IsSizeSupported(50000, 10000000));
+
+	//A network too large is rejected by its counts, before anything is allocated for it.
+	std::string data;
+	ComMsg::BinaryWriter writer(data);
+	writer.Write(gsk_roadGraphMagic);
+	writer.WriteSize(1000000);
+	data.append(1000000 * 2 * sizeof(double), '\0');
+	RS_CHECK_THROWS(RoadGraph::Parse(StringView(data)), RuntimeException);
+}
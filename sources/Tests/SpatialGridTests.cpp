@@ -0,0 +1,170 @@
+#include <random>
+#include <algorithm>
+
+#include "../Common_Enc/SpatialGrid.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+
+namespace
+{
+	struct Item
+	{
+		double m_x;
+		double m_y;
+	};
+
+	typedef SpatialGrid<Item>::ResultType ResultType;
+
+	//The same formula as the grid's, so the distances can be compared exactly.
+	double CalcDist(const Item& item, const double x, const double y)
+	{
+		const double dx = item.m_x - x;
+		const double dy = item.m_y - y;
+		return std::sqrt(dx * dx + dy * dy);
+	}
+
+	std::vector<Item> GenerateItems(const size_t num, std::mt19937& randGen)
+	{
+		std::uniform_real_distribution<double> coordDis(-20.0, 20.0);
+
+		std::vector<Item> res;
+		for (size_t i = 0; i < num; ++i)
+		{
+			res.push_back(Item{ coordDis(randGen), coordDis(randGen) });
+		}
+		return res;
+	}
+
+	//The reference: the distances of all items within the radius, sorted.
+	std::vector<double> FindInRadiusNaive(const std::vector<Item>& items, const double x, const double y, const double radius)
+	{
+		std::vector<double> res;
+		for (const Item& item : items)
+		{
+			const double dist = CalcDist(item, x, y);
+			if (dist <= radius)
+			{
+				res.push_back(dist);
+			}
+		}
+		std::sort(res.begin(), res.end());
+		return res;
+	}
+
+	std::vector<double> ToSortedDists(const std::vector<ResultType>& results)
+	{
+		std::vector<double> res;
+		for (const ResultType& result : results)
+		{
+			res.push_back(result.second);
+		}
+		std::sort(res.begin(), res.end());
+		return res;
+	}
+}
+
+RS_TEST(SpatialGrid_FindInRadius_MatchesNaive)
+{
+	std::mt19937 randGen(1);
+	std::vector<Item> items = GenerateItems(500, randGen);
+
+	SpatialGrid<Item> grid(2.0);
+	for (Item& item : items)
+	{
+		grid.Insert(item.m_x, item.m_y, &item);
+	}
+	RS_CHECK(grid.GetSize() == items.size());
+
+	std::uniform_real_distribution<double> coordDis(-25.0, 25.0);
+	const double radii[] = { 0.5, 3.0, 100.0 };
+	for (size_t i = 0; i < 50; ++i)
+	{
+		const double x = coordDis(randGen);
+		const double y = coordDis(randGen);
+		for (const double radius : radii)
+		{
+			std::vector<ResultType> results;
+			grid.FindInRadius(x, y, radius, results);
+			RS_CHECK(ToSortedDists(results) == FindInRadiusNaive(items, x, y, radius));
+		}
+	}
+}
+
+RS_TEST(SpatialGrid_FindNearest_SortedAndBounded)
+{
+	std::mt19937 randGen(2);
+	std::vector<Item> items = GenerateItems(500, randGen);
+
+	SpatialGrid<Item> grid(1.0);
+	for (Item& item : items)
+	{
+		grid.Insert(item.m_x, item.m_y, &item);
+	}
+
+	std::uniform_real_distribution<double> coordDis(-25.0, 25.0);
+	for (size_t i = 0; i < 50; ++i)
+	{
+		const double x = coordDis(randGen);
+		const double y = coordDis(randGen);
+
+		std::vector<ResultType> results;
+		grid.FindNearest(x, y, 8.0, 5, results);
+
+		std::vector<double> expDists = FindInRadiusNaive(items, x, y, 8.0);
+		expDists.resize(std::min<size_t>(expDists.size(), 5));
+
+		std::vector<double> dists;
+		for (const ResultType& result : results)
+		{
+			dists.push_back(result.second);
+			RS_CHECK(CalcDist(*result.first, x, y) == result.second);
+		}
+		RS_CHECK(dists == expDists);
+	}
+}
+
+RS_TEST(SpatialGrid_Remove)
+{
+	Item a{ 1.5, 1.5 };
+	Item b{ 1.6, 1.4 };
+	Item c{ -7.0, 3.0 };
+
+	SpatialGrid<Item> grid(1.0);
+	grid.Insert(a.m_x, a.m_y, &a);
+	grid.Insert(b.m_x, b.m_y, &b);
+	grid.Insert(c.m_x, c.m_y, &c);
+
+	RS_CHECK(grid.Remove(a.m_x, a.m_y, &a));
+	//Already removed, or at the wrong location.
+	RS_CHECK(!grid.Remove(a.m_x, a.m_y, &a));
+	RS_CHECK(!grid.Remove(0.0, 0.0, &b));
+	RS_CHECK(grid.GetSize() == 2);
+
+	std::vector<ResultType> results;
+	grid.FindInRadius(1.5, 1.5, 1.0, results);
+	RS_CHECK(results.size() == 1 && results[0].first == &b);
+
+	RS_CHECK(grid.Remove(c.m_x, c.m_y, &c));
+	grid.FindNearest(0.0, 0.0, 100.0, 10, results);
+	RS_CHECK(results.size() == 1 && results[0].first == &b);
+}
+
+RS_TEST(SpatialGrid_ExtremeCoordinates)
+{
+	//Coordinates beyond the 32-bit range of the cells are clamped to the border cells.
+	Item far{ 1e300, -1e300 };
+	Item near{ 0.0, 0.0 };
+
+	SpatialGrid<Item> grid(1.0);
+	grid.Insert(far.m_x, far.m_y, &far);
+	grid.Insert(near.m_x, near.m_y, &near);
+
+	std::vector<ResultType> results;
+	grid.FindNearest(0.0, 0.0, 10.0, 10, results);
+	RS_CHECK(results.size() == 1 && results[0].first == &near);
+
+	RS_CHECK(grid.Remove(far.m_x, far.m_y, &far));
+	RS_CHECK(grid.GetSize() == 1);
+}
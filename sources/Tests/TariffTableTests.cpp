@@ -0,0 +1,204 @@
+#include <random>
+
+#include "../Common/BinaryCoding.h"
+#include "../Common/MessageException.h"
+#include "../Common/RuntimeException.h"
+#include "../Billing_Enc/TariffTable.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+
+namespace
+{
+	constexpr uint32_t gsk_tariffMagic = 0x46545352; //"RSTF"
+
+	typedef TariffTable::Vertex Vertex;
+	typedef TariffTable::Tariff Tariff;
+	typedef TariffTable::Zone Zone;
+	typedef ComMsg::Point2D<double> Point;
+
+	Tariff MakeTariff(const double unitPrice, const double surcharge)
+	{
+		Tariff res;
+		res.m_unitPrice = unitPrice;
+		res.m_surcharge = surcharge;
+		return res;
+	}
+
+	Zone MakeSquareZone(const double minX, const double minY, const double size, const Tariff& tariff)
+	{
+		Zone res;
+		res.m_polygon = { Vertex{ minX, minY }, Vertex{ minX + size, minY }, Vertex{ minX + size, minY + size }, Vertex{ minX, minY + size } };
+		res.m_tariff = tariff;
+		return res;
+	}
+
+	std::vector<Point> MakePath(const std::vector<std::pair<double, double> >& points)
+	{
+		std::vector<Point> res;
+		for (const std::pair<double, double>& point : points)
+		{
+			res.push_back(Point(point.first, point.second));
+		}
+		return res;
+	}
+
+	void WriteTariff(ComMsg::BinaryWriter& writer, const Tariff& tariff)
+	{
+		writer.Write(tariff.m_unitPrice);
+		writer.Write(tariff.m_surcharge);
+		writer.WriteSize(tariff.m_windows.size());
+		for (const TariffTable::TimeWindow& window : tariff.m_windows)
+		{
+			writer.Write(window.m_begin);
+			writer.Write(window.m_end);
+			writer.Write(window.m_unitPrice);
+		}
+	}
+
+	std::string Serialize(const Tariff& defaultTariff, const std::vector<Zone>& zones)
+	{
+		std::string res;
+		ComMsg::BinaryWriter writer(res);
+
+		writer.Write(gsk_tariffMagic);
+		WriteTariff(writer, defaultTariff);
+		writer.WriteSize(zones.size());
+		for (const Zone& zone : zones)
+		{
+			writer.WriteSize(zone.m_polygon.size());
+			for (const Vertex& vertex : zone.m_polygon)
+			{
+				writer.Write(vertex.m_x);
+				writer.Write(vertex.m_y);
+			}
+			WriteTariff(writer, zone.m_tariff);
+		}
+		return res;
+	}
+}
+
+RS_TEST(TariffTable_DefaultOnly)
+{
+	TariffTable table(MakeTariff(2.0, 0.5), std::vector<Zone>());
+
+	std::vector<double> unitPrices;
+	table.GetUnitPrices(0, unitPrices);
+	RS_CHECK(unitPrices.size() == 1 && unitPrices[0] == 2.0);
+
+	//The surcharge of the default tariff is charged once, for a path outside all the zones.
+	const std::vector<Point> path = MakePath({ { 0.0, 0.0 }, { 3.0, 4.0 }, { 3.0, 0.0 } });
+	RS_CHECK_NEAR(table.CalPrice(path, unitPrices), 9.0 * 2.0 + 0.5, 1e-9);
+}
+
+RS_TEST(TariffTable_ZonesSplitSegments)
+{
+	//A square zone from (0, 0) to (10, 10), and a zone of a higher priority inside it.
+	std::vector<Zone> zones;
+	zones.push_back(MakeSquareZone(4.0, 4.0, 2.0, MakeTariff(5.0, 1.0)));
+	zones.push_back(MakeSquareZone(0.0, 0.0, 10.0, MakeTariff(3.0, 0.0)));
+	TariffTable table(MakeTariff(1.0, 0.0), std::move(zones));
+	RS_CHECK(table.GetNumZones() == 2);
+
+	std::vector<double> unitPrices;
+	table.GetUnitPrices(0, unitPrices);
+
+	//From x = -5 to 15 on y = 5: 5 outside, 4 in the outer zone, 2 in the inner one, 4 in the
+	//  outer one, and 5 outside; the inner zone's surcharge is charged once.
+	const std::vector<Point> path = MakePath({ { -5.0, 5.0 }, { 15.0, 5.0 } });
+	RS_CHECK_NEAR(table.CalPrice(path, unitPrices), 10.0 * 1.0 + 8.0 * 3.0 + 2.0 * 5.0 + 1.0, 1e-9);
+
+	//The same path, in many short segments, and going through the inner zone twice.
+	std::vector<Point> longPath;
+	for (int i = 0; i <= 20; ++i)
+	{
+		longPath.push_back(Point(-5.0 + i, 5.0));
+	}
+	for (int i = 19; i >= 0; --i)
+	{
+		longPath.push_back(Point(-5.0 + i, 5.0));
+	}
+	RS_CHECK_NEAR(table.CalPrice(longPath, unitPrices), 2.0 * (10.0 * 1.0 + 8.0 * 3.0 + 2.0 * 5.0) + 1.0, 1e-9);
+
+	//The precomputed segment lengths give the same price.
+	std::vector<double> segLens;
+	for (size_t i = 1; i < longPath.size(); ++i)
+	{
+		segLens.push_back(std::hypot(longPath[i].GetX() - longPath[i - 1].GetX(), longPath[i].GetY() - longPath[i - 1].GetY()));
+	}
+	RS_CHECK_NEAR(table.CalPrice(longPath, unitPrices, segLens.data()), table.CalPrice(longPath, unitPrices), 1e-9);
+}
+
+RS_TEST(TariffTable_PathsOnBoundaries)
+{
+	std::vector<Zone> zones;
+	zones.push_back(MakeSquareZone(0.0, 0.0, 10.0, MakeTariff(3.0, 0.0)));
+	TariffTable table(MakeTariff(1.0, 0.0), std::move(zones));
+
+	std::vector<double> unitPrices;
+	table.GetUnitPrices(0, unitPrices);
+
+	//Through two vertices, along the diagonal, and touching one from outside.
+	RS_CHECK_NEAR(table.CalPrice(MakePath({ { -5.0, -5.0 }, { 15.0, 15.0 } }), unitPrices), 10.0 * std::sqrt(2.0) * (1.0 + 3.0), 1e-9);
+	RS_CHECK_NEAR(table.CalPrice(MakePath({ { -5.0, 5.0 }, { 5.0, 15.0 } }), unitPrices), 10.0 * std::sqrt(2.0), 1e-9);
+
+	//Turning right on the boundary, back out of the zone, or into it.
+	RS_CHECK_NEAR(table.CalPrice(MakePath({ { 5.0, 15.0 }, { 5.0, 10.0 }, { 15.0, 15.0 } }), unitPrices), 5.0 + std::hypot(10.0, 5.0), 1e-9);
+	RS_CHECK_NEAR(table.CalPrice(MakePath({ { 5.0, 15.0 }, { 5.0, 10.0 }, { 5.0, 5.0 } }), unitPrices), 5.0 + 5.0 * 3.0, 1e-9);
+
+	//Ending on a boundary, or starting there, after crossing another one right at the corner of
+	//  a cell; the cells of this zone are half a unit wide, from (6, 2).
+	std::vector<Zone> triangleZones(1);
+	triangleZones[0].m_polygon = { Vertex{ 6.0, 2.0 }, Vertex{ 14.0, 2.0 }, Vertex{ 6.0, 6.0 } };
+	triangleZones[0].m_tariff = MakeTariff(3.0, 0.0);
+	TariffTable triangleTable(MakeTariff(1.0, 0.0), std::move(triangleZones));
+	triangleTable.GetUnitPrices(0, unitPrices);
+
+	const double price = std::hypot(12.0, 14.0) + std::hypot(1.5, 1.75) * 2.0;
+	RS_CHECK_NEAR(triangleTable.CalPrice(MakePath({ { 0.0, 16.0 }, { 12.0, 2.0 } }), unitPrices), price, 1e-9);
+	RS_CHECK_NEAR(triangleTable.CalPrice(MakePath({ { 12.0, 2.0 }, { 0.0, 16.0 } }), unitPrices), price, 1e-9);
+}
+
+RS_TEST(TariffTable_TimeWindows)
+{
+	Tariff tariff = MakeTariff(2.0, 0.0);
+	//At night, wrapping past midnight.
+	tariff.m_windows.push_back(TariffTable::TimeWindow{ 22 * 3600, 6 * 3600, 3.0 });
+	TariffTable table(std::move(tariff), std::vector<Zone>());
+
+	std::vector<double> unitPrices;
+	table.GetUnitPrices(23 * 3600, unitPrices);
+	RS_CHECK(unitPrices[0] == 3.0);
+	table.GetUnitPrices(5 * 3600, unitPrices);
+	RS_CHECK(unitPrices[0] == 3.0);
+	table.GetUnitPrices(6 * 3600, unitPrices);
+	RS_CHECK(unitPrices[0] == 2.0);
+	//The time of the day wraps.
+	table.GetUnitPrices(TariffTable::sk_secondsPerDay + 23 * 3600, unitPrices);
+	RS_CHECK(unitPrices[0] == 3.0);
+}
+
+RS_TEST(TariffTable_Parse)
+{
+	Tariff defaultTariff = MakeTariff(1.5, 0.25);
+	defaultTariff.m_windows.push_back(TariffTable::TimeWindow{ 0, 3600, 4.0 });
+	std::vector<Zone> zones;
+	zones.push_back(MakeSquareZone(0.0, 0.0, 10.0, MakeTariff(3.0, 1.0)));
+
+	const std::string data = Serialize(defaultTariff, zones);
+	std::unique_ptr<TariffTable> table = TariffTable::Parse(StringView(data));
+	RS_CHECK(table->GetNumZones() == 1);
+
+	std::vector<double> unitPrices;
+	table->GetUnitPrices(1800, unitPrices);
+	RS_CHECK(unitPrices.size() == 2 && unitPrices[0] == 3.0 && unitPrices[1] == 4.0);
+
+	RS_CHECK_THROWS(TariffTable::Parse(StringView(data.substr(0, data.size() - 1))), MessageParseException);
+	RS_CHECK_THROWS(TariffTable::Parse(StringView(data + '\0')), MessageParseException);
+
+	//Invalid prices, and a zone that isn't a polygon.
+	RS_CHECK_THROWS(TariffTable::Parse(StringView(Serialize(MakeTariff(-1.0, 0.0), zones))), RuntimeException);
+	zones[0].m_polygon.resize(2);
+	RS_CHECK_THROWS(TariffTable::Parse(StringView(Serialize(defaultTariff, zones))), RuntimeException);
+}
@@ -0,0 +1,70 @@
+#include "TestRunner.h"
+
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <exception>
+
+using namespace RideShare::Tests;
+
+namespace
+{
+	typedef std::pair<const char*, TestFunc> TestCase;
+
+	//A function-local static, so it's constructed before the registrars of the other files use it.
+	std::vector<TestCase>& GetTestCases()
+	{
+		static std::vector<TestCase> testCases;
+		return testCases;
+	}
+
+	size_t gs_numFailures = 0;
+}
+
+TestRegistrar::TestRegistrar(const char* name, TestFunc func)
+{
+	GetTestCases().push_back(std::make_pair(name, func));
+}
+
+void RideShare::Tests::ReportFailure(const char* expr, const char* file, const int line)
+{
+	++gs_numFailures;
+	std::cout << "    " << file << ":" << line << ": check failed: " << expr << std::endl;
+}
+
+int main(int argc, char ** argv)
+{
+	//Optionally, only the test cases whose names contain the given string are run.
+	const std::string filter = argc > 1 ? argv[1] : "";
+
+	size_t numRun = 0;
+	size_t numFailed = 0;
+	for (const TestCase& testCase : GetTestCases())
+	{
+		if (std::string(testCase.first).find(filter) == std::string::npos)
+		{
+			continue;
+		}
+
+		std::cout << "[ RUN  ] " << testCase.first << std::endl;
+		const size_t prevNumFailures = gs_numFailures;
+		try
+		{
+			testCase.second();
+		}
+		catch (const std::exception& e)
+		{
+			++gs_numFailures;
+			std::cout << "    Caught exception: " << e.what() << std::endl;
+		}
+
+		++numRun;
+		const bool isPassed = gs_numFailures == prevNumFailures;
+		numFailed += isPassed ? 0 : 1;
+		std::cout << (isPassed ? "[  OK  ] " : "[ FAIL ] ") << testCase.first << std::endl;
+	}
+
+	std::cout << numRun - numFailed << " of " << numRun << " test cases passed." << std::endl;
+
+	return numFailed == 0 ? 0 : -1;
+}
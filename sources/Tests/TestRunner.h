@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+
+namespace RideShare
+{
+	namespace Tests
+	{
+		typedef void(*TestFunc)();
+
+		/**
+		 * \brief	Registers a test case, so it's run by the main function of the test runner. It's used
+		 * 			through RS_TEST, by a static instance in each test file.
+		 */
+		class TestRegistrar
+		{
+		public:
+			TestRegistrar(const char* name, TestFunc func);
+		};
+
+		/**
+		 * \brief	Records a failed check of the running test case; the test case goes on, so all its
+		 * 			failed checks are reported.
+		 */
+		void ReportFailure(const char* expr, const char* file, const int line);
+	}
+}
+
+#define RS_TEST(name) \
+	static void name(); \
+	static RideShare::Tests::TestRegistrar gs_##name##Registrar(#name, &name); \
+	static void name()
+
+#define RS_CHECK(expr) \
+	do { if (!(expr)) { RideShare::Tests::ReportFailure(#expr, __FILE__, __LINE__); } } while (false)
+
+#define RS_CHECK_NEAR(a, b, tol) \
+	RS_CHECK(std::abs((a) - (b)) <= (tol))
+
+#define RS_CHECK_THROWS(expr, ExceptionType) \
+	do { \
+		bool isThrown = false; \
+		try { expr; } \
+		catch (const ExceptionType&) { isThrown = true; } \
+		if (!isThrown) { RideShare::Tests::ReportFailure(#expr " throws " #ExceptionType, __FILE__, __LINE__); } \
+	} while (false)
@@ -0,0 +1,94 @@
+#include <map>
+#include <random>
+
+#include "../TripMatcher_Enc/TripIdMap.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+
+namespace
+{
+	TripId MakeTripId(const uint64_t hashKey, const uint8_t tag)
+	{
+		Decent::General256Hash hash;
+		hash.fill(tag);
+		std::memcpy(hash.data(), &hashKey, sizeof(hashKey));
+		return TripId(hash);
+	}
+}
+
+RS_TEST(TripIdMap_InsertFindErase)
+{
+	TripIdMap<int> map;
+
+	RS_CHECK(map.Insert(MakeTripId(1, 0), 10));
+	RS_CHECK(map.Insert(MakeTripId(2, 0), 20));
+	//Already in the table; the value is kept.
+	RS_CHECK(!map.Insert(MakeTripId(1, 0), 11));
+	RS_CHECK(map.GetSize() == 2);
+
+	RS_CHECK(map.Find(MakeTripId(1, 0)) != nullptr && *map.Find(MakeTripId(1, 0)) == 10);
+	RS_CHECK(map.Find(MakeTripId(3, 0)) == nullptr);
+
+	RS_CHECK(map.Erase(MakeTripId(1, 0)));
+	RS_CHECK(!map.Erase(MakeTripId(1, 0)));
+	RS_CHECK(map.Find(MakeTripId(1, 0)) == nullptr);
+	RS_CHECK(map.Find(MakeTripId(2, 0)) != nullptr && *map.Find(MakeTripId(2, 0)) == 20);
+	RS_CHECK(map.GetSize() == 1);
+}
+
+RS_TEST(TripIdMap_EraseKeepsProbeChains)
+{
+	//IDs with the same hash key, and the keys of the following slots, so they all share one probe
+	//  chain; erasing one in the middle must keep the others reachable.
+	TripIdMap<int> map;
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		RS_CHECK(map.Insert(MakeTripId(5, i), i));
+	}
+	RS_CHECK(map.Insert(MakeTripId(6, 0), 100));
+	RS_CHECK(map.Insert(MakeTripId(7, 0), 101));
+
+	RS_CHECK(map.Erase(MakeTripId(5, 1)));
+	RS_CHECK(map.Erase(MakeTripId(6, 0)));
+
+	RS_CHECK(map.Find(MakeTripId(5, 0)) != nullptr && *map.Find(MakeTripId(5, 0)) == 0);
+	RS_CHECK(map.Find(MakeTripId(5, 2)) != nullptr && *map.Find(MakeTripId(5, 2)) == 2);
+	RS_CHECK(map.Find(MakeTripId(5, 3)) != nullptr && *map.Find(MakeTripId(5, 3)) == 3);
+	RS_CHECK(map.Find(MakeTripId(7, 0)) != nullptr && *map.Find(MakeTripId(7, 0)) == 101);
+	RS_CHECK(map.Find(MakeTripId(5, 1)) == nullptr);
+	RS_CHECK(map.Find(MakeTripId(6, 0)) == nullptr);
+}
+
+RS_TEST(TripIdMap_MatchesStdMap)
+{
+	std::mt19937_64 randGen(3);
+	//Few distinct keys in a small range, so there are many collisions, and IDs come and go.
+	std::uniform_int_distribution<uint64_t> keyDis(0, 300);
+
+	TripIdMap<uint64_t> map;
+	std::map<uint64_t, uint64_t> expMap;
+	for (size_t i = 0; i < 20000; ++i)
+	{
+		const uint64_t key = keyDis(randGen);
+		const TripId tripId = MakeTripId(key * 0x9E3779B97F4A7C15ULL, 0);
+		if (randGen() % 3 == 0)
+		{
+			RS_CHECK(map.Erase(tripId) == (expMap.erase(key) == 1));
+		}
+		else
+		{
+			RS_CHECK(map.Insert(tripId, i) == expMap.insert(std::make_pair(key, i)).second);
+		}
+	}
+
+	RS_CHECK(map.GetSize() == expMap.size());
+	for (uint64_t key = 0; key <= 300; ++key)
+	{
+		const uint64_t* val = map.Find(MakeTripId(key * 0x9E3779B97F4A7C15ULL, 0));
+		auto it = expMap.find(key);
+		RS_CHECK((val == nullptr) == (it == expMap.end()));
+		RS_CHECK(val == nullptr || *val == it->second);
+	}
+}
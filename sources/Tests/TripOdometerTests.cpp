@@ -0,0 +1,60 @@
+#include "../TripMatcher_Enc/TripOdometer.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+
+namespace
+{
+	typedef ComMsg::TripTrace TripTrace;
+	typedef ComMsg::Point2D<double> Point;
+
+	//The fixed-point units per coordinate unit.
+	constexpr int32_t gsk_unit = 100000;
+}
+
+RS_TEST(TripOdometer_PathLength)
+{
+	const std::vector<Point> path = { Point(0.0, 0.0), Point(3.0, 4.0), Point(3.0, 0.0) };
+	RS_CHECK_NEAR(TripOdometer::CalPathLength(path), 9.0, 1e-12);
+	RS_CHECK(TripOdometer::CalPathLength(std::vector<Point>()) == 0.0);
+}
+
+RS_TEST(TripOdometer_TracesContinue)
+{
+	TripOdometer odometer(0.01);
+
+	//(1, 1) -> (4, 5) -> (4, 1), in two traces; the second one starts where the first one ends.
+	odometer.Add(TripTrace("trip", gsk_unit, gsk_unit, { TripTrace::Delta{ 3 * gsk_unit, 4 * gsk_unit } }));
+	odometer.Add(TripTrace("trip", 4 * gsk_unit, 5 * gsk_unit, { TripTrace::Delta{ 0, -4 * gsk_unit } }));
+
+	RS_CHECK_NEAR(odometer.GetDistance(), 9.0, 1e-9);
+	RS_CHECK(odometer.GetNumPoints() == 4);
+	RS_CHECK_NEAR(odometer.GetFirstPoint().GetX(), 1.0, 1e-9);
+	RS_CHECK_NEAR(odometer.GetFirstPoint().GetY(), 1.0, 1e-9);
+	RS_CHECK_NEAR(odometer.GetLastPoint().GetX(), 4.0, 1e-9);
+	RS_CHECK_NEAR(odometer.GetLastPoint().GetY(), 1.0, 1e-9);
+}
+
+RS_TEST(TripOdometer_JitterSkipped)
+{
+	TripOdometer odometer(0.01);
+
+	//A standing car, jittering by 0.001 back and forth, and then moving by 1.
+	std::vector<TripTrace::Delta> deltas;
+	for (size_t i = 0; i < 100; ++i)
+	{
+		deltas.push_back(TripTrace::Delta{ (i % 2 == 0) ? 100 : -100, 0 });
+	}
+	deltas.push_back(TripTrace::Delta{ gsk_unit, 0 });
+	odometer.Add(TripTrace("trip", 0, 0, deltas));
+
+	RS_CHECK_NEAR(odometer.GetDistance(), 1.0, 1e-9);
+	RS_CHECK(odometer.GetNumPoints() == deltas.size() + 1);
+
+	//Small steps in one direction add up, since each is measured from the last point counted.
+	TripOdometer slowOdometer(0.01);
+	std::vector<TripTrace::Delta> slowDeltas(100, TripTrace::Delta{ 500, 0 });
+	slowOdometer.Add(TripTrace("trip", 0, 0, slowDeltas));
+	RS_CHECK_NEAR(slowOdometer.GetDistance(), 0.5, 1e-9);
+}
@@ -0,0 +1,187 @@
+#include "../Common/RideSharingMessages.h"
+
+#include "TestRunner.h"
+
+using namespace RideShare;
+using namespace RideShare::ComMsg;
+
+namespace
+{
+	const WireFormat gsk_formats[] = { WireFormat::Json, WireFormat::Binary };
+
+	//Serializes the message in the format, and parses it back, as the receiver would.
+	template<typename MsgType>
+	std::unique_ptr<MsgType> RoundTrip(const MsgType& msg, const WireFormat format)
+	{
+		const std::string msgStr = msg.ToString(format);
+		RS_CHECK(DetectWireFormat(StringView(msgStr)) == format);
+		return ParseWireMsg<MsgType>(msgStr);
+	}
+
+	ClientId MakeClientId(const uint8_t tag)
+	{
+		ClientId::HashType hash;
+		hash.fill(tag);
+		return ClientId(hash);
+	}
+
+	bool IsSamePath(const std::vector<Point2D<double> >& a, const std::vector<Point2D<double> >& b)
+	{
+		if (a.size() != b.size())
+		{
+			return false;
+		}
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (a[i].GetX() != b[i].GetX() || a[i].GetY() != b[i].GetY())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	Quote MakeQuote()
+	{
+		const std::vector<Point2D<double> > path = { Point2D<double>(0.5, -1.25), Point2D<double>(3.0, 4.0) };
+		return Quote(GetQuote(path.front(), path.back()), Path(path), Price(12.5, "PriceOpPay"), "QuoteOpPay", MakeClientId(1));
+	}
+}
+
+RS_TEST(WireFormat_Quote)
+{
+	const Quote quote = MakeQuote();
+
+	for (const WireFormat format : gsk_formats)
+	{
+		std::unique_ptr<Quote> res = RoundTrip(quote, format);
+		RS_CHECK(res->GetGetQuote().GetOri().GetX() == 0.5 && res->GetGetQuote().GetOri().GetY() == -1.25);
+		RS_CHECK(res->GetGetQuote().GetDest().GetX() == 3.0 && res->GetGetQuote().GetDest().GetY() == 4.0);
+		RS_CHECK(IsSamePath(res->GetPath().GetPath(), quote.GetPath().GetPath()));
+		RS_CHECK(res->GetPrice().GetPrice() == 12.5 && res->GetPrice().GetOpPayment() == "PriceOpPay");
+		RS_CHECK(res->GetOpPayment() == "QuoteOpPay");
+		RS_CHECK(res->GetPasId() == MakeClientId(1));
+	}
+}
+
+RS_TEST(WireFormat_Contacts)
+{
+	const PasContact pasContact("Alice", "555-0100");
+	const DriContact driContact("Bob", "555-0199", "RS-1234");
+
+	for (const WireFormat format : gsk_formats)
+	{
+		std::unique_ptr<PasContact> pasRes = RoundTrip(pasContact, format);
+		RS_CHECK(pasRes->GetName() == "Alice" && pasRes->GetPhone() == "555-0100");
+
+		std::unique_ptr<DriContact> driRes = RoundTrip(driContact, format);
+		RS_CHECK(driRes->GetName() == "Bob" && driRes->GetPhone() == "555-0199");
+		//The contacts are hashed into the signed quotes, so everything must survive the round trip.
+		RS_CHECK(driRes->CalcHash() == driContact.CalcHash());
+	}
+}
+
+RS_TEST(WireFormat_DriverLocAndBatches)
+{
+	const DriverLoc loc(Point2D<double>(1.5, 2.5), 3.0, 7);
+	const PriceBatch priceBatch({ 1.0, 2.25, 0.0 }, "OpPay");
+	const CellCount cellCount(-3, 7, 42);
+
+	for (const WireFormat format : gsk_formats)
+	{
+		std::unique_ptr<DriverLoc> locRes = RoundTrip(loc, format);
+		RS_CHECK(locRes->GetLoc().GetX() == 1.5 && locRes->GetLoc().GetY() == 2.5);
+		RS_CHECK(locRes->GetRadius() == 3.0 && locRes->GetMaxNum() == 7);
+
+		std::unique_ptr<PriceBatch> priceRes = RoundTrip(priceBatch, format);
+		RS_CHECK(priceRes->GetPrices() == priceBatch.GetPrices() && priceRes->GetOpPayment() == "OpPay");
+
+		std::unique_ptr<CellCount> cellRes = RoundTrip(cellCount, format);
+		RS_CHECK(cellRes->GetX() == -3 && cellRes->GetY() == 7 && cellRes->GetCount() == 42);
+	}
+}
+
+RS_TEST(WireFormat_MatchUpdate)
+{
+	const std::vector<Point2D<double> > path = { Point2D<double>(0.0, 0.0), Point2D<double>(1.0, 1.0) };
+	const MatchUpdate update({ MatchItem("TripA", Path(path)) }, { "TripB", "TripC" });
+
+	for (const WireFormat format : gsk_formats)
+	{
+		std::unique_ptr<MatchUpdate> res = RoundTrip(update, format);
+		RS_CHECK(res->GetAdded().size() == 1);
+		for (const MatchItem& item : res->GetAdded())
+		{
+			RS_CHECK(item.GetTripId() == "TripA");
+			RS_CHECK(IsSamePath(item.GetPath().GetPath(), path));
+		}
+		RS_CHECK(res->GetRemoved() == update.GetRemoved());
+	}
+}
+
+RS_TEST(WireFormat_FinalBillBatch)
+{
+	std::vector<FinalBill> bills;
+	bills.push_back(FinalBill("TripA", MakeQuote(), "BillOpPay", MakeClientId(2), 13.75));
+	bills.push_back(FinalBill("TripB", MakeQuote(), "BillOpPay", MakeClientId(3), 0.5));
+	const FinalBillBatch batch(bills);
+
+	for (const WireFormat format : gsk_formats)
+	{
+		std::unique_ptr<FinalBillBatch> res = RoundTrip(batch, format);
+		RS_CHECK(res->GetBills().size() == 2);
+		for (size_t i = 0; i < res->GetBills().size() && i < bills.size(); ++i)
+		{
+			const FinalBill& bill = res->GetBills()[i];
+			RS_CHECK(bill.GetTripId() == bills[i].GetTripId());
+			RS_CHECK(bill.GetOpPayment() == "BillOpPay");
+			RS_CHECK(bill.GetDriId() == bills[i].GetDriId());
+			RS_CHECK(bill.GetFare() == bills[i].GetFare());
+			RS_CHECK(bill.GetQuote().GetPasId() == MakeClientId(1));
+		}
+	}
+}
+
+RS_TEST(WireFormat_TripTrace)
+{
+	std::vector<Point2D<double> > points;
+	for (int i = 0; i < 200; ++i)
+	{
+		points.push_back(Point2D<double>(10.0 + std::cos(i * 0.05) * 3.0, -5.0 + std::sin(i * 0.05) * 3.0));
+	}
+	const TripTrace trace("TripA", points);
+
+	for (const WireFormat format : gsk_formats)
+	{
+		std::unique_ptr<TripTrace> res = RoundTrip(trace, format);
+		RS_CHECK(res->GetTripId() == "TripA");
+		RS_CHECK(res->GetOriX() == trace.GetOriX() && res->GetOriY() == trace.GetOriY());
+		RS_CHECK(res->GetDeltas().size() == points.size() - 1);
+
+		//Each point is within the resolution of the fixed-point.
+		int64_t x = res->GetOriX();
+		int64_t y = res->GetOriY();
+		for (size_t i = 0; i < res->GetDeltas().size() && i + 1 < points.size(); ++i)
+		{
+			x += res->GetDeltas()[i].m_dx;
+			y += res->GetDeltas()[i].m_dy;
+			RS_CHECK_NEAR(TripTrace::ToCoord(x), points[i + 1].GetX(), TripTrace::sk_resolution);
+			RS_CHECK_NEAR(TripTrace::ToCoord(y), points[i + 1].GetY(), TripTrace::sk_resolution);
+		}
+	}
+
+	//The coordinates out of range are rejected.
+	RS_CHECK_THROWS(TripTrace::ToFixed(2 * TripTrace::sk_maxCoord), MessageException);
+	RS_CHECK_THROWS(TripTrace::ToFixed(std::nan("")), MessageException);
+}
+
+RS_TEST(WireFormat_RejectsMalformed)
+{
+	const std::string msgStr = MakeQuote().ToString(WireFormat::Binary);
+
+	//Truncated, or with trailing bytes.
+	RS_CHECK_THROWS(ParseWireMsg<Quote>(msgStr.substr(0, msgStr.size() - 1)), MessageParseException);
+	RS_CHECK_THROWS(ParseWireMsg<Quote>(msgStr + '\0'), MessageParseException);
+	//Not a JSON text either.
+	RS_CHECK_THROWS(ParseWireMsg<Quote>("{ \"Price\": "), MessageParseException);
+}
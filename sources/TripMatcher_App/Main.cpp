@@ -1,5 +1,6 @@
 #include <string>
 #include <memory>
+#include <chrono>
 #include <iostream>
 
 #include <tclap/CmdLine.h>
@@ -25,6 +26,8 @@
 
 #include "../Common/AppNames.h"
 #include "../Common_App/ConnectionManager.h"
+#include "../Common_App/PeriodicTask.h"
+#include "../Common_App/SessionWatchdog.h"
 
 #include "TripMatcherApp.h"
 
@@ -59,13 +62,24 @@ int main(int argc, char ** argv)
 	TCLAP::ValueArg<std::string> configPathArg("c", "config", "Path to the configuration file.", false, "Config.json", "String");
 	TCLAP::ValueArg<std::string> wlKeyArg("w", "wl-key", "Key for the loaded whitelist.", false, "WhiteListKey", "String");
 	TCLAP::SwitchArg isSendWlArg("s", "not-send-wl", "Do not send whitelist to Decent Server.", true);
+	TCLAP::ValueArg<uint64_t> quoteTtlArg("q", "quote-ttl", "Seconds a confirmed quote waits for a driver before it expires.", false, 10 * 60, "Seconds");
+	TCLAP::ValueArg<uint64_t> tripTtlArg("t", "trip-ttl", "Seconds a matched trip may take to end before it's dropped.", false, 4 * 60 * 60, "Seconds");
+	TCLAP::ValueArg<uint64_t> assignWindowArg("a", "assign-window", "Milliseconds between the batch assignment rounds; 0 disables the batch assignment.", false, 0, "Milliseconds");
 	cmd.add(configPathArg);
 	cmd.add(wlKeyArg);
 	cmd.add(isSendWlArg);
+	cmd.add(quoteTtlArg);
+	cmd.add(tripTtlArg);
+	cmd.add(assignWindowArg);
 
 	cmd.parse(argc, argv);
 
 	const size_t numListenThread = 5;
+	const std::chrono::seconds expiryInterval(5);
+	const std::chrono::milliseconds assignWindow(assignWindowArg.getValue());
+	const std::chrono::milliseconds paymentInterval(100);
+	const std::chrono::milliseconds pushInterval(100);
+	const std::chrono::seconds idleSessionCheckInterval(5);
 
 	//------- Read configuration file:
 	std::unique_ptr<DecentAppConfig> configMgr;
@@ -168,6 +182,9 @@ int main(int argc, char ** argv)
 			ENCLAVE_FILENAME, tokenPath, wlKeyArg.getValue(), *serverCon,
 			"TripMatcher Pay Info" + selfAddr + ":" + std::to_string(selfPort));
 
+		enclave->SetExpiry(quoteTtlArg.getValue(), tripTtlArg.getValue());
+		enclave->SetBatchAssign(assignWindow.count() > 0);
+
 		smartServer.AddServer(server, enclave, nullptr, numListenThread, 0);
 	}
 	catch (const std::exception& e)
@@ -176,10 +193,71 @@ int main(int argc, char ** argv)
 		return -1;
 	}
 
+	//------- Reclaim expired quotes and trips periodically:
+	PeriodicTask expiryTask("reclaim expired items", expiryInterval, [&enclave]()
+	{
+		const uint64_t numReclaimed = enclave->ExpireItems();
+		if (numReclaimed > 0)
+		{
+			PRINT_I("Reclaimed %llu expired items.", static_cast<unsigned long long>(numReclaimed));
+		}
+	});
+
+	//------- Run the batch assignment rounds, if enabled:
+	std::unique_ptr<PeriodicTask> assignTask;
+	if (assignWindow.count() > 0)
+	{
+		assignTask = std::make_unique<PeriodicTask>("run the batch assignment", assignWindow, [&enclave]()
+		{
+			enclave->AssignBatch();
+		});
+	}
+
+	//------- Send the final bills queued by the ended trips:
+	PeriodicTask paymentTask("dispatch payments", paymentInterval, [&enclave]()
+	{
+		enclave->DispatchPayments();
+	});
+
+	//------- Push the match updates queued for the subscribed drivers:
+	PeriodicTask pushTask("push match updates", pushInterval, [&enclave]()
+	{
+		enclave->PushMatchUpdates();
+	});
+
+	//------- Close the client sessions left idle, so they don't hold the listen threads:
+	PeriodicTask idleSessionTask("close idle sessions", idleSessionCheckInterval, []()
+	{
+		const size_t numClosed = SessionWatchdog::GetInstance().CloseIdle();
+		if (numClosed > 0)
+		{
+			PRINT_I("Closed %llu idle sessions.", static_cast<unsigned long long>(numClosed));
+		}
+	});
+
 	//------- keep running until an interrupt signal (Ctrl + C) is received.
 	mainThreadWorker->UpdateUntilInterrupt();
 
 	//------- Exit...
+	idleSessionTask.Stop();
+	expiryTask.Stop();
+	if (assignTask)
+	{
+		assignTask->Stop();
+	}
+	paymentTask.Stop();
+	pushTask.Stop();
+
+	//------- Flush the bills queued since the last dispatch:
+	try
+	{
+		enclave->DispatchPayments();
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to dispatch payments. Error Msg: %s", e.what());
+	}
+
 	enclave.reset();
 	smartServer.Terminate();
 
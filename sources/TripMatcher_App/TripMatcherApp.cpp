@@ -1,18 +1,96 @@
 #include "TripMatcherApp.h"
 
+#include <set>
+#include <mutex>
+#include <queue>
+#include <chrono>
+
 #include <DecentApi/Common/SGX/RuntimeError.h>
+#include <DecentApi/Common/Net/ConnectionBase.h>
 
 #include "../Common_App/RequestCategory.h"
+#include "../Common_App/SessionWatchdog.h"
 
 #include "Enclave_u.h"
 
 using namespace RideShare;
 
+namespace
+{
+	//Held connections can only be released through the freeHeldCnt of ProcessSmartMessage, one per
+	//  call, so the ones the enclave is done with are queued here, and handed back by the later calls.
+	//  Their sockets are closed as soon as they're queued, so only the objects wait for the hand back.
+	//  The enclave may be done with a connection (e.g., a match is found by another thread) before
+	//  the ecall parking it has returned, i.e., before it's held; such a connection is only queued
+	//  once the hold is acknowledged, so it's never handed back before it's held.
+	std::mutex gs_heldCntMutex;
+	std::set<Decent::Net::ConnectionBase*> gs_heldCnts;
+	std::set<Decent::Net::ConnectionBase*> gs_freedBeforeHeld;
+	std::queue<Decent::Net::ConnectionBase*> gs_heldCntToFree;
+}
+
+static void QueueHeldCntToFree(Decent::Net::ConnectionBase* cnt)
+{
+	cnt->Terminate();
+	gs_heldCntToFree.push(cnt);
+}
+
+extern "C" void ocall_ride_share_tm_free_held_cnt(void* cnt)
+{
+	Decent::Net::ConnectionBase* connection = static_cast<Decent::Net::ConnectionBase*>(cnt);
+
+	std::unique_lock<std::mutex> heldCntLock(gs_heldCntMutex);
+	if (gs_heldCnts.erase(connection) > 0)
+	{
+		QueueHeldCntToFree(connection);
+	}
+	else
+	{
+		gs_freedBeforeHeld.insert(connection);
+	}
+}
+
+/**
+ * \brief	Acknowledges that a connection is held, once the ecall parking it has returned.
+ */
+static void AcknowledgeHeldCnt(Decent::Net::ConnectionBase* cnt)
+{
+	std::unique_lock<std::mutex> heldCntLock(gs_heldCntMutex);
+	if (gs_freedBeforeHeld.erase(cnt) > 0)
+	{
+		QueueHeldCntToFree(cnt);
+	}
+	else
+	{
+		gs_heldCnts.insert(cnt);
+	}
+}
+
+static uint64_t GetCurrentTime()
+{
+	//A monotonic clock, so the TTLs aren't affected by changes of the wall clock.
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static Decent::Net::ConnectionBase* PopHeldCntToFree()
+{
+	std::unique_lock<std::mutex> heldCntLock(gs_heldCntMutex);
+	if (gs_heldCntToFree.size() == 0)
+	{
+		return nullptr;
+	}
+
+	Decent::Net::ConnectionBase* cnt = gs_heldCntToFree.front();
+	gs_heldCntToFree.pop();
+	return cnt;
+}
+
 bool TripMatcher::ProcessMsgFromPassenger(Decent::Net::ConnectionBase & connection)
 {
 	int retValue = false;
 	sgx_status_t enclaveRet = SGX_SUCCESS;
 
+	SessionWatchdog::Session session(SessionWatchdog::GetInstance(), connection);
 	enclaveRet = ecall_ride_share_tm_from_pas(GetEnclaveId(), &retValue, &connection);
 	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tm_from_pas);
 
@@ -24,6 +102,7 @@ bool TripMatcher::ProcessMsgFromDriver(Decent::Net::ConnectionBase& connection)
 	int retValue = false;
 	sgx_status_t enclaveRet = SGX_SUCCESS;
 
+	SessionWatchdog::Session session(SessionWatchdog::GetInstance(), connection);
 	enclaveRet = ecall_ride_share_tm_from_dri(GetEnclaveId(), &retValue, &connection);
 	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tm_from_dri);
 
@@ -32,16 +111,84 @@ bool TripMatcher::ProcessMsgFromDriver(Decent::Net::ConnectionBase& connection)
 
 bool TripMatcher::ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt)
 {
+	bool res = false;
 	if (category == RequestCategory::sk_fromPassenger)
 	{
-		return ProcessMsgFromPassenger(connection);
+		res = ProcessMsgFromPassenger(connection);
+		if (res)
+		{
+			AcknowledgeHeldCnt(&connection);
+		}
 	}
 	else if (category == RequestCategory::sk_fromDriver)
 	{
-		return ProcessMsgFromDriver(connection);
+		res = ProcessMsgFromDriver(connection);
+		if (res)
+		{
+			AcknowledgeHeldCnt(&connection);
+		}
 	}
 	else
 	{
-		return RideShareApp::ProcessSmartMessage(category, connection, freeHeldCnt);
+		res = RideShareApp::ProcessSmartMessage(category, connection, freeHeldCnt);
 	}
+
+	if (freeHeldCnt == nullptr)
+	{
+		freeHeldCnt = PopHeldCntToFree();
+	}
+
+	return res;
+}
+
+void TripMatcher::SetExpiry(uint64_t quoteTtl, uint64_t tripTtl)
+{
+	sgx_status_t enclaveRet = ecall_ride_share_tm_set_expiry(GetEnclaveId(), GetCurrentTime(), quoteTtl, tripTtl);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tm_set_expiry);
+}
+
+uint64_t TripMatcher::ExpireItems()
+{
+	uint64_t retValue = 0;
+
+	sgx_status_t enclaveRet = ecall_ride_share_tm_expire(GetEnclaveId(), &retValue, GetCurrentTime());
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tm_expire);
+
+	return retValue;
+}
+
+void TripMatcher::SetBatchAssign(bool isEnabled)
+{
+	sgx_status_t enclaveRet = ecall_ride_share_tm_set_batch_assign(GetEnclaveId(), isEnabled ? 1 : 0);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tm_set_batch_assign);
+}
+
+uint64_t TripMatcher::AssignBatch()
+{
+	uint64_t retValue = 0;
+
+	sgx_status_t enclaveRet = ecall_ride_share_tm_assign_batch(GetEnclaveId(), &retValue, GetCurrentTime());
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tm_assign_batch);
+
+	return retValue;
+}
+
+uint64_t TripMatcher::DispatchPayments()
+{
+	uint64_t retValue = 0;
+
+	sgx_status_t enclaveRet = ecall_ride_share_tm_dispatch_payments(GetEnclaveId(), &retValue, GetCurrentTime());
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tm_dispatch_payments);
+
+	return retValue;
+}
+
+uint64_t TripMatcher::PushMatchUpdates()
+{
+	uint64_t retValue = 0;
+
+	sgx_status_t enclaveRet = ecall_ride_share_tm_push_updates(GetEnclaveId(), &retValue);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tm_push_updates);
+
+	return retValue;
 }
@@ -17,5 +17,48 @@ namespace RideShare
 
 		virtual bool ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt) override;
 
+		/**
+		 * \brief	Sets the TTLs (in seconds) of pending quotes and matched trips. It should be called
+		 * 			before any request is served, since it also starts the enclave's clock.
+		 */
+		void SetExpiry(uint64_t quoteTtl, uint64_t tripTtl);
+
+		/**
+		 * \brief	Reclaims the pending quotes and matched trips that have outlived their TTLs.
+		 *
+		 * \return	The number of items reclaimed.
+		 */
+		uint64_t ExpireItems();
+
+		/**
+		 * \brief	Enables or disables the requests waiting for the batch assignment. Once enabled,
+		 * 			AssignBatch should be called periodically.
+		 */
+		void SetBatchAssign(bool isEnabled);
+
+		/**
+		 * \brief	Runs one round of the batch assignment, over the drivers and pending quotes
+		 * 			gathered since the last round.
+		 *
+		 * \return	The number of drivers assigned.
+		 */
+		uint64_t AssignBatch();
+
+		/**
+		 * \brief	Sends the queued final bills to the Payment Services. It should be called
+		 * 			periodically; after a failure, the enclave skips the calls until its backoff is over.
+		 *
+		 * \return	The number of bills sent.
+		 */
+		uint64_t DispatchPayments();
+
+		/**
+		 * \brief	Pushes the match updates queued for the subscribed drivers. It should be called
+		 * 			periodically, since the requests changing the quotes only queue the updates.
+		 *
+		 * \return	The number of updates pushed.
+		 */
+		uint64_t PushMatchUpdates();
+
 	};
 }
@@ -0,0 +1,99 @@
+#include "AuctionAssignment.h"
+
+#include <deque>
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+using namespace RideShare;
+
+constexpr size_t AuctionAssignment::sk_unassigned;
+
+AuctionAssignment::AuctionAssignment(const size_t numObjs, std::vector<std::vector<Edge> >&& edges) :
+	m_numObjs(numObjs),
+	m_edges(std::forward<std::vector<std::vector<Edge> > >(edges)),
+	m_prices(numObjs, 0.0),
+	m_owners(numObjs, sk_unassigned),
+	m_assigned(m_edges.size(), sk_unassigned),
+	m_numBids(0)
+{
+}
+
+AuctionAssignment::~AuctionAssignment()
+{
+}
+
+std::vector<size_t> AuctionAssignment::Solve(const double epsilon, const size_t maxBids)
+{
+	m_numBids = 0;
+	std::fill(m_prices.begin(), m_prices.end(), 0.0);
+
+	RunAuction(epsilon, maxBids);
+
+	return m_assigned;
+}
+
+bool AuctionAssignment::RunAuction(const double epsilon, const size_t maxBids)
+{
+	std::fill(m_owners.begin(), m_owners.end(), sk_unassigned);
+	std::fill(m_assigned.begin(), m_assigned.end(), sk_unassigned);
+
+	std::deque<size_t> bidders;
+	for (size_t i = 0; i < m_edges.size(); ++i)
+	{
+		if (m_edges[i].size() > 0)
+		{
+			bidders.push_back(i);
+		}
+	}
+
+	while (bidders.size() > 0)
+	{
+		if (m_numBids >= maxBids)
+		{
+			return false;
+		}
+
+		const size_t person = bidders.front();
+		bidders.pop_front();
+
+		//Staying unassigned is worth 0, so it's the initial best, and the second best once beaten.
+		size_t bestObj = sk_unassigned;
+		double bestVal = 0.0;
+		double secondVal = -std::numeric_limits<double>::infinity();
+		for (const Edge& edge : m_edges[person])
+		{
+			const double val = edge.m_benefit - m_prices[edge.m_obj];
+			if (val > bestVal)
+			{
+				secondVal = bestVal;
+				bestVal = val;
+				bestObj = edge.m_obj;
+			}
+			else if (val > secondVal)
+			{
+				secondVal = val;
+			}
+		}
+
+		if (bestObj == sk_unassigned)
+		{
+			//Every object is too expensive; the person gives up.
+			continue;
+		}
+
+		m_prices[bestObj] += bestVal - secondVal + epsilon;
+		++m_numBids;
+
+		const size_t prevOwner = m_owners[bestObj];
+		if (prevOwner != sk_unassigned)
+		{
+			m_assigned[prevOwner] = sk_unassigned;
+			bidders.push_back(prevOwner);
+		}
+		m_owners[bestObj] = person;
+		m_assigned[person] = bestObj;
+	}
+
+	return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace RideShare
+{
+	/**
+	 * \brief	Solves the sparse assignment problem (each person gets at most one object, and each
+	 * 			object goes to at most one person, maximizing the total benefit) with the forward
+	 * 			auction algorithm. Only the given edges are considered, so the cost of a bid grows
+	 * 			with the edges of one person, rather than the number of objects. Leaving a person
+	 * 			unassigned is worth 0; thus, edges should have positive benefits. Epsilon-scaling is
+	 * 			not used, since it needs a reverse auction to stay optimal when the numbers of persons
+	 * 			and objects differ.
+	 * 			This class is NOT thread-safe.
+	 */
+	class AuctionAssignment
+	{
+	public:
+		struct Edge
+		{
+			size_t m_obj;
+			double m_benefit;
+		};
+
+		static constexpr size_t sk_unassigned = SIZE_MAX;
+
+	public:
+		AuctionAssignment() = delete;
+
+		/**
+		 * \brief	Constructor
+		 *
+		 * \param	numObjs	Number of objects.
+		 * \param	edges  	The edges of each person.
+		 */
+		AuctionAssignment(const size_t numObjs, std::vector<std::vector<Edge> >&& edges);
+
+		AuctionAssignment(const AuctionAssignment& rhs) = delete;
+		AuctionAssignment(AuctionAssignment&& rhs) = delete;
+
+		~AuctionAssignment();
+
+		/**
+		 * \brief	Runs the auction.
+		 *
+		 * \param	epsilon	The minimum price raise of a bid; the result is within (number of persons x
+		 * 					epsilon) of the optimum.
+		 * \param	maxBids	The work budget. If it runs out, the partial assignment so far is returned,
+		 * 					which is still valid, but may leave some persons unassigned.
+		 *
+		 * \return	The object assigned to each person, or sk_unassigned.
+		 */
+		std::vector<size_t> Solve(const double epsilon, const size_t maxBids);
+
+		/** \brief	Gets the number of bids made by the last Solve call. */
+		size_t GetNumBids() const { return m_numBids; }
+
+	private:
+		//Returns false if the budget runs out before every person has an object, or has given up.
+		bool RunAuction(const double epsilon, const size_t maxBids);
+
+		const size_t m_numObjs;
+		const std::vector<std::vector<Edge> > m_edges;
+
+		std::vector<double> m_prices;
+		std::vector<size_t> m_owners;
+		std::vector<size_t> m_assigned;
+		size_t m_numBids;
+	};
+}
@@ -1,8 +1,15 @@
+#include <cmath>
 #include <map>
+#include <queue>
+#include <deque>
+#include <atomic>
+#include <unordered_set>
+#include <array>
 #include <memory>
 #include <mutex>
+#include <iterator>
 #include <algorithm>
-#include <condition_variable>
+#include <functional>
 
 #include <DecentApi/Common/Common.h>
 #include <DecentApi/Common/make_unique.h>
@@ -13,7 +20,6 @@
 #include <DecentApi/Common/Ra/CertContainer.h>
 #include <DecentApi/Common/Net/TlsCommLayer.h>
 #include <DecentApi/Common/Tools/JsonTools.h>
-#include <DecentApi/Common/MbedTls/Hasher.h>
 
 #include <DecentApi/CommonEnclave/Net/EnclaveConnectionOwner.h>
 #include <DecentApi/CommonEnclave/Net/EnclaveCntTranslator.h>
@@ -26,9 +32,20 @@
 #include "../Common/AppNames.h"
 #include "../Common/RideSharingFuncNums.h"
 #include "../Common/RideSharingMessages.h"
+#include "../Common/ClientId.h"
 #include "../Common/UnexpectedErrorException.h"
 
+#include "../Common_Enc/EnclaveClock.h"
+#include "../Common_Enc/InSituMessages.h"
 #include "../Common_Enc/OperatorPayment.h"
+#include "../Common_Enc/SharedMutex.h"
+#include "../Common_Enc/SpatialGrid.h"
+#include "../Common_Enc/TlsChannelPool.h"
+
+#include "AuctionAssignment.h"
+#include "TripId.h"
+#include "TripIdMap.h"
+#include "TripOdometer.h"
 
 #include "Enclave_t.h"
 
@@ -41,107 +58,395 @@ using namespace Decent::Tools;
 namespace
 {
 	static AppStates& gs_state = GetAppStateSingleton();
+
+	constexpr size_t gsk_maxIdleChannels = 2;
+
+	static TlsChannelPool gs_driMgmPool(gs_state, AppNames::sk_driverMgm, &ocall_ride_share_cnt_mgr_get_dri_mgm, EncFunc::DriverMgm::k_endSession, gsk_maxIdleChannels);
+	static TlsChannelPool gs_paymentPool(gs_state, AppNames::sk_payment, &ocall_ride_share_cnt_mgr_get_payment, EncFunc::Payment::k_endSession, gsk_maxIdleChannels);
 	
 	struct ConfirmedQuoteItem
 	{
 		ComMsg::PasContact m_contact;
 		ComMsg::Quote m_quote;
-		std::string m_tripId;
+		TripId m_tripId;
 		std::unique_ptr<ComMsg::DriContact> m_driContact;
-		std::string m_driId;
+		ClientId m_driId;
+
+		//The passenger's connection is held by the untrusted side while waiting for a match,
+		//  so that no enclave thread is blocked; the match result is pushed through it later.
+		void* m_pasCnt;
+		std::unique_ptr<TlsCommLayer> m_pasTls;
+		ComMsg::WireFormat m_pasFormat;
+
+		//Set when the quote has been claimed by the expiry, so drivers can't take it anymore.
+		bool m_isExpired;
+		uint64_t m_deadline;
 
 		std::mutex m_mutex;
-		std::condition_variable m_cond;
 
-		ConfirmedQuoteItem(const ComMsg::PasContact& contact, const ComMsg::Quote& quote, const std::string& tripId) :
+		ConfirmedQuoteItem(const ComMsg::PasContact& contact, ComMsg::Quote&& quote, const TripId& tripId) :
 			m_contact(contact),
-			m_quote(quote),
+			m_quote(std::forward<ComMsg::Quote>(quote)),
 			m_tripId(tripId),
-			m_driId()
+			m_driId(),
+			m_pasCnt(nullptr),
+			m_pasTls(),
+			m_pasFormat(ComMsg::GetDefaultWireFormat()),
+			m_isExpired(false),
+			m_deadline(0)
 		{}
 
 		ConfirmedQuoteItem(const ConfirmedQuoteItem& rhs) = delete;
 		ConfirmedQuoteItem(ConfirmedQuoteItem&& rhs) = delete;
 	};
 
+	//Points of the trace closer than this to the last one counted are taken as GPS jitter.
+	constexpr double gsk_traceMinStep = 0.01;
+
 	struct MatchedItem
 	{
 		ComMsg::Quote m_quote;
 		bool m_isEndByPas;
 		bool m_isEndByDri;
-		std::string m_driId;
+		ClientId m_driId;
+		const uint64_t m_deadline;
+
+		//Set once the driver starts the trip; the trace is only taken from then on.
+		bool m_isStartByDri;
+		TripOdometer m_odometer;
+
 		std::mutex m_mutex;
 
-		MatchedItem(ComMsg::Quote&& quote, const std::string& driId) :
+		MatchedItem(ComMsg::Quote&& quote, const ClientId& driId, const uint64_t deadline) :
 			m_quote(std::forward<ComMsg::Quote>(quote)),
 			m_isEndByPas(false),
 			m_isEndByDri(false),
-			m_driId(driId)
+			m_driId(driId),
+			m_deadline(deadline),
+			m_isStartByDri(false),
+			m_odometer(gsk_traceMinStep)
 		{}
+	};
 
-		MatchedItem(ComMsg::Quote&& quote, std::string&& driId) :
-			m_quote(std::forward<ComMsg::Quote>(quote)),
-			m_isEndByPas(false),
-			m_isEndByDri(false),
-			m_driId(std::forward<std::string>(driId))
+	//Defaults used when the driver doesn't specify them, and the upper bounds a driver can ask for.
+	constexpr double gsk_distanceLimit = 10.0;
+	constexpr double gsk_maxDistanceLimit = 50.0;
+	constexpr size_t gsk_maxBestMatchSize = 5;
+	constexpr size_t gsk_maxBestMatchSizeLimit = 20;
+	constexpr size_t gsk_maxFindMatchBatchSize = 4096;
+	constexpr size_t gsk_maxTraceSize = 4096;
+	//The metered fare is the quoted price scaled by the distance driven over the quoted one, within
+	//  these ratios; the upper one bounds what a driver can claim by streaming a made-up trace, and
+	//  the lower one bounds what is lost to a trace cut short (e.g., the driver's phone went offline).
+	constexpr double gsk_minMeteredFareRatio = 0.5;
+	constexpr double gsk_maxMeteredFareRatio = 1.5;
+	//How far the ends of the trace may be from the ones of the quoted path; otherwise, the trace is
+	//  not of this trip, and the quoted price is charged.
+	constexpr double gsk_maxTraceEndpointDist = 0.5;
+	//Half of the default distance limit, so a default query visits at most 5x5 cells.
+	constexpr double gsk_quoteGridCellSize = gsk_distanceLimit / 2.0;
+
+	//The pending-quote store is partitioned into geographic shards, each guarded by its own
+	//  readers-writer lock; thus, searches only take shared locks on the shards they cover, and
+	//  inserts & removals only lock the one shard the quote is located in.
+	//The trip ID index is partitioned separately by the hash of the trip ID.
+	constexpr size_t gsk_numQuoteShards = 16;
+	constexpr size_t gsk_numQuoteIdShards = 16;
+	//Each geographic shard owns square regions of this size; a default query covers at most 2x2 regions.
+	constexpr double gsk_quoteShardRegionSize = gsk_quoteGridCellSize * 8;
+
+	typedef std::map<ConfirmedQuoteItem*, std::unique_ptr<ConfirmedQuoteItem> > ConfirmedQuoteMapType;
+	typedef SpatialGrid<ConfirmedQuoteItem> ConfirmedQuoteGridType;
+	typedef TripIdMap<ConfirmedQuoteItem*> ConfirmedQuoteIdMapType;
+
+	struct ConfirmedQuoteShard
+	{
+		ConfirmedQuoteMapType m_quoteMap;
+		ConfirmedQuoteGridType m_grid;
+		SharedMutex m_mutex;
+
+		ConfirmedQuoteShard() :
+			m_quoteMap(),
+			m_grid(gsk_quoteGridCellSize),
+			m_mutex()
 		{}
 	};
 
-	typedef std::map<ConfirmedQuoteItem*, std::unique_ptr<ConfirmedQuoteItem> > ConfirmedQuoteMapType;
-	//Double as key should be fine here. B.C. we either find() using the original value, or compare() for a range.
-	typedef std::map<double, std::vector<ConfirmedQuoteItem*> > ConfirmedQuotePosMapType;
-	ConfirmedQuoteMapType gs_confirmedQuoteMap;
-	//const ConfirmedQuoteMapType& gsk_confirmedQuoteMap = gs_confirmedQuoteMap;
-	ConfirmedQuotePosMapType gs_confirmedQuotePosXMap;
-	//const ConfirmedQuotePosMapType& gsk_confirmedQuotePosXMap = gs_confirmedQuotePosXMap;
-	ConfirmedQuotePosMapType gs_confirmedQuotePosYMap;
-	//const ConfirmedQuotePosMapType& gsk_confirmedQuotePosYMap = gs_confirmedQuotePosYMap;
-	std::map<std::string, ConfirmedQuoteItem*> gs_confirmedQuoteIdMap;
-	std::mutex gs_confirmedQuoteMapMutex;
+	struct ConfirmedQuoteIdShard
+	{
+		ConfirmedQuoteIdMapType m_idMap;
+		SharedMutex m_mutex;
+	};
 
-	constexpr double gsk_distanceLimit = 10.0;
-	constexpr size_t gsk_maxBestMatchSize = 5;
+	std::array<ConfirmedQuoteShard, gsk_numQuoteShards> gs_confirmedQuoteShards;
+	std::array<ConfirmedQuoteIdShard, gsk_numQuoteIdShards> gs_confirmedQuoteIdShards;
 
-	typedef std::map<std::string, std::shared_ptr<MatchedItem> > MatchedMapType;
+	typedef TripIdMap<std::shared_ptr<MatchedItem> > MatchedMapType;
 	MatchedMapType gs_matchedMap;
 	const MatchedMapType& gsk_matchedMap = gs_matchedMap;
 	std::mutex gs_matchedMapMutex;
 
-	template<typename MsgType>
-	static std::unique_ptr<MsgType> ParseMsg(const std::string& msgStr)
+	//The time (in seconds), for the expiry (see AdvanceTime). The worst the untrusted side can do
+	//  by lying is expiring trips early, which it could already do by dropping the connections.
+	std::atomic<uint64_t> gs_currTime(0);
+	//TTLs in seconds, for pending quotes waiting for a driver, and for matched trips waiting to end.
+	std::atomic<uint64_t> gs_quoteTtl(10 * 60);
+	std::atomic<uint64_t> gs_tripTtl(4 * 60 * 60);
+
+	struct ExpiryEntry
 	{
-		rapidjson::Document json;
-		Decent::Tools::ParseStr2Json(json, msgStr);
-		return Decent::Tools::make_unique<MsgType>(json);
-	}
-	
-	static std::unique_ptr<ComMsg::SignedQuote> ParseSignedQuote(const std::string& msg, Decent::Ra::States& state)
+		uint64_t m_deadline;
+		TripId m_tripId;
+		bool m_isMatched;
+
+		ExpiryEntry(const uint64_t deadline, const TripId& tripId, const bool isMatched) :
+			m_deadline(deadline),
+			m_tripId(tripId),
+			m_isMatched(isMatched)
+		{}
+
+		bool operator>(const ExpiryEntry& rhs) const
+		{
+			return m_deadline > rhs.m_deadline;
+		}
+	};
+
+	//A min-heap on deadlines. Entries are not removed when their trips move on or end; instead,
+	//  an entry is dropped when it's due, if the trip with that ID and deadline is gone.
+	std::priority_queue<ExpiryEntry, std::vector<ExpiryEntry>, std::greater<ExpiryEntry> > gs_expiryQueue;
+	std::mutex gs_expiryQueueMutex;
+
+	//A driver subscribed to the matches around a location. Like the pending passengers, the
+	//  connection is held by the untrusted side. The threads adding or removing a quote nearby only
+	//  queue the updates; they're pushed by the push ticks from the untrusted side, so a request
+	//  never waits on the drivers' connections.
+	struct Subscription
+	{
+		const ComMsg::Point2D<double> m_loc;
+		const double m_radius;
+		void* const m_cnt;
+		std::unique_ptr<TlsCommLayer> m_tls;
+		const ComMsg::WireFormat m_format;
+		const uint64_t m_deadline;
+
+		//Serializes the pushes, and guards m_tls & m_isClosed.
+		std::mutex m_mutex;
+		bool m_isClosed;
+
+		//Guards the fields below; it's never held while sending.
+		std::mutex m_queueMutex;
+		std::deque<std::shared_ptr<const std::string> > m_pendingUpdates;
+		//Whether it's in the push queue already.
+		bool m_isQueued;
+		//The driver fell too far behind; it's closed at the next push, and has to subscribe again.
+		bool m_isOverflowed;
+
+		Subscription(const ComMsg::Point2D<double>& loc, const double radius, void* const cnt, const ComMsg::WireFormat format, const uint64_t deadline) :
+			m_loc(loc),
+			m_radius(radius),
+			m_cnt(cnt),
+			m_tls(),
+			m_format(format),
+			m_deadline(deadline),
+			m_mutex(),
+			m_isClosed(false),
+			m_queueMutex(),
+			m_pendingUpdates(),
+			m_isQueued(false),
+			m_isOverflowed(false)
+		{}
+
+		Subscription(const Subscription& rhs) = delete;
+		Subscription(Subscription&& rhs) = delete;
+	};
+
+	constexpr size_t gsk_maxSubscriptions = 1024;
+	//Drivers have to subscribe again after this long (in seconds), so dead connections are reclaimed.
+	constexpr uint64_t gsk_subscriptionTtl = 30 * 60;
+	//Updates queued for one subscription between two push ticks.
+	constexpr size_t gsk_maxPendingUpdates = 64;
+
+	typedef std::map<Subscription*, std::shared_ptr<Subscription> > SubscriptionMapType;
+
+	SubscriptionMapType gs_subscriptionMap;
+	SpatialGrid<Subscription> gs_subscriptionGrid(gsk_quoteGridCellSize);
+	SharedMutex gs_subscriptionMutex;
+
+	//The subscriptions with updates to push.
+	std::vector<std::shared_ptr<Subscription> > gs_pushQueue;
+	std::mutex gs_pushQueueMutex;
+
+	//A driver waiting for the batch assignment. The connection is parked until a trip is assigned,
+	//  or the wait expires.
+	struct WaitingDriver
+	{
+		ComMsg::DriContact m_contact;
+		const ClientId m_driId;
+		const ComMsg::Point2D<double> m_loc;
+		const double m_radius;
+		void* const m_cnt;
+		std::unique_ptr<TlsCommLayer> m_tls;
+		const ComMsg::WireFormat m_format;
+		const uint64_t m_deadline;
+
+		WaitingDriver(const ComMsg::DriContact& contact, const ClientId& driId, const ComMsg::Point2D<double>& loc, const double radius,
+			void* const cnt, const ComMsg::WireFormat format, const uint64_t deadline) :
+			m_contact(contact),
+			m_driId(driId),
+			m_loc(loc),
+			m_radius(radius),
+			m_cnt(cnt),
+			m_tls(),
+			m_format(format),
+			m_deadline(deadline)
+		{}
+
+		WaitingDriver(const WaitingDriver& rhs) = delete;
+		WaitingDriver(WaitingDriver&& rhs) = delete;
+	};
+
+	constexpr size_t gsk_maxWaitingDrivers = 16 * 1024;
+	//Number of the nearest quotes each waiting driver may be assigned to.
+	constexpr size_t gsk_assignCandidateNum = 8;
+	//The work budget of one assignment round, in bids per candidate edge.
+	constexpr size_t gsk_assignBidsPerEdge = 32;
+	//The total pickup distance is within (number of drivers x this) of the optimum.
+	constexpr double gsk_assignEpsilon = 0.01;
+
+	//Batch assignment is off, unless the untrusted side is going to run the assignment rounds.
+	std::atomic<bool> gs_isBatchAssignEnabled(false);
+	std::vector<std::unique_ptr<WaitingDriver> > gs_waitingDrivers;
+	std::mutex gs_waitingDriversMutex;
+
+	//A final bill waiting to be sent to the Payment Services. Trips end without waiting for the
+	//  Payment Services; the bills are sent in batches by the dispatch ticks from the untrusted side.
+	//  The Payment Services settle a trip at most once, so a bill is sent again until it's settled,
+	//  and is never dropped.
+	struct PendingBill
+	{
+		ComMsg::FinalBill m_bill;
+		//Seconds to wait before sending it again, once it's rejected; 0 if it's never rejected.
+		uint64_t m_retryDelay;
+
+		explicit PendingBill(ComMsg::FinalBill&& bill) :
+			m_bill(std::forward<ComMsg::FinalBill>(bill)),
+			m_retryDelay(0)
+		{}
+	};
+
+	//Of the pending and the rejected bills together; once reached, trips can't end until bills are settled.
+	constexpr size_t gsk_maxPendingBills = 64 * 1024;
+	//Number of bills settled by one request to the Payment Services.
+	constexpr size_t gsk_paymentBatchSize = 256;
+	//Seconds to wait after a failed dispatch; doubled on each consecutive failure, up to the max.
+	constexpr uint64_t gsk_paymentRetryDelay = 1;
+	constexpr uint64_t gsk_maxPaymentRetryDelay = 60;
+	//Seconds before a rejected bill (e.g., its passenger isn't registered right now) is sent again;
+	//  doubled each time it's rejected, up to the max.
+	constexpr uint64_t gsk_rejectedBillRetryDelay = 60;
+	constexpr uint64_t gsk_maxRejectedBillRetryDelay = 60 * 60;
+
+	std::deque<PendingBill> gs_pendingBills;
+	//Retry time => rejected bill.
+	std::multimap<uint64_t, PendingBill> gs_rejectedBills;
+	std::mutex gs_pendingBillsMutex;
+
+	//Only one dispatch runs at a time, so the bills are sent in order. It also guards the backoff state.
+	std::mutex gs_paymentDispatchMutex;
+	uint64_t gs_paymentRetryTime = 0;
+	uint64_t gs_paymentRetryDelay = 0;
+
+	template<typename MsgType>
+	static std::unique_ptr<MsgType> ParseMsg(std::string& msgStr)
 	{
-		JsonDoc json;
-		ParseStr2Json(json, msg);
-		return Decent::Tools::make_unique<ComMsg::SignedQuote>(ComMsg::SignedQuote::ParseSignedQuote(json, state, AppNames::sk_tripPlanner));
+		return Decent::Tools::make_unique<MsgType>(ComMsg::ParseInSitu<MsgType>(msgStr, msgStr));
 	}
 }
 
-static std::string ConstructTripId(const std::string& signedQuote)
+static TripId ConstructTripId(const StringView& signedQuote)
 {
-	using namespace Decent::MbedTlsObj;
-
 	General256Hash hash;
-	Hasher<HashType::SHA256>().Calc(hash, signedQuote);
+	CalcSha256(hash, signedQuote);
+
+	return TripId(hash);
+}
+
+static int64_t ToQuoteShardRegionIndex(const double val)
+{
+	const double idx = std::floor(val / gsk_quoteShardRegionSize);
+	//NaN & out-of-range values all go to region 0; it just needs to be deterministic.
+	return (idx > INT32_MIN && idx < INT32_MAX) ? static_cast<int64_t>(idx) : 0;
+}
+
+static size_t GetQuoteShardIndex(const int64_t regionX, const int64_t regionY)
+{
+	const uint64_t hash = (static_cast<uint64_t>(regionX) * 73856093ULL) ^ (static_cast<uint64_t>(regionY) * 19349663ULL);
+	return static_cast<size_t>(hash % gsk_numQuoteShards);
+}
+
+static ConfirmedQuoteShard& GetQuoteShard(const ComMsg::Point2D<double>& loc)
+{
+	return gs_confirmedQuoteShards[GetQuoteShardIndex(ToQuoteShardRegionIndex(loc.GetX()), ToQuoteShardRegionIndex(loc.GetY()))];
+}
+
+static ConfirmedQuoteIdShard& GetQuoteIdShard(const TripId& tripId)
+{
+	//The first bytes are used by the hash table in the shard, so take the last one here.
+	return gs_confirmedQuoteIdShards[tripId.Get().back() % gsk_numQuoteIdShards];
+}
+
+/**
+ * \brief	Gets the indices of the geographic shards overlapping the square around (x, y), in
+ * 			ascending order. Locks on multiple shards must always be taken in this order.
+ */
+static std::vector<size_t> GetQuoteShardIndices(const double x, const double y, const double radius)
+{
+	const int64_t minRx = ToQuoteShardRegionIndex(x - radius);
+	const int64_t maxRx = ToQuoteShardRegionIndex(x + radius);
+	const int64_t minRy = ToQuoteShardRegionIndex(y - radius);
+	const int64_t maxRy = ToQuoteShardRegionIndex(y + radius);
+
+	std::array<bool, gsk_numQuoteShards> isCovered;
+	isCovered.fill(false);
+	if (maxRx < minRx || maxRy < minRy || //One side falls into the NaN/out-of-range region.
+		(maxRx - minRx + 1) * (maxRy - minRy + 1) >= static_cast<int64_t>(gsk_numQuoteShards))
+	{
+		isCovered.fill(true);
+	}
+	else
+	{
+		for (int64_t rx = minRx; rx <= maxRx; ++rx)
+		{
+			for (int64_t ry = minRy; ry <= maxRy; ++ry)
+			{
+				isCovered[GetQuoteShardIndex(rx, ry)] = true;
+			}
+		}
+	}
 
-	return cppcodec::base64_rfc4648::encode(hash);
+	std::vector<size_t> res;
+	for (size_t i = 0; i < gsk_numQuoteShards; ++i)
+	{
+		if (isCovered[i])
+		{
+			res.push_back(i);
+		}
+	}
+	return std::move(res);
 }
 
 static bool AddConfirmedQuote(std::unique_ptr<ConfirmedQuoteItem>& item)
 {
 	ConfirmedQuoteItem* itemPtr = item.get();
-	double x = item->m_quote.GetGetQuote().GetOri().GetX();
-	double y = item->m_quote.GetGetQuote().GetOri().GetY();
-	const std::string& tripId = item->m_tripId;
-
-	std::unique_lock<std::mutex> mapLockQuote(gs_confirmedQuoteMapMutex);
-	if (gs_confirmedQuoteIdMap.find(tripId) != gs_confirmedQuoteIdMap.end())
+	const ComMsg::Point2D<double>& ori = item->m_quote.GetGetQuote().GetOri();
+	const TripId& tripId = item->m_tripId;
+
+	//Claim the trip ID first, so the same quote can't be added twice. The ID lock is held until the
+	//  item is in the geographic shard too, since a driver can claim (and then remove) the item as
+	//  soon as its ID is published. The ID shard is always locked before the geographic one.
+	ConfirmedQuoteIdShard& idShard = GetQuoteIdShard(tripId);
+	std::unique_lock<SharedMutex> idLock(idShard.m_mutex);
+	if (idShard.m_idMap.Find(tripId) != nullptr)
 	{
 		LOGI("Quote already exist!");
 		return false;
@@ -149,66 +454,56 @@ static bool AddConfirmedQuote(std::unique_ptr<ConfirmedQuoteItem>& item)
 
 	{
 		std::unique_lock<std::mutex> mapLockMatched(gs_matchedMapMutex);
-		if (gsk_matchedMap.find(tripId) != gsk_matchedMap.cend())
+		if (gsk_matchedMap.Find(tripId) != nullptr)
 		{
 			LOGI("Quote already exist!");
 			return false;
 		}
 	}
-	gs_confirmedQuoteMap.insert(std::make_pair(itemPtr, std::move(item)));
-	gs_confirmedQuotePosXMap[x].push_back(itemPtr);
-	gs_confirmedQuotePosYMap[y].push_back(itemPtr);
-	gs_confirmedQuoteIdMap.insert(std::make_pair(tripId, itemPtr));
-
-	return true;
-}
-
-static void RemoveConfirmedQuotePos(ConfirmedQuotePosMapType& map, double key, ConfirmedQuoteItem* const itemPtr)
-{
-	auto it = map.find(key);
-	DEBUG_ASSERT(it != map.end());
 
-	auto posIt = std::find(it->second.begin(), it->second.end(), itemPtr);
-	DEBUG_ASSERT(posIt != it->second.end());
-	
-	it->second.erase(posIt);
-
-	if (it->second.size() == 0)
 	{
-		map.erase(it);
+		ConfirmedQuoteShard& shard = GetQuoteShard(ori);
+		std::unique_lock<SharedMutex> shardLock(shard.m_mutex);
+		shard.m_grid.Insert(ori.GetX(), ori.GetY(), itemPtr);
+		shard.m_quoteMap.insert(std::make_pair(itemPtr, std::move(item)));
 	}
+
+	idShard.m_idMap.Insert(tripId, itemPtr);
+
+	return true;
 }
 
 static std::unique_ptr<ConfirmedQuoteItem> RemoveConfirmedQuote(ConfirmedQuoteItem* const itemPtr)
 {
-	std::unique_lock<std::mutex> mapLock(gs_confirmedQuoteMapMutex);
-	auto it = gs_confirmedQuoteMap.find(itemPtr);
+	const ComMsg::Point2D<double>& ori = itemPtr->m_quote.GetGetQuote().GetOri();
 
-	DEBUG_ASSERT(it != gs_confirmedQuoteMap.end());
-	
-	std::unique_ptr<ConfirmedQuoteItem> res = std::move(it->second);
-	gs_confirmedQuoteMap.erase(it);
+	ConfirmedQuoteShard& shard = GetQuoteShard(ori);
+	std::unique_lock<SharedMutex> shardLock(shard.m_mutex);
+	auto it = shard.m_quoteMap.find(itemPtr);
+
+	DEBUG_ASSERT(it != shard.m_quoteMap.end());
 
-	double x = res->m_quote.GetGetQuote().GetOri().GetX();
-	double y = res->m_quote.GetGetQuote().GetOri().GetY();
+	const bool isPosRemoved = shard.m_grid.Remove(ori.GetX(), ori.GetY(), itemPtr);
+	DEBUG_ASSERT(isPosRemoved);
 
-	RemoveConfirmedQuotePos(gs_confirmedQuotePosXMap, x, itemPtr);
-	RemoveConfirmedQuotePos(gs_confirmedQuotePosYMap, y, itemPtr);
+	std::unique_ptr<ConfirmedQuoteItem> res = std::move(it->second);
+	shard.m_quoteMap.erase(it);
 
 	return std::move(res);
 }
 
-static void AddMatchedItem(const std::string& tripId, std::shared_ptr<MatchedItem>& matched)
+static void AddMatchedItem(const TripId& tripId, std::shared_ptr<MatchedItem>& matched)
 {
-	std::unique_lock<std::mutex> mapLock(gs_matchedMapMutex);
-	DEBUG_ASSERT(gsk_matchedMap.find(tripId) == gsk_matchedMap.cend());
-	
-	gs_matchedMap.insert(std::make_pair(tripId, std::move(matched)));
-
 	{
-		std::unique_lock<std::mutex> mapLockQuote(gs_confirmedQuoteMapMutex);
-		gs_confirmedQuoteIdMap.erase(tripId);
+		std::unique_lock<std::mutex> mapLock(gs_matchedMapMutex);
+		const bool isInserted = gs_matchedMap.Insert(tripId, std::move(matched));
+		DEBUG_ASSERT(isInserted);
 	}
+
+	//Only release the trip ID after it's in the matched map, so the quote can't be re-added in between.
+	ConfirmedQuoteIdShard& idShard = GetQuoteIdShard(tripId);
+	std::unique_lock<SharedMutex> idLock(idShard.m_mutex);
+	idShard.m_idMap.Erase(tripId);
 }
 
 static bool VerifyContactHash(const std::string& certPem, const Decent::General256Hash& contactHash)
@@ -218,353 +513,1435 @@ static bool VerifyContactHash(const std::string& certPem, const Decent::General2
 	return cert.GetAppId() == cppcodec::base64_rfc4648::encode(contactHash);
 }
 
-static inline std::string GetClientIdFromTls(const Decent::Net::TlsCommLayer& tls)
+static inline ClientId GetClientIdFromTls(const Decent::Net::TlsCommLayer& tls)
 {
-	return tls.GetPublicKeyPem();
+	return ClientId::FromPubKeyPem(tls.GetPublicKeyPem());
 }
 
-static void ProcessPasConfirmQuoteReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+static void FreeHeldConnection(void* const connection)
 {
-	LOGI("Processing passenger confirm request...");
-
-	EnclaveCntTranslator cnt(connection);
-
-	const std::string pasId = GetClientIdFromTls(tls);
+	sgx_status_t ret = ocall_ride_share_tm_free_held_cnt(connection);
+	if (ret != SGX_SUCCESS)
+	{
+		PRINT_W("Failed to free the held connection.");
+	}
+}
 
-	std::string msgBuf;
+static uint64_t GetDeadline(const std::atomic<uint64_t>& ttl)
+{
+	return gs_currTime.load() + ttl.load();
+}
 
-	msgBuf = tls.RecvContainer<std::string>(cnt);
-	std::unique_ptr<ComMsg::ConfirmQuote> confirmQuote = ParseMsg<ComMsg::ConfirmQuote>(msgBuf);
-	std::unique_ptr<ComMsg::SignedQuote> signedQuote = ParseSignedQuote(confirmQuote->GetSignQuote(), gs_state);
-	std::unique_ptr<ComMsg::Quote> quote = ParseMsg<ComMsg::Quote>(signedQuote->GetQuote());
+static void ScheduleExpiry(const uint64_t deadline, const TripId& tripId, const bool isMatched)
+{
+	std::unique_lock<std::mutex> queueLock(gs_expiryQueueMutex);
+	gs_expiryQueue.push(ExpiryEntry(deadline, tripId, isMatched));
+}
 
-	if (quote->GetPasId() != pasId)
+static bool AddSubscription(const std::shared_ptr<Subscription>& sub)
+{
+	std::unique_lock<SharedMutex> subLock(gs_subscriptionMutex);
+	if (gs_subscriptionMap.size() >= gsk_maxSubscriptions)
 	{
-		return;
+		return false;
 	}
 
-	//verify pas contact.
-	if (!VerifyContactHash(tls.GetPeerCertPem(), confirmQuote->GetContact().CalcHash()))
+	gs_subscriptionGrid.Insert(sub->m_loc.GetX(), sub->m_loc.GetY(), sub.get());
+	gs_subscriptionMap.insert(std::make_pair(sub.get(), sub));
+
+	return true;
+}
+
+static void RemoveSubscription(Subscription* const sub)
+{
+	std::unique_lock<SharedMutex> subLock(gs_subscriptionMutex);
+	auto it = gs_subscriptionMap.find(sub);
+	if (it == gs_subscriptionMap.end())
 	{
-		LOGW("Passenger's contact doesn't match!");
 		return;
 	}
 
-	std::string tripId = ConstructTripId(confirmQuote->GetSignQuote());
-	PRINT_I("Got quote with trip ID: %s.", tripId.c_str());
-	std::unique_ptr<ConfirmedQuoteItem> item = make_unique<ConfirmedQuoteItem>(confirmQuote->GetContact(), *quote, tripId);
-	ConfirmedQuoteItem* itemPtr = item.get();
-
-	//Clean up memory:
-	confirmQuote.reset();
-	signedQuote.reset();
-	quote.reset();
+	gs_subscriptionGrid.Remove(sub->m_loc.GetX(), sub->m_loc.GetY(), sub);
+	gs_subscriptionMap.erase(it);
+}
 
-	std::mutex& itemMutex = item->m_mutex;
-	std::condition_variable& itemCond = item->m_cond;
-	const std::unique_ptr<ComMsg::DriContact>& driContact = item->m_driContact;
+/**
+ * \brief	Removes the subscription from the index, and hands the connection back to the untrusted side.
+ */
+static void CloseSubscription(const std::shared_ptr<Subscription>& sub)
+{
+	RemoveSubscription(sub.get());
 
-	std::unique_lock<std::mutex> itemLock(itemMutex);
-	if (!AddConfirmedQuote(item))
+	std::unique_lock<std::mutex> pushLock(sub->m_mutex);
+	if (sub->m_isClosed)
 	{
 		return;
 	}
-	item.reset();
-
-	PRINT_I("Waiting for a match for the trip with ID %s...", tripId.c_str());
-	itemCond.wait(itemLock, [&driContact] {return static_cast<bool>(driContact); });
-	PRINT_I("Match for the trip with ID %s is found.", tripId.c_str());
-
-	item = RemoveConfirmedQuote(itemPtr);
-
-	std::shared_ptr<MatchedItem> matched = std::make_shared<MatchedItem>(std::move(item->m_quote), std::move(item->m_driId));
-
-	AddMatchedItem(item->m_tripId, matched);
-
-	ComMsg::PasMatchedResult pasMatchedRes(std::move(item->m_tripId), std::move(*item->m_driContact));
-	item.reset();
-
-	tls.SendContainer(cnt, pasMatchedRes.ToString());
 
+	sub->m_isClosed = true;
+	sub->m_tls.reset();
+	FreeHeldConnection(sub->m_cnt);
 }
 
-static void TripStart(void* const connection, Decent::Net::TlsCommLayer& tls, const bool isPassenger)
+/**
+ * \brief	Finds the subscriptions whose area covers the given location.
+ */
+static std::vector<std::shared_ptr<Subscription> > FindSubscriptions(const ComMsg::Point2D<double>& loc)
 {
-	LOGI("Processing trip start from %s...", isPassenger ? "passenger" : "driver");
-
-	EnclaveCntTranslator cnt(connection);
-
-	std::string tripId;
+	std::vector<std::shared_ptr<Subscription> > res;
 
-	tripId = tls.RecvContainer<std::string>(cnt);
+	SharedLock<SharedMutex> subLock(gs_subscriptionMutex);
+	if (gs_subscriptionMap.size() == 0)
+	{
+		return res;
+	}
 
-	std::shared_ptr<MatchedItem> item;
+	//No subscription's radius is larger than the limit, so the exact radius is checked afterwards.
+	std::vector<SpatialGrid<Subscription>::ResultType> found;
+	gs_subscriptionGrid.FindInRadius(loc.GetX(), loc.GetY(), gsk_maxDistanceLimit, found);
+	for (const SpatialGrid<Subscription>::ResultType& item : found)
 	{
-		//Check if it's in the map.
-		std::unique_lock<std::mutex> mapLock(gs_matchedMapMutex);
-		auto it = gs_matchedMap.find(tripId);
-		if (it != gs_matchedMap.end())
+		if (item.second <= item.first->m_radius)
 		{
-			item = it->second;
+			res.push_back(gs_subscriptionMap.find(item.first)->second);
 		}
 	}
-	LOGI("The trip is %s. The ID is %s.", item ? "found" : "not found", tripId.c_str());
 
-	if (!item ||
-		GetClientIdFromTls(tls) != (isPassenger ? item->m_quote.GetPasId() : item->m_driId))
-	{
-		LOGI("Requester is not the %s of this trip!", isPassenger ? "passenger" : "driver");
-		return;
-	}
+	return res;
 }
 
-static void ProcessPayment(const std::shared_ptr<MatchedItem>& item)
+static void QueueMatchUpdate(const std::shared_ptr<Subscription>& sub, const std::shared_ptr<const std::string>& updateStr)
 {
-	using namespace EncFunc::Payment;
-
-	ComMsg::FinalBill bill(std::move(item->m_quote), std::string(OperatorPayment::GetPaymentInfo()), std::move(item->m_driId));
-
-	LOGI("Sending final bill to payment services...");
-	EnclaveConnectionOwner cnt = EnclaveConnectionOwner::CntBuilder(SGX_SUCCESS, &ocall_ride_share_cnt_mgr_get_payment);
+	{
+		std::unique_lock<std::mutex> queueLock(sub->m_queueMutex);
+		if (sub->m_pendingUpdates.size() >= gsk_maxPendingUpdates)
+		{
+			sub->m_isOverflowed = true;
+		}
+		else
+		{
+			sub->m_pendingUpdates.push_back(updateStr);
+		}
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_payment, nullptr);
-	Decent::Net::TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
+		if (sub->m_isQueued)
+		{
+			return;
+		}
+		sub->m_isQueued = true;
+	}
 
-	tls.SendStruct(cnt, k_procPayment);
-	tls.SendContainer(cnt, bill.ToString());
+	std::unique_lock<std::mutex> pushQueueLock(gs_pushQueueMutex);
+	gs_pushQueue.push_back(sub);
 }
 
-static void TripEnd(void* const connection, Decent::Net::TlsCommLayer& tls, const bool isPassenger)
+/**
+ * \brief	Queues the update for the drivers subscribed around the location of the changed quote;
+ * 			it's pushed by the next push tick (see PushMatchUpdates). The caller must not hold any
+ * 			lock of the quote store.
+ */
+static void NotifySubscribers(const ComMsg::Point2D<double>& loc, const ComMsg::MatchUpdate& update)
 {
-	LOGI("Processing trip end from %s...", isPassenger ? "passenger" : "driver");
-
-	EnclaveCntTranslator cnt(connection);
-
-	std::string tripId = tls.RecvContainer<std::string>(cnt);
+	const std::vector<std::shared_ptr<Subscription> > subs = FindSubscriptions(loc);
 
-	std::shared_ptr<MatchedItem> item;
+	//Serialize once for each format in use.
+	std::shared_ptr<const std::string> jsonStr;
+	std::shared_ptr<const std::string> binaryStr;
+	for (const std::shared_ptr<Subscription>& sub : subs)
 	{
-		//Check if it's in the map.
-		std::unique_lock<std::mutex> mapLock(gs_matchedMapMutex);
-		auto it = gs_matchedMap.find(tripId);
-		if (it != gs_matchedMap.end())
+		std::shared_ptr<const std::string>& updateStr = (sub->m_format == ComMsg::WireFormat::Json) ? jsonStr : binaryStr;
+		if (!updateStr)
 		{
-			item = it->second;
+			updateStr = std::make_shared<std::string>(update.ToString(sub->m_format));
 		}
-	}
 
-	LOGI("The trip is %s. The ID is %s.", item ? "found" : "not found", tripId.c_str());
+		QueueMatchUpdate(sub, updateStr);
+	}
+}
 
-	if (!item ||
-		GetClientIdFromTls(tls) != (isPassenger ? item->m_quote.GetPasId() : item->m_driId))
+/**
+ * \return	False if the subscription is broken and should be closed.
+ */
+static bool PushMatchUpdates(Subscription& sub, const std::deque<std::shared_ptr<const std::string> >& updates)
+{
+	std::unique_lock<std::mutex> pushLock(sub.m_mutex);
+	if (sub.m_isClosed)
 	{
-		LOGI("Requester is not the %s of this trip!", isPassenger ? "passenger" : "driver");
-		return;
+		return true;
 	}
 
-	std::unique_lock<std::mutex> itemLock(item->m_mutex);
-
-	if (item->m_isEndByPas && item->m_isEndByDri) //Trip is already finished by other process.
+	try
 	{
-		return;
+		EnclaveCntTranslator driCnt(sub.m_cnt);
+		for (const std::shared_ptr<const std::string>& updateStr : updates)
+		{
+			sub.m_tls->SendContainer(driCnt, *updateStr);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		LOGW("Failed to push the match update to the driver. Caught exception: %s", e.what());
+		return false;
 	}
 
-	switch (isPassenger)
+	return true;
+}
+
+/**
+ * \brief	Pushes the queued updates to the subscribed drivers. The subscriptions that are broken,
+ * 			or have fallen too far behind, are closed.
+ *
+ * \return	The number of updates pushed.
+ */
+static size_t PushMatchUpdates()
+{
+	std::vector<std::shared_ptr<Subscription> > subs;
 	{
-	case false: //zero
-		item->m_isEndByDri = true;
-		break;
-	default: //true, non-zero
-		item->m_isEndByPas = true;
-		break;
+		std::unique_lock<std::mutex> pushQueueLock(gs_pushQueueMutex);
+		subs.swap(gs_pushQueue);
 	}
 
-	if (item->m_isEndByPas && item->m_isEndByDri) //Trip is finished.
+	size_t numPushed = 0;
+	std::deque<std::shared_ptr<const std::string> > updates;
+	for (const std::shared_ptr<Subscription>& sub : subs)
 	{
-		{//Remove it from map first.
-			std::unique_lock<std::mutex> mapLock(gs_matchedMapMutex);
-			auto it = gs_matchedMap.find(tripId);
-			if (it != gs_matchedMap.end())
-			{
-				gs_matchedMap.erase(it);
-			}
+		bool isOverflowed = false;
+		{
+			std::unique_lock<std::mutex> queueLock(sub->m_queueMutex);
+			updates.swap(sub->m_pendingUpdates);
+			isOverflowed = sub->m_isOverflowed;
+			sub->m_isQueued = false;
+		}
+
+		if (isOverflowed)
+		{
+			LOGW("A subscribed driver has too many pending updates.");
+			CloseSubscription(sub);
+		}
+		else if (!PushMatchUpdates(*sub, updates))
+		{
+			CloseSubscription(sub);
+		}
+		else
+		{
+			numPushed += updates.size();
 		}
-		
-		ProcessPayment(item); //Caution: m_quote & m_driId in item become invalid after this call!
+		updates.clear();
 	}
+
+	return numPushed;
 }
 
-static std::vector<std::pair<ConfirmedQuoteItem*, double> > FindMatchInitial(const ComMsg::Point2D<double>& driLoc)
+static void NotifyQuoteRemoved(const ComMsg::Point2D<double>& loc, const TripId& tripId)
 {
-	std::unique_lock<std::mutex> mapLock(gs_confirmedQuoteMapMutex);
+	NotifySubscribers(loc, ComMsg::MatchUpdate(std::vector<ComMsg::MatchItem>(), std::vector<std::string>(1, tripId.ToString())));
+}
 
-	std::map<ConfirmedQuoteItem*, double> midRes1;
+static size_t ExpireSubscriptions(const uint64_t currTime)
+{
+	std::vector<std::shared_ptr<Subscription> > expired;
 	{
-		auto end = gs_confirmedQuotePosXMap.upper_bound(driLoc.GetX() + gsk_distanceLimit);
-		for (auto it = gs_confirmedQuotePosXMap.lower_bound(driLoc.GetX() - gsk_distanceLimit);
-			it != end; ++it)
+		SharedLock<SharedMutex> subLock(gs_subscriptionMutex);
+		for (const SubscriptionMapType::value_type& item : gs_subscriptionMap)
 		{
-			double dist = pow(driLoc.GetX() - it->first, 2);
-
-			for (ConfirmedQuoteItem* ptr : it->second)
+			if (item.second->m_deadline <= currTime)
 			{
-				midRes1[ptr] = dist;
+				expired.push_back(item.second);
 			}
 		}
 	}
 
-	std::vector<std::pair<ConfirmedQuoteItem*, double> > midRes2;
+	for (const std::shared_ptr<Subscription>& sub : expired)
 	{
-		auto end = gs_confirmedQuotePosYMap.upper_bound(driLoc.GetY() + gsk_distanceLimit);
-		for (auto it = gs_confirmedQuotePosYMap.lower_bound(driLoc.GetY() - gsk_distanceLimit);
-			it != end; ++it)
-		{
-			double dist = pow(driLoc.GetY() - it->first, 2);
-
-			for (ConfirmedQuoteItem* ptr : it->second)
-			{
-				auto midResIt = midRes1.find(ptr);
-				if (midResIt != midRes1.end())
-				{
-					midRes2.push_back(std::make_pair(ptr, sqrt(midResIt->second + dist)));
-				}
-			}
-		}
+		CloseSubscription(sub);
 	}
 
-	return std::move(midRes2);
+	return expired.size();
 }
 
-static std::vector<ConfirmedQuoteItem*> FindMatchSort(std::vector<std::pair<ConfirmedQuoteItem*, double> >& midRes)
+/**
+ * \brief	Sends the result to the passenger waiting on the parked connection, and then hands the
+ * 			connection back to the untrusted side.
+ */
+static void ReleaseParkedPassenger(ConfirmedQuoteItem& item, const ComMsg::PasMatchedResult& pasMatchedRes)
 {
-	std::vector<ConfirmedQuoteItem*> res;
-	res.reserve(midRes.size());
-
-	std::sort(midRes.begin(), midRes.end(), [](const std::pair<ConfirmedQuoteItem*, double>& a, const std::pair<ConfirmedQuoteItem*, double>&b)
+	try
 	{
-		return a.second < b.second;
-	});
-
-	LOGI("List of matches:");
-	for (const std::pair<ConfirmedQuoteItem*, double>& item : midRes)
+		EnclaveCntTranslator pasCnt(item.m_pasCnt);
+		item.m_pasTls->SendContainer(pasCnt, pasMatchedRes.ToString(item.m_pasFormat));
+	}
+	catch (const std::exception& e)
 	{
-		LOGI("\tDist: %f", item.second);
-		res.push_back(item.first);
+		PRINT_W("Failed to send the match result to the passenger. Caught exception: %s", e.what());
 	}
 
-	return std::move(res);
+	item.m_pasTls.reset();
+	FreeHeldConnection(item.m_pasCnt);
 }
 
-static std::vector<ComMsg::MatchItem> FindMatchFinal(const std::vector<ConfirmedQuoteItem*>& matchesList)
+/**
+ * \brief	Claims the pending quote for the driver. Competing drivers (and the expiry) are
+ * 			serialized by the item lock, so only the first one gets the trip.
+ *
+ * \return	The claimed item, which should be passed to CompleteMatch, or nullptr if the quote is
+ * 			gone, or has been taken or expired.
+ */
+static ConfirmedQuoteItem* ClaimQuote(const TripId& tripId, const ComMsg::DriContact& driContact, const ClientId& driId,
+	std::unique_ptr<ComMsg::PasContact>& pasContact)
 {
-	std::vector<ComMsg::MatchItem> res;
+	//The shared lock on the ID shard keeps the item alive, since it's only released after
+	//  its ID is erased under the exclusive lock.
+	ConfirmedQuoteIdShard& idShard = GetQuoteIdShard(tripId);
+	SharedLock<SharedMutex> idLock(idShard.m_mutex);
 
-	std::unique_lock<std::mutex> mapLock(gs_confirmedQuoteMapMutex);
+	ConfirmedQuoteItem* const* idMapIt = idShard.m_idMap.Find(tripId);
+	if (idMapIt == nullptr)
+	{
+		return nullptr;
+	}
 
-	for (size_t i = 0; i < matchesList.size() && i < gsk_maxBestMatchSize; ++i)
+	ConfirmedQuoteItem* item = *idMapIt;
+	std::unique_lock<std::mutex> itemLock(item->m_mutex);
+	if (item->m_driContact || item->m_isExpired)
 	{
-		auto it = gs_confirmedQuoteMap.find(matchesList[i]);
-		if (it != gs_confirmedQuoteMap.end())
-		{
-			res.push_back(ComMsg::MatchItem(it->second->m_tripId, it->second->m_quote.GetPath()));
-		}
+		return nullptr;
 	}
 
-	return std::move(res);
+	item->m_driContact = Tools::make_unique<ComMsg::DriContact>(driContact);
+	item->m_driId = driId;
+
+	pasContact = Tools::make_unique<ComMsg::PasContact>(item->m_contact);
+
+	return item;
 }
 
-static bool SendQueryLog(const std::string& userId, const ComMsg::Point2D<double>& loc)
+/**
+ * \brief	Moves a quote, which has been taken by a driver, to the matched map, and pushes the result
+ * 			to the waiting passenger.
+ */
+static void CompleteMatch(ConfirmedQuoteItem* const itemPtr)
 {
-	using namespace EncFunc::DriverMgm;
+	std::unique_ptr<ConfirmedQuoteItem> item = RemoveConfirmedQuote(itemPtr);
+	const ComMsg::Point2D<double> ori = item->m_quote.GetGetQuote().GetOri();
 
-	LOGI("Sending query log to a driver management...");
+	const uint64_t deadline = GetDeadline(gs_tripTtl);
+	std::shared_ptr<MatchedItem> matched = std::make_shared<MatchedItem>(std::move(item->m_quote), item->m_driId, deadline);
 
-	EnclaveConnectionOwner cnt = EnclaveConnectionOwner::CntBuilder(SGX_SUCCESS, &ocall_ride_share_cnt_mgr_get_dri_mgm);
+	AddMatchedItem(item->m_tripId, matched);
+	ScheduleExpiry(deadline, item->m_tripId, true);
 
-	ComMsg::DriQueryLog log(userId, loc);
+	PRINT_I("Match for the trip with ID %s is found.", item->m_tripId.ToString().c_str());
 
-	std::shared_ptr<TlsConfigWithName> tlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_driverMgm, nullptr);
-	Decent::Net::TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
+	NotifyQuoteRemoved(ori, item->m_tripId);
 
-	tls.SendStruct(cnt, k_logQuery);
-	tls.SendContainer(cnt, log.ToString());
+	ComMsg::PasMatchedResult pasMatchedRes(item->m_tripId.ToString(), std::move(*item->m_driContact));
 
-	return true;
+	ReleaseParkedPassenger(*item, pasMatchedRes);
 }
 
-static void DriverFindMatchReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+/**
+ * \brief	Removes a pending quote that no driver has taken before its deadline, and releases the
+ * 			waiting passenger with an empty result (i.e., without trip ID).
+ *
+ * \return	True if the quote is reclaimed, false if it's gone, taken, or re-added with a new deadline.
+ */
+static bool ExpirePendingQuote(const TripId& tripId, const uint64_t deadline)
 {
-	LOGI("Process driver find match request...");
-
-	EnclaveCntTranslator cnt(connection);
+	ConfirmedQuoteItem* itemPtr = nullptr;
+	{
+		//Claim the item the same way as a driver does, so only one of them can get it.
+		ConfirmedQuoteIdShard& idShard = GetQuoteIdShard(tripId);
+		SharedLock<SharedMutex> idLock(idShard.m_mutex);
 
-	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
+		ConfirmedQuoteItem* const* idMapIt = idShard.m_idMap.Find(tripId);
+		if (idMapIt == nullptr)
+		{
+			return false;
+		}
+
+		ConfirmedQuoteItem* item = *idMapIt;
+		std::unique_lock<std::mutex> itemLock(item->m_mutex);
+		if (item->m_driContact || item->m_isExpired || item->m_deadline != deadline)
+		{
+			return false;
+		}
+
+		item->m_isExpired = true;
+		itemPtr = item;
+	}
+
+	std::unique_ptr<ConfirmedQuoteItem> item = RemoveConfirmedQuote(itemPtr);
+	{
+		//Release the trip ID before the item is destroyed, since drivers may still reach the item through it.
+		ConfirmedQuoteIdShard& idShard = GetQuoteIdShard(tripId);
+		std::unique_lock<SharedMutex> idLock(idShard.m_mutex);
+		idShard.m_idMap.Erase(tripId);
+	}
+
+	PRINT_I("The quote with trip ID %s has expired.", tripId.ToString().c_str());
+
+	NotifyQuoteRemoved(item->m_quote.GetGetQuote().GetOri(), tripId);
+
+	ComMsg::PasMatchedResult timeoutRes("", ComMsg::DriContact("", "", ""));
+	ReleaseParkedPassenger(*item, timeoutRes);
+
+	return true;
+}
+
+/**
+ * \brief	Removes a matched trip that hasn't been ended by both sides before its deadline. The trip
+ * 			is dropped without payment.
+ *
+ * \return	True if the trip is reclaimed, false if it's gone, or re-added with a new deadline.
+ */
+static bool ExpireMatchedTrip(const TripId& tripId, const uint64_t deadline)
+{
+	std::unique_lock<std::mutex> mapLock(gs_matchedMapMutex);
+	const std::shared_ptr<MatchedItem>* item = gsk_matchedMap.Find(tripId);
+	if (item == nullptr || (*item)->m_deadline != deadline)
+	{
+		return false;
+	}
+
+	gs_matchedMap.Erase(tripId);
+	PRINT_I("The matched trip with ID %s has expired.", tripId.ToString().c_str());
+
+	return true;
+}
+
+/**
+ * \brief	Sends the assignment to the waiting driver, and then hands the connection back to the
+ * 			untrusted side.
+ */
+static void ReleaseWaitingDriver(WaitingDriver& driver, const ComMsg::DriAssignment& assignment)
+{
+	try
+	{
+		EnclaveCntTranslator driCnt(driver.m_cnt);
+		driver.m_tls->SendContainer(driCnt, assignment.ToString(driver.m_format));
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to send the assignment to the driver. Caught exception: %s", e.what());
+	}
+
+	driver.m_tls.reset();
+	FreeHeldConnection(driver.m_cnt);
+}
+
+static size_t ExpireWaitingDrivers(const uint64_t currTime)
+{
+	std::vector<std::unique_ptr<WaitingDriver> > expired;
+	{
+		std::unique_lock<std::mutex> driversLock(gs_waitingDriversMutex);
+		auto it = std::partition(gs_waitingDrivers.begin(), gs_waitingDrivers.end(), [currTime](const std::unique_ptr<WaitingDriver>& driver)
+		{
+			return driver->m_deadline > currTime;
+		});
+		std::move(it, gs_waitingDrivers.end(), std::back_inserter(expired));
+		gs_waitingDrivers.erase(it, gs_waitingDrivers.end());
+	}
+
+	const ComMsg::DriAssignment timeoutRes("", ComMsg::PasContact("", ""));
+	for (std::unique_ptr<WaitingDriver>& driver : expired)
+	{
+		ReleaseWaitingDriver(*driver, timeoutRes);
+	}
+
+	return expired.size();
+}
+
+static size_t ExpireItems(const uint64_t currTime)
+{
+	//Take the due entries out first, so the queue isn't locked while the passengers are released.
+	std::vector<ExpiryEntry> dueEntries;
+	{
+		std::unique_lock<std::mutex> queueLock(gs_expiryQueueMutex);
+		while (gs_expiryQueue.size() > 0 && gs_expiryQueue.top().m_deadline <= currTime)
+		{
+			dueEntries.push_back(gs_expiryQueue.top());
+			gs_expiryQueue.pop();
+		}
+	}
+
+	size_t numReclaimed = 0;
+	for (const ExpiryEntry& entry : dueEntries)
+	{
+		const bool isReclaimed = entry.m_isMatched ?
+			ExpireMatchedTrip(entry.m_tripId, entry.m_deadline) :
+			ExpirePendingQuote(entry.m_tripId, entry.m_deadline);
+		numReclaimed += isReclaimed ? 1 : 0;
+	}
+
+	numReclaimed += ExpireSubscriptions(currTime);
+	numReclaimed += ExpireWaitingDrivers(currTime);
+
+	return numReclaimed;
+}
+
+/**
+ * \brief	Process the passenger confirm quote request. The quote is added to the pending list, and
+ * 			the connection (along with the TLS session) is parked until a driver takes the trip.
+ *
+ * \return	True if the connection is parked and should be held by the untrusted side, otherwise, false.
+ */
+static bool ProcessPasConfirmQuoteReq(void* const connection, std::unique_ptr<TlsCommLayer>& tls)
+{
+	LOGI("Processing passenger confirm request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	const ClientId pasId = GetClientIdFromTls(*tls);
+
+	//All three layers are parsed in place, so the views below refer into this buffer.
+	std::string msgBuf = tls->RecvContainer<std::string>(cnt);
+	const ComMsg::WireFormat format = ComMsg::DetectWireFormat(msgBuf);
+
+	const ComMsg::ConfirmQuoteView confirmQuote = ComMsg::ParseInSitu<ComMsg::ConfirmQuoteView>(msgBuf, msgBuf);
+
+	//In-situ JSON parsing below modifies the signed quote in the buffer, so hash it first.
+	const TripId tripId = ConstructTripId(confirmQuote.GetSignQuote());
+
+	const ComMsg::SignedQuoteView signedQuote = ComMsg::ParseInSitu<ComMsg::SignedQuoteView>(msgBuf, confirmQuote.GetSignQuote());
+	signedQuote.Verify(gs_state, AppNames::sk_tripPlanner);
+	ComMsg::Quote quote = ComMsg::ParseInSitu<ComMsg::Quote>(msgBuf, signedQuote.GetQuote());
+
+	if (quote.GetPasId() != pasId)
+	{
+		return false;
+	}
+
+	//verify pas contact.
+	if (!VerifyContactHash(tls->GetPeerCertPem(), confirmQuote.GetContact().CalcHash()))
+	{
+		LOGW("Passenger's contact doesn't match!");
+		return false;
+	}
+
+	PRINT_I("Got quote with trip ID: %s.", tripId.ToString().c_str());
+	std::unique_ptr<ConfirmedQuoteItem> item = make_unique<ConfirmedQuoteItem>(confirmQuote.GetContact(), std::move(quote), tripId);
+
+	//The item must own the connection before it's visible to drivers.
+	item->m_pasCnt = connection;
+	item->m_pasTls = std::move(tls);
+	item->m_pasFormat = format;
+
+	const uint64_t deadline = GetDeadline(gs_quoteTtl);
+	item->m_deadline = deadline;
+
+	//The item can be taken as soon as it's added, so take what the subscribers need beforehand.
+	const ComMsg::Point2D<double> ori = item->m_quote.GetGetQuote().GetOri();
+	ComMsg::MatchUpdate update(std::vector<ComMsg::MatchItem>(1, ComMsg::MatchItem(tripId.ToString(), item->m_quote.GetPath())), std::vector<std::string>());
+
+	if (!AddConfirmedQuote(item))
+	{
+		tls = std::move(item->m_pasTls);
+		return false;
+	}
+
+	ScheduleExpiry(deadline, tripId, false);
+	NotifySubscribers(ori, update);
+
+	PRINT_I("Waiting for a match for the trip with ID %s...", tripId.ToString().c_str());
+	return true;
+}
+
+/**
+ * \brief	Looks up the matched trip by the ID received from a client.
+ *
+ * \param 		  	tripIdStr	The trip ID in base64.
+ * \param [out]	tripId   	(Optional) The decoded trip ID.
+ *
+ * \return	The matched trip, or nullptr if the ID is invalid or not found.
+ */
+static std::shared_ptr<MatchedItem> FindMatchedItem(const std::string& tripIdStr, TripId* tripId = nullptr)
+{
+	TripId id;
+	if (!TripId::FromString(tripIdStr, id))
+	{
+		return nullptr;
+	}
+
+	if (tripId)
+	{
+		*tripId = id;
+	}
+
+	std::unique_lock<std::mutex> mapLock(gs_matchedMapMutex);
+	const std::shared_ptr<MatchedItem>* item = gsk_matchedMap.Find(id);
+	return item ? *item : nullptr;
+}
+
+static void TripStart(void* const connection, Decent::Net::TlsCommLayer& tls, const bool isPassenger)
+{
+	LOGI("Processing trip start from %s...", isPassenger ? "passenger" : "driver");
+
+	EnclaveCntTranslator cnt(connection);
+
+	const std::string tripIdStr = tls.RecvContainer<std::string>(cnt);
+
+	std::shared_ptr<MatchedItem> item = FindMatchedItem(tripIdStr);
+	LOGI("The trip is %s. The ID is %s.", item ? "found" : "not found", tripIdStr.c_str());
+
+	if (!item ||
+		GetClientIdFromTls(tls) != (isPassenger ? item->m_quote.GetPasId() : item->m_driId))
+	{
+		LOGI("Requester is not the %s of this trip!", isPassenger ? "passenger" : "driver");
+		return;
+	}
+
+	if (!isPassenger)
+	{
+		std::unique_lock<std::mutex> itemLock(item->m_mutex);
+		item->m_isStartByDri = true;
+	}
+}
+
+/**
+ * \brief	Adds a part of the trace streamed by the driver to the odometer of the trip. It's only
+ * 			taken between the start and the end of the trip by the driver.
+ *
+ * \return	False if the trace is too large, so the session should be ended.
+ */
+static bool DriverTripTraceReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Processing trip trace from driver...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
+	std::unique_ptr<ComMsg::TripTrace> trace = ParseMsg<ComMsg::TripTrace>(msgBuf);
+
+	if (trace->GetDeltas().size() >= gsk_maxTraceSize)
+	{
+		LOGW("Trip trace is too large (%llu deltas).", static_cast<unsigned long long>(trace->GetDeltas().size()));
+		return false;
+	}
+
+	std::shared_ptr<MatchedItem> item = FindMatchedItem(trace->GetTripId());
+	if (!item ||
+		GetClientIdFromTls(tls) != item->m_driId)
+	{
+		LOGI("Requester is not the driver of this trip!");
+		return true;
+	}
+
+	std::unique_lock<std::mutex> itemLock(item->m_mutex);
+	if (!item->m_isStartByDri || item->m_isEndByDri)
+	{
+		LOGI("The trip is not in progress.");
+		return true;
+	}
+
+	item->m_odometer.Add(*trace);
+
+	return true;
+}
+
+static double CalPointDist(const ComMsg::Point2D<double>& a, const ComMsg::Point2D<double>& b)
+{
+	const double dx = a.GetX() - b.GetX();
+	const double dy = a.GetY() - b.GetY();
+	return std::sqrt(dx * dx + dy * dy);
+}
+
+/**
+ * \brief	Gets the fare of a finished trip, metered from its trace. Without a trace (or a quoted
+ * 			distance to compare with), or if the trace doesn't start and end where the quoted path
+ * 			does, the quoted price is charged.
+ */
+static double GetMeteredFare(const MatchedItem& item)
+{
+	const double quotedPrice = item.m_quote.GetPrice().GetPrice();
+	const std::vector<ComMsg::Point2D<double> >& quotedPath = item.m_quote.GetPath().GetPath();
+	const double quotedDistance = TripOdometer::CalPathLength(quotedPath);
+
+	if (item.m_odometer.GetNumPoints() < 2 || !(quotedDistance > 0.0))
+	{
+		return quotedPrice;
+	}
+
+	if (CalPointDist(item.m_odometer.GetFirstPoint(), quotedPath.front()) > gsk_maxTraceEndpointDist ||
+		CalPointDist(item.m_odometer.GetLastPoint(), quotedPath.back()) > gsk_maxTraceEndpointDist)
+	{
+		LOGW("The trip trace doesn't match the ends of the quoted path. The quoted price is charged.");
+		return quotedPrice;
+	}
+
+	const double ratio = std::max(gsk_minMeteredFareRatio,
+		std::min(item.m_odometer.GetDistance() / quotedDistance, gsk_maxMeteredFareRatio));
+
+	LOGI("Metered distance: %f, quoted: %f.", item.m_odometer.GetDistance(), quotedDistance);
+
+	return quotedPrice * ratio;
+}
+
+/**
+ * \brief	Queues the final bill of a finished trip.
+ *
+ * \return	False if the payment queue is full, in which case nothing is queued and the item is
+ * 			left untouched.
+ */
+static bool QueuePayment(const std::shared_ptr<MatchedItem>& item, const TripId& tripId)
+{
+	const double fare = GetMeteredFare(*item);
+
+	std::unique_lock<std::mutex> billsLock(gs_pendingBillsMutex);
+	if (gs_pendingBills.size() + gs_rejectedBills.size() >= gsk_maxPendingBills)
+	{
+		return false;
+	}
+
+	gs_pendingBills.push_back(PendingBill(ComMsg::FinalBill(tripId.ToString(), std::move(item->m_quote), std::string(OperatorPayment::GetPaymentInfo()), item->m_driId, fare)));
+	LOGI("Final bill is queued. %llu bills are pending.", static_cast<unsigned long long>(gs_pendingBills.size()));
+
+	return true;
+}
+
+/**
+ * \brief	Puts the bills of a failed batch back to the front of the queue, in order.
+ */
+static void RequeueBills(std::vector<PendingBill>& batch)
+{
+	std::unique_lock<std::mutex> billsLock(gs_pendingBillsMutex);
+	for (auto it = batch.rbegin(); it != batch.rend(); ++it)
+	{
+		gs_pendingBills.push_front(std::move(*it));
+	}
+}
+
+/**
+ * \brief	Moves the bills rejected by the Payment Services aside, to be sent again after their backoff.
+ */
+static void DeferRejectedBills(std::vector<PendingBill>& batch, const std::vector<uint8_t>& statuses, const uint64_t currTime)
+{
+	std::unique_lock<std::mutex> billsLock(gs_pendingBillsMutex);
+	for (size_t i = 0; i < batch.size(); ++i)
+	{
+		if (statuses[i] == static_cast<uint8_t>(ComMsg::BillStatus::Settled))
+		{
+			continue;
+		}
+
+		PendingBill& pending = batch[i];
+		pending.m_retryDelay = pending.m_retryDelay == 0 ? gsk_rejectedBillRetryDelay : std::min(pending.m_retryDelay * 2, gsk_maxRejectedBillRetryDelay);
+
+		gs_rejectedBills.emplace(currTime + pending.m_retryDelay, std::move(pending));
+	}
+}
+
+/**
+ * \brief	Sends the pending bills to the Payment Services, in batches, until the queue is empty
+ * 			or a batch fails. A batch only leaves the queue once the Payment Services reply the
+ * 			status of each bill; since they settle a trip at most once, a batch whose reply is lost
+ * 			is simply sent again. Rejected bills are sent again after their own backoff. After a
+ * 			failure, the dispatch is skipped until the backoff is over.
+ *
+ * \return	The number of bills sent.
+ */
+static size_t DispatchPayments(const uint64_t currTime)
+{
+	using namespace EncFunc::Payment;
+
+	std::unique_lock<std::mutex> dispatchLock(gs_paymentDispatchMutex);
+	if (currTime < gs_paymentRetryTime)
+	{
+		return 0;
+	}
+
+	{
+		std::unique_lock<std::mutex> billsLock(gs_pendingBillsMutex);
+		auto it = gs_rejectedBills.begin();
+		for (; it != gs_rejectedBills.end() && it->first <= currTime; ++it)
+		{
+			gs_pendingBills.push_back(std::move(it->second));
+		}
+		gs_rejectedBills.erase(gs_rejectedBills.begin(), it);
+	}
+
+	size_t numSent = 0;
+	std::vector<PendingBill> batch;
+	batch.reserve(gsk_paymentBatchSize);
+	while (true)
+	{
+		batch.clear();
+		{
+			std::unique_lock<std::mutex> billsLock(gs_pendingBillsMutex);
+			while (batch.size() < gsk_paymentBatchSize && gs_pendingBills.size() > 0)
+			{
+				batch.push_back(std::move(gs_pendingBills.front()));
+				gs_pendingBills.pop_front();
+			}
+		}
+
+		if (batch.size() == 0)
+		{
+			return numSent;
+		}
+
+		std::vector<ComMsg::FinalBill> bills;
+		bills.reserve(batch.size());
+		for (const PendingBill& pending : batch)
+		{
+			bills.push_back(pending.m_bill);
+		}
+		const std::string batchStr = ComMsg::FinalBillBatch(std::move(bills)).ToString();
+
+		std::vector<uint8_t> statuses;
+		try
+		{
+			//Safe to retry, since the Payment Services settle each trip at most once.
+			gs_paymentPool.UseWithRetry([&batchStr, &statuses, &batch](ConnectionBase& cnt, TlsCommLayer& tls)
+			{
+				tls.SendStruct(cnt, k_procPaymentBatch);
+				tls.SendContainer(cnt, batchStr);
+				statuses = tls.RecvContainer<std::vector<uint8_t> >(cnt);
+				if (statuses.size() != batch.size())
+				{
+					throw RuntimeException("The number of bill statuses replied doesn't match the batch size.");
+				}
+			});
+		}
+		catch (const std::exception& e)
+		{
+			RequeueBills(batch);
+
+			gs_paymentRetryDelay = gs_paymentRetryDelay == 0 ? gsk_paymentRetryDelay : std::min(gs_paymentRetryDelay * 2, gsk_maxPaymentRetryDelay);
+			gs_paymentRetryTime = currTime + gs_paymentRetryDelay;
+
+			PRINT_W("Failed to send final bills to the Payment Services (%s). Retrying in %llu s.",
+				e.what(), static_cast<unsigned long long>(gs_paymentRetryDelay));
+			return numSent;
+		}
+
+		const size_t numRejected = batch.size() -
+			std::count(statuses.begin(), statuses.end(), static_cast<uint8_t>(ComMsg::BillStatus::Settled));
+		if (numRejected > 0)
+		{
+			DeferRejectedBills(batch, statuses, currTime);
+
+			PRINT_W("%llu of %llu final bills are rejected by the Payment Services, and will be sent again later.",
+				static_cast<unsigned long long>(numRejected), static_cast<unsigned long long>(batch.size()));
+		}
+
+		numSent += batch.size();
+		gs_paymentRetryDelay = 0;
+	}
+}
+
+static void TripEnd(void* const connection, Decent::Net::TlsCommLayer& tls, const bool isPassenger)
+{
+	LOGI("Processing trip end from %s...", isPassenger ? "passenger" : "driver");
+
+	EnclaveCntTranslator cnt(connection);
+
+	const std::string tripIdStr = tls.RecvContainer<std::string>(cnt);
+
+	TripId tripId;
+	std::shared_ptr<MatchedItem> item = FindMatchedItem(tripIdStr, &tripId);
+
+	LOGI("The trip is %s. The ID is %s.", item ? "found" : "not found", tripIdStr.c_str());
+
+	if (!item ||
+		GetClientIdFromTls(tls) != (isPassenger ? item->m_quote.GetPasId() : item->m_driId))
+	{
+		LOGI("Requester is not the %s of this trip!", isPassenger ? "passenger" : "driver");
+		return;
+	}
+
+	std::unique_lock<std::mutex> itemLock(item->m_mutex);
+
+	if (item->m_isEndByPas && item->m_isEndByDri) //Trip is already finished by other process.
+	{
+		return;
+	}
+
+	switch (isPassenger)
+	{
+	case false: //zero
+		item->m_isEndByDri = true;
+		break;
+	default: //true, non-zero
+		item->m_isEndByPas = true;
+		break;
+	}
+
+	if (item->m_isEndByPas && item->m_isEndByDri) //Trip is finished.
+	{
+		if (!QueuePayment(item, tripId)) //Caution: m_quote in item becomes invalid after this call!
+		{
+			//Keep the trip, so its bill isn't lost; the end can be sent again once the queue drains.
+			(isPassenger ? item->m_isEndByPas : item->m_isEndByDri) = false;
+			PRINT_W("The payment queue is full. The trip end is refused.");
+			return;
+		}
+
+		std::unique_lock<std::mutex> mapLock(gs_matchedMapMutex);
+		gs_matchedMap.Erase(tripId);
+	}
+}
+
+static double GetMatchRadius(const ComMsg::DriverLoc& driLoc)
+{
+	const double radius = driLoc.GetRadius();
+	if (!(radius > 0.0)) //Also catches NaN.
+	{
+		return gsk_distanceLimit;
+	}
+	return radius < gsk_maxDistanceLimit ? radius : gsk_maxDistanceLimit;
+}
+
+static size_t GetMatchMaxNum(const ComMsg::DriverLoc& driLoc)
+{
+	const int maxNum = driLoc.GetMaxNum();
+	if (maxNum <= 0)
+	{
+		return gsk_maxBestMatchSize;
+	}
+	return static_cast<size_t>(maxNum) < gsk_maxBestMatchSizeLimit ? static_cast<size_t>(maxNum) : gsk_maxBestMatchSizeLimit;
+}
+
+typedef std::vector<std::unique_ptr<SharedLock<SharedMutex> > > QuoteShardLocksType;
+
+static QuoteShardLocksType LockQuoteShardsShared(const std::vector<size_t>& shardIdxs)
+{
+	QuoteShardLocksType shardLocks;
+	shardLocks.reserve(shardIdxs.size());
+	for (size_t idx : shardIdxs)
+	{
+		shardLocks.push_back(Tools::make_unique<SharedLock<SharedMutex> >(gs_confirmedQuoteShards[idx].m_mutex));
+	}
+	return shardLocks;
+}
+
+/**
+ * \brief	Finds the k nearest pending quotes in the given shards, sorted by distance. The caller must
+ * 			hold the shared locks of these shards, for as long as the results are in use.
+ */
+static void FindNearestLocked(const std::vector<size_t>& shardIdxs, const ComMsg::Point2D<double>& driLoc, const double radius, const size_t maxNum,
+	std::vector<ConfirmedQuoteGridType::ResultType>& nearest)
+{
+	//Take the k nearest ones from each shard, and then the k nearest ones among them.
+	nearest.clear();
+	std::vector<ConfirmedQuoteGridType::ResultType> shardNearest;
+	for (size_t idx : shardIdxs)
+	{
+		gs_confirmedQuoteShards[idx].m_grid.FindNearest(driLoc.GetX(), driLoc.GetY(), radius, maxNum, shardNearest);
+		nearest.insert(nearest.end(), shardNearest.begin(), shardNearest.end());
+	}
+	std::sort(nearest.begin(), nearest.end(), [](const ConfirmedQuoteGridType::ResultType& a, const ConfirmedQuoteGridType::ResultType& b)
+	{
+		return a.second < b.second;
+	});
+	if (nearest.size() > maxNum)
+	{
+		nearest.resize(maxNum);
+	}
+}
+
+static std::vector<ComMsg::MatchItem> FindMatch(const ComMsg::Point2D<double>& driLoc, const double radius, const size_t maxNum)
+{
+	const std::vector<size_t> shardIdxs = GetQuoteShardIndices(driLoc.GetX(), driLoc.GetY(), radius);
+
+	QuoteShardLocksType shardLocks = LockQuoteShardsShared(shardIdxs);
+
+	std::vector<ConfirmedQuoteGridType::ResultType> nearest;
+	FindNearestLocked(shardIdxs, driLoc, radius, maxNum, nearest);
+
+	LOGI("List of matches:");
+	std::vector<ComMsg::MatchItem> res;
+	res.reserve(nearest.size());
+	for (const ConfirmedQuoteGridType::ResultType& item : nearest)
+	{
+		LOGI("\tDist: %f", item.second);
+		res.push_back(ComMsg::MatchItem(item.first->m_tripId.ToString(), item.first->m_quote.GetPath()));
+	}
+
+	return std::move(res);
+}
+
+/**
+ * \brief	Finds matches for a batch of driver locations in one pass, under one set of shard locks.
+ * 			Each driver gets its k nearest quotes, but a trip that is near several drivers in the
+ * 			batch is only offered to the nearest one of them; thus, some drivers may get fewer
+ * 			than k matches.
+ */
+static std::vector<ComMsg::BestMatches> FindMatchBatch(const std::vector<ComMsg::DriverLoc>& driLocs)
+{
+	struct Candidate
+	{
+		size_t m_locIdx;
+		const ConfirmedQuoteItem* m_item;
+		double m_dist;
+	};
+
+	std::vector<double> radii;
+	std::vector<size_t> maxNums;
+	std::vector<std::vector<size_t> > shardIdxsList;
+	radii.reserve(driLocs.size());
+	maxNums.reserve(driLocs.size());
+	shardIdxsList.reserve(driLocs.size());
+
+	std::array<bool, gsk_numQuoteShards> isCovered;
+	isCovered.fill(false);
+	for (const ComMsg::DriverLoc& driLoc : driLocs)
+	{
+		radii.push_back(GetMatchRadius(driLoc));
+		maxNums.push_back(GetMatchMaxNum(driLoc));
+		shardIdxsList.push_back(GetQuoteShardIndices(driLoc.GetLoc().GetX(), driLoc.GetLoc().GetY(), radii.back()));
+		for (size_t idx : shardIdxsList.back())
+		{
+			isCovered[idx] = true;
+		}
+	}
+
+	std::vector<size_t> allShardIdxs;
+	for (size_t i = 0; i < gsk_numQuoteShards; ++i)
+	{
+		if (isCovered[i])
+		{
+			allShardIdxs.push_back(i);
+		}
+	}
+
+	QuoteShardLocksType shardLocks = LockQuoteShardsShared(allShardIdxs);
+
+	std::vector<Candidate> candidates;
+	std::vector<ConfirmedQuoteGridType::ResultType> nearest;
+	for (size_t i = 0; i < driLocs.size(); ++i)
+	{
+		FindNearestLocked(shardIdxsList[i], driLocs[i].GetLoc(), radii[i], maxNums[i], nearest);
+		for (const ConfirmedQuoteGridType::ResultType& item : nearest)
+		{
+			candidates.push_back(Candidate{ i, item.first, item.second });
+		}
+	}
+
+	//Hand out the trips from the shortest distance up, so each trip goes to its nearest driver.
+	std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b)
+	{
+		return a.m_dist < b.m_dist;
+	});
+
+	std::vector<std::vector<ComMsg::MatchItem> > matches(driLocs.size());
+	std::unordered_set<const ConfirmedQuoteItem*> offered;
+	for (const Candidate& candidate : candidates)
+	{
+		if (matches[candidate.m_locIdx].size() < maxNums[candidate.m_locIdx] &&
+			offered.insert(candidate.m_item).second)
+		{
+			matches[candidate.m_locIdx].push_back(ComMsg::MatchItem(candidate.m_item->m_tripId.ToString(), candidate.m_item->m_quote.GetPath()));
+		}
+	}
+
+	LOGI("Found %llu matches for %llu driver locations.",
+		static_cast<unsigned long long>(offered.size()), static_cast<unsigned long long>(driLocs.size()));
+
+	std::vector<ComMsg::BestMatches> res;
+	res.reserve(matches.size());
+	for (std::vector<ComMsg::MatchItem>& driMatches : matches)
+	{
+		res.push_back(ComMsg::BestMatches(std::move(driMatches)));
+	}
+
+	return std::move(res);
+}
+
+static bool SendQueryLog(const ClientId& userId, const ComMsg::Point2D<double>& loc)
+{
+	using namespace EncFunc::DriverMgm;
+
+	LOGI("Sending query log to a driver management...");
+
+	ComMsg::DriQueryLog log(userId, loc);
+	const std::string logStr = log.ToString();
+
+	gs_driMgmPool.Use([&logStr](ConnectionBase& cnt, TlsCommLayer& tls)
+	{
+		tls.SendStruct(cnt, k_logQuery);
+		tls.SendContainer(cnt, logStr);
+	});
+
+	return true;
+}
+
+static bool DriverFindMatchReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Process driver find match request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
 	std::unique_ptr<ComMsg::DriverLoc> driLoc = ParseMsg<ComMsg::DriverLoc>(msgBuf);
 
-	const std::string driId = tls.GetPublicKeyPem();
-	if (driId.size() == 0 ||
-		!SendQueryLog(driId, driLoc->GetLoc()))
+	const ClientId driId = GetClientIdFromTls(tls);
+	if (!SendQueryLog(driId, driLoc->GetLoc()))
 	{
-		return;
+		return false;
 	}
 	
-	std::vector<std::pair<ConfirmedQuoteItem*, double> > midRes = FindMatchInitial(driLoc->GetLoc());
-	const std::vector<ConfirmedQuoteItem*> matchesList = FindMatchSort(midRes);
+	const ComMsg::BestMatches bestMatches = FindMatch(driLoc->GetLoc(), GetMatchRadius(*driLoc), GetMatchMaxNum(*driLoc));
 
-	const ComMsg::BestMatches bestMatches = FindMatchFinal(matchesList);
+	tls.SendContainer(cnt, bestMatches.ToString(ComMsg::DetectWireFormat(msgBuf)));
 
-	tls.SendContainer(cnt, bestMatches.ToString());
+	return true;
 }
 
-static void DriverConfirmMatchReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+/**
+ * \brief	Sends the query logs of a batch of driver locations. The drivers behind a gateway are not
+ * 			identified one by one, so the batch is sent as one log, tagged with the gateway's ID.
+ */
+static bool SendQueryLogBatch(const ClientId& gatewayId, const std::vector<ComMsg::DriverLoc>& driLocs)
 {
-	LOGI("Process driver confirm match request...");
+	using namespace EncFunc::DriverMgm;
 
-	EnclaveCntTranslator cnt(connection);
+	LOGI("Sending a batch of query logs to a driver management...");
+
+	std::vector<ComMsg::Point2D<double> > locs;
+	locs.reserve(driLocs.size());
+	for (const ComMsg::DriverLoc& driLoc : driLocs)
+	{
+		locs.push_back(driLoc.GetLoc());
+	}
+
+	const std::string logStr = ComMsg::DriQueryLogBatch(gatewayId, std::move(locs)).ToString();
+
+	gs_driMgmPool.Use([&logStr](ConnectionBase& cnt, TlsCommLayer& tls)
+	{
+		tls.SendStruct(cnt, k_logQueryBatch);
+		tls.SendContainer(cnt, logStr);
+	});
+
+	return true;
+}
 
-	const std::string driId = GetClientIdFromTls(tls);
+/**
+ * \brief	Process a batch of driver locations, e.g., from a fleet gateway, in one request. The reply
+ * 			has the best matches for each location, in the same order.
+ */
+static bool DriverFindMatchBatchReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Process driver find match batch request...");
+
+	EnclaveCntTranslator cnt(connection);
 
 	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
-	std::unique_ptr<ComMsg::DriSelection> selection = ParseMsg<ComMsg::DriSelection>(msgBuf);
+	std::unique_ptr<ComMsg::DriverLocBatch> driLocBatch = ParseMsg<ComMsg::DriverLocBatch>(msgBuf);
 
-	//verify pas contact.
-	if (!VerifyContactHash(tls.GetPeerCertPem(), selection->GetContact().CalcHash()))
+	if (driLocBatch->GetLocs().size() > gsk_maxFindMatchBatchSize)
+	{
+		LOGW("The batch of driver locations is too large!");
+		return false;
+	}
+
+	const ClientId gatewayId = GetClientIdFromTls(tls);
+	if (!SendQueryLogBatch(gatewayId, driLocBatch->GetLocs()))
+	{
+		return false;
+	}
+
+	const ComMsg::BestMatchesBatch bestMatchesBatch(FindMatchBatch(driLocBatch->GetLocs()));
+
+	tls.SendContainer(cnt, bestMatchesBatch.ToString(ComMsg::DetectWireFormat(msgBuf)));
+
+	return true;
+}
+
+/**
+ * \brief	Subscribes the driver to the matches around a location. The driver gets the current best
+ * 			matches first, and then an update whenever a quote within the radius is added, taken, or
+ * 			expired. The connection is parked until the subscription is closed; the driver
+ * 			unsubscribes by closing the connection, which is noticed on the next failed push, or
+ * 			when the subscription expires.
+ *
+ * \return	True if the connection is parked and should be held by the untrusted side, otherwise, false.
+ */
+static bool DriverSubscribeReq(void* const connection, std::unique_ptr<TlsCommLayer>& tls)
+{
+	LOGI("Process driver subscribe request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	std::string msgBuf = tls->RecvContainer<std::string>(cnt);
+	const ComMsg::WireFormat format = ComMsg::DetectWireFormat(msgBuf);
+	std::unique_ptr<ComMsg::DriverLoc> driLoc = ParseMsg<ComMsg::DriverLoc>(msgBuf);
+
+	//The query is only logged once for the whole subscription.
+	const ClientId driId = GetClientIdFromTls(*tls);
+	if (!SendQueryLog(driId, driLoc->GetLoc()))
+	{
+		return false;
+	}
+
+	const double radius = GetMatchRadius(*driLoc);
+	std::shared_ptr<Subscription> sub = std::make_shared<Subscription>(driLoc->GetLoc(), radius, connection, format, gs_currTime.load() + gsk_subscriptionTtl);
+	sub->m_tls = std::move(tls);
+
+	//Hold the push lock until the snapshot is sent, so the updates made after the subscription
+	//  is visible are queued behind it. An update may repeat a trip in the snapshot, though.
+	std::unique_lock<std::mutex> pushLock(sub->m_mutex);
+	if (!AddSubscription(sub))
+	{
+		LOGW("Too many subscriptions!");
+		tls = std::move(sub->m_tls);
+		return false;
+	}
+
+	bool isSent = false;
+	try
+	{
+		const ComMsg::MatchUpdate snapshot(FindMatch(driLoc->GetLoc(), radius, GetMatchMaxNum(*driLoc)), std::vector<std::string>());
+		sub->m_tls->SendContainer(cnt, snapshot.ToString(format));
+		isSent = true;
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to send the current matches to the driver. Caught exception: %s", e.what());
+	}
+
+	if (!isSent)
+	{
+		sub->m_isClosed = true;
+		tls = std::move(sub->m_tls);
+		pushLock.unlock();
+		RemoveSubscription(sub.get());
+		return false;
+	}
+
+	PRINT_I("A driver has subscribed to the matches around (%f, %f).", sub->m_loc.GetX(), sub->m_loc.GetY());
+	return true;
+}
+
+/**
+ * \brief	Puts the driver into the pool for the next batch assignment. The connection is parked
+ * 			until a trip is assigned, or the wait expires (with the same TTL as the pending quotes).
+ *
+ * \return	True if the connection is parked and should be held by the untrusted side, otherwise, false.
+ */
+static bool DriverWaitAssignReq(void* const connection, std::unique_ptr<TlsCommLayer>& tls)
+{
+	LOGI("Process driver wait assignment request...");
+
+	if (!gs_isBatchAssignEnabled)
+	{
+		LOGW("Batch assignment is disabled!");
+		return false;
+	}
+
+	EnclaveCntTranslator cnt(connection);
+
+	const ClientId driId = GetClientIdFromTls(*tls);
+
+	std::string msgBuf = tls->RecvContainer<std::string>(cnt);
+	const ComMsg::WireFormat format = ComMsg::DetectWireFormat(msgBuf);
+	std::unique_ptr<ComMsg::DriAvailable> available = ParseMsg<ComMsg::DriAvailable>(msgBuf);
+
+	if (!VerifyContactHash(tls->GetPeerCertPem(), available->GetContact().CalcHash()))
 	{
 		LOGI("Driver's contact doesn't match!");
-		return;
+		return false;
 	}
 
-	std::unique_ptr<ComMsg::PasContact> pasContact;
+	if (!SendQueryLog(driId, available->GetLoc().GetLoc()))
+	{
+		return false;
+	}
+
+	std::unique_ptr<WaitingDriver> driver = Tools::make_unique<WaitingDriver>(available->GetContact(), driId,
+		available->GetLoc().GetLoc(), GetMatchRadius(available->GetLoc()), connection, format, GetDeadline(gs_quoteTtl));
+	driver->m_tls = std::move(tls);
+
+	std::unique_lock<std::mutex> driversLock(gs_waitingDriversMutex);
+	if (gs_waitingDrivers.size() >= gsk_maxWaitingDrivers)
 	{
-		std::unique_lock<std::mutex> mapLock(gs_confirmedQuoteMapMutex);
+		LOGW("Too many drivers waiting for the assignment!");
+		tls = std::move(driver->m_tls);
+		return false;
+	}
+	gs_waitingDrivers.push_back(std::move(driver));
 
-		auto idMapIt = gs_confirmedQuoteIdMap.find(selection->GetTripId());
-		if (idMapIt == gs_confirmedQuoteIdMap.end())
+	return true;
+}
+
+/**
+ * \brief	Runs one batch assignment round over the waiting drivers and the pending quotes. The
+ * 			candidate edges are pruned spatially to each driver's k nearest quotes, and the
+ * 			assignment maximizing the number of matches, and then minimizing the total pickup
+ * 			distance, is solved by the auction algorithm, within a work budget proportional to the
+ * 			number of edges. Drivers not assigned (or whose trip is taken by someone else in the
+ * 			meantime) wait for the next round.
+ *
+ * \return	The number of drivers assigned.
+ */
+//Puts the drivers back to wait for the next assignment round; the ones already taken out are skipped.
+static void RequeueWaitingDrivers(std::vector<std::unique_ptr<WaitingDriver> >& drivers)
+{
+	std::unique_lock<std::mutex> driversLock(gs_waitingDriversMutex);
+	for (std::unique_ptr<WaitingDriver>& driver : drivers)
+	{
+		if (driver)
 		{
-			return;
+			gs_waitingDrivers.push_back(std::move(driver));
+		}
+	}
+}
+
+static size_t AssignBatch()
+{
+	std::vector<std::unique_ptr<WaitingDriver> > drivers;
+	{
+		std::unique_lock<std::mutex> driversLock(gs_waitingDriversMutex);
+		drivers.swap(gs_waitingDrivers);
+	}
+
+	if (drivers.size() == 0)
+	{
+		return 0;
+	}
+
+	size_t numAssigned = 0;
+	std::vector<std::unique_ptr<WaitingDriver> > unassigned;
+	//The driver whose quote is claimed, until it's released with the assignment.
+	std::unique_ptr<WaitingDriver> claimed;
+	try
+	{
+		//Any match is worth more than the longest pickup distance, so the number of matches comes first.
+		constexpr double benefitBase = gsk_maxDistanceLimit + 1.0;
+
+		std::vector<TripId> tripIds;
+		std::vector<std::vector<AuctionAssignment::Edge> > edges(drivers.size());
+		size_t numEdges = 0;
+		{
+			std::vector<std::vector<size_t> > shardIdxsList;
+			shardIdxsList.reserve(drivers.size());
+
+			std::array<bool, gsk_numQuoteShards> isCovered;
+			isCovered.fill(false);
+			for (const std::unique_ptr<WaitingDriver>& driver : drivers)
+			{
+				shardIdxsList.push_back(GetQuoteShardIndices(driver->m_loc.GetX(), driver->m_loc.GetY(), driver->m_radius));
+				for (size_t idx : shardIdxsList.back())
+				{
+					isCovered[idx] = true;
+				}
+			}
+
+			std::vector<size_t> allShardIdxs;
+			for (size_t i = 0; i < gsk_numQuoteShards; ++i)
+			{
+				if (isCovered[i])
+				{
+					allShardIdxs.push_back(i);
+				}
+			}
+
+			QuoteShardLocksType shardLocks = LockQuoteShardsShared(allShardIdxs);
+
+			std::map<const ConfirmedQuoteItem*, size_t> objIdxs;
+			std::vector<ConfirmedQuoteGridType::ResultType> nearest;
+			for (size_t i = 0; i < drivers.size(); ++i)
+			{
+				FindNearestLocked(shardIdxsList[i], drivers[i]->m_loc, drivers[i]->m_radius, gsk_assignCandidateNum, nearest);
+				for (const ConfirmedQuoteGridType::ResultType& item : nearest)
+				{
+					auto objIt = objIdxs.insert(std::make_pair(item.first, tripIds.size())).first;
+					if (objIt->second == tripIds.size())
+					{
+						tripIds.push_back(item.first->m_tripId);
+					}
+					edges[i].push_back(AuctionAssignment::Edge{ objIt->second, benefitBase - item.second });
+				}
+				numEdges += nearest.size();
+			}
 		}
 
-		auto quoteMapIt = gs_confirmedQuoteMap.find(idMapIt->second);
-		if (quoteMapIt == gs_confirmedQuoteMap.end() || 
-			quoteMapIt->second->m_driContact)
+		//The quotes are claimed through their IDs later, so no lock is held while solving.
+		AuctionAssignment auction(tripIds.size(), std::move(edges));
+		const std::vector<size_t> assigned = auction.Solve(gsk_assignEpsilon, gsk_assignBidsPerEdge * numEdges);
+
+		for (size_t i = 0; i < drivers.size(); ++i)
 		{
-			return;
+			ConfirmedQuoteItem* itemPtr = nullptr;
+			std::unique_ptr<ComMsg::PasContact> pasContact;
+			if (assigned[i] != AuctionAssignment::sk_unassigned)
+			{
+				itemPtr = ClaimQuote(tripIds[assigned[i]], drivers[i]->m_contact, drivers[i]->m_driId, pasContact);
+			}
+
+			if (!itemPtr)
+			{
+				unassigned.push_back(std::move(drivers[i]));
+				continue;
+			}
+
+			claimed = std::move(drivers[i]);
+			CompleteMatch(itemPtr);
+			ReleaseWaitingDriver(*claimed, ComMsg::DriAssignment(tripIds[assigned[i]].ToString(), *pasContact));
+			claimed.reset();
+			++numAssigned;
 		}
 
-		std::unique_ptr<ConfirmedQuoteItem>& item = quoteMapIt->second;
-		std::unique_lock<std::mutex> itemLock(item->m_mutex);
+		LOGI("Assigned %llu of %llu waiting drivers to %llu candidate trips, with %llu bids.",
+			static_cast<unsigned long long>(numAssigned), static_cast<unsigned long long>(drivers.size()),
+			static_cast<unsigned long long>(tripIds.size()), static_cast<unsigned long long>(auction.GetNumBids()));
+	}
+	catch (const std::exception&)
+	{
+		//One bad message doesn't drop the whole batch; the drivers not assigned yet wait for the
+		//  next round, and the one whose match failed half-way is released, like an expired one.
+		if (claimed)
+		{
+			ReleaseWaitingDriver(*claimed, ComMsg::DriAssignment("", ComMsg::PasContact("", "")));
+		}
+		RequeueWaitingDrivers(drivers);
+		RequeueWaitingDrivers(unassigned);
+		throw;
+	}
+
+	RequeueWaitingDrivers(unassigned);
+
+	return numAssigned;
+}
+
+static bool DriverConfirmMatchReq(void* const connection, Decent::Net::TlsCommLayer& tls)
+{
+	LOGI("Process driver confirm match request...");
+
+	EnclaveCntTranslator cnt(connection);
+
+	const ClientId driId = GetClientIdFromTls(tls);
 
-		item->m_driContact = Tools::make_unique<ComMsg::DriContact>(std::move(selection->GetContact()));
-		item->m_driId = driId;
+	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
+	const ComMsg::WireFormat format = ComMsg::DetectWireFormat(msgBuf);
+	std::unique_ptr<ComMsg::DriSelection> selection = ParseMsg<ComMsg::DriSelection>(msgBuf);
+
+	//verify pas contact.
+	if (!VerifyContactHash(tls.GetPeerCertPem(), selection->GetContact().CalcHash()))
+	{
+		LOGI("Driver's contact doesn't match!");
+		return false;
+	}
 
-		pasContact = Tools::make_unique<ComMsg::PasContact>(item->m_contact);
+	TripId tripId;
+	if (!TripId::FromString(selection->GetTripId(), tripId))
+	{
+		return false;
+	}
 
-		item->m_cond.notify_one();
+	std::unique_ptr<ComMsg::PasContact> pasContact;
+	ConfirmedQuoteItem* itemPtr = ClaimQuote(tripId, selection->GetContact(), driId, pasContact);
+	if (!itemPtr)
+	{
+		return false;
 	}
 
 	selection.reset();
 
-	tls.SendContainer(cnt, pasContact->ToString());
+	//Only the driver who set the contact above can reach here for this item.
+	CompleteMatch(itemPtr);
+
+	tls.SendContainer(cnt, pasContact->ToString(format));
+
+	return true;
 }
 
 extern "C" int ecall_ride_share_tm_from_pas(void* const connection)
@@ -583,24 +1960,35 @@ extern "C" int ecall_ride_share_tm_from_pas(void* const connection)
 	try
 	{
 		std::shared_ptr<TlsConfigClient> tlsCfg = std::make_shared<TlsConfigClient>(gs_state, TlsConfigClient::Mode::ServerVerifyPeer, AppNames::sk_passengerMgm, nullptr);
-		TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
+		std::unique_ptr<TlsCommLayer> tls = Tools::make_unique<TlsCommLayer>(cnt, tlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the passenger ends it.
 		NumType funcNum;
-		tls.RecvStruct(funcNum);
-
-		switch (funcNum)
+		bool isSessionAlive = true;
+		while (isSessionAlive)
 		{
-		case k_confirmQuote:
-			ProcessPasConfirmQuoteReq(connection, tls);
-			break;
-		case k_tripStart:
-			TripStart(connection, tls, true);
-			break;
-		case k_tripEnd:
-			TripEnd(connection, tls, true);
-			break;
-		default:
-			break;
+			tls->RecvStruct(funcNum);
+			//Not idle while serving the request (see SessionWatchdog in the untrusted side).
+			ocall_ride_share_session_touch(connection);
+
+			switch (funcNum)
+			{
+			case k_confirmQuote:
+				//The connection is parked until a match is found, which also ends the session.
+				return ProcessPasConfirmQuoteReq(connection, tls);
+			case k_tripStart:
+				TripStart(connection, *tls, true);
+				break;
+			case k_tripEnd:
+				TripEnd(connection, *tls, true);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
+
+			ocall_ride_share_session_touch(connection);
 		}
 	}
 	catch (const std::exception& e)
@@ -627,27 +2015,50 @@ extern "C" int ecall_ride_share_tm_from_dri(void* const connection)
 	try
 	{
 		std::shared_ptr<TlsConfigClient> tlsCfg = std::make_shared<TlsConfigClient>(gs_state, TlsConfigClient::Mode::ServerVerifyPeer, AppNames::sk_driverMgm, nullptr);
-		TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
+		std::unique_ptr<TlsCommLayer> tls = Tools::make_unique<TlsCommLayer>(cnt, tlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the driver ends it, or a request fails.
 		NumType funcNum;
-		tls.RecvStruct(funcNum);
-
-		switch (funcNum)
-		{
-		case k_findMatch:
-			DriverFindMatchReq(connection, tls);
-			break;
-		case k_confirmMatch:
-			DriverConfirmMatchReq(connection, tls);
-			break;
-		case k_tripStart:
-			TripStart(connection, tls, false);
-			break;
-		case k_tripEnd:
-			TripEnd(connection, tls, false);
-			break;
-		default:
-			break;
+		bool isSessionAlive = true;
+		while (isSessionAlive)
+		{
+			tls->RecvStruct(funcNum);
+			//Not idle while serving the request (see SessionWatchdog in the untrusted side).
+			ocall_ride_share_session_touch(connection);
+
+			switch (funcNum)
+			{
+			case k_findMatch:
+				isSessionAlive = DriverFindMatchReq(connection, *tls);
+				break;
+			case k_findMatchBatch:
+				isSessionAlive = DriverFindMatchBatchReq(connection, *tls);
+				break;
+			case k_subscribe:
+				//The connection is parked for the pushed updates, which also ends the session.
+				return DriverSubscribeReq(connection, tls);
+			case k_waitAssign:
+				//The connection is parked until a trip is assigned, which also ends the session.
+				return DriverWaitAssignReq(connection, tls);
+			case k_confirmMatch:
+				isSessionAlive = DriverConfirmMatchReq(connection, *tls);
+				break;
+			case k_tripStart:
+				TripStart(connection, *tls, false);
+				break;
+			case k_tripEnd:
+				TripEnd(connection, *tls, false);
+				break;
+			case k_tripTrace:
+				isSessionAlive = DriverTripTraceReq(connection, *tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
+
+			ocall_ride_share_session_touch(connection);
 		}
 	}
 	catch (const std::exception& e)
@@ -657,3 +2068,93 @@ extern "C" int ecall_ride_share_tm_from_dri(void* const connection)
 
 	return false;
 }
+
+extern "C" void ecall_ride_share_tm_set_expiry(uint64_t curr_time, uint64_t quote_ttl, uint64_t trip_ttl)
+{
+	gs_quoteTtl = quote_ttl;
+	gs_tripTtl = trip_ttl;
+
+	AdvanceTime(gs_currTime, curr_time);
+
+	PRINT_I("TTL of pending quotes: %llu s; TTL of matched trips: %llu s.",
+		static_cast<unsigned long long>(quote_ttl), static_cast<unsigned long long>(trip_ttl));
+}
+
+extern "C" uint64_t ecall_ride_share_tm_expire(uint64_t curr_time)
+{
+	try
+	{
+		const size_t numReclaimed = ExpireItems(AdvanceTime(gs_currTime, curr_time));
+
+		gs_driMgmPool.EvictIdle();
+		gs_paymentPool.EvictIdle();
+
+		if (numReclaimed > 0)
+		{
+			LOGI("Reclaimed %llu expired pending quotes, matched trips, and subscriptions.", static_cast<unsigned long long>(numReclaimed));
+		}
+		return numReclaimed;
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to expire items. Caught exception: %s", e.what());
+	}
+
+	return 0;
+}
+
+extern "C" uint64_t ecall_ride_share_tm_push_updates()
+{
+	try
+	{
+		return PushMatchUpdates();
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to push match updates. Caught exception: %s", e.what());
+	}
+
+	return 0;
+}
+
+extern "C" void ecall_ride_share_tm_set_batch_assign(int is_enabled)
+{
+	gs_isBatchAssignEnabled = (is_enabled != 0);
+
+	PRINT_I("Batch assignment is %s.", is_enabled ? "enabled" : "disabled");
+}
+
+extern "C" uint64_t ecall_ride_share_tm_assign_batch(uint64_t curr_time)
+{
+	try
+	{
+		AdvanceTime(gs_currTime, curr_time);
+
+		return AssignBatch();
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to run the batch assignment. Caught exception: %s", e.what());
+	}
+
+	return 0;
+}
+
+extern "C" uint64_t ecall_ride_share_tm_dispatch_payments(uint64_t curr_time)
+{
+	try
+	{
+		const size_t numSent = DispatchPayments(AdvanceTime(gs_currTime, curr_time));
+		if (numSent > 0)
+		{
+			LOGI("Sent %llu final bills to the Payment Services.", static_cast<unsigned long long>(numSent));
+		}
+		return numSent;
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to dispatch payments. Caught exception: %s", e.what());
+	}
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+#include "TripId.h"
+
+#include <vector>
+#include <algorithm>
+
+#include <cppcodec/base64_default_rfc4648.hpp>
+
+using namespace RideShare;
+
+bool TripId::FromString(const std::string& str, TripId& res)
+{
+	//Base64 of a 256-bit hash.
+	constexpr size_t encodedSize = 44;
+	if (str.size() != encodedSize)
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> bin;
+	try
+	{
+		bin = cppcodec::base64_rfc4648::decode(str.data(), str.size());
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+
+	if (bin.size() != res.m_hash.size())
+	{
+		return false;
+	}
+
+	std::copy(bin.begin(), bin.end(), res.m_hash.begin());
+	return true;
+}
+
+std::string TripId::ToString() const
+{
+	return cppcodec::base64_rfc4648::encode(m_hash);
+}
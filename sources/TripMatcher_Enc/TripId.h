@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <DecentApi/Common/GeneralKeyTypes.h>
+
+namespace RideShare
+{
+	/**
+	 * \brief	The ID of a trip, i.e., the SHA-256 hash of the signed quote. It's kept in the binary
+	 * 			form inside the enclave, and only encoded in base64 on the wire.
+	 */
+	class TripId
+	{
+	public:
+		/**
+		 * \brief	Decodes the trip ID from its base64 form.
+		 *
+		 * \return	False if the string isn't a valid trip ID.
+		 */
+		static bool FromString(const std::string& str, TripId& res);
+
+	public:
+		TripId() :
+			m_hash()
+		{
+			m_hash.fill(0);
+		}
+
+		explicit TripId(const Decent::General256Hash& hash) :
+			m_hash(hash)
+		{}
+
+		~TripId() {}
+
+		std::string ToString() const;
+
+		const Decent::General256Hash& Get() const { return m_hash; }
+
+		/**
+		 * \brief	Gets a key for the hash tables. The ID is already a SHA-256 hash, so its first
+		 * 			bytes are used directly.
+		 */
+		uint64_t GetHashKey() const
+		{
+			uint64_t res;
+			std::memcpy(&res, m_hash.data(), sizeof(res));
+			return res;
+		}
+
+		bool operator==(const TripId& rhs) const { return m_hash == rhs.m_hash; }
+		bool operator!=(const TripId& rhs) const { return m_hash != rhs.m_hash; }
+
+	private:
+		Decent::General256Hash m_hash;
+	};
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "TripId.h"
+
+namespace RideShare
+{
+	/**
+	 * \brief	A flat hash table keyed by trip IDs, with open addressing and linear probing. The slots
+	 * 			are kept in one array, and the ID's hash bytes are used as the hash directly; thus, a
+	 * 			lookup usually touches one slot. Removal shifts the following entries back, instead of
+	 * 			leaving tombstones, so lookups don't slow down as trips come and go. The table grows
+	 * 			to keep the load factor at most 1/2, and never shrinks. This class is NOT thread-safe.
+	 *
+	 * \tparam	T	Type of the value. It must be default-constructible and movable.
+	 */
+	template<typename T>
+	class TripIdMap
+	{
+	public:
+		TripIdMap() :
+			TripIdMap(sk_minCapacity)
+		{}
+
+		explicit TripIdMap(const size_t capacity) :
+			m_slots(),
+			m_mask(0),
+			m_size(0)
+		{
+			size_t cap = sk_minCapacity;
+			while (cap < capacity)
+			{
+				cap <<= 1;
+			}
+			m_slots.resize(cap);
+			m_mask = cap - 1;
+		}
+
+		TripIdMap(const TripIdMap& rhs) = delete;
+		TripIdMap(TripIdMap&& rhs) = delete;
+
+		~TripIdMap() {}
+
+		/**
+		 * \return	The value, or nullptr if the ID isn't in the table.
+		 */
+		T* Find(const TripId& key)
+		{
+			const size_t idx = FindIdx(key);
+			return idx == sk_notFound ? nullptr : &m_slots[idx].m_val;
+		}
+
+		const T* Find(const TripId& key) const
+		{
+			const size_t idx = FindIdx(key);
+			return idx == sk_notFound ? nullptr : &m_slots[idx].m_val;
+		}
+
+		/**
+		 * \return	False if the ID is already in the table, in which case nothing is changed.
+		 */
+		bool Insert(const TripId& key, T&& val)
+		{
+			if (FindIdx(key) != sk_notFound)
+			{
+				return false;
+			}
+
+			if ((m_size + 1) * 2 > m_slots.size())
+			{
+				Grow();
+			}
+
+			InsertNew(key, std::forward<T>(val));
+			return true;
+		}
+
+		bool Insert(const TripId& key, const T& val)
+		{
+			T copy(val);
+			return Insert(key, std::move(copy));
+		}
+
+		/**
+		 * \return	False if the ID isn't in the table.
+		 */
+		bool Erase(const TripId& key)
+		{
+			size_t hole = FindIdx(key);
+			if (hole == sk_notFound)
+			{
+				return false;
+			}
+
+			//Shift back each following entry that is allowed to sit in the hole (i.e., the hole
+			//  is not before its home slot), until an empty slot is reached.
+			for (size_t i = (hole + 1) & m_mask; m_slots[i].m_isUsed; i = (i + 1) & m_mask)
+			{
+				const size_t home = GetHomeIdx(m_slots[i].m_key);
+				if (((i - home) & m_mask) >= ((i - hole) & m_mask))
+				{
+					m_slots[hole] = std::move(m_slots[i]);
+					hole = i;
+				}
+			}
+
+			m_slots[hole] = Slot();
+			--m_size;
+			return true;
+		}
+
+		size_t GetSize() const { return m_size; }
+
+	private:
+		static constexpr size_t sk_minCapacity = 16;
+		static constexpr size_t sk_notFound = static_cast<size_t>(-1);
+
+		struct Slot
+		{
+			TripId m_key;
+			T m_val;
+			bool m_isUsed;
+
+			Slot() :
+				m_key(),
+				m_val(),
+				m_isUsed(false)
+			{}
+		};
+
+		size_t GetHomeIdx(const TripId& key) const
+		{
+			return static_cast<size_t>(key.GetHashKey()) & m_mask;
+		}
+
+		size_t FindIdx(const TripId& key) const
+		{
+			for (size_t i = GetHomeIdx(key); m_slots[i].m_isUsed; i = (i + 1) & m_mask)
+			{
+				if (m_slots[i].m_key == key)
+				{
+					return i;
+				}
+			}
+			return sk_notFound;
+		}
+
+		void InsertNew(const TripId& key, T&& val)
+		{
+			size_t i = GetHomeIdx(key);
+			while (m_slots[i].m_isUsed)
+			{
+				i = (i + 1) & m_mask;
+			}
+
+			m_slots[i].m_key = key;
+			m_slots[i].m_val = std::forward<T>(val);
+			m_slots[i].m_isUsed = true;
+			++m_size;
+		}
+
+		void Grow()
+		{
+			std::vector<Slot> oldSlots(m_slots.size() * 2);
+			oldSlots.swap(m_slots);
+			m_mask = m_slots.size() - 1;
+			m_size = 0;
+
+			for (Slot& slot : oldSlots)
+			{
+				if (slot.m_isUsed)
+				{
+					InsertNew(slot.m_key, std::move(slot.m_val));
+				}
+			}
+		}
+
+		std::vector<Slot> m_slots;
+		size_t m_mask;
+		size_t m_size;
+	};
+
+	template<typename T>
+	constexpr size_t TripIdMap<T>::sk_minCapacity;
+
+	template<typename T>
+	constexpr size_t TripIdMap<T>::sk_notFound;
+}
@@ -0,0 +1,75 @@
+#include "TripOdometer.h"
+
+#include <cmath>
+
+using namespace RideShare;
+
+double TripOdometer::CalPathLength(const std::vector<ComMsg::Point2D<double> >& path)
+{
+	double res = 0.0;
+	for (size_t i = 1; i < path.size(); ++i)
+	{
+		const double dx = path[i].GetX() - path[i - 1].GetX();
+		const double dy = path[i].GetY() - path[i - 1].GetY();
+		res += std::sqrt(dx * dx + dy * dy);
+	}
+	return res;
+}
+
+TripOdometer::TripOdometer(const double minStep) :
+	m_minStepSq((minStep / ComMsg::TripTrace::sk_resolution) * (minStep / ComMsg::TripTrace::sk_resolution)),
+	m_hasPoint(false),
+	m_firstX(0),
+	m_firstY(0),
+	m_lastX(0),
+	m_lastY(0),
+	m_distance(0.0),
+	m_numPoints(0)
+{
+}
+
+TripOdometer::~TripOdometer()
+{
+}
+
+void TripOdometer::Add(const ComMsg::TripTrace& trace)
+{
+	//The deltas are summed in 64-bit integers, so the points are decoded exactly, one at a time.
+	int64_t x = trace.GetOriX();
+	int64_t y = trace.GetOriY();
+	AddPoint(x, y);
+
+	for (const ComMsg::TripTrace::Delta& delta : trace.GetDeltas())
+	{
+		x += delta.m_dx;
+		y += delta.m_dy;
+		AddPoint(x, y);
+	}
+}
+
+void TripOdometer::AddPoint(const int64_t x, const int64_t y)
+{
+	++m_numPoints;
+
+	if (!m_hasPoint)
+	{
+		m_hasPoint = true;
+		m_firstX = x;
+		m_firstY = y;
+		m_lastX = x;
+		m_lastY = y;
+		return;
+	}
+
+	const double dx = static_cast<double>(x - m_lastX);
+	const double dy = static_cast<double>(y - m_lastY);
+	const double stepSq = dx * dx + dy * dy;
+	if (stepSq < m_minStepSq)
+	{
+		return;
+	}
+
+	m_distance += std::sqrt(stepSq);
+	m_lastX = x;
+	m_lastY = y;
+}
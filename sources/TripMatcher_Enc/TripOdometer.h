@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../Common/RideSharingMessages.h"
+
+namespace RideShare
+{
+	/**
+	 * \brief	Meters the distance driven in a trip, from the trace streamed by the driver. The
+	 * 			points are folded into a running distance as they arrive, so it takes constant
+	 * 			memory, however long the trip is; the trace itself is never kept. A trace continues
+	 * 			from the last point of the previous one. Points closer than the minimum step to the
+	 * 			last point counted are skipped (but not lost, since the next step is measured from
+	 * 			that point), so the GPS jitter of a standing car doesn't add up.
+	 */
+	class TripOdometer
+	{
+	public:
+		/**
+		 * \brief	Calculates the length of a path, e.g., the one of the quote, to compare with the
+		 * 			distance driven.
+		 */
+		static double CalPathLength(const std::vector<ComMsg::Point2D<double> >& path);
+
+	public:
+		TripOdometer() = delete;
+
+		/**
+		 * \brief	Constructor
+		 *
+		 * \param	minStep	The minimum step counted, in the units of the coordinates.
+		 */
+		explicit TripOdometer(const double minStep);
+
+		~TripOdometer();
+
+		void Add(const ComMsg::TripTrace& trace);
+
+		/** \brief	Gets the distance driven so far, in the units of the coordinates. */
+		double GetDistance() const { return m_distance * ComMsg::TripTrace::sk_resolution; }
+
+		uint64_t GetNumPoints() const { return m_numPoints; }
+
+		/** \brief	Gets the first point of the trace. Only valid if there is at least one point. */
+		ComMsg::Point2D<double> GetFirstPoint() const
+		{
+			return ComMsg::Point2D<double>(ComMsg::TripTrace::ToCoord(m_firstX), ComMsg::TripTrace::ToCoord(m_firstY));
+		}
+
+		/** \brief	Gets the last point counted. Only valid if there is at least one point. */
+		ComMsg::Point2D<double> GetLastPoint() const
+		{
+			return ComMsg::Point2D<double>(ComMsg::TripTrace::ToCoord(m_lastX), ComMsg::TripTrace::ToCoord(m_lastY));
+		}
+
+	private:
+		void AddPoint(const int64_t x, const int64_t y);
+
+		//The minimum step, in fixed-point, squared.
+		double m_minStepSq;
+
+		//The first point, and the last point counted, in fixed-point (see ComMsg::TripTrace).
+		bool m_hasPoint;
+		int64_t m_firstX;
+		int64_t m_firstY;
+		int64_t m_lastX;
+		int64_t m_lastY;
+
+		//In fixed-point units.
+		double m_distance;
+		uint64_t m_numPoints;
+	};
+}
@@ -1,5 +1,6 @@
 #include <string>
 #include <memory>
+#include <chrono>
 #include <iostream>
 
 #include <tclap/CmdLine.h>
@@ -25,6 +26,8 @@
 
 #include "../Common/AppNames.h"
 #include "../Common_App/ConnectionManager.h"
+#include "../Common_App/PeriodicTask.h"
+#include "../Common_App/SessionWatchdog.h"
 
 #include "TripPlanerApp.h"
 
@@ -59,13 +62,21 @@ int main(int argc, char ** argv)
 	TCLAP::ValueArg<std::string> configPathArg("c", "config", "Path to the configuration file.", false, "Config.json", "String");
 	TCLAP::ValueArg<std::string> wlKeyArg("w", "wl-key", "Key for the loaded whitelist.", false, "WhiteListKey", "String");
 	TCLAP::SwitchArg isSendWlArg("s", "not-send-wl", "Do not send whitelist to Decent Server.", true);
+	TCLAP::ValueArg<std::string> roadGraphPathArg("g", "road-graph", "Path to the road network file; without it, routes are straight lines.", false, "", "String");
 	cmd.add(configPathArg);
 	cmd.add(wlKeyArg);
 	cmd.add(isSendWlArg);
+	TCLAP::ValueArg<uint64_t> routeTtlArg("r", "route-ttl", "Seconds a computed route and its price are reused; 0 disables the route cache.", false, 10 * 60, "Seconds");
+	cmd.add(roadGraphPathArg);
+	cmd.add(routeTtlArg);
 
 	cmd.parse(argc, argv);
 
 	const size_t numListenThread = 5;
+	const std::chrono::seconds timeTickInterval(5);
+	const std::chrono::seconds idleSessionCheckInterval(5);
+	//In the number of time ticks.
+	const size_t routeCacheStatsInterval = 12;
 
 	//------- Read configuration file:
 	std::unique_ptr<DecentAppConfig> configMgr;
@@ -168,6 +179,23 @@ int main(int argc, char ** argv)
 			ENCLAVE_FILENAME, tokenPath, wlKeyArg.getValue(), *serverCon,
 			"TripPlanner Pay Info" + selfAddr + ":" + std::to_string(selfPort));
 
+		if (roadGraphPathArg.getValue().size() > 0)
+		{
+			std::string roadGraphStr;
+			DiskFile file(roadGraphPathArg.getValue(), FileBase::Mode::Read, true);
+			roadGraphStr.resize(file.GetFileSize());
+			file.ReadBlockExactSize(roadGraphStr);
+
+			if (!enclave->LoadRoadGraph(roadGraphStr))
+			{
+				PRINT_W("Failed to load the road network.");
+				return -1;
+			}
+		}
+
+		enclave->UpdateTime();
+		enclave->SetRouteCacheTtl(routeTtlArg.getValue());
+
 		smartServer.AddServer(server, enclave, nullptr, numListenThread, 0);
 	}
 	catch (const std::exception& e)
@@ -176,10 +204,49 @@ int main(int argc, char ** argv)
 		return -1;
 	}
 
+	//------- Keep the enclave's clock going, for the TTLs of the cached routes, and report the route cache:
+	uint64_t prevNumHits = 0;
+	uint64_t prevNumMisses = 0;
+	size_t numTicks = 0;
+	PeriodicTask tickTask("update the time of the enclave", timeTickInterval, [&]()
+	{
+		enclave->UpdateTime();
+
+		if (++numTicks % routeCacheStatsInterval == 0)
+		{
+			uint64_t numHits = 0;
+			uint64_t numMisses = 0;
+			enclave->GetRouteCacheStats(numHits, numMisses);
+
+			const uint64_t numLookups = (numHits - prevNumHits) + (numMisses - prevNumMisses);
+			if (numLookups > 0)
+			{
+				PRINT_I("Route cache: %llu hits, %llu misses (%.1f%% hit rate recently).",
+					static_cast<unsigned long long>(numHits), static_cast<unsigned long long>(numMisses),
+					100.0 * (numHits - prevNumHits) / numLookups);
+			}
+			prevNumHits = numHits;
+			prevNumMisses = numMisses;
+		}
+	});
+
+	//------- Close the client sessions left idle, so they don't hold the listen threads:
+	PeriodicTask idleSessionTask("close idle sessions", idleSessionCheckInterval, []()
+	{
+		const size_t numClosed = SessionWatchdog::GetInstance().CloseIdle();
+		if (numClosed > 0)
+		{
+			PRINT_I("Closed %llu idle sessions.", static_cast<unsigned long long>(numClosed));
+		}
+	});
+
 	//------- keep running until an interrupt signal (Ctrl + C) is received.
 	mainThreadWorker->UpdateUntilInterrupt();
 
 	//------- Exit...
+	idleSessionTask.Stop();
+	tickTask.Stop();
+
 	enclave.reset();
 	smartServer.Terminate();
 
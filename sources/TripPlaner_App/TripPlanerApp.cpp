@@ -1,8 +1,11 @@
 #include "TripPlanerApp.h"
 
+#include <chrono>
+
 #include <DecentApi/Common/SGX/RuntimeError.h>
 
 #include "../Common_App/RequestCategory.h"
+#include "../Common_App/SessionWatchdog.h"
 
 #include "Enclave_u.h"
 
@@ -13,12 +16,45 @@ bool TripPlanerApp::ProcessMsgFromPassenger(Decent::Net::ConnectionBase& connect
 	int retValue = false;
 	sgx_status_t enclaveRet = SGX_SUCCESS;
 
+	SessionWatchdog::Session session(SessionWatchdog::GetInstance(), connection);
 	enclaveRet = ecall_ride_share_tp_from_pas(GetEnclaveId(), &retValue, &connection);
 	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tp_from_pas);
 
 	return retValue;
 }
 
+bool TripPlanerApp::LoadRoadGraph(const std::string& data)
+{
+	int retValue = false;
+	sgx_status_t enclaveRet = SGX_SUCCESS;
+
+	enclaveRet = ecall_ride_share_tp_load_road_graph(GetEnclaveId(), &retValue, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tp_load_road_graph);
+
+	return retValue;
+}
+
+void TripPlanerApp::UpdateTime()
+{
+	//A monotonic clock, so the TTLs aren't affected by changes of the wall clock.
+	const uint64_t currTime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+
+	sgx_status_t enclaveRet = ecall_ride_share_tp_set_time(GetEnclaveId(), currTime);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tp_set_time);
+}
+
+void TripPlanerApp::SetRouteCacheTtl(uint64_t ttl)
+{
+	sgx_status_t enclaveRet = ecall_ride_share_tp_set_route_cache_ttl(GetEnclaveId(), ttl);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tp_set_route_cache_ttl);
+}
+
+void TripPlanerApp::GetRouteCacheStats(uint64_t& numHits, uint64_t& numMisses)
+{
+	sgx_status_t enclaveRet = ecall_ride_share_tp_get_route_cache_stats(GetEnclaveId(), &numHits, &numMisses);
+	DECENT_CHECK_SGX_STATUS_ERROR(enclaveRet, ecall_ride_share_tp_get_route_cache_stats);
+}
+
 bool TripPlanerApp::ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt)
 {
 	if (category == RequestCategory::sk_fromPassenger)
@@ -15,6 +15,31 @@ namespace RideShare
 
 		virtual bool ProcessSmartMessage(const std::string& category, Decent::Net::ConnectionBase& connection, Decent::Net::ConnectionBase*& freeHeldCnt) override;
 
+		/**
+		 * \brief	Loads the road network, in the binary format of RoadGraph, into the enclave. It's
+		 * 			preprocessed there, which may take a while on a large network.
+		 *
+		 * \return	True if it succeeds, false if the road network is rejected.
+		 */
+		bool LoadRoadGraph(const std::string& data);
+
+		/**
+		 * \brief	Gives the current time to the enclave, which times out its cached routes. It should
+		 * 			be called before any request is served, and periodically afterwards.
+		 */
+		void UpdateTime();
+
+		/**
+		 * \brief	Sets the TTL (in seconds) of the cached routes, which bounds how long a change of the
+		 * 			pricing goes unnoticed; 0 disables the route cache.
+		 */
+		void SetRouteCacheTtl(uint64_t ttl);
+
+		/**
+		 * \brief	Gets the numbers of quotes served with, and without, a cached route.
+		 */
+		void GetRouteCacheStats(uint64_t& numHits, uint64_t& numMisses);
+
 	};
 }
 
@@ -0,0 +1,273 @@
+#include <new>
+#include <cmath>
+#include <queue>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <cstdlib>
+#include <cstddef>
+#include <iostream>
+#include <functional>
+
+#include <tclap/CmdLine.h>
+
+#include "../Common/BinaryCoding.h"
+#include "../TripPlaner_Enc/RoadGraph.h"
+
+using namespace RideShare;
+
+namespace
+{
+	//The heap in use, and its peak, so the heap needed to build the hierarchy can be compared
+	//  with RoadGraph::IsSizeSupported.
+	static std::atomic<size_t> gs_heapInUse(0);
+	static std::atomic<size_t> gs_heapPeak(0);
+
+	constexpr uint32_t gsk_roadGraphMagic = 0x47525352; //"RSRG"
+}
+
+void* operator new(size_t size)
+{
+	//The size is kept in front of the block, so operator delete knows how much is freed.
+	size_t* block = static_cast<size_t*>(std::malloc(size + sizeof(std::max_align_t)));
+	if (block == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	*block = size;
+
+	const size_t inUse = (gs_heapInUse += size);
+	size_t peak = gs_heapPeak.load();
+	while (inUse > peak && !gs_heapPeak.compare_exchange_weak(peak, inUse)) {}
+
+	return reinterpret_cast<uint8_t*>(block) + sizeof(std::max_align_t);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if (ptr == nullptr)
+	{
+		return;
+	}
+	size_t* block = reinterpret_cast<size_t*>(reinterpret_cast<uintptr_t>(ptr) - sizeof(std::max_align_t));
+	gs_heapInUse -= *block;
+	std::free(block);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	operator delete(ptr);
+}
+
+/**
+ * \brief	Generates a synthetic road network: a width x width grid, with the nodes jittered, some of
+ * 			the roads removed or made one-way, and some diagonal roads added, so it's irregular
+ * 			like a city district.
+ */
+static void GenerateRoadNetwork(const uint32_t width, const uint32_t diagonalPct, std::mt19937& randGen,
+	std::vector<RoadGraph::Node>& nodes, std::vector<RoadGraph::Road>& roads)
+{
+	std::uniform_real_distribution<double> jitterDis(-0.3, 0.3);
+	std::uniform_int_distribution<uint32_t> pctDis(0, 99);
+
+	for (uint32_t i = 0; i < width; ++i)
+	{
+		for (uint32_t j = 0; j < width; ++j)
+		{
+			nodes.push_back(RoadGraph::Node{ i + jitterDis(randGen), j + jitterDis(randGen) });
+		}
+	}
+
+	for (uint32_t i = 0; i < width; ++i)
+	{
+		for (uint32_t j = 0; j < width; ++j)
+		{
+			const uint32_t from = i * width + j;
+			if (i + 1 < width && pctDis(randGen) >= 10)
+			{
+				roads.push_back(RoadGraph::Road{ from, (i + 1) * width + j, pctDis(randGen) < 10 });
+			}
+			if (j + 1 < width && pctDis(randGen) >= 10)
+			{
+				roads.push_back(RoadGraph::Road{ from, i * width + j + 1, pctDis(randGen) < 10 });
+			}
+			if (i + 1 < width && j + 1 < width && pctDis(randGen) < diagonalPct)
+			{
+				roads.push_back(RoadGraph::Road{ from, (i + 1) * width + j + 1, false });
+			}
+		}
+	}
+}
+
+static std::string SerializeRoadNetwork(const std::vector<RoadGraph::Node>& nodes, const std::vector<RoadGraph::Road>& roads)
+{
+	std::string res;
+	ComMsg::BinaryWriter writer(res);
+
+	writer.Write(gsk_roadGraphMagic);
+	writer.WriteSize(nodes.size());
+	for (const RoadGraph::Node& node : nodes)
+	{
+		writer.Write(node.m_x);
+		writer.Write(node.m_y);
+	}
+	writer.WriteSize(roads.size());
+	for (const RoadGraph::Road& road : roads)
+	{
+		writer.Write(road.m_from);
+		writer.Write(road.m_to);
+		writer.Write(static_cast<uint8_t>(road.m_isOneWay ? 1 : 0));
+	}
+
+	return res;
+}
+
+static double CalcDistance(const RoadGraph::Node& a, const RoadGraph::Node& b)
+{
+	return std::hypot(b.m_x - a.m_x, b.m_y - a.m_y);
+}
+
+/**
+ * \brief	The reference: the length of the shortest route found by Dijkstra's algorithm on the
+ * 			original roads, or infinity if there is none.
+ */
+static double FindShortestLength(const std::vector<std::vector<std::pair<uint32_t, double> > >& adj, const uint32_t ori, const uint32_t dst)
+{
+	typedef std::pair<double, uint32_t> QueueItem;
+
+	std::vector<double> dists(adj.size(), std::numeric_limits<double>::infinity());
+	std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem> > queue;
+
+	dists[ori] = 0.0;
+	queue.push(QueueItem(0.0, ori));
+	while (!queue.empty())
+	{
+		const QueueItem item = queue.top();
+		queue.pop();
+		if (item.second == dst)
+		{
+			return item.first;
+		}
+		if (item.first > dists[item.second])
+		{
+			continue;
+		}
+		for (const std::pair<uint32_t, double>& arc : adj[item.second])
+		{
+			const double dist = item.first + arc.second;
+			if (dist < dists[arc.first])
+			{
+				dists[arc.first] = dist;
+				queue.push(QueueItem(dist, arc.first));
+			}
+		}
+	}
+
+	return dists[dst];
+}
+
+int main(int argc, char ** argv)
+{
+	TCLAP::CmdLine cmd("Benchmark of the road network of the Trip Planner", ' ', "ver", true);
+
+	TCLAP::ValueArg<uint32_t> widthArg("w", "width", "Width of the grid of the road network.", false, 100, "Width");
+	TCLAP::ValueArg<uint32_t> numQueriesArg("q", "queries", "Number of routes to find.", false, 200, "Count");
+	TCLAP::ValueArg<uint32_t> diagonalArg("d", "diagonal", "Percentage of the grid cells with a diagonal road.", false, 20, "Percentage");
+	cmd.add(widthArg);
+	cmd.add(numQueriesArg);
+	cmd.add(diagonalArg);
+
+	cmd.parse(argc, argv);
+
+	if (widthArg.getValue() < 2 || numQueriesArg.getValue() == 0)
+	{
+		std::cout << "The width must be at least 2, and at least one route must be found." << std::endl;
+		return -1;
+	}
+
+	std::mt19937 randGen(1);
+
+	std::vector<RoadGraph::Node> nodes;
+	std::vector<RoadGraph::Road> roads;
+	GenerateRoadNetwork(widthArg.getValue(), diagonalArg.getValue(), randGen, nodes, roads);
+	const std::string data = SerializeRoadNetwork(nodes, roads);
+
+	std::cout << "Road network: " << nodes.size() << " nodes, " << roads.size() << " roads; "
+		<< (RoadGraph::IsSizeSupported(nodes.size(), roads.size()) ? "within" : "beyond") << " the heap budget." << std::endl;
+
+	const size_t heapBase = gs_heapInUse.load();
+	gs_heapPeak = heapBase;
+
+	std::unique_ptr<RoadGraph> roadGraph;
+	const auto buildStart = std::chrono::steady_clock::now();
+	try
+	{
+		roadGraph = RoadGraph::Parse(StringView(data));
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Failed to build the road network. Caught exception: " << e.what() << std::endl;
+		return -1;
+	}
+	const std::chrono::duration<double> buildTime = std::chrono::steady_clock::now() - buildStart;
+
+	const size_t heapPeak = gs_heapPeak.load() - heapBase;
+	const size_t heapResident = gs_heapInUse.load() - heapBase;
+	std::cout << "Built in " << buildTime.count() << " s, with " << roadGraph->GetNumArcs() << " arcs in the hierarchy." << std::endl;
+	std::cout << "Heap: peak " << heapPeak << " B (" << heapPeak / nodes.size() << " B/node), resident "
+		<< heapResident << " B (" << heapResident / nodes.size() << " B/node)." << std::endl;
+
+	std::vector<std::vector<std::pair<uint32_t, double> > > adj(nodes.size());
+	for (const RoadGraph::Road& road : roads)
+	{
+		const double length = CalcDistance(nodes[road.m_from], nodes[road.m_to]);
+		adj[road.m_from].push_back(std::make_pair(road.m_to, length));
+		if (!road.m_isOneWay)
+		{
+			adj[road.m_to].push_back(std::make_pair(road.m_from, length));
+		}
+	}
+
+	std::uniform_int_distribution<uint32_t> nodeDis(0, static_cast<uint32_t>(nodes.size() - 1));
+	std::chrono::duration<double> queryTime(0.0);
+	size_t numMismatches = 0;
+	for (uint32_t i = 0; i < numQueriesArg.getValue(); ++i)
+	{
+		const uint32_t ori = nodeDis(randGen);
+		const uint32_t dst = nodeDis(randGen);
+
+		std::vector<const RoadGraph::Node*> route;
+		uint32_t oriNode = 0;
+		uint32_t dstNode = 0;
+
+		const auto queryStart = std::chrono::steady_clock::now();
+		const bool isFound = roadGraph->SnapToNode(nodes[ori], 0.01, oriNode) &&
+			roadGraph->SnapToNode(nodes[dst], 0.01, dstNode) &&
+			roadGraph->FindRoute(oriNode, dstNode, route);
+		queryTime += std::chrono::steady_clock::now() - queryStart;
+
+		const double expLength = FindShortestLength(adj, ori, dst);
+		if (isFound != !std::isinf(expLength))
+		{
+			++numMismatches;
+			continue;
+		}
+
+		double length = 0.0;
+		for (size_t j = 1; j < route.size(); ++j)
+		{
+			length += CalcDistance(*route[j - 1], *route[j]);
+		}
+		if (isFound && std::abs(length - expLength) > 1e-6)
+		{
+			++numMismatches;
+		}
+	}
+
+	std::cout << "Found " << numQueriesArg.getValue() << " routes, in " << (queryTime.count() * 1000.0 / numQueriesArg.getValue())
+		<< " ms each; " << numMismatches << " differ from Dijkstra's." << std::endl;
+
+	return numMismatches == 0 ? 0 : -1;
+}
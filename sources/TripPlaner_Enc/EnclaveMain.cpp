@@ -1,5 +1,11 @@
 //#include "Enclave_t.h"
 
+#include <cmath>
+#include <mutex>
+#include <atomic>
+
+#include <sgx_trts.h>
+
 #include <DecentApi/Common/Common.h>
 #include <DecentApi/Common/make_unique.h>
 #include <DecentApi/Common/Ra/TlsConfigWithName.h>
@@ -16,7 +22,13 @@
 #include "../Common/RideSharingMessages.h"
 #include "../Common/AppNames.h"
 
+#include "../Common_Enc/EnclaveClock.h"
+#include "../Common_Enc/InSituMessages.h"
 #include "../Common_Enc/OperatorPayment.h"
+#include "../Common_Enc/TlsChannelPool.h"
+
+#include "RoadGraph.h"
+#include "RouteCache.h"
 
 #include "Enclave_t.h"
 
@@ -28,62 +40,196 @@ namespace
 {
 	static AppStates& gs_state = GetAppStateSingleton();
 
+	constexpr size_t gsk_maxIdleChannels = 2;
+
+	static TlsChannelPool gs_pasMgmPool(gs_state, AppNames::sk_passengerMgm, &ocall_ride_share_cnt_mgr_get_pas_mgm, EncFunc::PassengerMgm::k_endSession, gsk_maxIdleChannels);
+	static TlsChannelPool gs_billingPool(gs_state, AppNames::sk_billing, &ocall_ride_share_cnt_mgr_get_billing, EncFunc::Billing::k_endSession, gsk_maxIdleChannels);
+
+	//The road network loaded by the untrusted side; until then, routes are straight lines.
+	std::shared_ptr<const RoadGraph> gs_roadGraph;
+	std::mutex gs_roadGraphMutex;
+
+	//The maximum distance from the origin (or destination) to the closest road network node.
+	constexpr double gsk_maxSnapDist = 10.0;
+
+	//Trips whose ends snap to the same nodes share a cached route; it's kept small, since most of
+	//  the heap is taken by the road network (see RoadGraph::sk_heapBudget).
+	constexpr size_t gsk_numRouteCacheShards = 16;
+	constexpr size_t gsk_routeCacheShardSize = 128;
+
+	//Disabled until the untrusted side sets the TTL.
+	RouteCache gs_routeCache(gsk_numRouteCacheShards, gsk_routeCacheShardSize, 0);
+
+	//The time (in seconds), for the TTL of the route cache (see AdvanceTime).
+	std::atomic<uint64_t> gs_currTime(0);
+
+	//The latest pricing epoch of the Billing Services seen, from its replies and the polls on the
+	//  time ticks; it only moves forward. Cached routes priced before it are stale.
+	std::atomic<uint64_t> gs_pricingEpoch(0);
+
 	template<typename MsgType>
-	static std::unique_ptr<MsgType> ParseMsg(const std::string& msgStr)
+	static std::unique_ptr<MsgType> ParseMsg(std::string& msgStr)
 	{
-		rapidjson::Document json;
-		Decent::Tools::ParseStr2Json(json, msgStr);
-		return Decent::Tools::make_unique<MsgType>(json);
+		return Decent::Tools::make_unique<MsgType>(ComMsg::ParseInSitu<MsgType>(msgStr, msgStr));
 	}
 }
 
-static bool FindPath(const ComMsg::Point2D<double>& ori, const ComMsg::Point2D<double>& dst, std::vector<ComMsg::Point2D<double> >& path)
+static std::shared_ptr<const RoadGraph> GetRoadGraph()
 {
-	path.clear();
-	path.push_back(ori);
-	path.push_back(dst);
-
-	return true;
+	std::unique_lock<std::mutex> roadGraphLock(gs_roadGraphMutex);
+	return gs_roadGraph;
 }
 
-static bool SendQueryLog(const std::string& userId, const ComMsg::GetQuote& getQuote)
+static bool SendQueryLog(const ClientId& userId, const ComMsg::GetQuote& getQuote)
 {
 	using namespace EncFunc::PassengerMgm;
-	LOGI("Connecting to a Passenger Management...");
-
-	EnclaveConnectionOwner cnt = EnclaveConnectionOwner::CntBuilder(SGX_SUCCESS, &ocall_ride_share_cnt_mgr_get_pas_mgm);
+	LOGI("Sending query log to a Passenger Management...");
 
 	ComMsg::PasQueryLog log(userId, getQuote);
+	const std::string logStr = log.ToString();
 
-	std::shared_ptr<TlsConfigWithName> pasMgmTlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_passengerMgm, nullptr);
-	Decent::Net::TlsCommLayer pasMgmTls(cnt, pasMgmTlsCfg, true, nullptr);
-	
-	pasMgmTls.SendStruct(cnt, k_logQuery);
-	pasMgmTls.SendContainer(cnt, log.ToString());
+	gs_pasMgmPool.Use([&logStr](ConnectionBase& cnt, TlsCommLayer& tls)
+	{
+		tls.SendStruct(cnt, k_logQuery);
+		tls.SendContainer(cnt, logStr);
+	});
 
 	return true;
 }
 
-static std::unique_ptr<ComMsg::Price> GetPriceFromBilling(const ComMsg::Path& pathMsg)
+static void UpdatePricingEpoch(const uint64_t pricingEpoch)
+{
+	uint64_t prevEpoch = gs_pricingEpoch.load();
+	while (prevEpoch < pricingEpoch && !gs_pricingEpoch.compare_exchange_weak(prevEpoch, pricingEpoch))
+	{}
+}
+
+static std::unique_ptr<ComMsg::Price> GetPriceFromBilling(const ComMsg::Path& pathMsg, uint64_t& pricingEpoch)
 {
 	using namespace EncFunc::Billing;
 	LOGI("Querying Billing Service for price...");
-	EnclaveConnectionOwner cnt = EnclaveConnectionOwner::CntBuilder(SGX_SUCCESS, &ocall_ride_share_cnt_mgr_get_billing);
-
-	std::shared_ptr<TlsConfigWithName> bsTlsCfg = std::make_shared<TlsConfigWithName>(gs_state, TlsConfigWithName::Mode::ClientHasCert, AppNames::sk_billing, nullptr);
-	Decent::Net::TlsCommLayer bsTls(cnt, bsTlsCfg, true, nullptr);
 
+	const std::string pathStr = pathMsg.ToString();
 	std::string msgBuf;
 
-	bsTls.SendStruct(cnt, k_calPrice);
-	bsTls.SendContainer(cnt, pathMsg.ToString());
-	msgBuf = bsTls.RecvContainer<std::string>(cnt);
+	gs_billingPool.UseWithRetry([&pathStr, &msgBuf, &pricingEpoch](ConnectionBase& cnt, TlsCommLayer& tls)
+	{
+		tls.SendStruct(cnt, k_calPrice);
+		tls.SendContainer(cnt, pathStr);
+		msgBuf = tls.RecvContainer<std::string>(cnt);
+		tls.RecvStruct(cnt, pricingEpoch);
+	});
 	std::unique_ptr<ComMsg::Price> price = ParseMsg<ComMsg::Price>(msgBuf);
 
+	UpdatePricingEpoch(pricingEpoch);
+
 	return std::move(price);
 }
 
-static void ProcessGetQuote(void* const connection, Decent::Net::TlsCommLayer& tls)
+static double CalDistance(const ComMsg::Point2D<double>& a, const ComMsg::Point2D<double>& b)
+{
+	const double dx = a.GetX() - b.GetX();
+	const double dy = a.GetY() - b.GetY();
+	return std::sqrt(dx * dx + dy * dy);
+}
+
+/**
+ * \brief	Finds and prices the route between two road network nodes. Only the road nodes are sent
+ * 			to the Billing Services, so the route can be cached and shared (see RouteCache).
+ *
+ * \return	The route, or nullptr if there is no route, or it's too short to derive a unit price from.
+ */
+static RouteCache::ValueType FindNodeRoute(const RoadGraph& roadGraph, const uint32_t oriNode, const uint32_t dstNode)
+{
+	std::vector<const RoadGraph::Node*> route;
+	if (!roadGraph.FindRoute(oriNode, dstNode, route))
+	{
+		LOGW("No route is found on the road network. Falling back to the straight line.");
+		return nullptr;
+	}
+
+	std::vector<ComMsg::Point2D<double> > nodes;
+	nodes.reserve(route.size());
+	double length = 0.0;
+	for (const RoadGraph::Node* node : route)
+	{
+		nodes.push_back(ComMsg::Point2D<double>(node->m_x, node->m_y));
+		length += nodes.size() > 1 ? CalDistance(nodes[nodes.size() - 2], nodes.back()) : 0.0;
+	}
+
+	if (!(length > 0.0))
+	{
+		return nullptr;
+	}
+
+	uint64_t pricingEpoch = 0;
+	std::unique_ptr<ComMsg::Price> price = GetPriceFromBilling(ComMsg::Path(nodes), pricingEpoch);
+	if (!price)
+	{
+		return nullptr;
+	}
+
+	return std::make_shared<RouteCache::Route>(std::move(nodes), length, std::move(*price), pricingEpoch);
+}
+
+/**
+ * \brief	Gets the path from ori to dst, and its price. The path runs along the shortest route
+ * 			between the road network nodes closest to ori and dst, which is cached; ori and dst are
+ * 			then spliced onto its ends, which are priced locally, at the average unit price of the
+ * 			route. If there is no road network, or no route is found, the straight line from ori
+ * 			to dst is priced by the Billing Services.
+ *
+ * \return	The price, or nullptr if it fails.
+ */
+static std::unique_ptr<ComMsg::Price> GetRoute(const ComMsg::Point2D<double>& ori, const ComMsg::Point2D<double>& dst,
+	std::vector<ComMsg::Point2D<double> >& path)
+{
+	path.clear();
+	path.push_back(ori);
+
+	std::shared_ptr<const RoadGraph> roadGraph = GetRoadGraph();
+	uint32_t oriNode = 0;
+	uint32_t dstNode = 0;
+	if (roadGraph &&
+		roadGraph->SnapToNode(RoadGraph::Node{ ori.GetX(), ori.GetY() }, gsk_maxSnapDist, oriNode) &&
+		roadGraph->SnapToNode(RoadGraph::Node{ dst.GetX(), dst.GetY() }, gsk_maxSnapDist, dstNode))
+	{
+		const uint64_t currTime = gs_currTime.load();
+		const uint64_t epoch = gs_routeCache.GetEpoch();
+		RouteCache::ValueType route = gs_routeCache.Find(oriNode, dstNode, currTime, gs_pricingEpoch.load());
+		if (!route)
+		{
+			route = FindNodeRoute(*roadGraph, oriNode, dstNode);
+			if (route)
+			{
+				gs_routeCache.Put(oriNode, dstNode, route, currTime, epoch);
+			}
+		}
+
+		if (route)
+		{
+			path.reserve(route->m_nodes.size() + 2);
+			for (const ComMsg::Point2D<double>& node : route->m_nodes)
+			{
+				path.push_back(node);
+			}
+			path.push_back(dst);
+
+			const double endsLength = CalDistance(ori, route->m_nodes.front()) + CalDistance(route->m_nodes.back(), dst);
+			const double routePrice = route->m_price.GetPrice();
+
+			return Decent::Tools::make_unique<ComMsg::Price>(routePrice + routePrice / route->m_length * endsLength,
+				route->m_price.GetOpPayment());
+		}
+	}
+
+	path.push_back(dst);
+
+	uint64_t pricingEpoch = 0;
+	return GetPriceFromBilling(ComMsg::Path(path), pricingEpoch);
+}
+
+static bool ProcessGetQuote(void* const connection, Decent::Net::TlsCommLayer& tls)
 {
 	LOGI("Process Get Quote Request.");
 
@@ -92,32 +238,27 @@ static void ProcessGetQuote(void* const connection, Decent::Net::TlsCommLayer& t
 	std::string msgBuf = tls.RecvContainer<std::string>(cnt);
 	std::unique_ptr<ComMsg::GetQuote> getQuote = ParseMsg<ComMsg::GetQuote>(msgBuf);
 
-	const std::string pasId = tls.GetPublicKeyPem();
-	if (pasId.size() == 0 ||
-		!SendQueryLog(pasId, *getQuote))
+	const ClientId pasId = ClientId::FromPubKeyPem(tls.GetPublicKeyPem());
+	if (!SendQueryLog(pasId, *getQuote))
 	{
-		return;
+		return false;
 	}
 
 	std::vector<ComMsg::Point2D<double> > path;
-	if (!FindPath(getQuote->GetOri(), getQuote->GetDest(), path))
-	{
-		return;
-	}
-
-	ComMsg::Path pathMsg(std::move(path));
-
-	std::unique_ptr<ComMsg::Price> price = GetPriceFromBilling(pathMsg);
+	std::unique_ptr<ComMsg::Price> price = GetRoute(getQuote->GetOri(), getQuote->GetDest(), path);
 	if (!price)
 	{
-		return;
+		return false;
 	}
 
-	ComMsg::Quote quote(*getQuote, pathMsg, *price, OperatorPayment::GetPaymentInfo(), pasId);
-	ComMsg::SignedQuote signedQuote = ComMsg::SignedQuote::SignQuote(quote, gs_state);
+	ComMsg::Quote quote(*getQuote, ComMsg::Path(std::move(path)), *price, OperatorPayment::GetPaymentInfo(), pasId);
+	//Reply in the format of the request; the quote inside is signed in the same format.
+	const ComMsg::WireFormat format = ComMsg::DetectWireFormat(msgBuf);
+	ComMsg::SignedQuote signedQuote = ComMsg::SignedQuote::SignQuote(quote, gs_state, format);
 
-	tls.SendContainer(cnt, signedQuote.ToString());
+	tls.SendContainer(cnt, signedQuote.ToString(format));
 
+	return true;
 }
 
 extern "C" int ecall_ride_share_tp_from_pas(void* const connection)
@@ -137,16 +278,27 @@ extern "C" int ecall_ride_share_tp_from_pas(void* const connection)
 		std::shared_ptr<TlsConfigClient> tlsCfg = std::make_shared<TlsConfigClient>(gs_state, TlsConfigClient::Mode::ServerVerifyPeer, AppNames::sk_passengerMgm, nullptr);
 		TlsCommLayer tls(cnt, tlsCfg, true, nullptr);
 
+		//Keep serving requests on the same session until the passenger ends it, or a request fails.
 		NumType funcNum;
-		tls.RecvStruct(cnt, funcNum);
-
-		switch (funcNum)
+		bool isSessionAlive = true;
+		while (isSessionAlive)
 		{
-		case k_getQuote:
-			ProcessGetQuote(connection, tls);
-			break;
-		default:
-			break;
+			tls.RecvStruct(cnt, funcNum);
+			//Not idle while serving the request (see SessionWatchdog in the untrusted side).
+			ocall_ride_share_session_touch(connection);
+
+			switch (funcNum)
+			{
+			case k_getQuote:
+				isSessionAlive = ProcessGetQuote(connection, tls);
+				break;
+			case k_endSession:
+			default:
+				isSessionAlive = false;
+				break;
+			}
+
+			ocall_ride_share_session_touch(connection);
 		}
 	}
 	catch (const std::exception& e)
@@ -156,3 +308,83 @@ extern "C" int ecall_ride_share_tp_from_pas(void* const connection)
 
 	return false;
 }
+
+extern "C" int ecall_ride_share_tp_load_road_graph(const uint8_t* data, size_t size)
+{
+	//The file is parsed in place (see RoadGraph::Parse), rather than copied into the heap.
+	if (data == nullptr || sgx_is_outside_enclave(data, size) != 1)
+	{
+		PRINT_W("Failed to load the road network. The input is not in the untrusted memory.");
+		return false;
+	}
+
+	try
+	{
+		std::shared_ptr<const RoadGraph> roadGraph = RoadGraph::Parse(StringView(reinterpret_cast<const char*>(data), size));
+
+		PRINT_I("Road network is loaded, with %llu nodes, and %llu arcs in the hierarchy.",
+			static_cast<unsigned long long>(roadGraph->GetNumNodes()), static_cast<unsigned long long>(roadGraph->GetNumArcs()));
+
+		{
+			std::unique_lock<std::mutex> roadGraphLock(gs_roadGraphMutex);
+			gs_roadGraph = roadGraph;
+		}
+		//The cached routes are on the old road network.
+		gs_routeCache.Clear();
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to load the road network. Caught exception: %s", e.what());
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * \brief	Polls the pricing epoch of the Billing Services, so the cached routes priced before a
+ * 			change of the tariffs or the surge multipliers are dropped, even when no route is priced.
+ */
+static void PollPricingEpoch()
+{
+	try
+	{
+		uint64_t pricingEpoch = 0;
+		gs_billingPool.UseWithRetry([&pricingEpoch](ConnectionBase& cnt, TlsCommLayer& tls)
+		{
+			tls.SendStruct(cnt, EncFunc::Billing::k_getPricingEpoch);
+			tls.RecvStruct(cnt, pricingEpoch);
+		});
+
+		UpdatePricingEpoch(pricingEpoch);
+	}
+	catch (const std::exception& e)
+	{
+		PRINT_W("Failed to poll the pricing epoch from the Billing Services. Caught exception: %s", e.what());
+	}
+}
+
+extern "C" void ecall_ride_share_tp_set_time(uint64_t curr_time)
+{
+	AdvanceTime(gs_currTime, curr_time);
+
+	PollPricingEpoch();
+
+	gs_pasMgmPool.EvictIdle();
+	gs_billingPool.EvictIdle();
+}
+
+extern "C" void ecall_ride_share_tp_set_route_cache_ttl(uint64_t ttl)
+{
+	gs_routeCache.SetTtl(ttl);
+	if (ttl == 0)
+	{
+		gs_routeCache.Clear();
+	}
+}
+
+extern "C" void ecall_ride_share_tp_get_route_cache_stats(uint64_t* num_hits, uint64_t* num_misses)
+{
+	*num_hits = gs_routeCache.GetNumHits();
+	*num_misses = gs_routeCache.GetNumMisses();
+}
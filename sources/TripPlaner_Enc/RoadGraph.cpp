@@ -0,0 +1,679 @@
+#include "RoadGraph.h"
+
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include <DecentApi/Common/make_unique.h>
+
+#include "../Common/BinaryCoding.h"
+#include "../Common/MessageException.h"
+#include "../Common/RuntimeException.h"
+
+using namespace RideShare;
+
+constexpr size_t RoadGraph::sk_heapBudget;
+constexpr size_t RoadGraph::sk_heapPerNode;
+constexpr size_t RoadGraph::sk_heapPerRoad;
+
+namespace
+{
+	//"RSRG" in little-endian.
+	constexpr uint32_t gsk_roadGraphMagic = 0x47525352;
+
+	constexpr uint8_t gsk_roadFlagOneWay = 0x01;
+
+	//Limits of the witness searches. A witness path that is missed only costs a redundant shortcut;
+	//  a smaller limit is used when estimating the priority, since it's done much more often.
+	constexpr size_t gsk_maxWitnessSettled = 500;
+	constexpr size_t gsk_maxSimWitnessSettled = 50;
+
+	//Expected number of nodes reached by a query search.
+	constexpr size_t gsk_searchSizeHint = 1024;
+
+	constexpr double gsk_inf = std::numeric_limits<double>::infinity();
+
+	constexpr uint32_t gsk_noNode = UINT32_MAX;
+	//The node skipped by an arc that isn't a shortcut.
+	constexpr uint32_t gsk_noMid = UINT32_MAX;
+
+	//Pair of (distance, node), for the min-heaps of the Dijkstra searches.
+	typedef std::pair<double, uint32_t> QueueItem;
+	typedef std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem> > MinQueue;
+
+	/**
+	 * \brief	Contracts the nodes of a road network, and collects the arcs of the hierarchy. Roads
+	 * 			and shortcuts between the nodes not contracted yet are kept in adjacency lists; once a
+	 * 			node is contracted, its remaining arcs all lead to higher ranked nodes, so they become
+	 * 			its arcs in the hierarchy.
+	 */
+	class HierarchyBuilder
+	{
+	public:
+		struct Arc
+		{
+			uint32_t m_node;
+			uint32_t m_mid;
+			double m_len;
+		};
+
+	public:
+		HierarchyBuilder(const std::vector<RoadGraph::Node>& nodes, const std::vector<RoadGraph::Road>& roads) :
+			m_outArcs(nodes.size()),
+			m_inArcs(nodes.size()),
+			m_numContractedNbrs(nodes.size(), 0),
+			m_levels(nodes.size(), 0),
+			m_witnessDist(nodes.size(), gsk_inf),
+			m_witnessTouched(),
+			m_isWitnessTarget(nodes.size(), false),
+			m_witnessHeap()
+		{
+			for (const RoadGraph::Road& road : roads)
+			{
+				const double dx = nodes[road.m_to].m_x - nodes[road.m_from].m_x;
+				const double dy = nodes[road.m_to].m_y - nodes[road.m_from].m_y;
+				const double len = std::sqrt(dx * dx + dy * dy);
+
+				AddArc(road.m_from, road.m_to, len, gsk_noMid);
+				if (!road.m_isOneWay)
+				{
+					AddArc(road.m_to, road.m_from, len, gsk_noMid);
+				}
+			}
+		}
+
+		/**
+		 * \brief	Contracts all the nodes.
+		 *
+		 * \param [out]	upArcs  	The arcs to higher ranked nodes, by their tails.
+		 * \param [out]	downArcs	The arcs from higher ranked nodes, by their heads; m_node is the tail.
+		 */
+		void Build(std::vector<std::vector<Arc> >& upArcs, std::vector<std::vector<Arc> >& downArcs)
+		{
+			const uint32_t numNodes = static_cast<uint32_t>(m_outArcs.size());
+			upArcs.assign(numNodes, std::vector<Arc>());
+			downArcs.assign(numNodes, std::vector<Arc>());
+
+			//Pair of (priority, node); priorities are updated lazily, when a node is popped.
+			typedef std::pair<int64_t, uint32_t> PriorityItem;
+			std::priority_queue<PriorityItem, std::vector<PriorityItem>, std::greater<PriorityItem> > queue;
+			for (uint32_t node = 0; node < numNodes; ++node)
+			{
+				queue.push(std::make_pair(CalcPriority(node), node));
+			}
+
+			while (queue.size() > 0)
+			{
+				const uint32_t node = queue.top().second;
+				queue.pop();
+
+				const int64_t priority = CalcPriority(node);
+				if (queue.size() > 0 && priority > queue.top().first)
+				{
+					queue.push(std::make_pair(priority, node));
+					continue;
+				}
+
+				Contract(node, false, gsk_maxWitnessSettled);
+
+				upArcs[node] = std::move(m_outArcs[node]);
+				downArcs[node] = std::move(m_inArcs[node]);
+				for (const Arc& arc : upArcs[node])
+				{
+					RemoveArc(m_inArcs[arc.m_node], node);
+					OnNeighborContracted(arc.m_node, node);
+				}
+				for (const Arc& arc : downArcs[node])
+				{
+					RemoveArc(m_outArcs[arc.m_node], node);
+					OnNeighborContracted(arc.m_node, node);
+				}
+				m_outArcs[node] = std::vector<Arc>();
+				m_inArcs[node] = std::vector<Arc>();
+			}
+		}
+
+	private:
+		//Adds the arc (from, to), or shortens the existing one.
+		void AddArc(const uint32_t from, const uint32_t to, const double len, const uint32_t mid)
+		{
+			if (from == to)
+			{
+				return;
+			}
+
+			for (Arc& arc : m_outArcs[from])
+			{
+				if (arc.m_node == to)
+				{
+					if (len < arc.m_len)
+					{
+						arc.m_len = len;
+						arc.m_mid = mid;
+						for (Arc& inArc : m_inArcs[to])
+						{
+							if (inArc.m_node == from)
+							{
+								inArc.m_len = len;
+								inArc.m_mid = mid;
+								break;
+							}
+						}
+					}
+					return;
+				}
+			}
+
+			m_outArcs[from].push_back(Arc{ to, mid, len });
+			m_inArcs[to].push_back(Arc{ from, mid, len });
+		}
+
+		void OnNeighborContracted(const uint32_t node, const uint32_t contracted)
+		{
+			++m_numContractedNbrs[node];
+			m_levels[node] = std::max(m_levels[node], m_levels[contracted] + 1);
+		}
+
+		static void RemoveArc(std::vector<Arc>& arcs, const uint32_t node)
+		{
+			for (size_t i = 0; i < arcs.size(); ++i)
+			{
+				if (arcs[i].m_node == node)
+				{
+					arcs[i] = arcs.back();
+					arcs.pop_back();
+					return;
+				}
+			}
+		}
+
+		//The more shortcuts a node needs, relative to the arcs it removes, the later it's contracted.
+		//  Contracted neighbors and the level (the depth of the hierarchy below the node) are counted,
+		//  so the contraction spreads evenly over the network, and the hierarchy stays shallow.
+		int64_t CalcPriority(const uint32_t node)
+		{
+			const int64_t numShortcuts = static_cast<int64_t>(Contract(node, true, gsk_maxSimWitnessSettled));
+			const int64_t numArcs = static_cast<int64_t>(m_outArcs[node].size() + m_inArcs[node].size());
+
+			return 2 * (numShortcuts - numArcs) + static_cast<int64_t>(m_numContractedNbrs[node]) + static_cast<int64_t>(m_levels[node]);
+		}
+
+		/**
+		 * \brief	Adds the shortcuts needed to contract the node, i.e., for each pair of its neighbors
+		 * 			(u, x), unless there is a path from u to x that avoids the node and isn't longer.
+		 *
+		 * \param	isSimulated	True to only count the shortcuts needed.
+		 *
+		 * \return	The number of shortcuts needed.
+		 */
+		size_t Contract(const uint32_t node, const bool isSimulated, const size_t maxSettled)
+		{
+			size_t numShortcuts = 0;
+
+			const std::vector<Arc>& inArcs = m_inArcs[node];
+			const std::vector<Arc>& outArcs = m_outArcs[node];
+			for (size_t i = 0; i < inArcs.size(); ++i)
+			{
+				const uint32_t from = inArcs[i].m_node;
+				const double inLen = inArcs[i].m_len;
+
+				double maxOutLen = 0.0;
+				size_t numTargets = 0;
+				for (const Arc& outArc : outArcs)
+				{
+					if (outArc.m_node != from)
+					{
+						maxOutLen = std::max(maxOutLen, outArc.m_len);
+						m_isWitnessTarget[outArc.m_node] = true;
+						++numTargets;
+					}
+				}
+				if (numTargets == 0)
+				{
+					continue;
+				}
+
+				SearchWitness(from, node, inLen + maxOutLen, numTargets, maxSettled);
+				for (const Arc& outArc : outArcs)
+				{
+					m_isWitnessTarget[outArc.m_node] = false;
+				}
+
+				for (size_t j = 0; j < outArcs.size(); ++j)
+				{
+					const uint32_t to = outArcs[j].m_node;
+					const double len = inLen + outArcs[j].m_len;
+					if (to == from || m_witnessDist[to] <= len)
+					{
+						continue;
+					}
+
+					++numShortcuts;
+					if (!isSimulated)
+					{
+						//It only changes the arcs of the neighbors, so the ones being walked are intact.
+						AddArc(from, to, len, node);
+					}
+				}
+			}
+
+			return numShortcuts;
+		}
+
+		//Dijkstra search from src that avoids the excluded node, until all the targets are settled, or
+		//  maxLen or maxSettled is reached.
+		void SearchWitness(const uint32_t src, const uint32_t excluded, const double maxLen, size_t numTargets, const size_t maxSettled)
+		{
+			for (const uint32_t node : m_witnessTouched)
+			{
+				m_witnessDist[node] = gsk_inf;
+			}
+			m_witnessTouched.clear();
+
+			//The heap is kept across the searches, so its memory is reused.
+			std::vector<QueueItem>& heap = m_witnessHeap;
+			heap.clear();
+
+			m_witnessDist[src] = 0.0;
+			m_witnessTouched.push_back(src);
+			heap.push_back(std::make_pair(0.0, src));
+
+			size_t numSettled = 0;
+			while (heap.size() > 0 && numSettled < maxSettled)
+			{
+				std::pop_heap(heap.begin(), heap.end(), std::greater<QueueItem>());
+				const QueueItem item = heap.back();
+				heap.pop_back();
+				if (item.first > m_witnessDist[item.second])
+				{
+					continue;
+				}
+				if (item.first > maxLen)
+				{
+					break;
+				}
+				++numSettled;
+				if (m_isWitnessTarget[item.second] && --numTargets == 0)
+				{
+					break;
+				}
+
+				for (const Arc& arc : m_outArcs[item.second])
+				{
+					const double dist = item.first + arc.m_len;
+					if (arc.m_node == excluded || dist >= m_witnessDist[arc.m_node])
+					{
+						continue;
+					}
+					if (m_witnessDist[arc.m_node] == gsk_inf)
+					{
+						m_witnessTouched.push_back(arc.m_node);
+					}
+					m_witnessDist[arc.m_node] = dist;
+					heap.push_back(std::make_pair(dist, arc.m_node));
+					std::push_heap(heap.begin(), heap.end(), std::greater<QueueItem>());
+				}
+			}
+		}
+
+		std::vector<std::vector<Arc> > m_outArcs;
+		std::vector<std::vector<Arc> > m_inArcs;
+		std::vector<uint32_t> m_numContractedNbrs;
+		std::vector<uint32_t> m_levels;
+
+		std::vector<double> m_witnessDist;
+		std::vector<uint32_t> m_witnessTouched;
+		std::vector<bool> m_isWitnessTarget;
+		std::vector<QueueItem> m_witnessHeap;
+	};
+
+	template<typename ArcType>
+	static void ToFlatArcs(const std::vector<std::vector<HierarchyBuilder::Arc> >& arcs, std::vector<size_t>& first, std::vector<ArcType>& flatArcs)
+	{
+		first.resize(arcs.size() + 1);
+		size_t numArcs = 0;
+		for (size_t i = 0; i < arcs.size(); ++i)
+		{
+			first[i] = numArcs;
+			numArcs += arcs[i].size();
+		}
+		first[arcs.size()] = numArcs;
+
+		flatArcs.clear();
+		flatArcs.reserve(numArcs);
+		for (const std::vector<HierarchyBuilder::Arc>& nodeArcs : arcs)
+		{
+			for (const HierarchyBuilder::Arc& arc : nodeArcs)
+			{
+				flatArcs.push_back(ArcType{ arc.m_node, arc.m_mid, arc.m_len });
+			}
+		}
+	}
+
+	//About four nodes per cell, on average.
+	static double CalcGridCellSize(const std::vector<RoadGraph::Node>& nodes)
+	{
+		if (nodes.size() == 0)
+		{
+			return 1.0;
+		}
+
+		double minX = nodes[0].m_x;
+		double maxX = nodes[0].m_x;
+		double minY = nodes[0].m_y;
+		double maxY = nodes[0].m_y;
+		for (const RoadGraph::Node& node : nodes)
+		{
+			minX = std::min(minX, node.m_x);
+			maxX = std::max(maxX, node.m_x);
+			minY = std::min(minY, node.m_y);
+			maxY = std::max(maxY, node.m_y);
+		}
+
+		const double cellSize = 2.0 * std::sqrt((maxX - minX) * (maxY - minY) / nodes.size());
+		return cellSize > 0.0 ? cellSize : 1.0;
+	}
+
+	//A label of a query search.
+	struct SearchLabel
+	{
+		double m_dist;
+		uint32_t m_parent;
+		uint32_t m_mid;
+	};
+}
+
+std::unique_ptr<RoadGraph> RoadGraph::Parse(const StringView& data)
+{
+	using namespace ComMsg;
+	BinaryReader reader(data);
+
+	if (reader.Read<uint32_t>() != gsk_roadGraphMagic)
+	{
+		throw MessageParseException();
+	}
+
+	const size_t numNodes = reader.ReadSize(2 * sizeof(double));
+	if (!IsSizeSupported(numNodes, 0))
+	{
+		throw RuntimeException("The road network is too large.");
+	}
+
+	std::vector<Node> nodes;
+	nodes.reserve(numNodes);
+	for (size_t i = 0; i < numNodes; ++i)
+	{
+		const double x = reader.Read<double>();
+		const double y = reader.Read<double>();
+		if (!std::isfinite(x) || !std::isfinite(y))
+		{
+			throw MessageParseException();
+		}
+		nodes.push_back(Node{ x, y });
+	}
+
+	const size_t numRoads = reader.ReadSize(2 * sizeof(uint32_t) + sizeof(uint8_t));
+	if (!IsSizeSupported(numNodes, numRoads))
+	{
+		throw RuntimeException("The road network is too large.");
+	}
+
+	std::vector<Road> roads;
+	roads.reserve(numRoads);
+	for (size_t i = 0; i < numRoads; ++i)
+	{
+		const uint32_t from = reader.Read<uint32_t>();
+		const uint32_t to = reader.Read<uint32_t>();
+		const uint8_t flags = reader.Read<uint8_t>();
+		roads.push_back(Road{ from, to, (flags & gsk_roadFlagOneWay) != 0 });
+	}
+
+	if (!reader.IsEnd())
+	{
+		throw MessageParseException();
+	}
+
+	return Decent::Tools::make_unique<RoadGraph>(std::move(nodes), roads);
+}
+
+RoadGraph::RoadGraph(std::vector<Node>&& nodes, const std::vector<Road>& roads) :
+	m_nodes(std::forward<std::vector<Node> >(nodes)),
+	m_fwdFirst(),
+	m_fwdArcs(),
+	m_bwdFirst(),
+	m_bwdArcs(),
+	m_nodeGrid(CalcGridCellSize(m_nodes))
+{
+	if (!IsSizeSupported(m_nodes.size(), roads.size()))
+	{
+		throw RuntimeException("The road network is too large.");
+	}
+
+	for (const Road& road : roads)
+	{
+		if (road.m_from >= m_nodes.size() || road.m_to >= m_nodes.size())
+		{
+			throw RuntimeException("A road refers to a node that doesn't exist.");
+		}
+	}
+
+	{
+		std::vector<std::vector<HierarchyBuilder::Arc> > upArcs;
+		std::vector<std::vector<HierarchyBuilder::Arc> > downArcs;
+
+		HierarchyBuilder builder(m_nodes, roads);
+		builder.Build(upArcs, downArcs);
+
+		ToFlatArcs(upArcs, m_fwdFirst, m_fwdArcs);
+		ToFlatArcs(downArcs, m_bwdFirst, m_bwdArcs);
+	}
+
+	//m_nodes won't change anymore, so the grid can point into it.
+	for (const Node& node : m_nodes)
+	{
+		m_nodeGrid.Insert(node.m_x, node.m_y, &node);
+	}
+}
+
+RoadGraph::~RoadGraph()
+{
+}
+
+bool RoadGraph::SnapToNode(const Node& pt, const double maxSnapDist, uint32_t& node) const
+{
+	std::vector<SpatialGrid<const Node>::ResultType> nearest;
+	m_nodeGrid.FindNearest(pt.m_x, pt.m_y, maxSnapDist, 1, nearest);
+	if (nearest.size() == 0)
+	{
+		return false;
+	}
+	node = static_cast<uint32_t>(nearest[0].first - m_nodes.data());
+	return true;
+}
+
+bool RoadGraph::FindRoute(const uint32_t ori, const uint32_t dst, std::vector<const Node*>& route) const
+{
+	route.clear();
+
+	std::vector<uint32_t> nodeRoute;
+	if (ori >= m_nodes.size() || dst >= m_nodes.size() ||
+		!FindNodeRoute(ori, dst, nodeRoute))
+	{
+		return false;
+	}
+
+	route.reserve(nodeRoute.size());
+	for (const uint32_t node : nodeRoute)
+	{
+		route.push_back(&m_nodes[node]);
+	}
+	return true;
+}
+
+bool RoadGraph::FindNodeRoute(const uint32_t src, const uint32_t dst, std::vector<uint32_t>& route) const
+{
+	route.clear();
+	if (src == dst)
+	{
+		route.push_back(src);
+		return true;
+	}
+
+	//Searches only reach a few hundred nodes, so the labels are kept in maps, rather than arrays
+	//  for the whole network, which would be costly to set up for each query.
+	std::unordered_map<uint32_t, SearchLabel> labels[2];
+	MinQueue queues[2];
+	const std::vector<size_t>* firsts[2] = { &m_fwdFirst, &m_bwdFirst };
+	const std::vector<Arc>* arcs[2] = { &m_fwdArcs, &m_bwdArcs };
+
+	labels[0].reserve(gsk_searchSizeHint);
+	labels[1].reserve(gsk_searchSizeHint);
+
+	labels[0][src] = SearchLabel{ 0.0, gsk_noNode, gsk_noMid };
+	queues[0].push(std::make_pair(0.0, src));
+	labels[1][dst] = SearchLabel{ 0.0, gsk_noNode, gsk_noMid };
+	queues[1].push(std::make_pair(0.0, dst));
+
+	double bestDist = gsk_inf;
+	uint32_t meetNode = gsk_noNode;
+	while (true)
+	{
+		const double fwdMin = queues[0].size() > 0 ? queues[0].top().first : gsk_inf;
+		const double bwdMin = queues[1].size() > 0 ? queues[1].top().first : gsk_inf;
+		if (std::min(fwdMin, bwdMin) >= bestDist)
+		{
+			break;
+		}
+
+		const size_t dir = fwdMin <= bwdMin ? 0 : 1;
+		const QueueItem item = queues[dir].top();
+		queues[dir].pop();
+		if (item.first > labels[dir][item.second].m_dist)
+		{
+			continue;
+		}
+
+		auto otherIt = labels[1 - dir].find(item.second);
+		if (otherIt != labels[1 - dir].end() && item.first + otherIt->second.m_dist < bestDist)
+		{
+			bestDist = item.first + otherIt->second.m_dist;
+			meetNode = item.second;
+		}
+
+		//Stall-on-demand: if a higher ranked node reaches this one by a shorter path, this label isn't
+		//  the distance, so there is no need to go on from here.
+		bool isStalled = false;
+		for (size_t i = (*firsts[1 - dir])[item.second]; i < (*firsts[1 - dir])[item.second + 1] && !isStalled; ++i)
+		{
+			const Arc& arc = (*arcs[1 - dir])[i];
+			auto it = labels[dir].find(arc.m_node);
+			isStalled = (it != labels[dir].end() && it->second.m_dist + arc.m_len < item.first);
+		}
+		if (isStalled)
+		{
+			continue;
+		}
+
+		for (size_t i = (*firsts[dir])[item.second]; i < (*firsts[dir])[item.second + 1]; ++i)
+		{
+			const Arc& arc = (*arcs[dir])[i];
+			const double dist = item.first + arc.m_len;
+
+			auto it = labels[dir].find(arc.m_node);
+			if (it == labels[dir].end())
+			{
+				labels[dir][arc.m_node] = SearchLabel{ dist, item.second, arc.m_mid };
+			}
+			else if (dist < it->second.m_dist)
+			{
+				it->second = SearchLabel{ dist, item.second, arc.m_mid };
+			}
+			else
+			{
+				continue;
+			}
+			queues[dir].push(std::make_pair(dist, arc.m_node));
+		}
+	}
+
+	if (meetNode == gsk_noNode)
+	{
+		return false;
+	}
+
+	//Arcs from the origin to the meeting node, collected backward.
+	std::vector<std::pair<uint32_t, const SearchLabel*> > fwdChain;
+	for (uint32_t node = meetNode; node != src; )
+	{
+		const SearchLabel& label = labels[0].find(node)->second;
+		fwdChain.push_back(std::make_pair(node, &label));
+		node = label.m_parent;
+	}
+
+	route.push_back(src);
+	for (auto it = fwdChain.rbegin(); it != fwdChain.rend(); ++it)
+	{
+		UnpackArc(it->second->m_parent, it->first, it->second->m_mid, route);
+	}
+	for (uint32_t node = meetNode; node != dst; )
+	{
+		const SearchLabel& label = labels[1].find(node)->second;
+		UnpackArc(node, label.m_parent, label.m_mid, route);
+		node = label.m_parent;
+	}
+
+	return true;
+}
+
+void RoadGraph::UnpackArc(const uint32_t from, const uint32_t to, const uint32_t mid, std::vector<uint32_t>& route) const
+{
+	struct PendingArc
+	{
+		uint32_t m_from;
+		uint32_t m_to;
+		uint32_t m_mid;
+	};
+
+	std::vector<PendingArc> stack;
+	stack.push_back(PendingArc{ from, to, mid });
+	while (stack.size() > 0)
+	{
+		const PendingArc arc = stack.back();
+		stack.pop_back();
+
+		if (arc.m_mid == gsk_noMid)
+		{
+			route.push_back(arc.m_to);
+			continue;
+		}
+
+		//The skipped node is lower ranked than both ends, so the arc (from, mid) is among its
+		//  backward arcs, and the arc (mid, to) is among its forward arcs.
+		uint32_t firstMid = gsk_noMid;
+		for (size_t i = m_bwdFirst[arc.m_mid]; i < m_bwdFirst[arc.m_mid + 1]; ++i)
+		{
+			if (m_bwdArcs[i].m_node == arc.m_from)
+			{
+				firstMid = m_bwdArcs[i].m_mid;
+				break;
+			}
+		}
+		uint32_t secondMid = gsk_noMid;
+		for (size_t i = m_fwdFirst[arc.m_mid]; i < m_fwdFirst[arc.m_mid + 1]; ++i)
+		{
+			if (m_fwdArcs[i].m_node == arc.m_to)
+			{
+				secondMid = m_fwdArcs[i].m_mid;
+				break;
+			}
+		}
+
+		//The second half goes first, so the first half is unpacked first.
+		stack.push_back(PendingArc{ arc.m_mid, arc.m_to, secondMid });
+		stack.push_back(PendingArc{ arc.m_from, arc.m_mid, firstMid });
+	}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../Common_Enc/SpatialGrid.h"
+
+namespace RideShare
+{
+	class StringView;
+
+	/**
+	 * \brief	A road network, preprocessed into a contraction hierarchy, for shortest path queries.
+	 * 			Nodes are contracted one by one in the order of importance, and shortcuts are added
+	 * 			to keep the distances among the remaining nodes; afterwards, a query only needs a
+	 * 			bidirectional Dijkstra search that goes upward in the hierarchy from both ends, which
+	 * 			settles a few hundred nodes, even on a metro-size network. The length of a road is
+	 * 			the Euclidean distance between its ends.
+	 * 			Once constructed, it's read-only, so queries can run concurrently.
+	 */
+	class RoadGraph
+	{
+	public:
+		struct Node
+		{
+			double m_x;
+			double m_y;
+		};
+
+		struct Road
+		{
+			uint32_t m_from;
+			uint32_t m_to;
+			bool m_isOneWay;
+		};
+
+		//The part of the enclave heap (see Enclave.config.xml) the road network may take while its
+		//  hierarchy is built, which is when it needs the most; the rest is left for the sessions and
+		//  the route cache.
+		static constexpr size_t sk_heapBudget = 48 * 1024 * 1024;
+		//The peak heap use of the build, per node and per road, measured with TripPlaner_Bench on
+		//  jittered grids with 1.8 to 2.8 roads per node, with some margin. Networks with more roads
+		//  per node add more shortcuts, and need more.
+		static constexpr size_t sk_heapPerNode = 320;
+		static constexpr size_t sk_heapPerRoad = 256;
+
+		/**
+		 * \brief	Checks if a network of the given size fits in the heap budget; with 2 roads per
+		 * 			node, that's about 60K nodes, e.g., the roads of a city district. Larger networks
+		 * 			need a larger heap, and thus a larger EPC, to avoid paging.
+		 */
+		static bool IsSizeSupported(const size_t numNodes, const size_t numRoads)
+		{
+			return numNodes <= sk_heapBudget / sk_heapPerNode &&
+				numRoads <= (sk_heapBudget - numNodes * sk_heapPerNode) / sk_heapPerRoad;
+		}
+
+		/**
+		 * \brief	Parses a road network in the binary format: a 32-bit magic number ("RSRG"), the
+		 * 			number of nodes, (X, Y) of each node, the number of roads, and then (from, to,
+		 * 			flags) of each road, where bit 0 of the flags marks a one-way road. It uses the
+		 * 			conventions of the binary wire format (see BinaryWriter). Each byte of the input is
+		 * 			read once, so it may be in the untrusted memory.
+		 *
+		 * \exception	MessageParseException	Thrown when the input is malformed.
+		 * \exception	RuntimeException	 	Thrown when the network is too large (see IsSizeSupported).
+		 */
+		static std::unique_ptr<RoadGraph> Parse(const StringView& data);
+
+	public:
+		RoadGraph() = delete;
+
+		/**
+		 * \brief	Constructor. It builds the contraction hierarchy, which takes a while on a large
+		 * 			network.
+		 *
+		 * \exception	RuntimeException	Thrown when the network is too large, or a road refers to a
+		 * 									node that doesn't exist.
+		 */
+		RoadGraph(std::vector<Node>&& nodes, const std::vector<Road>& roads);
+
+		RoadGraph(const RoadGraph& rhs) = delete;
+		RoadGraph(RoadGraph&& rhs) = delete;
+
+		~RoadGraph();
+
+		/**
+		 * \brief	Finds the node closest to the given point.
+		 *
+		 * \param	maxSnapDist	The maximum distance between the point and the node.
+		 * \param [out]	node   	The index of the node.
+		 *
+		 * \return	False if there is no node close enough.
+		 */
+		bool SnapToNode(const Node& pt, const double maxSnapDist, uint32_t& node) const;
+
+		/**
+		 * \brief	Finds the shortest route between two nodes (see SnapToNode).
+		 *
+		 * \param [out]	route	The nodes on the route, in order.
+		 *
+		 * \return	False if there is no route between them.
+		 */
+		bool FindRoute(const uint32_t ori, const uint32_t dst, std::vector<const Node*>& route) const;
+
+		size_t GetNumNodes() const { return m_nodes.size(); }
+
+		/** \brief	Gets the number of arcs (roads and shortcuts) used by queries. */
+		size_t GetNumArcs() const { return m_fwdArcs.size() + m_bwdArcs.size(); }
+
+	private:
+		struct Arc
+		{
+			uint32_t m_node;
+			//The node skipped by the shortcut, or UINT32_MAX if it's a road.
+			uint32_t m_mid;
+			double m_len;
+		};
+
+		//Returns false if there is no route.
+		bool FindNodeRoute(const uint32_t src, const uint32_t dst, std::vector<uint32_t>& route) const;
+
+		//Appends the nodes on the arc (from, to) after from, with the shortcuts expanded.
+		void UnpackArc(const uint32_t from, const uint32_t to, const uint32_t mid, std::vector<uint32_t>& route) const;
+
+		std::vector<Node> m_nodes;
+
+		//Arcs to higher ranked nodes, by their tails; for the search from the origin.
+		std::vector<size_t> m_fwdFirst;
+		std::vector<Arc> m_fwdArcs;
+		//Arcs from higher ranked nodes, by their heads; for the search from the destination.
+		std::vector<size_t> m_bwdFirst;
+		std::vector<Arc> m_bwdArcs;
+
+		SpatialGrid<const Node> m_nodeGrid;
+	};
+}
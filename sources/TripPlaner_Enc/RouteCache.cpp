@@ -0,0 +1,137 @@
+#include "RouteCache.h"
+
+#include <algorithm>
+
+#include <DecentApi/Common/make_unique.h>
+
+using namespace RideShare;
+
+uint64_t RouteCache::CalcHash(const Key& key)
+{
+	//FNV-1a over the two node indexes.
+	uint64_t hash = 14695981039346656037ULL;
+	const uint32_t vals[] = { static_cast<uint32_t>(key >> 32), static_cast<uint32_t>(key) };
+	for (const uint32_t val : vals)
+	{
+		hash ^= val;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+size_t RouteCache::KeyHash::operator()(const Key& key) const
+{
+	return static_cast<size_t>(CalcHash(key));
+}
+
+RouteCache::RouteCache(const size_t numShards, const size_t maxSizePerShard, const uint64_t ttl) :
+	m_maxSizePerShard(maxSizePerShard),
+	m_ttl(ttl),
+	m_epoch(0),
+	m_shards(),
+	m_numHits(0),
+	m_numMisses(0)
+{
+	for (size_t i = 0; i < std::max<size_t>(numShards, 1); ++i)
+	{
+		m_shards.push_back(Decent::Tools::make_unique<Shard>());
+	}
+}
+
+RouteCache::~RouteCache()
+{
+}
+
+RouteCache::ValueType RouteCache::Find(const uint32_t oriNode, const uint32_t dstNode, const uint64_t currTime, const uint64_t minPricingEpoch)
+{
+	if (m_ttl.load() == 0)
+	{
+		return nullptr;
+	}
+
+	const Key key = ToKey(oriNode, dstNode);
+	Shard& shard = GetShard(key);
+
+	std::unique_lock<std::mutex> shardLock(shard.m_mutex);
+
+	auto it = shard.m_map.find(key);
+	if (it == shard.m_map.end())
+	{
+		++m_numMisses;
+		return nullptr;
+	}
+
+	if (currTime >= it->second.m_expireTime ||
+		it->second.m_val->m_pricingEpoch < minPricingEpoch)
+	{
+		shard.m_lruList.erase(it->second.m_lruIt);
+		shard.m_map.erase(it);
+		++m_numMisses;
+		return nullptr;
+	}
+
+	shard.m_lruList.splice(shard.m_lruList.begin(), shard.m_lruList, it->second.m_lruIt);
+	++m_numHits;
+	return it->second.m_val;
+}
+
+void RouteCache::Put(const uint32_t oriNode, const uint32_t dstNode, const ValueType& val, const uint64_t currTime, const uint64_t epoch)
+{
+	const uint64_t ttl = m_ttl.load();
+	if (ttl == 0 || m_maxSizePerShard == 0)
+	{
+		return;
+	}
+
+	const Key key = ToKey(oriNode, dstNode);
+	Shard& shard = GetShard(key);
+
+	std::unique_lock<std::mutex> shardLock(shard.m_mutex);
+	if (epoch != m_epoch.load())
+	{
+		//The cache has been cleared since the route was computed; it may be stale.
+		return;
+	}
+
+	auto it = shard.m_map.find(key);
+	if (it != shard.m_map.end())
+	{
+		it->second.m_val = val;
+		it->second.m_expireTime = currTime + ttl;
+		shard.m_lruList.splice(shard.m_lruList.begin(), shard.m_lruList, it->second.m_lruIt);
+		return;
+	}
+
+	if (shard.m_map.size() >= m_maxSizePerShard)
+	{
+		shard.m_map.erase(shard.m_lruList.back());
+		shard.m_lruList.pop_back();
+	}
+
+	shard.m_lruList.push_front(key);
+
+	Entry& entry = shard.m_map[key];
+	entry.m_val = val;
+	entry.m_expireTime = currTime + ttl;
+	entry.m_lruIt = shard.m_lruList.begin();
+}
+
+void RouteCache::Clear()
+{
+	//The epoch is bumped first, so a Put checking it under a shard lock either comes before the
+	//  shard is cleared, or is rejected.
+	++m_epoch;
+
+	for (std::unique_ptr<Shard>& shard : m_shards)
+	{
+		std::unique_lock<std::mutex> shardLock(shard->m_mutex);
+		shard->m_map.clear();
+		shard->m_lruList.clear();
+	}
+}
+
+RouteCache::Shard& RouteCache::GetShard(const Key& key)
+{
+	//The high bits pick the shard, so the keys in a shard still spread over the buckets of its map.
+	return *m_shards[static_cast<size_t>(CalcHash(key) >> 32) % m_shards.size()];
+}
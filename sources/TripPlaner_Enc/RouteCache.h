@@ -0,0 +1,132 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "../Common/RideSharingMessages.h"
+
+namespace RideShare
+{
+	/**
+	 * \brief	A bounded (LRU) cache of the computed routes over the road network, keyed by the nodes
+	 * 			the origin and the destination are snapped to. An entry only holds the road nodes of
+	 * 			the route and the price the Billing Services gave for them, never a requester's own
+	 * 			origin or destination, so it can be shared by every trip between the same nodes.
+	 * 			It's split into shards, each with its own lock, so concurrent quotes rarely wait for
+	 * 			each other. Entries expire after the TTL, and are dropped once they're priced before
+	 * 			the given pricing epoch of the Billing Services. Clear bumps an epoch, like
+	 * 			PaymentInfoCache does, so a route computed before it isn't stored afterwards.
+	 */
+	class RouteCache
+	{
+	public:
+		struct Route
+		{
+			std::vector<ComMsg::Point2D<double> > m_nodes;
+			double m_length;
+			//The price of the route between the first and the last node.
+			ComMsg::Price m_price;
+			//The pricing epoch of the Billing Services the price was given in.
+			uint64_t m_pricingEpoch;
+
+			Route(std::vector<ComMsg::Point2D<double> >&& nodes, const double length, ComMsg::Price&& price, const uint64_t pricingEpoch) :
+				m_nodes(std::forward<std::vector<ComMsg::Point2D<double> > >(nodes)),
+				m_length(length),
+				m_price(std::forward<ComMsg::Price>(price)),
+				m_pricingEpoch(pricingEpoch)
+			{}
+		};
+
+		typedef std::shared_ptr<const Route> ValueType;
+
+	public:
+		RouteCache() = delete;
+
+		/**
+		 * \brief	Constructor
+		 *
+		 * \param	numShards	   	The number of shards.
+		 * \param	maxSizePerShard	The maximum number of entries in each shard.
+		 * \param	ttl			   	Seconds an entry is kept; 0 disables the cache.
+		 */
+		RouteCache(const size_t numShards, const size_t maxSizePerShard, const uint64_t ttl);
+
+		RouteCache(const RouteCache& rhs) = delete;
+		RouteCache(RouteCache&& rhs) = delete;
+
+		~RouteCache();
+
+		/**
+		 * \param	minPricingEpoch	Routes priced in an older pricing epoch are dropped.
+		 *
+		 * \return	The cached route, or nullptr if it's not cached, has expired, or its price is stale.
+		 */
+		ValueType Find(const uint32_t oriNode, const uint32_t dstNode, const uint64_t currTime, const uint64_t minPricingEpoch);
+
+		/**
+		 * \brief	Gets the current epoch; it should be read before the route is computed, and then
+		 * 			given to Put.
+		 */
+		uint64_t GetEpoch() const { return m_epoch.load(); }
+
+		void Put(const uint32_t oriNode, const uint32_t dstNode, const ValueType& val, const uint64_t currTime, const uint64_t epoch);
+
+		/** \brief	Removes all the entries, e.g., once the road network changes. */
+		void Clear();
+
+		/** \brief	Sets the TTL of the entries put afterwards; 0 disables the cache. */
+		void SetTtl(const uint64_t ttl) { m_ttl.store(ttl); }
+
+		uint64_t GetNumHits() const { return m_numHits.load(); }
+		uint64_t GetNumMisses() const { return m_numMisses.load(); }
+
+	private:
+		//The origin node in the high 32 bits, and the destination node in the low 32 bits.
+		typedef uint64_t Key;
+
+		struct KeyHash
+		{
+			size_t operator()(const Key& key) const;
+		};
+
+		static uint64_t CalcHash(const Key& key);
+
+		static Key ToKey(const uint32_t oriNode, const uint32_t dstNode)
+		{
+			return (static_cast<uint64_t>(oriNode) << 32) | dstNode;
+		}
+
+		typedef std::list<Key> LruListType;
+
+		struct Entry
+		{
+			ValueType m_val;
+			uint64_t m_expireTime;
+			LruListType::iterator m_lruIt;
+		};
+
+		struct Shard
+		{
+			std::mutex m_mutex;
+			std::unordered_map<Key, Entry, KeyHash> m_map;
+			//Most recently used at the front.
+			LruListType m_lruList;
+		};
+
+		Shard& GetShard(const Key& key);
+
+		const size_t m_maxSizePerShard;
+		std::atomic<uint64_t> m_ttl;
+
+		std::atomic<uint64_t> m_epoch;
+		std::vector<std::unique_ptr<Shard> > m_shards;
+
+		std::atomic<uint64_t> m_numHits;
+		std::atomic<uint64_t> m_numMisses;
+	};
+}